@@ -1,7 +1,7 @@
 #!/bin/bash
 
 # Compile the binary
-gcc -o kat kat.c -std=c11 -lX11 -lXtst -lpthread -Wall -lm -Wextra -O2
+gcc -o kat kat.c -std=c11 -lX11 -lXtst -lXext -lXdamage -lXfixes -lXrandr -lpthread -Wall -lm -Wextra -O2
 
 # Create package structure
 mkdir -p kat_1.0-1/DEBIAN
@@ -17,7 +17,7 @@ Version: 1.0-1
 Section: utils
 Priority: optional
 Architecture: amd64
-Depends: libx11-6, libxtst6, x11-utils, sudo
+Depends: libx11-6, libxtst6, libxext6, libxdamage1, libxfixes3, libxrandr2, x11-utils, sudo
 Maintainer: Your Name <your.email@example.com>
 Description: Kat's Numpad Mouse Daemon
  A daemon that uses the numpad as a mouse input device.
@@ -41,8 +41,8 @@ if [ -z "\$SUDO_USER" ]; then
   fi
 fi
 
-# Set up sudoers
-echo "\$SUDO_USER ALL=(root) SETENV: NOPASSWD: /usr/local/bin/kat" > /etc/sudoers.d/kat
+# Set up sudoers: the bare daemon only; "" forbids arguments
+echo "\$SUDO_USER ALL=(root) SETENV: NOPASSWD: /usr/local/bin/kat \"\"" > /etc/sudoers.d/kat
 chmod 0440 /etc/sudoers.d/kat
 
 # Get user home and group
@@ -1,12 +1,13 @@
 /*
  * kat.c
  * Toggles mouse_mode with double-Ctrl press and moves mouse with numpad.
- * Compile: gcc -o kat kat.c -std=c11 -lX11 -lXtst -lpthread -Wall -Wextra
+ * Compile: gcc -o kat kat.c -std=c11 -lX11 -lXtst -lXext -lXdamage -lXfixes -lXrandr -lpthread -Wall -Wextra
  * Run: sudo ./kat
  */
 
 #define _POSIX_C_SOURCE 200809L
 #define _DEFAULT_SOURCE
+#define _GNU_SOURCE   /* setresuid, setresgid */
 
 #include <errno.h>
 #include <math.h>
@@ -30,10 +31,32 @@
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
 #include <X11/extensions/XTest.h>
+#include <X11/extensions/shape.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#include <X11/extensions/Xrandr.h>
 #include <ctype.h>
 #include <poll.h>
 #include <libgen.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <stdatomic.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/file.h>
+#include <grp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #define MAX_KBDS 16
 #define INPUT_DIR "/dev/input"
@@ -49,13 +72,13 @@
     "; Edit the values below – the daemon will reload them on every start\n" \
     "; Missing entries are filled with the hard-coded defaults\n\n"
 
-#define DOUBLE_PRESS_THRESHOLD 0.3   /* seconds */
-#define ALT_DOUBLE_THRESHOLD 0.3
 #define MODE_POPUP_DURATION_MS 1000  /* mode toggle popup */
 #define MARGIN_OVERLAY_TIMEOUT 1.0   /* seconds after last adjust to hide */
 #define JUMP_OVERLAY_TIMEOUT 1.0     /* seconds after last adjust to hide */
 
 static const char *config_file = NULL;
+/* Set for the daemons --probe and --stress start: no user files, and device names carry the tag */
+static const char *isolated_tag = NULL;
 
 /* ------------------------------------------------------------------ */
 /* Configuration Struct                                               */
@@ -74,6 +97,23 @@ typedef struct {
     int scroll_interval_ms;
     double autoscroll_speed;
     int autoscroll_interval_ms;
+    double scroll_acceleration;
+    int scroll_momentum_ms;
+    int hint_click;
+    int sticky_speed;
+    int jump_anim_ms;
+    int rt_policy;
+    int rt_priority;
+    int mlock;
+    int thread_stack_kb;
+    int input_cpu;
+    int movement_cpu;
+    int double_tap_ms;
+    int hold_ms;
+    int chord_ms;
+    int auto_tune;
+    int feedback_leds;
+    int dwell_ms;
 } Config;
 
 /* ------------------------------------------------------------------ */
@@ -85,41 +125,74 @@ typedef struct {
     const char *fmt;
     bool is_double;
     double min_val;
+    double max_val;      /* 0 = unbounded */
     const char *unit;
     const char *shortcut;
-    unsigned int bit;
+    unsigned long long bit;
 } ConfigItem;
 
-enum {
-    CFG_MOUSE_SPEED_BIT = 1u<<0,
-    CFG_MOVEMENT_INTERVAL_SLOW_MS_BIT = 1u<<1,
-    CFG_MOVEMENT_INTERVAL_FAST_MS_BIT = 1u<<2,
-    CFG_MOVEMENT_ACCELERATION_TIME_BIT = 1u<<3,
-    CFG_JUMP_HORIZONTAL_BIT = 1u<<4,
-    CFG_JUMP_VERTICAL_BIT = 1u<<5,
-    CFG_JUMP_DIAGONAL_BIT = 1u<<6,
-    CFG_JUMP_MARGIN_BIT = 1u<<7,
-    CFG_JUMP_INTERVAL_MS_BIT = 1u<<8,
-    CFG_SCROLL_SPEED_BIT = 1u<<9,
-    CFG_SCROLL_INTERVAL_MS_BIT = 1u<<10,
-    CFG_AUTOSCROLL_SPEED_BIT = 1u<<11,
-    CFG_AUTOSCROLL_INTERVAL_MS_BIT = 1u<<12,
-};
+#define CFG_MOUSE_SPEED_BIT (1ULL << 0)
+#define CFG_MOVEMENT_INTERVAL_SLOW_MS_BIT (1ULL << 1)
+#define CFG_MOVEMENT_INTERVAL_FAST_MS_BIT (1ULL << 2)
+#define CFG_MOVEMENT_ACCELERATION_TIME_BIT (1ULL << 3)
+#define CFG_JUMP_HORIZONTAL_BIT (1ULL << 4)
+#define CFG_JUMP_VERTICAL_BIT (1ULL << 5)
+#define CFG_JUMP_DIAGONAL_BIT (1ULL << 6)
+#define CFG_JUMP_MARGIN_BIT (1ULL << 7)
+#define CFG_JUMP_INTERVAL_MS_BIT (1ULL << 8)
+#define CFG_SCROLL_SPEED_BIT (1ULL << 9)
+#define CFG_SCROLL_INTERVAL_MS_BIT (1ULL << 10)
+#define CFG_AUTOSCROLL_SPEED_BIT (1ULL << 11)
+#define CFG_AUTOSCROLL_INTERVAL_MS_BIT (1ULL << 12)
+#define CFG_SCROLL_ACCELERATION_BIT (1ULL << 13)
+#define CFG_SCROLL_MOMENTUM_MS_BIT (1ULL << 14)
+#define CFG_HINT_CLICK_BIT (1ULL << 15)
+#define CFG_STICKY_SPEED_BIT (1ULL << 16)
+#define CFG_JUMP_ANIM_MS_BIT (1ULL << 17)
+#define CFG_RT_POLICY_BIT (1ULL << 18)
+#define CFG_RT_PRIORITY_BIT (1ULL << 19)
+#define CFG_MLOCK_BIT (1ULL << 20)
+#define CFG_THREAD_STACK_KB_BIT (1ULL << 21)
+#define CFG_INPUT_CPU_BIT (1ULL << 22)
+#define CFG_MOVEMENT_CPU_BIT (1ULL << 23)
+#define CFG_DOUBLE_TAP_MS_BIT (1ULL << 24)
+#define CFG_HOLD_MS_BIT (1ULL << 25)
+#define CFG_CHORD_MS_BIT (1ULL << 26)
+#define CFG_AUTO_TUNE_BIT (1ULL << 27)
+#define CFG_FEEDBACK_LEDS_BIT (1ULL << 28)
+#define CFG_DWELL_MS_BIT (1ULL << 29)
 
 static ConfigItem config_items[] = {
-    {"MOUSE_SPEED", NULL, "%d", false, 1, "px", "(Shift)+Alt+NumLock", CFG_MOUSE_SPEED_BIT},
-    {"MOVEMENT_INTERVAL_SLOW_MS", NULL, "%d", false, 1, "ms", "(Shift)+Alt+Asterisk", CFG_MOVEMENT_INTERVAL_SLOW_MS_BIT},
-    {"MOVEMENT_INTERVAL_FAST_MS", NULL, "%d", false, 1, "ms", "(Shift)+Alt+Hyphen", CFG_MOVEMENT_INTERVAL_FAST_MS_BIT},
-    {"MOVEMENT_ACCELERATION_TIME", NULL, "%.1f", true, 0.1, "s", "(Shift)+Alt+Slash", CFG_MOVEMENT_ACCELERATION_TIME_BIT},
-    {"JUMP_HORIZONTAL", NULL, "%d", false, 0, "px", "Alt+6/4", CFG_JUMP_HORIZONTAL_BIT},
-    {"JUMP_VERTICAL", NULL, "%d", false, 0, "px", "Alt+8/2", CFG_JUMP_VERTICAL_BIT},
-    {"JUMP_DIAGONAL", NULL, "%d", false, 0, "px", "Alt+7/9 / Alt+1/3", CFG_JUMP_DIAGONAL_BIT},
-    {"JUMP_MARGIN", NULL, "%d", false, 0, "px", "(Shift)+Alt+5", CFG_JUMP_MARGIN_BIT},
-    {"JUMP_INTERVAL_MS", NULL, "%d", false, 1, "ms", "(Shift)+Alt+0", CFG_JUMP_INTERVAL_MS_BIT},
-    {"SCROLL_SPEED", NULL, "%.2f", true, 0.01, "ticks", "Alt+Plus/Enter (manual)", CFG_SCROLL_SPEED_BIT},
-    {"SCROLL_INTERVAL_MS", NULL, "%d", false, 1, "ms", "(Shift)+Alt+Period (manual)", CFG_SCROLL_INTERVAL_MS_BIT},
-    {"AUTOSCROLL_SPEED", NULL, "%.2f", true, 0.01, "ticks", "Alt+Plus/Enter (auto)", CFG_AUTOSCROLL_SPEED_BIT},
-    {"AUTOSCROLL_INTERVAL_MS", NULL, "%d", false, 1, "ms", "(Shift)+Alt+Period (auto)", CFG_AUTOSCROLL_INTERVAL_MS_BIT},
+    {"MOUSE_SPEED", NULL, "%d", false, 1, 0, "px", "(Shift)+Alt+NumLock", CFG_MOUSE_SPEED_BIT},
+    {"MOVEMENT_INTERVAL_SLOW_MS", NULL, "%d", false, 1, 0, "ms", "(Shift)+Alt+Asterisk", CFG_MOVEMENT_INTERVAL_SLOW_MS_BIT},
+    {"MOVEMENT_INTERVAL_FAST_MS", NULL, "%d", false, 1, 0, "ms", "(Shift)+Alt+Hyphen", CFG_MOVEMENT_INTERVAL_FAST_MS_BIT},
+    {"MOVEMENT_ACCELERATION_TIME", NULL, "%.1f", true, 0.1, 0, "s", "(Shift)+Alt+Slash", CFG_MOVEMENT_ACCELERATION_TIME_BIT},
+    {"JUMP_HORIZONTAL", NULL, "%d", false, 0, 0, "px", "Alt+6/4", CFG_JUMP_HORIZONTAL_BIT},
+    {"JUMP_VERTICAL", NULL, "%d", false, 0, 0, "px", "Alt+8/2", CFG_JUMP_VERTICAL_BIT},
+    {"JUMP_DIAGONAL", NULL, "%d", false, 0, 0, "px", "Alt+7/9 / Alt+1/3", CFG_JUMP_DIAGONAL_BIT},
+    {"JUMP_MARGIN", NULL, "%d", false, 0, 0, "px", "(Shift)+Alt+5", CFG_JUMP_MARGIN_BIT},
+    {"JUMP_INTERVAL_MS", NULL, "%d", false, 1, 0, "ms", "(Shift)+Alt+0", CFG_JUMP_INTERVAL_MS_BIT},
+    {"SCROLL_SPEED", NULL, "%.2f", true, 0.01, 0, "ticks", "Alt+Plus/Enter (manual)", CFG_SCROLL_SPEED_BIT},
+    {"SCROLL_INTERVAL_MS", NULL, "%d", false, 1, 0, "ms", "(Shift)+Alt+Period (manual)", CFG_SCROLL_INTERVAL_MS_BIT},
+    {"AUTOSCROLL_SPEED", NULL, "%.2f", true, 0.01, 0, "ticks", "Alt+Plus/Enter (auto)", CFG_AUTOSCROLL_SPEED_BIT},
+    {"AUTOSCROLL_INTERVAL_MS", NULL, "%d", false, 1, 0, "ms", "(Shift)+Alt+Period (auto)", CFG_AUTOSCROLL_INTERVAL_MS_BIT},
+    {"SCROLL_ACCELERATION", NULL, "%.1f", true, 1.0, 0, "x", "Config panel", CFG_SCROLL_ACCELERATION_BIT},
+    {"SCROLL_MOMENTUM_MS", NULL, "%d", false, 0, 0, "ms", "Config panel", CFG_SCROLL_MOMENTUM_MS_BIT},
+    {"HINT_CLICK", NULL, "%d", false, 0, 3, "btn", "Config panel", CFG_HINT_CLICK_BIT},
+    {"STICKY_SPEED", NULL, "%d", false, 1, 100, "%", "Config panel", CFG_STICKY_SPEED_BIT},
+    {"JUMP_ANIM_MS", NULL, "%d", false, 0, 500, "ms", "Config panel", CFG_JUMP_ANIM_MS_BIT},
+    {"RT_POLICY", NULL, "%d", false, 0, 2, "", "Restart", CFG_RT_POLICY_BIT},
+    {"RT_PRIORITY", NULL, "%d", false, 1, 99, "", "Restart", CFG_RT_PRIORITY_BIT},
+    {"MLOCK", NULL, "%d", false, 0, 1, "", "Restart", CFG_MLOCK_BIT},
+    {"THREAD_STACK_KB", NULL, "%d", false, 0, 65536, "KiB", "Restart", CFG_THREAD_STACK_KB_BIT},
+    {"INPUT_CPU", NULL, "%d", false, -1, 1023, "", "Restart", CFG_INPUT_CPU_BIT},
+    {"MOVEMENT_CPU", NULL, "%d", false, -1, 1023, "", "Restart", CFG_MOVEMENT_CPU_BIT},
+    {"DOUBLE_TAP_MS", NULL, "%d", false, 50, 1000, "ms", "Config panel", CFG_DOUBLE_TAP_MS_BIT},
+    {"HOLD_MS", NULL, "%d", false, 100, 5000, "ms", "Config panel", CFG_HOLD_MS_BIT},
+    {"CHORD_MS", NULL, "%d", false, 10, 500, "ms", "Config panel", CFG_CHORD_MS_BIT},
+    {"AUTO_TUNE", NULL, "%d", false, 0, 1, "", "Config panel", CFG_AUTO_TUNE_BIT},
+    {"FEEDBACK_LEDS", NULL, "%d", false, 0, 1, "", "Config panel", CFG_FEEDBACK_LEDS_BIT},
+    {"DWELL_MS", NULL, "%d", false, 0, 5000, "ms", "Config panel", CFG_DWELL_MS_BIT},
 };
 
 static const int num_config_items = sizeof(config_items) / sizeof(config_items[0]);
@@ -134,13 +207,16 @@ typedef struct {
     bool shift_pressed;
     bool mouse_mode;
     bool numpad_keys_pressed[8];   /* 0=8,1=2,2=4,3=6,4=7,5=9,6=1,7=3 */
-    bool scroll_keys_pressed[2];   /* 0=plus (up), 1=enter (down) */
+    bool scroll_keys_pressed[4];   /* 0=plus (up), 1=enter (down), 2=shift+plus (left), 3=shift+enter (right) */
     bool left_button_held;
 	bool drag_locked;
     bool autoscroll_up_active;
     bool autoscroll_down_active;
     double movement_start_time;
-    double last_alt_press;
+    double scroll_start_time;      /* manual scroll hold, for acceleration */
+    double scroll_velocity;        /* notches/s carried as momentum after release */
+    double scroll_momentum_time;
+    int scroll_momentum_axis;
     double last_autoscroll_feedback;
     double adjust_start_times[KEY_MAX + 1];
     bool left_ctrl_forwarded;
@@ -189,6 +265,8 @@ static void* config_panel_thread(void *arg);
 static void* feedback_popup_thread(void *arg);
 static void* margin_overlay_thread(void *arg);
 static void* jump_overlay_thread(void *arg);
+static void* grid_overlay_thread(void *arg);
+static void* hint_overlay_thread(void *arg);
 
 /* ------------------------------------------------------------------ */
 /* Forward Declarations for Other Functions                           */
@@ -197,7 +275,18 @@ static void show_feedback(const char *text);
 static void show_margin_overlay(void);
 static void hide_margin_overlay(void);
 static void show_jump_overlay(int type);
-static bool handle_ctrl_key(const struct input_event *ev, double *last_ctrl_press);
+static void lens_tick(Display *dpy);
+static void history_note_pointer(void);
+static void rt_stats_dump(FILE *f);
+static void tune_stats_dump(FILE *f);
+static void jump_to(Display *dpy, int x, int y);
+static void anim_finish(void);
+static void set_mouse_mode(bool on);
+static void macro_note_warp(int x, int y);
+static void dwell_note_motion(int x, int y);
+static bool dwell_cancel(void);
+static void macro_note_mouse(uint16_t type, uint16_t code, int32_t value);
+static bool handle_ctrl_key(const struct input_event *ev, ConfigPanel *panel);
 static bool handle_alt_key(const struct input_event *ev, ConfigPanel *panel);
 static bool handle_shift_key(const struct input_event *ev);
 static bool handle_esc_in_panel(const struct input_event *ev, ConfigPanel *panel);
@@ -214,16 +303,176 @@ static bool handle_kpslash_key(const struct input_event *ev);
 static bool handle_kpasterisk_key(const struct input_event *ev);
 static bool handle_kpminus_key(const struct input_event *ev);
 static bool handle_numlock_key(const struct input_event *ev);
+static bool handle_grid_key(const struct input_event *ev);
+static bool handle_hint_key(const struct input_event *ev);
+static bool handle_snap_key(const struct input_event *ev);
+static bool handle_anchor_key(const struct input_event *ev);
+static bool handle_kp0_layer_key(const struct input_event *ev);
+
+/* ------------------------------------------------------------------ */
+/* Privileges                                                         */
+/* ------------------------------------------------------------------ */
+/*
+ * kat runs as root through sudo, but every path it is handed on the
+ * command line belongs to the user who ran sudo. Those are opened with
+ * the effective ids switched to SUDO_UID/SUDO_GID, so root never creates
+ * or truncates a file the user could not write. Modes that need no root
+ * at all drop it for good before doing anything.
+ */
+static bool sudo_ids(uid_t *uid, gid_t *gid) {
+    const char *u = getenv("SUDO_UID"), *g = getenv("SUDO_GID");
+    if (getuid() != 0 || !u || !g) return false;
+    *uid = (uid_t)strtoul(u, NULL, 10);
+    *gid = (gid_t)strtoul(g, NULL, 10);
+    return *uid != 0;
+}
+
+static void drop_privileges(void) {
+    uid_t uid;
+    gid_t gid;
+    if (!sudo_ids(&uid, &gid)) return;
+    if (setgroups(1, &gid) < 0 || setresgid(gid, gid, gid) < 0 || setresuid(uid, uid, uid) < 0) {
+        perror("drop privileges");
+        exit(1);
+    }
+}
+
+/* Effective ids of the sudo user until as_user_end(); false when not under sudo */
+static bool as_user_begin(void) {
+    uid_t uid;
+    gid_t gid;
+    if (!sudo_ids(&uid, &gid)) return false;
+    if (setgroups(1, &gid) < 0 || setresgid(-1, gid, -1) < 0 || setresuid(-1, uid, -1) < 0) {
+        perror("switch to user");
+        exit(1);
+    }
+    return true;
+}
+
+static void as_user_end(void) {
+    gid_t root = 0;
+    if (setresuid(-1, 0, -1) < 0 || setresgid(-1, 0, -1) < 0 || setgroups(1, &root) < 0) {
+        perror("switch back to root");
+        exit(1);
+    }
+}
+
+/* Who may use the control socket: the sudo user, or whoever runs kat */
+static uid_t user_uid(void) {
+    uid_t uid = getuid();
+    gid_t gid;
+    sudo_ids(&uid, &gid);
+    return uid;
+}
+
+/*
+ * Status page and control socket live in RUN_DIR. Nothing there is done
+ * by path unless the directory is root's and nobody else can write it,
+ * so no entry can be swapped for a symlink under the daemon.
+ */
+#define RUN_DIR "/run/kat"
+
+static bool run_dir_ready(void) {
+    struct stat st;
+    if (mkdir(RUN_DIR, 0755) < 0 && errno != EEXIST) {
+        perror("mkdir " RUN_DIR);
+        return false;
+    }
+    if (lstat(RUN_DIR, &st) < 0 || !S_ISDIR(st.st_mode) || st.st_uid != 0 || (st.st_mode & 022)) {
+        fprintf(stderr, "%s is not a root-owned directory, not using it\n", RUN_DIR);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Files under ~/.config/kat, which the user controls: never opened through
+ * a symlink, and never one that is not a plain, singly linked file owned by
+ * the user (or by root, from before kat handed its files over). A file kat
+ * creates is given to the user. O_TRUNC is applied only after the checks.
+ */
+static int user_file_open(const char *path, int flags) {
+    int base = (flags & ~(O_CREAT | O_TRUNC)) | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC;
+    bool created = false;
+    int fd = -1;
+    if (flags & O_CREAT) {
+        fd = open(path, base | O_CREAT | O_EXCL, 0644);
+        created = fd >= 0;
+    }
+    if (fd < 0 && (!(flags & O_CREAT) || errno == EEXIST)) fd = open(path, base);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    uid_t uid = user_uid();
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_nlink != 1 ||
+        (st.st_uid != uid && st.st_uid != 0)) {
+        fprintf(stderr, "%s: not a plain file of yours, not using it\n", path);
+        close(fd);
+        errno = EPERM;
+        return -1;
+    }
+    gid_t gid;
+    if (created && sudo_ids(&uid, &gid) && fchown(fd, uid, gid) < 0) perror("fchown");
+    if ((flags & O_TRUNC) && ftruncate(fd, 0) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* fopen() through user_file_open(); mode is "r", "w" or "a", optionally with "b" */
+static FILE* user_file_fopen(const char *path, const char *mode) {
+    int flags = mode[0] == 'r' ? O_RDONLY :
+                mode[0] == 'a' ? O_WRONLY | O_CREAT | O_APPEND : O_WRONLY | O_CREAT | O_TRUNC;
+    int fd = user_file_open(path, flags);
+    if (fd < 0) return NULL;
+    FILE *f = fdopen(fd, mode);
+    if (!f) close(fd);
+    return f;
+}
+
+/* fopen() of a user-supplied path, with the user's permissions */
+static FILE* fopen_as_user(const char *path, const char *mode) {
+    bool as_user = as_user_begin();
+    FILE *f = fopen(path, mode);
+    int err = errno;
+    if (as_user) as_user_end();
+    errno = err;
+    return f;
+}
 
 /* ------------------------------------------------------------------ */
 /* Config Handling Functions                                          */
 /* ------------------------------------------------------------------ */
+/* Replay drives the handlers from a virtual clock instead of wall time */
+static bool clock_virtual = false;
+static double clock_virtual_now = 0.0;
+
 static double get_time(void) {
+    if (clock_virtual) return clock_virtual_now;
     struct timeval tv;
     gettimeofday(&tv, NULL);
     return tv.tv_sec + tv.tv_usec * 1e-6;
 }
 
+static void get_timeval(struct timeval *tv) {
+    if (clock_virtual) {
+        tv->tv_sec = (time_t)clock_virtual_now;
+        tv->tv_usec = (suseconds_t)((clock_virtual_now - tv->tv_sec) * 1e6 + 0.5);
+        if (tv->tv_usec >= 1000000) { tv->tv_sec++; tv->tv_usec -= 1000000; }
+        return;
+    }
+    gettimeofday(tv, NULL);
+}
+
+static void clock_sleep_us(long us) {
+    if (clock_virtual) {
+        clock_virtual_now += us * 1e-6;
+        return;
+    }
+    usleep(us);
+}
+
 static int cfg_parse_line(const char *line, char *name, size_t name_sz, char *value, size_t value_sz) {
     const char *p = line;
     while (*p && (isspace(*p) || *p == ';' || *p == '#')) ++p;
@@ -252,7 +501,7 @@ static int cfg_parse_line(const char *line, char *name, size_t name_sz, char *va
 }
 
 static void write_default_config(void) {
-    FILE *f = fopen(config_file, "w");
+    FILE *f = user_file_fopen(config_file, "w");
     if (!f) { perror("fopen config"); return; }
 
     fprintf(f, CONFIG_COMMENT);
@@ -270,9 +519,9 @@ static void write_default_config(void) {
     printf("Created default %s\n", config_file);
 }
 
-static void verify_and_restore_config(unsigned int *cfg_seen) {
+static void verify_and_restore_config(unsigned long long *cfg_seen) {
     bool changed = false;
-    FILE *f = fopen(config_file, "a");
+    FILE *f = user_file_fopen(config_file, "a");
     if (!f) { perror("append config"); return; }
 
     for (int i = 0; i < num_config_items; i++) {
@@ -292,7 +541,7 @@ static void verify_and_restore_config(unsigned int *cfg_seen) {
     if (changed) printf("Updated %s with missing defaults\n", config_file);
 }
 
-static void load_config(void) {
+static void init_config_defaults(void) {
     state.cfg.mouse_speed = 5;
     state.cfg.movement_interval_slow_ms = 64;
     state.cfg.movement_interval_fast_ms = 8;
@@ -306,6 +555,23 @@ static void load_config(void) {
     state.cfg.scroll_interval_ms = 100;
     state.cfg.autoscroll_speed = 0.01;
     state.cfg.autoscroll_interval_ms = 24;
+    state.cfg.scroll_acceleration = 1.0;
+    state.cfg.scroll_momentum_ms = 0;
+    state.cfg.hint_click = 0;
+    state.cfg.sticky_speed = 40;
+    state.cfg.jump_anim_ms = 0;
+    state.cfg.rt_policy = 0;
+    state.cfg.rt_priority = 10;
+    state.cfg.mlock = 0;
+    state.cfg.thread_stack_kb = 0;
+    state.cfg.input_cpu = -1;
+    state.cfg.movement_cpu = -1;
+    state.cfg.double_tap_ms = 300;
+    state.cfg.hold_ms = 500;
+    state.cfg.chord_ms = 50;
+    state.cfg.auto_tune = 0;
+    state.cfg.feedback_leds = 0;
+    state.cfg.dwell_ms = 0;
 
     // Bind config items to struct fields
     config_items[0].value = &state.cfg.mouse_speed;
@@ -321,13 +587,50 @@ static void load_config(void) {
     config_items[10].value = &state.cfg.scroll_interval_ms;
     config_items[11].value = &state.cfg.autoscroll_speed;
     config_items[12].value = &state.cfg.autoscroll_interval_ms;
+    config_items[13].value = &state.cfg.scroll_acceleration;
+    config_items[14].value = &state.cfg.scroll_momentum_ms;
+    config_items[15].value = &state.cfg.hint_click;
+    config_items[16].value = &state.cfg.sticky_speed;
+    config_items[17].value = &state.cfg.jump_anim_ms;
+    config_items[18].value = &state.cfg.rt_policy;
+    config_items[19].value = &state.cfg.rt_priority;
+    config_items[20].value = &state.cfg.mlock;
+    config_items[21].value = &state.cfg.thread_stack_kb;
+    config_items[22].value = &state.cfg.input_cpu;
+    config_items[23].value = &state.cfg.movement_cpu;
+    config_items[24].value = &state.cfg.double_tap_ms;
+    config_items[25].value = &state.cfg.hold_ms;
+    config_items[26].value = &state.cfg.chord_ms;
+    config_items[27].value = &state.cfg.auto_tune;
+    config_items[28].value = &state.cfg.feedback_leds;
+    config_items[29].value = &state.cfg.dwell_ms;
+}
+
+static unsigned long long apply_config_value(const char *name, const char *value) {
+    for (int i = 0; i < num_config_items; i++) {
+        ConfigItem *item = &config_items[i];
+        if (strcmp(name, item->name) == 0) {
+            if (item->is_double) {
+                *(double*)item->value = atof(value);
+            } else {
+                *(int*)item->value = atoi(value);
+            }
+            return item->bit;
+        }
+    }
+    return 0;
+}
+
+static void load_config(void) {
+    init_config_defaults();
+    if (!config_file) return;   /* isolated: defaults only */
 
     if (access(config_file, F_OK) != 0) {
         write_default_config();
         return;
     }
 
-    FILE *f = fopen(config_file, "r");
+    FILE *f = user_file_fopen(config_file, "r");
     if (!f) {
         fprintf(stderr, "Can't open %s – using defaults\n", config_file);
         return;
@@ -335,22 +638,11 @@ static void load_config(void) {
 
     char line[256];
     char name[64], value[64];
-    unsigned int cfg_seen = 0;
+    unsigned long long cfg_seen = 0;
 
     while (fgets(line, sizeof(line), f)) {
         if (cfg_parse_line(line, name, sizeof(name), value, sizeof(value))) {
-            for (int i = 0; i < num_config_items; i++) {
-                ConfigItem *item = &config_items[i];
-                if (strcmp(name, item->name) == 0) {
-                    if (item->is_double) {
-                        *(double*)item->value = atof(value);
-                    } else {
-                        *(int*)item->value = atoi(value);
-                    }
-                    cfg_seen |= item->bit;
-                    break;
-                }
-            }
+            cfg_seen |= apply_config_value(name, value);
         }
     }
     fclose(f);
@@ -359,7 +651,9 @@ static void load_config(void) {
 }
 
 static void save_config(void) {
-    FILE *f = fopen(config_file, "w");
+    if (!config_file) return;   /* replay never touches the user's config */
+
+    FILE *f = user_file_fopen(config_file, "w");
     if (!f) { perror("fopen config for save"); return; }
 
     fprintf(f, CONFIG_COMMENT);
@@ -401,6 +695,16 @@ static double get_scroll_speed_delta(double current, int multi, bool increase) {
     return delta;
 }
 
+static void clamp_config_item(ConfigItem *item) {
+    if (item->is_double) {
+        if (*(double*)item->value < item->min_val) *(double*)item->value = item->min_val;
+        if (item->max_val > item->min_val && *(double*)item->value > item->max_val) *(double*)item->value = item->max_val;
+    } else {
+        if (*(int*)item->value < (int)item->min_val) *(int*)item->value = (int)item->min_val;
+        if (item->max_val > item->min_val && *(int*)item->value > (int)item->max_val) *(int*)item->value = (int)item->max_val;
+    }
+}
+
 static void adjust_config_value(int index, int step, bool is_live) {
     ConfigItem *item = &config_items[index];
     if (item->is_double) {
@@ -408,11 +712,10 @@ static void adjust_config_value(int index, int step, bool is_live) {
                        ? get_scroll_speed_delta(*(double*)item->value, abs(step), step > 0)
                        : step * 0.1;
         *(double*)item->value += delta;
-        if (*(double*)item->value < item->min_val) *(double*)item->value = item->min_val;
     } else {
         *(int*)item->value += step;
-        if (*(int*)item->value < (int)item->min_val) *(int*)item->value = (int)item->min_val;
     }
+    clamp_config_item(item);
 
     if (is_live) {
         char msg[128], valbuf[64];
@@ -427,1697 +730,7962 @@ static void adjust_config_value(int index, int step, bool is_live) {
 }
 
 /* ------------------------------------------------------------------ */
-/* Mouse Control Helpers                                              */
+/* Trace Format                                                       */
 /* ------------------------------------------------------------------ */
-static void emit_event(int fd, uint16_t type, uint16_t code, int32_t value)
-{
-    struct input_event ev = {
-        .type = type,
-        .code = code,
-        .value = value,
-    };
-    gettimeofday(&ev.time, NULL);
+/*
+ * A trace file is a header followed by fixed-size records:
+ *
+ *   "KATTRACE" | u32 version | u32 meta_len | meta (config.ini-style text)
+ *   TraceRecord * N
+ *
+ * Recorded traces tag each record with the index of the grabbed keyboard
+ * it came from and carry the config and screen geometry in the meta block.
+ * Replay output uses the same layout, tagged with TRACE_OUT_* instead.
+ * All fields are host-endian.
+ */
+#define TRACE_MAGIC "KATTRACE"
+#define TRACE_VERSION 1
+#define TRACE_META_MAX 4096
 
-    /* Silence -Wunused-result cleanly and safely */
-    if (write(fd, &ev, sizeof(ev)) < 0) {
-        /* Only spam if it's not a broken pipe / device gone */
-        if (errno != EPIPE && errno != ENODEV && errno != EINVAL)
-            perror("write to uinput failed");
-    }
-}
+enum {
+    TRACE_OUT_KEYBOARD = 0,   /* virtual keyboard */
+    TRACE_OUT_MOUSE = 1,      /* virtual mouse */
+    TRACE_OUT_POINTER = 2,    /* X pointer warp, EV_ABS ABS_X/ABS_Y */
+};
 
-static void warp_mouse(Display *dpy, int x, int y) {
-    XWarpPointer(dpy, None, DefaultRootWindow(dpy), 0, 0, 0, 0, x, y);
-    XSync(dpy, False);
+typedef struct {
+    uint64_t time_us;         /* relative to the first recorded event */
+    uint8_t dev;
+    uint8_t type;
+    uint16_t code;
+    int32_t value;
+} TraceRecord;
+
+_Static_assert(sizeof(TraceRecord) == 16, "TraceRecord must stay 16 bytes");
+
+static FILE *trace_record_file = NULL;
+static double trace_record_start = -1.0;
+static FILE *replay_out = NULL;
+static double replay_epoch = 0.0;
+static long replay_out_records = 0;
+
+/* No popups, overlays or X connections; pointer is simulated */
+static bool headless = false;
+static int virtual_pointer_x = 0;
+static int virtual_pointer_y = 0;
+static int virtual_screen_w = 1920;
+static int virtual_screen_h = 1080;
+
+static bool trace_write_header(FILE *f, const char *meta, uint32_t meta_len) {
+    uint32_t version = TRACE_VERSION;
+    return fwrite(TRACE_MAGIC, 1, 8, f) == 8 &&
+           fwrite(&version, sizeof(version), 1, f) == 1 &&
+           fwrite(&meta_len, sizeof(meta_len), 1, f) == 1 &&
+           (meta_len == 0 || fwrite(meta, 1, meta_len, f) == meta_len);
 }
 
-static void mouse_click(int button) {
-    emit_event(state.mouse_fd, EV_KEY, button, 1);
-    emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
-    usleep(10000);
-    emit_event(state.mouse_fd, EV_KEY, button, 0);
-    emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+static void trace_write_record(FILE *f, double t, int dev, uint16_t type, uint16_t code, int32_t value) {
+    TraceRecord rec = {
+        .time_us = (uint64_t)(t * 1e6 + 0.5),
+        .dev = (uint8_t)dev,
+        .type = (uint8_t)type,
+        .code = code,
+        .value = value,
+    };
+    fwrite(&rec, sizeof(rec), 1, f);
 }
 
-static void mouse_wheel(double amount) {
-    int hi_res_value = (int)(amount * 120);
-    emit_event(state.mouse_fd, EV_REL, REL_WHEEL_HI_RES, hi_res_value);
-    int full_notches = hi_res_value / 120;
-    if (full_notches != 0) {
-        emit_event(state.mouse_fd, EV_REL, REL_WHEEL, full_notches);
-    }
-    emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+static void trace_record_event(int kbd_index, const struct input_event *ev) {
+    double t = ev->time.tv_sec + ev->time.tv_usec * 1e-6;
+    if (trace_record_start < 0) trace_record_start = t;
+    if (t < trace_record_start) t = trace_record_start;
+    trace_write_record(trace_record_file, t - trace_record_start, kbd_index, ev->type, ev->code, ev->value);
 }
 
-/* ------------------------------------------------------------------ */
-/* Diagonal Component Helper                                          */
-/* ------------------------------------------------------------------ */
-static void diag_components(int diag, int *dx, int *dy) {
-    if (diag <= 0) { *dx = *dy = 0; return; }
-    int comp = (int)((diag * 7071) / 10000 + 0.5);   /* 7071 approx 1/sqrt(2)*10000 */
-    *dx = comp;
-    *dy = comp;
+static void replay_emit(int dev, uint16_t type, uint16_t code, int32_t value) {
+    double t = get_time() - replay_epoch;
+    if (t < 0) t = 0;
+    trace_write_record(replay_out, t, dev, type, code, value);
+    replay_out_records++;
 }
 
 /* ------------------------------------------------------------------ */
-/* Movement Thread                                                    */
+/* Runtime Statistics                                                 */
 /* ------------------------------------------------------------------ */
-static void* movement_thread_func(void *arg) {
-    (void)arg;
-    Display *dpy = XOpenDisplay(NULL);
-    if (!dpy) {
-        fprintf(stderr, "Failed to open display in movement thread\n");
-        return NULL;
-    }
-
-    while (state.running) {
-        pthread_mutex_lock(&state.state_mutex);
+/*
+ * Lock-free latency histograms and per-thread counters, dumped to stdout
+ * (the journal, under systemd) on SIGUSR1. Buckets are log-linear: four
+ * sub-buckets per power of two of nanoseconds, so any value is reported
+ * within 25%.
+ */
+#define HIST_SUB_BITS 2
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (40 * HIST_SUB_BUCKETS)
 
-        bool any_numpad = false;
-        for (int i = 0; i < 8; ++i) any_numpad |= state.numpad_keys_pressed[i];
+enum {
+    HIST_FORWARD,         /* evdev kernel timestamp -> forwarded uinput write */
+    HIST_FIRST_MOTION,    /* numpad press -> first warp */
+    HIST_TICK_JITTER,     /* movement thread oversleep past its deadline */
+    HIST_UINPUT_WRITE,    /* write() to a uinput device */
+    HIST_X_WARP,          /* XWarpPointer + XSync round trip */
+    HIST_TIME_TO_TARGET,  /* first numpad motion -> the click it led to */
+    NUM_HISTS
+};
 
-        bool scroll_up = state.scroll_keys_pressed[0] || state.autoscroll_up_active;
-        bool scroll_down = state.scroll_keys_pressed[1] || state.autoscroll_down_active;
+static const char *hist_names[NUM_HISTS] = {
+    "forward_latency", "key_to_first_motion", "tick_jitter", "uinput_write", "x_warp_round_trip",
+    "time_to_target",
+};
 
-        bool do_jump = state.ctrl_pressed && any_numpad;
-        bool do_smooth = !state.ctrl_pressed && any_numpad;
+typedef struct {
+    atomic_ulong buckets[HIST_BUCKETS];
+    atomic_ulong count;
+    atomic_ulong sum_ns;
+    atomic_ulong max_ns;
+} Histogram;
 
-        int dx = 0, dy = 0;
-        if (do_jump || do_smooth) {
-            int horiz = do_jump ? state.cfg.jump_horizontal : state.cfg.mouse_speed;
-            int vert = do_jump ? state.cfg.jump_vertical : state.cfg.mouse_speed;
-            int diag = do_jump ? state.cfg.jump_diagonal : state.cfg.mouse_speed;
+enum {
+    STATS_THREAD_INPUT,
+    STATS_THREAD_MOVEMENT,
+    STATS_THREAD_OTHER,
+    NUM_STATS_THREADS
+};
 
-            if (state.numpad_keys_pressed[0]) dy -= vert;  // 8 → up
-            if (state.numpad_keys_pressed[1]) dy += vert;  // 2 → down
-            if (state.numpad_keys_pressed[2]) dx -= horiz; // 4 → left
-            if (state.numpad_keys_pressed[3]) dx += horiz; // 6 → right
+static const char *stats_thread_names[NUM_STATS_THREADS] = { "input", "movement", "other" };
 
-            int cx = 0, cy = 0;
-            if (state.numpad_keys_pressed[4]) { diag_components(diag, &cx, &cy); dx -= cx; dy -= cy; } // 7
-            if (state.numpad_keys_pressed[5]) { diag_components(diag, &cx, &cy); dx += cx; dy -= cy; } // 9
-            if (state.numpad_keys_pressed[6]) { diag_components(diag, &cx, &cy); dx -= cx; dy += cy; } // 1
-            if (state.numpad_keys_pressed[7]) { diag_components(diag, &cx, &cy); dx += cx; dy += cy; } // 3
-        }
+typedef struct {
+    atomic_ulong events;
+    atomic_ulong syscalls;
+    atomic_ulong wakeups;
+} ThreadCounters;
+
+static Histogram histograms[NUM_HISTS];
+static ThreadCounters thread_counters_local[NUM_STATS_THREADS];
+/* Moved into the status page once that is mapped, so readers see it live */
+static ThreadCounters *thread_counters = thread_counters_local;
+static _Thread_local int stats_thread = STATS_THREAD_OTHER;
+static atomic_ulong motion_press_ns;   /* pending numpad press awaiting its first warp */
+static volatile sig_atomic_t stats_dump_requested = 0;
+static double stats_start_time = 0.0;
+
+static double mono_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
-        pthread_mutex_unlock(&state.state_mutex);
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-        if (state.mouse_mode) {
-            double now = get_time();
+static int hist_bucket(uint64_t ns) {
+    if (ns < HIST_SUB_BUCKETS) return (int)ns;
+    int msb = 63 - __builtin_clzll(ns);
+    int idx = ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+              (int)((ns >> (msb - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+    return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
 
-            if ((do_jump || do_smooth) && (dx != 0 || dy != 0)) {
-                Window root = DefaultRootWindow(dpy);
-                Window child;
-                int root_x, root_y, win_x, win_y;
-                unsigned int mask;
+static uint64_t hist_bucket_floor(int idx) {
+    if (idx < HIST_SUB_BUCKETS) return (uint64_t)idx;
+    int msb = (idx >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    return (uint64_t)(HIST_SUB_BUCKETS + (idx & (HIST_SUB_BUCKETS - 1))) << (msb - HIST_SUB_BITS);
+}
 
-                if (!XQueryPointer(dpy, root, &root, &child, &root_x, &root_y, &win_x, &win_y, &mask)) {
-                    usleep(1000);
-                    continue;
-                }
+static void hist_record(int h, uint64_t ns) {
+    Histogram *hist = &histograms[h];
+    atomic_fetch_add_explicit(&hist->buckets[hist_bucket(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum_ns, ns, memory_order_relaxed);
+    unsigned long max = atomic_load_explicit(&hist->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&hist->max_ns, &max, ns,
+                                                              memory_order_relaxed, memory_order_relaxed)) {}
+}
 
-                int scr_w = DisplayWidth(dpy, DefaultScreen(dpy));
-                int scr_h = DisplayHeight(dpy, DefaultScreen(dpy));
+static void count_event(void) {
+    atomic_fetch_add_explicit(&thread_counters[stats_thread].events, 1, memory_order_relaxed);
+}
 
-                int target_x = root_x + dx;
-                int target_y = root_y + dy;
+static void count_syscall(void) {
+    atomic_fetch_add_explicit(&thread_counters[stats_thread].syscalls, 1, memory_order_relaxed);
+}
 
-                target_x = (target_x % scr_w + scr_w) % scr_w;
-                target_y = (target_y % scr_h + scr_h) % scr_h;
+static void count_wakeup(void) {
+    atomic_fetch_add_explicit(&thread_counters[stats_thread].wakeups, 1, memory_order_relaxed);
+}
 
-                warp_mouse(dpy, target_x, target_y);
+/* Upper edge of the bucket holding the q-th quantile, in microseconds */
+static double hist_quantile_us(const unsigned long *buckets, unsigned long count, double q) {
+    unsigned long rank = (unsigned long)(q * count);
+    if (rank >= count) rank = count - 1;
+    unsigned long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > rank) return hist_bucket_floor(i + 1) / 1000.0;
+    }
+    return hist_bucket_floor(HIST_BUCKETS) / 1000.0;
+}
 
-                int interval_ms;
-                if (do_jump) {
-                    interval_ms = state.cfg.jump_interval_ms;
-                } else {
-                    if (state.movement_start_time == 0.0) state.movement_start_time = now;
+static void stats_dump(FILE *f) {
+    fprintf(f, "--- kat stats, %.1f s since start ---\n", get_time() - stats_start_time);
+    fprintf(f, "%-20s %10s %10s %10s %10s %10s %10s\n",
+            "histogram", "count", "mean_us", "p50_us", "p90_us", "p99_us", "max_us");
+
+    for (int h = 0; h < NUM_HISTS; h++) {
+        Histogram *hist = &histograms[h];
+        unsigned long buckets[HIST_BUCKETS];
+        unsigned long count = 0;
+        for (int i = 0; i < HIST_BUCKETS; i++) {
+            buckets[i] = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+            count += buckets[i];
+        }
+        if (count == 0) {
+            fprintf(f, "%-20s %10lu\n", hist_names[h], 0UL);
+            continue;
+        }
+        double mean = atomic_load(&hist->sum_ns) / 1000.0 / atomic_load(&hist->count);
+        fprintf(f, "%-20s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f\n", hist_names[h], count, mean,
+                hist_quantile_us(buckets, count, 0.50), hist_quantile_us(buckets, count, 0.90),
+                hist_quantile_us(buckets, count, 0.99), atomic_load(&hist->max_ns) / 1000.0);
+    }
 
-                    double elapsed = now - state.movement_start_time;
-                    double progress = elapsed / state.cfg.movement_acceleration_time;
-                    if (progress > 1.0) progress = 1.0;
+    fprintf(f, "%-20s %10s %10s %10s\n", "thread", "events", "syscalls", "wakeups");
+    for (int t = 0; t < NUM_STATS_THREADS; t++) {
+        fprintf(f, "%-20s %10lu %10lu %10lu\n", stats_thread_names[t],
+                atomic_load(&thread_counters[t].events), atomic_load(&thread_counters[t].syscalls),
+                atomic_load(&thread_counters[t].wakeups));
+    }
+    rt_stats_dump(f);
+    tune_stats_dump(f);
+    fflush(f);
+}
 
-                    interval_ms = state.cfg.movement_interval_slow_ms -
-                                  (int)((state.cfg.movement_interval_slow_ms - state.cfg.movement_interval_fast_ms) * progress);
-                }
+static void request_stats_dump(int sig) {
+    (void)sig;
+    stats_dump_requested = 1;
+}
 
-                usleep(interval_ms * 1000);
-            } else {
-                state.movement_start_time = 0.0;
-            }
+/* ------------------------------------------------------------------ */
+/* Real-time Scheduling                                               */
+/* ------------------------------------------------------------------ */
+/*
+ * Opt-in scheduling for the two threads on the latency path: the input
+ * loop (main thread) and the movement thread. RT_POLICY selects
+ * SCHED_FIFO or SCHED_RR at RT_PRIORITY. INPUT_CPU and MOVEMENT_CPU pin
+ * each thread to one CPU. MLOCK locks all current and future memory and
+ * prefaults the main stack, so no tick waits on a page fault. Each thread
+ * applies its own settings and reads them back, and the result is shown
+ * next to tick_jitter in the stats. Every other thread is started through
+ * helper_thread_create(), which puts it back on SCHED_OTHER, the CPUs the
+ * process started with and a small stack, so X helpers, popups and the
+ * anchor search neither compete with the input loop at RT priority nor
+ * pin every locked 8 MB default stack.
+ */
+#define RT_PREFAULT_STACK (256 * 1024)
+#define HELPER_STACK_SIZE (256 * 1024)
 
-            if (scroll_up || scroll_down) {
-                double direction = scroll_up ? 1.0 : -1.0;
-                double speed = (state.autoscroll_up_active || state.autoscroll_down_active) ? state.cfg.autoscroll_speed : state.cfg.scroll_speed;
-                int interval = (state.autoscroll_up_active || state.autoscroll_down_active) ? state.cfg.autoscroll_interval_ms : state.cfg.scroll_interval_ms;
+typedef struct {
+    bool applied;
+    int policy, priority;
+    int cpu;                /* -1 = not pinned */
+} RtStatus;
+
+static RtStatus rt_status[NUM_STATS_THREADS];
+static bool rt_memory_locked = false;
+static unsigned long rt_start_mask[1024 / (8 * sizeof(unsigned long))];
+static bool rt_start_mask_saved = false;
+
+static const char* rt_policy_name(int policy) {
+    switch (policy) {
+        case SCHED_FIFO: return "fifo";
+        case SCHED_RR: return "rr";
+        default: return "other";
+    }
+}
 
-                mouse_wheel(direction * speed);
-                usleep(interval * 1000);
-            }
+/* Touch the stack once so it is resident before the first event */
+static void rt_prefault_stack(void) {
+    volatile unsigned char buf[RT_PREFAULT_STACK];
+    for (size_t i = 0; i < sizeof(buf); i += 4096) buf[i] = 0;
+}
 
-            usleep(1000);
-        } else {
-            state.movement_start_time = 0.0;
-            usleep(1000);
-        }
+static void rt_lock_memory(void) {
+    if (!state.cfg.mlock) return;
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        perror("mlockall");
+        return;
     }
+    rt_prefault_stack();
+    rt_memory_locked = true;
+}
 
-    XCloseDisplay(dpy);
-    return NULL;
+/* Stack size for the movement thread; NULL attr means the default */
+static pthread_attr_t* rt_thread_attr(pthread_attr_t *attr) {
+    if (state.cfg.thread_stack_kb <= 0) return NULL;
+    size_t size = (size_t)state.cfg.thread_stack_kb * 1024;
+    if (size < (size_t)PTHREAD_STACK_MIN) size = (size_t)PTHREAD_STACK_MIN;
+    pthread_attr_init(attr);
+    if (pthread_attr_setstacksize(attr, size) != 0) {
+        fprintf(stderr, "Invalid THREAD_STACK_KB %d; using the default stack\n", state.cfg.thread_stack_kb);
+        pthread_attr_destroy(attr);
+        return NULL;
+    }
+    return attr;
 }
 
-static bool feedback_popup_active = false;
-static char feedback_message[64] = "";
-static double feedback_end_time = 0.0;
-static pthread_mutex_t feedback_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t feedback_cond = PTHREAD_COND_INITIALIZER;
-static bool drag_popup_visible = false;
-static pthread_mutex_t drag_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t drag_cond = PTHREAD_COND_INITIALIZER;
+/* Remember the CPUs the process may use before any thread gets pinned */
+static void rt_save_affinity(void) {
+    rt_start_mask_saved = syscall(SYS_sched_getaffinity, 0, sizeof(rt_start_mask), rt_start_mask) > 0;
+}
 
-static void* feedback_popup_thread(void *arg) {
-    (void)arg;
-    Display *dpy = XOpenDisplay(NULL);
-    if (!dpy) return NULL;
+typedef struct {
+    void *(*func)(void *);
+    void *arg;
+} HelperStart;
+
+static void* helper_thread_start(void *p) {
+    HelperStart hs = *(HelperStart *)p;
+    free(p);
+    if (rt_start_mask_saved) syscall(SYS_sched_setaffinity, 0, sizeof(rt_start_mask), rt_start_mask);
+    return hs.func(hs.arg);
+}
 
-    int scr = DefaultScreen(dpy);
-    Window root = DefaultRootWindow(dpy);
+/* pthread_create() for anything but the input and movement threads */
+static int helper_thread_create(pthread_t *th, bool detached, void *(*func)(void *), void *arg) {
+    HelperStart *hs = malloc(sizeof(*hs));
+    if (!hs) return ENOMEM;
+    *hs = (HelperStart){ func, arg };
 
-    XFontStruct *font = XLoadQueryFont(dpy, "fixed");
-    if (!font) font = XLoadQueryFont(dpy, "9x15");
+    pthread_attr_t attr;
+    struct sched_param sp = { .sched_priority = 0 };
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &sp);
+    pthread_attr_setstacksize(&attr, HELPER_STACK_SIZE);
+    if (detached) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(th, &attr, helper_thread_start, hs);
+    pthread_attr_destroy(&attr);
+    if (err != 0) free(hs);
+    return err;
+}
 
-    Window win = None;
-    GC gc = None;
-    bool first = true;
+/* Apply policy and affinity to the calling thread and record what stuck */
+static void rt_apply(int which, int cpu) {
+    static const int policies[] = { SCHED_OTHER, SCHED_FIFO, SCHED_RR };
+    int policy = policies[state.cfg.rt_policy >= 0 && state.cfg.rt_policy <= 2 ? state.cfg.rt_policy : 0];
+    if (policy != SCHED_OTHER) {
+        struct sched_param sp = { .sched_priority = state.cfg.rt_priority };
+        int err = pthread_setschedparam(pthread_self(), policy, &sp);
+        if (err != 0) fprintf(stderr, "%s thread: cannot set %s priority %d: %s\n", stats_thread_names[which],
+                              rt_policy_name(policy), state.cfg.rt_priority, strerror(err));
+    }
 
-    while (true) {
-        pthread_mutex_lock(&feedback_mutex);
-        if (!feedback_popup_active) {
-            pthread_mutex_unlock(&feedback_mutex);
-            break;
+    RtStatus *st = &rt_status[which];
+    st->cpu = -1;
+    if (cpu >= 0 && cpu < 1024) {
+        unsigned long mask[1024 / (8 * sizeof(unsigned long))] = {0};
+        mask[cpu / (8 * sizeof(unsigned long))] = 1UL << (cpu % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) < 0) {
+            fprintf(stderr, "%s thread: cannot pin to CPU %d: %s\n", stats_thread_names[which], cpu, strerror(errno));
+        } else {
+            st->cpu = cpu;
         }
+    }
 
-        char msg[128];
-        strcpy(msg, feedback_message);
-        double end_time = feedback_end_time;
-        pthread_mutex_unlock(&feedback_mutex);
+    struct sched_param sp;
+    if (pthread_getschedparam(pthread_self(), &st->policy, &sp) == 0) st->priority = sp.sched_priority;
+    st->applied = true;
+}
 
-        int w = 260, h = 60;
-        int text_w = 0, asc = 0, desc = 0;
-        if (font) {
-            int dir;
-            XCharStruct ov;
-            XTextExtents(font, msg, strlen(msg), &dir, &asc, &desc, &ov);
-            w = ov.width + 40;
-            h = asc + desc + 24;
-            text_w = ov.width;
-        }
+static void rt_stats_dump(FILE *f) {
+    fprintf(f, "%-20s %10s %10s %10s\n", "sched", "policy", "priority", "cpu");
+    for (int t = 0; t < NUM_STATS_THREADS; t++) {
+        const RtStatus *st = &rt_status[t];
+        if (!st->applied) continue;
+        char cpu[16] = "any";
+        if (st->cpu >= 0) snprintf(cpu, sizeof(cpu), "%d", st->cpu);
+        fprintf(f, "%-20s %10s %10d %10s\n", stats_thread_names[t], rt_policy_name(st->policy), st->priority, cpu);
+    }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(f, "%-20s %10s %10s %10ld\n", "memory", rt_memory_locked ? "locked" : "unlocked",
+            "majflt", ru.ru_majflt);
+}
 
-        int x = (DisplayWidth(dpy, scr) - w) / 2;
-        int y = (DisplayHeight(dpy, scr) - h) / 2;
+/* ------------------------------------------------------------------ */
+/* Mouse Control Helpers                                              */
+/* ------------------------------------------------------------------ */
+static void emit_event(int fd, uint16_t type, uint16_t code, int32_t value)
+{
+    if (fd == state.mouse_fd) {
+        macro_note_mouse(type, code, value);
+        /* Any button the daemon sends supersedes a pending dwell click */
+        if (type == EV_KEY) dwell_cancel();
+    }
+    if (replay_out) {
+        replay_emit(fd == state.mouse_fd ? TRACE_OUT_MOUSE : TRACE_OUT_KEYBOARD, type, code, value);
+        return;
+    }
 
-        if (first) {
-            first = false;
+    struct input_event ev = {
+        .type = type,
+        .code = code,
+        .value = value,
+    };
+    get_timeval(&ev.time);
 
-            XSetWindowAttributes attrs = {0};
-            attrs.override_redirect = True;
-            attrs.background_pixel = 0xFFFFFF;
-            attrs.border_pixel = 0;
+    /* Silence -Wunused-result cleanly and safely */
+    uint64_t t0 = mono_ns();
+    ssize_t ret = write(fd, &ev, sizeof(ev));
+    hist_record(HIST_UINPUT_WRITE, mono_ns() - t0);
+    count_syscall();
+    if (ret < 0) {
+        /* Only spam if it's not a broken pipe / device gone */
+        if (errno != EPIPE && errno != ENODEV && errno != EINVAL)
+            perror("write to uinput failed");
+    }
+}
 
-            win = XCreateWindow(dpy, root, x, y, w, h, 0,
-                                CopyFromParent, InputOutput, CopyFromParent,
-                                CWOverrideRedirect | CWBackPixel | CWBorderPixel,
-                                &attrs);
+static void warp_mouse(Display *dpy, int x, int y) {
+    macro_note_warp(x, y);
+    dwell_note_motion(x, y);
+    if (!dpy) {
+        virtual_pointer_x = x;
+        virtual_pointer_y = y;
+        if (replay_out) {
+            replay_emit(TRACE_OUT_POINTER, EV_ABS, ABS_X, x);
+            replay_emit(TRACE_OUT_POINTER, EV_ABS, ABS_Y, y);
+        }
+        return;
+    }
+    uint64_t t0 = mono_ns();
+    XWarpPointer(dpy, None, DefaultRootWindow(dpy), 0, 0, 0, 0, x, y);
+    XSync(dpy, False);
+    hist_record(HIST_X_WARP, mono_ns() - t0);
+    count_syscall();
+}
 
-            Atom opacity_atom = XInternAtom(dpy, "_NET_WM_WINDOW_OPACITY", False);
-            unsigned long opacity = 0xFFFFFFFF;
-            XChangeProperty(dpy, win, opacity_atom, XA_CARDINAL, 32,
-                            PropModeReplace, (unsigned char*)&opacity, 1);
+/* Lazily opened connection for X work done on the input thread */
+static Display *input_dpy = NULL;
 
-            XMapWindow(dpy, win);
+static Display* input_display(void) {
+    if (headless) return NULL;
+    if (!input_dpy) input_dpy = XOpenDisplay(NULL);
+    return input_dpy;
+}
 
-            gc = XCreateGC(dpy, win, 0, NULL);
-            XSetForeground(dpy, gc, BlackPixel(dpy, scr));
-            if (font) XSetFont(dpy, gc, font->fid);
-        } else {
-            XMoveResizeWindow(dpy, win, x, y, w, h);
-        }
+/* Pointer and screen queries; a NULL display means the headless simulation */
+static bool query_pointer(Display *dpy, int *x, int *y) {
+    if (!dpy) {
+        *x = virtual_pointer_x;
+        *y = virtual_pointer_y;
+        return true;
+    }
+    Window root, child;
+    int win_x, win_y;
+    unsigned int mask;
+    count_syscall();
+    return XQueryPointer(dpy, DefaultRootWindow(dpy), &root, &child, x, y, &win_x, &win_y, &mask);
+}
 
-        XClearWindow(dpy, win);
-        if (font) {
-            int tx = (w - text_w) / 2;
-            int ty = (h + asc - desc) / 2;
-            XDrawString(dpy, win, gc, tx, ty, msg, strlen(msg));
-        }
-        XFlush(dpy);
+static void screen_size(Display *dpy, int *w, int *h) {
+    if (!dpy) {
+        *w = virtual_screen_w;
+        *h = virtual_screen_h;
+        return;
+    }
+    *w = DisplayWidth(dpy, DefaultScreen(dpy));
+    *h = DisplayHeight(dpy, DefaultScreen(dpy));
+}
 
-        struct timespec ts;
-        clock_gettime(CLOCK_REALTIME, &ts);
-        double now = ts.tv_sec + ts.tv_nsec * 1e-9;
-        double wait = end_time - now;
-        if (wait <= 0) {
-            pthread_mutex_lock(&feedback_mutex);
-            feedback_popup_active = false;
-            pthread_mutex_unlock(&feedback_mutex);
-            continue;
-        }
+static void mouse_click(int button) {
+    /* A jump may still be gliding; click, and remember, where it ends */
+    anim_finish();
+    history_note_pointer();
+    emit_event(state.mouse_fd, EV_KEY, button, 1);
+    emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+    clock_sleep_us(10000);
+    emit_event(state.mouse_fd, EV_KEY, button, 0);
+    emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+}
 
-        long sec = (long)wait;
-        long nsec = (wait - sec) * 1000000000L;
-        ts.tv_sec += sec;
-        ts.tv_nsec += nsec;
-        if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+/* ------------------------------------------------------------------ */
+/* Monitor Layout                                                     */
+/* ------------------------------------------------------------------ */
+/*
+ * Monitor rectangles and pixel densities from XRandR, reloaded only on
+ * RRScreenChangeNotify. Jumps, margins, overlays and wrap-around use the
+ * monitor under the pointer; lookups scan the cached table and never touch
+ * the server. Step sizes in pixels are taken to be at MONITOR_REF_DPI and
+ * scaled to each monitor's density, so speed feels the same on every panel.
+ * Without RandR, or with nothing cached, the whole X screen is one monitor.
+ */
+#define MAX_MONITORS 16
+#define MONITOR_REF_DPI 96.0
+#define MONITOR_DEFAULT_HZ 60.0
 
-        pthread_mutex_lock(&feedback_mutex);
-        int r = pthread_cond_timedwait(&feedback_cond, &feedback_mutex, &ts);
-        pthread_mutex_unlock(&feedback_mutex);
+typedef struct {
+    int x, y, w, h;
+} Rect;
 
-        if (r == ETIMEDOUT) {
-            pthread_mutex_lock(&feedback_mutex);
-            feedback_popup_active = false;
-            pthread_mutex_unlock(&feedback_mutex);
+typedef struct {
+    Rect r;
+    double scale;           /* step multiplier for this monitor's density */
+    double hz;              /* refresh rate */
+} Monitor;
+
+static Monitor monitors[MAX_MONITORS];
+static int num_monitors = 0;
+static pthread_t monitor_thread = 0;
+static pthread_mutex_t monitor_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static double monitor_density_scale(int px, int mm) {
+    if (px <= 0 || mm <= 0) return 1.0;
+    double scale = px * 25.4 / mm / MONITOR_REF_DPI;
+    /* Projectors and bogus EDIDs report silly sizes */
+    if (scale < 0.5 || scale > 4.0) return 1.0;
+    return scale;
+}
+
+static int rect_distance(const Rect *r, int x, int y) {
+    int dx = x < r->x ? r->x - x : x >= r->x + r->w ? x - (r->x + r->w - 1) : 0;
+    int dy = y < r->y ? r->y - y : y >= r->y + r->h ? y - (r->y + r->h - 1) : 0;
+    return dx + dy;
+}
+
+/* The monitor containing (x, y), or the nearest one */
+static Monitor monitor_at(Display *dpy, int x, int y) {
+    Monitor m = { { 0, 0, 0, 0 }, 1.0, MONITOR_DEFAULT_HZ };
+    int best = INT_MAX;
+    pthread_mutex_lock(&monitor_mutex);
+    for (int i = 0; i < num_monitors && best > 0; i++) {
+        int d = rect_distance(&monitors[i].r, x, y);
+        if (d < best) {
+            best = d;
+            m = monitors[i];
         }
     }
-
-    if (font) XFreeFont(dpy, font);
-    if (gc) XFreeGC(dpy, gc);
-    if (win != None) XDestroyWindow(dpy, win);
-    XCloseDisplay(dpy);
-    return NULL;
+    pthread_mutex_unlock(&monitor_mutex);
+    if (best == INT_MAX) screen_size(dpy, &m.r.w, &m.r.h);
+    return m;
 }
 
-static void* drag_popup_thread(void *arg) {
-    (void)arg;
-    Display *dpy = XOpenDisplay(NULL);
-    if (!dpy) return NULL;
+static bool monitor_contains(Display *dpy, int x, int y) {
+    Monitor m = monitor_at(dpy, x, y);
+    return rect_distance(&m.r, x, y) == 0;
+}
 
-    int scr = DefaultScreen(dpy);
-    Window root = DefaultRootWindow(dpy);
+/* Bounding box of all monitors: the part of the root that is on screen */
+static Rect monitor_bounds(Display *dpy) {
+    Rect b = { 0, 0, 0, 0 };
+    pthread_mutex_lock(&monitor_mutex);
+    for (int i = 0; i < num_monitors; i++) {
+        const Rect *r = &monitors[i].r;
+        if (i == 0) {
+            b = *r;
+            continue;
+        }
+        int x1 = b.x + b.w > r->x + r->w ? b.x + b.w : r->x + r->w;
+        int y1 = b.y + b.h > r->y + r->h ? b.y + b.h : r->y + r->h;
+        if (r->x < b.x) b.x = r->x;
+        if (r->y < b.y) b.y = r->y;
+        b.w = x1 - b.x;
+        b.h = y1 - b.y;
+    }
+    pthread_mutex_unlock(&monitor_mutex);
+    if (b.w <= 0 || b.h <= 0) screen_size(dpy, &b.w, &b.h);
+    return b;
+}
 
-    XFontStruct *font = XLoadQueryFont(dpy, "fixed");
-    if (!font) font = XLoadQueryFont(dpy, "9x15");
+static Monitor monitor_under_pointer(Display *dpy) {
+    int x = 0, y = 0;
+    query_pointer(dpy, &x, &y);
+    return monitor_at(dpy, x, y);
+}
 
-    const char *msg = "Drag Mode";
-    Window win = None;
-    GC gc = None;
+static double mode_refresh(const XRRModeInfo *mode) {
+    double v_total = mode->vTotal;
+    if (mode->modeFlags & RR_DoubleScan) v_total *= 2;
+    if (mode->modeFlags & RR_Interlace) v_total /= 2;
+    if (mode->hTotal == 0 || v_total <= 0) return 0.0;
+    return mode->dotClock / (mode->hTotal * v_total);
+}
 
-    int w = 260, h = 60;
-    int text_w = 0, asc = 0, desc = 0;
-    if (font) {
-        int dir;
-        XCharStruct ov;
-        XTextExtents(font, msg, strlen(msg), &dir, &asc, &desc, &ov);
-        w = ov.width + 40;
-        h = asc + desc + 24;
-        text_w = ov.width;
+/* Refresh rate of the CRTC showing rect r, from its current mode */
+static double monitor_refresh(Display *dpy, XRRScreenResources *res, const Rect *r) {
+    double hz = 0.0;
+    for (int c = 0; res && c < res->ncrtc && hz == 0.0; c++) {
+        XRRCrtcInfo *crtc = XRRGetCrtcInfo(dpy, res, res->crtcs[c]);
+        if (!crtc) continue;
+        if (crtc->mode != None && crtc->x == r->x && crtc->y == r->y) {
+            for (int m = 0; m < res->nmode; m++) {
+                if (res->modes[m].id == crtc->mode) hz = mode_refresh(&res->modes[m]);
+            }
+        }
+        XRRFreeCrtcInfo(crtc);
     }
+    return hz >= 20.0 ? hz : MONITOR_DEFAULT_HZ;
+}
 
-    int x = (DisplayWidth(dpy, scr) - w) / 2;
-    int y = (DisplayHeight(dpy, scr) - h) / 2;
-
-    XSetWindowAttributes attrs = {0};
-    attrs.override_redirect = True;
-    attrs.background_pixel = 0xFFFFFF;
-    attrs.border_pixel = 0;
-
-    win = XCreateWindow(dpy, root, x, y, w, h, 0,
-                        CopyFromParent, InputOutput, CopyFromParent,
-                        CWOverrideRedirect | CWBackPixel | CWBorderPixel,
-                        &attrs);
+static void monitor_load(Display *dpy) {
+    int n = 0;
+    Window root = DefaultRootWindow(dpy);
+    XRRMonitorInfo *info = XRRGetMonitors(dpy, root, True, &n);
+    XRRScreenResources *res = XRRGetScreenResourcesCurrent(dpy, root);
+    Monitor next[MAX_MONITORS];
+    int count = 0;
+    for (int i = 0; info && i < n && count < MAX_MONITORS; i++) {
+        if (info[i].width <= 0 || info[i].height <= 0) continue;
+        Monitor *m = &next[count++];
+        m->r = (Rect){ info[i].x, info[i].y, info[i].width, info[i].height };
+        double sx = monitor_density_scale(info[i].width, info[i].mwidth);
+        double sy = monitor_density_scale(info[i].height, info[i].mheight);
+        m->scale = (sx + sy) / 2.0;
+        m->hz = monitor_refresh(dpy, res, &m->r);
+    }
+    if (res) XRRFreeScreenResources(res);
+    if (info) XRRFreeMonitors(info);
 
-    Atom opacity_atom = XInternAtom(dpy, "_NET_WM_WINDOW_OPACITY", False);
-    unsigned long opacity = 0xFFFFFFFF;
-    XChangeProperty(dpy, win, opacity_atom, XA_CARDINAL, 32,
-                    PropModeReplace, (unsigned char*)&opacity, 1);
+    pthread_mutex_lock(&monitor_mutex);
+    memcpy(monitors, next, count * sizeof(Monitor));
+    num_monitors = count;
+    pthread_mutex_unlock(&monitor_mutex);
+}
 
-    XMapWindow(dpy, win);
+/* RRGetMonitors needs RandR 1.5 */
+static bool monitor_randr_ok(Display *dpy, int *event_base) {
+    int error_base, major = 0, minor = 0;
+    return XRRQueryExtension(dpy, event_base, &error_base) &&
+           XRRQueryVersion(dpy, &major, &minor) && (major > 1 || minor >= 5);
+}
 
-    gc = XCreateGC(dpy, win, 0, NULL);
-    XSetForeground(dpy, gc, BlackPixel(dpy, scr));
-    if (font) XSetFont(dpy, gc, font->fid);
+static void* monitor_thread_func(void *arg) {
+    (void)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) return NULL;
 
-    XClearWindow(dpy, win);
-    if (font) {
-        int tx = (w - text_w) / 2;
-        int ty = (h + asc - desc) / 2;
-        XDrawString(dpy, win, gc, tx, ty, msg, strlen(msg));
+    int event_base;
+    if (!monitor_randr_ok(dpy, &event_base)) {
+        fprintf(stderr, "XRandR 1.5 not available; treating the screen as one monitor\n");
+        XCloseDisplay(dpy);
+        return NULL;
     }
-    XFlush(dpy);
+    XRRSelectInput(dpy, DefaultRootWindow(dpy), RRScreenChangeNotifyMask);
+    monitor_load(dpy);
 
-    pthread_mutex_lock(&drag_mutex);
-    while (drag_popup_visible) {
-        pthread_cond_wait(&drag_cond, &drag_mutex);
+    struct pollfd pfd = { .fd = ConnectionNumber(dpy), .events = POLLIN };
+    while (state.running) {
+        if (!XPending(dpy) && poll(&pfd, 1, 250) <= 0) continue;
+        count_wakeup();
+        bool changed = false;
+        while (XPending(dpy)) {
+            XEvent ev;
+            XNextEvent(dpy, &ev);
+            if (ev.type == event_base + RRScreenChangeNotify) {
+                XRRUpdateConfiguration(&ev);
+                changed = true;
+            }
+        }
+        if (changed) monitor_load(dpy);
     }
-    pthread_mutex_unlock(&drag_mutex);
 
-    if (font) XFreeFont(dpy, font);
-    if (gc) XFreeGC(dpy, gc);
-    if (win != None) XDestroyWindow(dpy, win);
     XCloseDisplay(dpy);
     return NULL;
 }
 
-static void show_feedback(const char *text) {
-    pthread_mutex_lock(&feedback_mutex);
-    strncpy(feedback_message, text, sizeof(feedback_message)-1);
-    feedback_message[sizeof(feedback_message)-1] = '\0';
-    feedback_end_time = get_time() + (MODE_POPUP_DURATION_MS / 1000.0);
-    bool was_active = feedback_popup_active;
-    feedback_popup_active = true;
-    pthread_cond_signal(&feedback_cond);
-    pthread_mutex_unlock(&feedback_mutex);
+static void monitor_tracker_start(void) {
+    if (helper_thread_create(&monitor_thread, false, monitor_thread_func, NULL) != 0) monitor_thread = 0;
+}
 
-    if (!was_active) {
-        pthread_t th;
-        pthread_attr_t attr;
-        pthread_attr_init(&attr);
-        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-        pthread_create(&th, &attr, feedback_popup_thread, NULL);
-        pthread_attr_destroy(&attr);
+/* Replay layouts: "WxH+X+Y[@DPI]" entries separated by commas */
+static void monitor_parse_layout(const char *spec) {
+    num_monitors = 0;
+    while (*spec && num_monitors < MAX_MONITORS) {
+        int w, h, x, y, used = 0;
+        double dpi = MONITOR_REF_DPI;
+        if (sscanf(spec, "%dx%d+%d+%d%n", &w, &h, &x, &y, &used) != 4) break;
+        spec += used;
+        if (*spec == '@') {
+            char *end;
+            dpi = strtod(spec + 1, &end);
+            spec = end;
+        }
+        monitors[num_monitors++] = (Monitor){ { x, y, w, h }, dpi > 0 ? dpi / MONITOR_REF_DPI : 1.0,
+                                              MONITOR_DEFAULT_HZ };
+        while (*spec == ',' || *spec == ' ') spec++;
     }
 }
 
-static void show_drag_popup(void) {
-    pthread_mutex_lock(&drag_mutex);
-    if (drag_popup_visible) {
-        pthread_mutex_unlock(&drag_mutex);
-        return;
+/* Current layout in the format monitor_parse_layout() reads; "" if unknown */
+static void monitor_format_layout(char *buf, size_t size) {
+    size_t len = 0;
+    buf[0] = '\0';
+    pthread_mutex_lock(&monitor_mutex);
+    for (int i = 0; i < num_monitors && len < size; i++) {
+        const Monitor *m = &monitors[i];
+        len += snprintf(buf + len, size - len, "%s%dx%d+%d+%d@%.0f", i ? "," : "",
+                        m->r.w, m->r.h, m->r.x, m->r.y, m->scale * MONITOR_REF_DPI);
     }
-    drag_popup_visible = true;
-    pthread_mutex_unlock(&drag_mutex);
+    pthread_mutex_unlock(&monitor_mutex);
+}
 
-    pthread_t th;
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-    pthread_create(&th, &attr, drag_popup_thread, NULL);
-    pthread_attr_destroy(&attr);
+/* ------------------------------------------------------------------ */
+/* Jump Animation                                                     */
+/* ------------------------------------------------------------------ */
+/*
+ * With JUMP_ANIM_MS set, jumps glide to their target with an ease-out
+ * curve instead of teleporting. Frames go out at the refresh rate of the
+ * target monitor, on absolute CLOCK_MONOTONIC deadlines counted from the
+ * start of the glide, so a late frame never pushes the later ones back.
+ * A new jump retargets from the current frame. Any key press finishes the
+ * glide at its target first, so clicks and further jumps act where the
+ * pointer is headed and never wait for the animation.
+ */
+static pthread_mutex_t anim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t anim_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t anim_thread = 0;
+static bool anim_active = false;
+static int anim_from_x, anim_from_y, anim_to_x, anim_to_y;
+static int anim_cur_x, anim_cur_y;    /* last position sent */
+static double anim_start, anim_duration, anim_period;
+static long anim_frame = 0;           /* frames due so far */
+
+static double anim_clock(void) {
+    return clock_virtual ? clock_virtual_now : mono_ns() * 1e-9;
 }
 
-static void hide_drag_popup(void) {
-    pthread_mutex_lock(&drag_mutex);
-    if (!drag_popup_visible) {
-        pthread_mutex_unlock(&drag_mutex);
+static double anim_next_deadline(void) {
+    return anim_start + (anim_frame + 1) * anim_period;
+}
+
+/* Jump to (x, y), animated if configured */
+static void anim_warp(Display *dpy, int x, int y) {
+    if (state.cfg.jump_anim_ms <= 0) {
+        warp_mouse(dpy, x, y);
         return;
     }
-    drag_popup_visible = false;
-    pthread_cond_signal(&drag_cond);
-    pthread_mutex_unlock(&drag_mutex);
+    pthread_mutex_lock(&anim_mutex);
+    if (!anim_active) {
+        anim_cur_x = x;
+        anim_cur_y = y;
+        query_pointer(dpy, &anim_cur_x, &anim_cur_y);
+    }
+    anim_from_x = anim_cur_x;
+    anim_from_y = anim_cur_y;
+    anim_to_x = x;
+    anim_to_y = y;
+    anim_start = anim_clock();
+    anim_duration = state.cfg.jump_anim_ms / 1000.0;
+    anim_period = 1.0 / monitor_at(dpy, x, y).hz;
+    anim_frame = 0;
+    anim_active = true;
+    pthread_cond_signal(&anim_cond);
+    pthread_mutex_unlock(&anim_mutex);
 }
 
-/* ------------------------------------------------------------------ */
-/* Config Panel Functions                                             */
-/* ------------------------------------------------------------------ */
-static void init_config_panel(ConfigPanel *panel) {
-    panel->active = false;
-    panel->last_activity_time = 0.0;
-    panel->selected_row = 0;
-    panel->shortcut_col_x = 0;
-    panel->max_shortcut_w = 0;
-    panel->col1_w = 0;
-    panel->initial_mouse_x = 0;
-    panel->initial_mouse_y = 0;
-    panel->win = None;
-    panel->dpy = NULL;
-    panel->gc = None;
-    panel->font = NULL;
-    pthread_mutex_init(&panel->mutex, NULL);
+/* Where a running glide will end; false when nothing is animating */
+static bool anim_target(int *x, int *y) {
+    pthread_mutex_lock(&anim_mutex);
+    bool active = anim_active;
+    if (active) {
+        *x = anim_to_x;
+        *y = anim_to_y;
+    }
+    pthread_mutex_unlock(&anim_mutex);
+    return active;
 }
 
-static void* panel_timer_func(void *arg) {
-    ConfigPanel *panel = (ConfigPanel *)arg;
-    while (panel->active) {
-        double now = get_time();
-        if (now - panel->last_activity_time > 5.0) {
-            panel->active = false;
-            break;
-        }
-        usleep(100000);
+/* Send the frame due at `now`; the mutex keeps it ordered against anim_finish() */
+static void anim_step(Display *dpy, double now) {
+    pthread_mutex_lock(&anim_mutex);
+    if (!anim_active) {
+        pthread_mutex_unlock(&anim_mutex);
+        return;
     }
-    return NULL;
+    double t = anim_duration > 0.0 ? (now - anim_start) / anim_duration : 1.0;
+    if (t > 1.0) t = 1.0;
+    double e = 1.0 - (1.0 - t) * (1.0 - t) * (1.0 - t);
+    anim_cur_x = anim_from_x + (int)lround((anim_to_x - anim_from_x) * e);
+    anim_cur_y = anim_from_y + (int)lround((anim_to_y - anim_from_y) * e);
+    if (anim_cur_x == anim_to_x && anim_cur_y == anim_to_y) anim_active = false;
+    long due = (long)((now - anim_start) / anim_period);
+    anim_frame = due > anim_frame ? due : anim_frame + 1;
+    warp_mouse(dpy, anim_cur_x, anim_cur_y);
+    pthread_mutex_unlock(&anim_mutex);
 }
 
-static void* mouse_monitor_func(void *arg) {
-    ConfigPanel *panel = (ConfigPanel *)arg;
+/* Land a running glide on its target right away */
+static void anim_finish(void) {
+    pthread_mutex_lock(&anim_mutex);
+    if (anim_active) {
+        anim_active = false;
+        warp_mouse(input_display(), anim_to_x, anim_to_y);
+    }
+    pthread_mutex_unlock(&anim_mutex);
+}
+
+static void* anim_thread_func(void *arg) {
+    (void)arg;
     Display *dpy = XOpenDisplay(NULL);
     if (!dpy) return NULL;
-    while (panel->active) {
-        Window root, child;
-        int root_x, root_y, win_x, win_y;
-        unsigned int mask;
-        if (XQueryPointer(dpy, DefaultRootWindow(dpy), &root, &child, &root_x, &root_y, &win_x, &win_y, &mask)) {
-            if (root_x != panel->initial_mouse_x || root_y != panel->initial_mouse_y) {
-                panel->active = false;
-                break;
-            }
+
+    pthread_mutex_lock(&anim_mutex);
+    while (state.running) {
+        if (!anim_active) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 250000000L;
+            if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+            pthread_cond_timedwait(&anim_cond, &anim_mutex, &ts);
+            continue;
         }
-        usleep(50000);
+        double deadline = anim_next_deadline();
+        pthread_mutex_unlock(&anim_mutex);
+
+        struct timespec ts = { (time_t)deadline, (long)((deadline - (time_t)deadline) * 1e9) };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+        count_wakeup();
+        anim_step(dpy, anim_clock());
+
+        pthread_mutex_lock(&anim_mutex);
     }
+    pthread_mutex_unlock(&anim_mutex);
+
     XCloseDisplay(dpy);
     return NULL;
 }
 
-static void draw_config_panel(ConfigPanel *panel) {
-    if (!panel->dpy || panel->win == None) return;
+static void anim_start_thread(void) {
+    if (helper_thread_create(&anim_thread, false, anim_thread_func, NULL) != 0) anim_thread = 0;
+}
 
-    XClearWindow(panel->dpy, panel->win);
-
-    int ascent = panel->font->ascent;
-    int descent = panel->font->descent;
-    int line_h = ascent + descent + 8;
-    int left_margin = 10;
-    int top_margin = 10;
-    int col1_w = panel->col1_w;
-    int value_col_x = left_margin + col1_w;
-    int shortcut_col_x = panel->shortcut_col_x;
-
-    int win_w;
-    XWindowAttributes attrs;
-    XGetWindowAttributes(panel->dpy, panel->win, &attrs);
-    win_w = attrs.width;
-
-    // Title with arrow characters
-    int current_x = left_margin;
-    int y = top_margin + ascent;
+/* Replay: send every frame due up to the virtual time `until` */
+static void anim_catch_up(double until) {
+    while (anim_active) {
+        double deadline = anim_next_deadline();
+        if (deadline > until) break;
+        if (clock_virtual_now < deadline) clock_virtual_now = deadline;
+        anim_step(NULL, deadline);
+    }
+}
 
-    XChar2b up_arrow = {0x21, 0x91};
-    XChar2b down_arrow = {0x21, 0x93};
-    XChar2b left_arrow = {0x21, 0x90};
-    XChar2b right_arrow = {0x21, 0x92};
+/* ------------------------------------------------------------------ */
+/* Scroll Engine                                                      */
+/* ------------------------------------------------------------------ */
+/*
+ * Scrolling is accumulated in fractional hi-res units (1/120 notch) so
+ * small speeds still add up, and legacy REL_WHEEL/REL_HWHEEL notches are
+ * emitted from the running hi-res total for apps that ignore hi-res.
+ */
+#define SCROLL_HI_RES_PER_NOTCH 120
+#define SCROLL_MOMENTUM_TICK 0.016    /* seconds between momentum steps */
+#define SCROLL_MOMENTUM_MIN 0.5       /* notches/s below which momentum stops */
+#define SCROLL_ACCEL_RAMP 1.0         /* seconds of hold to reach SCROLL_ACCELERATION */
 
-    char *part1 = "Esc = Exit | (8";
-    XDrawString(panel->dpy, panel->win, panel->gc, current_x, y, part1, strlen(part1));
-    current_x += XTextWidth(panel->font, part1, strlen(part1));
+enum { SCROLL_VERTICAL = 0, SCROLL_HORIZONTAL = 1 };
 
-    XDrawString16(panel->dpy, panel->win, panel->gc, current_x, y, &up_arrow, 1);
-    current_x += XTextWidth16(panel->font, &up_arrow, 1);
+typedef struct {
+    double pending;      /* hi-res units not yet emitted */
+    int since_notch;     /* hi-res units emitted since the last legacy notch */
+} ScrollAxis;
+
+static ScrollAxis scroll_axes[2];
+
+static void mouse_wheel(int axis, double amount) {
+    ScrollAxis *a = &scroll_axes[axis];
+    a->pending += amount * SCROLL_HI_RES_PER_NOTCH;
+    int hi_res_value = (int)a->pending;
+    if (hi_res_value == 0) return;
+    a->pending -= hi_res_value;
+
+    emit_event(state.mouse_fd, EV_REL, axis == SCROLL_VERTICAL ? REL_WHEEL_HI_RES : REL_HWHEEL_HI_RES, hi_res_value);
+    a->since_notch += hi_res_value;
+    int full_notches = a->since_notch / SCROLL_HI_RES_PER_NOTCH;
+    if (full_notches != 0) {
+        a->since_notch -= full_notches * SCROLL_HI_RES_PER_NOTCH;
+        emit_event(state.mouse_fd, EV_REL, axis == SCROLL_VERTICAL ? REL_WHEEL : REL_HWHEEL, full_notches);
+    }
+    emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+}
 
-    char *part2 = " 2";
-    XDrawString(panel->dpy, panel->win, panel->gc, current_x, y, part2, strlen(part2));
-    current_x += XTextWidth(panel->font, part2, strlen(part2));
+/* Ease-in from 1x to SCROLL_ACCELERATION over SCROLL_ACCEL_RAMP seconds of hold */
+static double scroll_accel_multiplier(double held) {
+    double t = held / SCROLL_ACCEL_RAMP;
+    if (t > 1.0) t = 1.0;
+    return 1.0 + (state.cfg.scroll_acceleration - 1.0) * t * t;
+}
 
-    XDrawString16(panel->dpy, panel->win, panel->gc, current_x, y, &down_arrow, 1);
-    current_x += XTextWidth16(panel->font, &down_arrow, 1);
+static void stop_scroll_momentum(void) {
+    state.scroll_velocity = 0.0;
+}
 
-    char *part3 = ") Select | (";
-    XDrawString(panel->dpy, panel->win, panel->gc, current_x, y, part3, strlen(part3));
-    current_x += XTextWidth(panel->font, part3, strlen(part3));
+/* Glide after a manual scroll key is released; returns true while active */
+static bool scroll_momentum_step(double now) {
+    if (state.scroll_velocity == 0.0) return false;
+    if (state.cfg.scroll_momentum_ms <= 0) {
+        stop_scroll_momentum();
+        return false;
+    }
 
-    XDrawString16(panel->dpy, panel->win, panel->gc, current_x, y, &left_arrow, 1);
-    current_x += XTextWidth16(panel->font, &left_arrow, 1);
+    double dt = now - state.scroll_momentum_time;
+    if (dt < SCROLL_MOMENTUM_TICK) return true;
 
-    char *part4 = "4 6";
-    XDrawString(panel->dpy, panel->win, panel->gc, current_x, y, part4, strlen(part4));
-    current_x += XTextWidth(panel->font, part4, strlen(part4));
+    state.scroll_velocity *= exp(-dt * 1000.0 / state.cfg.scroll_momentum_ms);
+    if (fabs(state.scroll_velocity) < SCROLL_MOMENTUM_MIN) {
+        stop_scroll_momentum();
+        return false;
+    }
+    mouse_wheel(state.scroll_momentum_axis, state.scroll_velocity * dt);
+    state.scroll_momentum_time = now;
+    return true;
+}
 
-    XDrawString16(panel->dpy, panel->win, panel->gc, current_x, y, &right_arrow, 1);
-    current_x += XTextWidth16(panel->font, &right_arrow, 1);
+/* ------------------------------------------------------------------ */
+/* Cursor Shape Tracking                                              */
+/* ------------------------------------------------------------------ */
+/*
+ * Smooth movement slows to STICKY_SPEED percent while the cursor shows a
+ * hand, I-beam or resize shape, which makes small targets easier to hit.
+ * The shape comes from XFixes CursorNotify events. Each cursor image is
+ * classified once by name and cached by its serial. The movement thread
+ * only reads an atomic flag, so a tick costs no extra round trips.
+ */
+#define CURSOR_CACHE_SIZE 64
 
-    char *part5 = ") Adjust";
-    XDrawString(panel->dpy, panel->win, panel->gc, current_x, y, part5, strlen(part5));
+typedef struct {
+    unsigned long serial;
+    bool sticky;
+} CursorClass;
 
-    int line_y = y + 10;
-    XSetForeground(panel->dpy, panel->gc, 0x000000);
-    XDrawLine(panel->dpy, panel->win, panel->gc, left_margin, line_y, win_w - left_margin, line_y);
+static atomic_bool cursor_sticky = false;
+static pthread_t cursor_thread = 0;
 
-    y += line_h + 10;
-    XSetForeground(panel->dpy, panel->gc, 0x555555);
-    char *header = "Shortcut";
-    int header_x = shortcut_col_x + panel->max_shortcut_w - XTextWidth(panel->font, header, strlen(header));
-    XDrawString(panel->dpy, panel->win, panel->gc, header_x, y - ascent - 20, header, strlen(header));
-    XSetForeground(panel->dpy, panel->gc, 0x000000);
+static bool ends_with(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
 
-    for (int i = 0; i < num_config_items; ++i) {
-        ConfigItem *item = &config_items[i];
-        char valbuf[32];
-        if (item->is_double) snprintf(valbuf, sizeof(valbuf), item->fmt, *(double*)item->value);
-        else snprintf(valbuf, sizeof(valbuf), item->fmt, *(int*)item->value);
+/* Cursor names from X core fonts, Xcursor themes and CSS */
+static bool cursor_name_sticky(const char *name) {
+    static const char *const exact[] = {
+        "hand", "hand1", "hand2", "pointer", "pointing_hand",
+        "xterm", "text", "ibeam", "vertical-text",
+        "fleur", "move", "all-scroll",
+    };
+    for (size_t i = 0; i < sizeof(exact) / sizeof(exact[0]); i++) {
+        if (strcmp(name, exact[i]) == 0) return true;
+    }
+    return strstr(name, "resize") || strncmp(name, "size_", 5) == 0 || strncmp(name, "split_", 6) == 0 ||
+           ends_with(name, "_side") || ends_with(name, "_corner") || ends_with(name, "double_arrow");
+}
 
-        int row_y = y - ascent;
+static bool cursor_classify(Display *dpy, CursorClass *cache, unsigned long serial, Atom name) {
+    CursorClass *c = &cache[serial % CURSOR_CACHE_SIZE];
+    if (c->serial == serial) return c->sticky;
 
-        if (i == panel->selected_row) {
-            XSetForeground(panel->dpy, panel->gc, 0xCCCCCC);
-            XFillRectangle(panel->dpy, panel->win, panel->gc, 0, row_y - 2, win_w, line_h + 4);
-            XSetForeground(panel->dpy, panel->gc, 0x000000);
+    bool sticky = false;
+    if (name != None) {
+        char *s = XGetAtomName(dpy, name);
+        if (s) {
+            sticky = cursor_name_sticky(s);
+            XFree(s);
         }
+    }
+    *c = (CursorClass){ serial, sticky };
+    return sticky;
+}
 
-        XDrawString(panel->dpy, panel->win, panel->gc, left_margin, y, item->name, strlen(item->name));
-        XDrawString(panel->dpy, panel->win, panel->gc, value_col_x, y, valbuf, strlen(valbuf));
+static void* cursor_thread_func(void *arg) {
+    (void)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) return NULL;
 
-        XSetForeground(panel->dpy, panel->gc, 0x555555);
-        int shortcut_w = XTextWidth(panel->font, item->shortcut, strlen(item->shortcut));
-        XDrawString(panel->dpy, panel->win, panel->gc,
-                    shortcut_col_x + panel->max_shortcut_w - shortcut_w, y, item->shortcut, strlen(item->shortcut));
-        XSetForeground(panel->dpy, panel->gc, 0x000000);
-        y += line_h;
+    int event_base, error_base;
+    if (!XFixesQueryExtension(dpy, &event_base, &error_base)) {
+        fprintf(stderr, "XFixes not available; sticky targets disabled\n");
+        XCloseDisplay(dpy);
+        return NULL;
     }
+    static CursorClass cache[CURSOR_CACHE_SIZE];
+    XFixesSelectCursorInput(dpy, DefaultRootWindow(dpy), XFixesDisplayCursorNotifyMask);
 
-    XFlush(panel->dpy);
-
-    if (panel->selected_row == 7) {
-        show_margin_overlay();
-    } else {
-        hide_margin_overlay();
+    XFixesCursorImage *img = XFixesGetCursorImage(dpy);
+    if (img) {
+        cursor_sticky = cursor_classify(dpy, cache, img->cursor_serial, img->atom);
+        XFree(img);
     }
 
-    if (panel->selected_row == 4) {
-        show_jump_overlay(1);
-    } else if (panel->selected_row == 5) {
-        show_jump_overlay(2);
-    } else if (panel->selected_row == 6) {
-        show_jump_overlay(3);
-    } else {
-        show_jump_overlay(0);
+    struct pollfd pfd = { .fd = ConnectionNumber(dpy), .events = POLLIN };
+    while (state.running) {
+        if (!XPending(dpy) && poll(&pfd, 1, 250) <= 0) continue;
+        count_wakeup();
+        while (XPending(dpy)) {
+            XEvent ev;
+            XNextEvent(dpy, &ev);
+            if (ev.type != event_base + XFixesCursorNotify) continue;
+            XFixesCursorNotifyEvent *cn = (XFixesCursorNotifyEvent *)&ev;
+            cursor_sticky = cursor_classify(dpy, cache, cn->cursor_serial, cn->cursor_name);
+        }
     }
+
+    XCloseDisplay(dpy);
+    return NULL;
 }
 
-static void* config_panel_thread(void *arg) {
-    ConfigPanel *panel = (ConfigPanel *)arg;
-    panel->dpy = XOpenDisplay(NULL);
-    if (!panel->dpy) return NULL;
+static void cursor_tracker_start(void) {
+    if (helper_thread_create(&cursor_thread, false, cursor_thread_func, NULL) != 0) cursor_thread = 0;
+}
 
-    int scr = DefaultScreen(panel->dpy);
-    int scr_w = DisplayWidth(panel->dpy, scr);
-    int scr_h = DisplayHeight(panel->dpy, scr);
+/* Smooth step size in px, reduced over clickable targets */
+static int sticky_speed(int speed) {
+    if (!cursor_sticky || state.cfg.sticky_speed >= 100) return speed;
+    int slowed = speed * state.cfg.sticky_speed / 100;
+    return slowed > 0 ? slowed : 1;
+}
 
-    panel->font = XLoadQueryFont(panel->dpy, "-misc-fixed-bold-r-normal--12-*-*-*-*-*-iso10646-1");
-    if (!panel->font) panel->font = XLoadQueryFont(panel->dpy, "-misc-fixed-medium-r-normal--13-*-*-*-*-*-iso10646-1");
-    if (!panel->font) panel->font = XLoadQueryFont(panel->dpy, "-misc-fixed-medium-r-*-*-18-*-*-*-*-*-iso10646-1");
-    if (!panel->font) panel->font = XLoadQueryFont(panel->dpy, "-misc-fixed-bold-r-normal--14-*-*-*-*-*-iso10646-1");
-    if (!panel->font) panel->font = XLoadQueryFont(panel->dpy, "9x15");
-    if (!panel->font) panel->font = XLoadQueryFont(panel->dpy, "fixed");
+/* ------------------------------------------------------------------ */
+/* Diagonal Component Helper                                          */
+/* ------------------------------------------------------------------ */
+static void diag_components(int diag, int *dx, int *dy) {
+    if (diag <= 0) { *dx = *dy = 0; return; }
+    int comp = (int)((diag * 7071) / 10000 + 0.5);   /* 7071 approx 1/sqrt(2)*10000 */
+    *dx = comp;
+    *dy = comp;
+}
 
-    int ascent = panel->font ? panel->font->ascent : 12;
-    int descent = panel->font ? panel->font->descent : 4;
-    int line_h = ascent + descent + 8;
+/* ------------------------------------------------------------------ */
+/* Movement Thread                                                    */
+/* ------------------------------------------------------------------ */
+/*
+ * One step of pointer motion and wheel scrolling. Returns how long to
+ * sleep before the next step, in microseconds. Shared by the movement
+ * thread and the replay driver, which calls it with a NULL display.
+ */
+static long movement_tick(Display *dpy) {
+    pthread_mutex_lock(&state.state_mutex);
 
-    int left_margin = 10;
-    int top_margin = 10;
-    int padding = 10;
-    int shortcut_padding = 60;
+    bool any_numpad = false;
+    for (int i = 0; i < 8; ++i) any_numpad |= state.numpad_keys_pressed[i];
+
+    bool scroll_up = state.scroll_keys_pressed[0] || state.autoscroll_up_active;
+    bool scroll_down = state.scroll_keys_pressed[1] || state.autoscroll_down_active;
+    bool scroll_left = state.scroll_keys_pressed[2];
+    bool scroll_right = state.scroll_keys_pressed[3];
+
+    bool do_jump = state.ctrl_pressed && any_numpad;
+    bool do_smooth = !state.ctrl_pressed && any_numpad;
+
+    int dx = 0, dy = 0;
+    if (do_jump || do_smooth) {
+        int speed = do_smooth ? sticky_speed(state.cfg.mouse_speed) : 0;
+        int horiz = do_jump ? state.cfg.jump_horizontal : speed;
+        int vert = do_jump ? state.cfg.jump_vertical : speed;
+        int diag = do_jump ? state.cfg.jump_diagonal : speed;
+
+        if (state.numpad_keys_pressed[0]) dy -= vert;  // 8 → up
+        if (state.numpad_keys_pressed[1]) dy += vert;  // 2 → down
+        if (state.numpad_keys_pressed[2]) dx -= horiz; // 4 → left
+        if (state.numpad_keys_pressed[3]) dx += horiz; // 6 → right
+
+        int cx = 0, cy = 0;
+        if (state.numpad_keys_pressed[4]) { diag_components(diag, &cx, &cy); dx -= cx; dy -= cy; } // 7
+        if (state.numpad_keys_pressed[5]) { diag_components(diag, &cx, &cy); dx += cx; dy -= cy; } // 9
+        if (state.numpad_keys_pressed[6]) { diag_components(diag, &cx, &cy); dx -= cx; dy += cy; } // 1
+        if (state.numpad_keys_pressed[7]) { diag_components(diag, &cx, &cy); dx += cx; dy += cy; } // 3
+    }
 
-    int max_name_w = 0;
-    int max_value_w = 0;
-    int max_shortcut_w = 0;
-    for (int i = 0; i < num_config_items; i++) {
-        ConfigItem *item = &config_items[i];
-        int nw = XTextWidth(panel->font, item->name, strlen(item->name));
-        if (nw > max_name_w) max_name_w = nw;
+    pthread_mutex_unlock(&state.state_mutex);
 
-        char valbuf[32];
-        if (item->is_double) snprintf(valbuf, sizeof(valbuf), item->fmt, *(double*)item->value);
-        else snprintf(valbuf, sizeof(valbuf), item->fmt, *(int*)item->value);
-        int vw = XTextWidth(panel->font, valbuf, strlen(valbuf));
-        if (vw > max_value_w) max_value_w = vw;
+    lens_tick(dpy);
 
-        int sw = XTextWidth(panel->font, item->shortcut, strlen(item->shortcut));
-        if (sw > max_shortcut_w) max_shortcut_w = sw;
+    if (!state.mouse_mode) {
+        state.movement_start_time = 0.0;
+        state.scroll_start_time = 0.0;
+        stop_scroll_momentum();
+        return 1000;
     }
 
-    int col1_w = max_name_w + padding;
-    panel->col1_w = col1_w;
-    int col2_x = left_margin + col1_w + max_value_w + shortcut_padding;
-    int total_content_w = col1_w + max_value_w + shortcut_padding + max_shortcut_w;
-    panel->shortcut_col_x = col2_x;
-    panel->max_shortcut_w = max_shortcut_w;
+    long sleep_us = 1000;
+    double now = get_time();
 
-    XChar2b up_arrow = {0x21, 0x91};
-    XChar2b down_arrow = {0x21, 0x93};
-    XChar2b left_arrow = {0x21, 0x90};
-    XChar2b right_arrow = {0x21, 0x92};
+    if ((do_jump || do_smooth) && (dx != 0 || dy != 0)) {
+        int root_x, root_y;
+        if (!query_pointer(dpy, &root_x, &root_y)) return 1000;
+        /* Chained jumps step on from where the running glide will land */
+        if (do_jump) anim_target(&root_x, &root_y);
+
+        Monitor mon = monitor_at(dpy, root_x, root_y);
+        int target_x = root_x + (int)lround(dx * mon.scale);
+        int target_y = root_y + (int)lround(dy * mon.scale);
+
+        /* Crossing onto another monitor is fine; off every monitor wraps around this one */
+        if (!monitor_contains(dpy, target_x, target_y)) {
+            Rect r = mon.r;
+            target_x = r.x + ((target_x - r.x) % r.w + r.w) % r.w;
+            target_y = r.y + ((target_y - r.y) % r.h + r.h) % r.h;
+        }
 
-    char *part1 = "Esc = Exit | (8";
-    char *part2 = " 2";
-    char *part3 = ") Select | (";
-    char *part4 = "4 6";
-    char *part5 = ") Adjust";
+        if (do_jump) anim_warp(dpy, target_x, target_y);
+        else warp_mouse(dpy, target_x, target_y);
 
-    int title_w = 0;
-    title_w += XTextWidth(panel->font, part1, strlen(part1));
-    title_w += XTextWidth16(panel->font, &up_arrow, 1);
-    title_w += XTextWidth(panel->font, part2, strlen(part2));
-    title_w += XTextWidth16(panel->font, &down_arrow, 1);
-    title_w += XTextWidth(panel->font, part3, strlen(part3));
-    title_w += XTextWidth16(panel->font, &left_arrow, 1);
-    title_w += XTextWidth(panel->font, part4, strlen(part4));
-    title_w += XTextWidth16(panel->font, &right_arrow, 1);
-    title_w += XTextWidth(panel->font, part5, strlen(part5));
+        uint64_t pressed_at = atomic_exchange(&motion_press_ns, 0);
+        if (pressed_at) hist_record(HIST_FIRST_MOTION, mono_ns() - pressed_at);
 
-    int inner_w = title_w > total_content_w ? title_w : total_content_w;
-    int win_w = left_margin * 2 + inner_w;
-    int win_h = top_margin * 2 + num_config_items * line_h + 20;
-    int win_x = (scr_w - win_w) / 2;
-    int win_y = (scr_h - win_h) / 2;
+        int interval_ms;
+        if (do_jump) {
+            interval_ms = state.cfg.jump_interval_ms;
+        } else {
+            if (state.movement_start_time == 0.0) state.movement_start_time = now;
 
-    Window root = DefaultRootWindow(panel->dpy);
+            double elapsed = now - state.movement_start_time;
+            double progress = elapsed / state.cfg.movement_acceleration_time;
+            if (progress > 1.0) progress = 1.0;
 
-    XSetWindowAttributes attrs = {0};
-    attrs.override_redirect = True;
-    attrs.background_pixel = 0xFFFFFF;
-    attrs.border_pixel = 0x000000;
-    attrs.event_mask = KeyPressMask;
+            interval_ms = state.cfg.movement_interval_slow_ms -
+                          (int)((state.cfg.movement_interval_slow_ms - state.cfg.movement_interval_fast_ms) * progress);
+        }
 
-    panel->win = XCreateWindow(panel->dpy, root, win_x, win_y, win_w, win_h, 2,
-                               CopyFromParent, InputOutput, CopyFromParent,
-                               CWOverrideRedirect | CWBackPixel | CWBorderPixel | CWEventMask,
-                               &attrs);
+        sleep_us += interval_ms * 1000L;
+    } else {
+        state.movement_start_time = 0.0;
+    }
 
-    panel->gc = XCreateGC(panel->dpy, panel->win, 0, NULL);
-    XSetForeground(panel->dpy, panel->gc, 0x000000);
-    if (panel->font) XSetFont(panel->dpy, panel->gc, panel->font->fid);
+    if (scroll_up || scroll_down || scroll_left || scroll_right) {
+        bool autoscroll = state.autoscroll_up_active || state.autoscroll_down_active;
+        int axis = (scroll_up || scroll_down) ? SCROLL_VERTICAL : SCROLL_HORIZONTAL;
+        double direction = (axis == SCROLL_VERTICAL) ? (scroll_up ? 1.0 : -1.0) : (scroll_right ? 1.0 : -1.0);
+        double speed = autoscroll ? state.cfg.autoscroll_speed : state.cfg.scroll_speed;
+        int interval = autoscroll ? state.cfg.autoscroll_interval_ms : state.cfg.scroll_interval_ms;
 
-    XMapWindow(panel->dpy, panel->win);
-    XStoreName(panel->dpy, panel->win, "Mouse Daemon Config");
+        if (autoscroll) {
+            stop_scroll_momentum();
+        } else {
+            if (state.scroll_start_time == 0.0) state.scroll_start_time = now;
+            speed *= scroll_accel_multiplier(now - state.scroll_start_time);
+            state.scroll_momentum_axis = axis;
+            state.scroll_velocity = direction * speed * 1000.0 / (interval > 0 ? interval : 1);
+            state.scroll_momentum_time = now;
+        }
 
-    draw_config_panel(panel);
+        mouse_wheel(axis, direction * speed);
+        sleep_us += interval * 1000L;
+    } else {
+        state.scroll_start_time = 0.0;
+        scroll_momentum_step(now);
+    }
 
-    while (panel->active) {
-        usleep(10000);
+    return sleep_us;
+}
+
+static void* movement_thread_func(void *arg) {
+    (void)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) {
+        fprintf(stderr, "Failed to open display in movement thread\n");
+        return NULL;
     }
 
-    if (panel->win != None) XDestroyWindow(panel->dpy, panel->win);
-    if (panel->gc) XFreeGC(panel->dpy, panel->gc);
-    if (panel->font) XFreeFont(panel->dpy, panel->font);
-    if (panel->dpy) XCloseDisplay(panel->dpy);
+    stats_thread = STATS_THREAD_MOVEMENT;
+    rt_apply(STATS_THREAD_MOVEMENT, state.cfg.movement_cpu);
 
-    panel->win = None;
-    panel->dpy = NULL;
-    panel->gc = None;
-    panel->font = NULL;
+    while (state.running) {
+        uint64_t sleep_ns = movement_tick(dpy) * 1000ULL;
+        uint64_t t0 = mono_ns();
+        usleep(sleep_ns / 1000);
+        uint64_t slept = mono_ns() - t0;
+        hist_record(HIST_TICK_JITTER, slept > sleep_ns ? slept - sleep_ns : 0);
+        count_wakeup();
+    }
 
+    XCloseDisplay(dpy);
     return NULL;
 }
 
-static void show_config_panel(ConfigPanel *panel) {
-    pthread_mutex_lock(&panel->mutex);
-    if (panel->active) {
-        pthread_mutex_unlock(&panel->mutex);
-        return;
-    }
-    panel->active = true;
-
-    pthread_mutex_lock(&state.state_mutex);
-    memset(state.numpad_keys_pressed, 0, sizeof(state.numpad_keys_pressed));
-    memset(state.scroll_keys_pressed, 0, sizeof(state.scroll_keys_pressed));
-    state.autoscroll_up_active = state.autoscroll_down_active = false;
-    pthread_mutex_unlock(&state.state_mutex);
+/* ------------------------------------------------------------------ */
+/* Overlay Registry                                                   */
+/* ------------------------------------------------------------------ */
+/*
+ * Screen rectangles of the daemon's own windows, so screen-change
+ * tracking can tell our popups and overlays apart from the user's
+ * applications. A hidden overlay stays listed for OVERLAY_GRACE, since
+ * unmapping it repaints whatever was underneath.
+ */
+#define MAX_OVERLAYS 64      /* live windows plus recently vacated spots */
+#define OVERLAY_GRACE 0.5   /* seconds */
 
-    if (state.left_button_held) {
-        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
-        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
-        state.left_button_held = false;
-		state.drag_locked = false;
-		hide_drag_popup();
-    }
+typedef struct {
+    Window win;
+    Rect r;
+    double hidden_at;       /* 0 while mapped */
+} OverlayRect;
 
-    panel->last_activity_time = get_time();
+static OverlayRect overlays[MAX_OVERLAYS];
+static pthread_mutex_t overlay_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-    Display *temp_dpy = XOpenDisplay(NULL);
-    if (temp_dpy) {
-        Window root, child;
-        int win_x, win_y;
-        unsigned int mask;
-        XQueryPointer(temp_dpy, DefaultRootWindow(temp_dpy), &root, &child, &panel->initial_mouse_x, &panel->initial_mouse_y, &win_x, &win_y, &mask);
-        XCloseDisplay(temp_dpy);
+static void overlay_track(Window win, int x, int y, int w, int h) {
+    pthread_mutex_lock(&overlay_mutex);
+    double now = get_time();
+    int live = -1, spare = -1;
+    for (int i = 0; i < MAX_OVERLAYS; i++) {
+        if (overlays[i].win == win && overlays[i].hidden_at == 0.0) live = i;
+        else if (spare < 0 && (overlays[i].win == None ||
+                               (overlays[i].hidden_at > 0.0 && now - overlays[i].hidden_at > OVERLAY_GRACE))) spare = i;
     }
 
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-    pthread_create(&panel->timer_thread, &attr, panel_timer_func, panel);
-    pthread_create(&panel->mouse_monitor_thread, &attr, mouse_monitor_func, panel);
-    pthread_attr_destroy(&attr);
-
-    pthread_t th;
-    pthread_create(&th, NULL, config_panel_thread, panel);
-    pthread_detach(th);
-    pthread_mutex_unlock(&panel->mutex);
-}
-
-static void hide_config_panel(ConfigPanel *panel) {
-    pthread_mutex_lock(&panel->mutex);
-    panel->active = false;
-    state.autoscroll_up_active = state.autoscroll_down_active = false;
-
-    save_config();
-
-    if (state.left_button_held) {
-        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
-        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
-        state.left_button_held = false;
-		state.drag_locked = false;
-		hide_drag_popup();
+    Rect r = { x, y, w, h };
+    if (live >= 0) {
+        Rect old = overlays[live].r;
+        /* Moving uncovers the old spot, which repaints as well */
+        if (spare >= 0 && memcmp(&old, &r, sizeof(r)) != 0) overlays[spare] = (OverlayRect){ win, old, now };
+        overlays[live].r = r;
+    } else if (spare >= 0) {
+        overlays[spare] = (OverlayRect){ win, r, 0.0 };
     }
-
-    panel->selected_row = 0;
-
-    pthread_mutex_unlock(&panel->mutex);
-    hide_margin_overlay();
-    show_jump_overlay(0);
+    pthread_mutex_unlock(&overlay_mutex);
 }
 
-/* ------------------------------------------------------------------ */
-/* Overlay Functions (Margin and Jump)                                */
-/* ------------------------------------------------------------------ */
-static bool margin_overlay_visible = false;
-static Window margin_window = None;
-static pthread_t margin_thread = 0;
-static double last_margin_adjust = 0.0;
-static bool margin_need_redraw = false;
-static pthread_mutex_t margin_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-static void show_margin_overlay(void) {
-    pthread_mutex_lock(&margin_mutex);
-    if (margin_thread && !margin_overlay_visible) {
-        pthread_join(margin_thread, NULL);
-        margin_thread = 0;
-    }
-    if (margin_overlay_visible) {
-        last_margin_adjust = get_time();
-        margin_need_redraw = true;
-        pthread_mutex_unlock(&margin_mutex);
-        return;
+static void overlay_untrack(Window win) {
+    pthread_mutex_lock(&overlay_mutex);
+    for (int i = 0; i < MAX_OVERLAYS; i++) {
+        if (overlays[i].win == win && overlays[i].hidden_at == 0.0) overlays[i].hidden_at = get_time();
     }
-    margin_overlay_visible = true;
-    last_margin_adjust = get_time();
-    margin_need_redraw = true;
-    pthread_create(&margin_thread, NULL, margin_overlay_thread, (void*)&state);
-    pthread_mutex_unlock(&margin_mutex);
+    pthread_mutex_unlock(&overlay_mutex);
 }
 
-static void hide_margin_overlay(void) {
-    pthread_mutex_lock(&margin_mutex);
-    if (!margin_overlay_visible) {
-        pthread_mutex_unlock(&margin_mutex);
-        return;
-    }
-    margin_overlay_visible = false;
-    pthread_mutex_unlock(&margin_mutex);
-    if (margin_thread) {
-        pthread_join(margin_thread, NULL);
-        margin_thread = 0;
+/* Whether r lies inside one of our windows, shown now or very recently */
+static bool overlay_covers(int x, int y, int w, int h, double now) {
+    bool covered = false;
+    pthread_mutex_lock(&overlay_mutex);
+    for (int i = 0; i < MAX_OVERLAYS && !covered; i++) {
+        const OverlayRect *o = &overlays[i];
+        if (o->win == None || (o->hidden_at > 0.0 && now - o->hidden_at > OVERLAY_GRACE)) continue;
+        covered = x >= o->r.x && y >= o->r.y && x + w <= o->r.x + o->r.w && y + h <= o->r.y + o->r.h;
     }
+    pthread_mutex_unlock(&overlay_mutex);
+    return covered;
 }
 
-static void* margin_overlay_thread(void *arg) {
-    AppState *app_state = (AppState *)arg;
+static bool feedback_popup_active = false;
+static char feedback_message[64] = "";
+static double feedback_end_time = 0.0;
+static pthread_mutex_t feedback_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t feedback_cond = PTHREAD_COND_INITIALIZER;
+static bool drag_popup_visible = false;
+static pthread_mutex_t drag_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drag_cond = PTHREAD_COND_INITIALIZER;
+
+static void* feedback_popup_thread(void *arg) {
+    (void)arg;
     Display *dpy = XOpenDisplay(NULL);
     if (!dpy) return NULL;
 
     int scr = DefaultScreen(dpy);
     Window root = DefaultRootWindow(dpy);
-    int scr_w = DisplayWidth(dpy, scr);
-    int scr_h = DisplayHeight(dpy, scr);
 
-    XVisualInfo vinfo;
-    if (!XMatchVisualInfo(dpy, scr, 32, TrueColor, &vinfo)) {
-        XCloseDisplay(dpy);
-        return NULL;
-    }
+    XFontStruct *font = XLoadQueryFont(dpy, "fixed");
+    if (!font) font = XLoadQueryFont(dpy, "9x15");
 
-    XSetWindowAttributes attrs = {0};
-    attrs.override_redirect = True;
-    attrs.background_pixel = 0x00000000;
-    attrs.border_pixel = 0;
-    attrs.colormap = XCreateColormap(dpy, root, vinfo.visual, AllocNone);
+    Window win = None;
+    GC gc = None;
+    bool first = true;
 
-    Window win = XCreateWindow(dpy, root, 0, 0, scr_w, scr_h, 0,
-                               32, InputOutput, vinfo.visual,
-                               CWOverrideRedirect | CWBackPixel | CWBorderPixel | CWColormap,
-                               &attrs);
+    while (true) {
+        pthread_mutex_lock(&feedback_mutex);
+        if (!feedback_popup_active) {
+            pthread_mutex_unlock(&feedback_mutex);
+            break;
+        }
 
-    Atom above = XInternAtom(dpy, "_NET_WM_STATE_ABOVE", False);
-    XChangeProperty(dpy, win, XInternAtom(dpy, "_NET_WM_STATE", False),
-                    XA_ATOM, 32, PropModeAppend, (unsigned char *)&above, 1);
+        char msg[128];
+        strcpy(msg, feedback_message);
+        double end_time = feedback_end_time;
+        pthread_mutex_unlock(&feedback_mutex);
 
-    XMapWindow(dpy, win);
+        int w = 260, h = 60;
+        int text_w = 0, asc = 0, desc = 0;
+        if (font) {
+            int dir;
+            XCharStruct ov;
+            XTextExtents(font, msg, strlen(msg), &dir, &asc, &desc, &ov);
+            w = ov.width + 40;
+            h = asc + desc + 24;
+            text_w = ov.width;
+        }
 
-    GC gc = XCreateGC(dpy, win, 0, NULL);
-    unsigned long pixel = 0x33000000UL;
-    XSetForeground(dpy, gc, pixel);
-    XSetLineAttributes(dpy, gc, 2, LineSolid, CapButt, JoinMiter);
+        Rect mon = monitor_under_pointer(dpy).r;
+        int x = mon.x + (mon.w - w) / 2;
+        int y = mon.y + (mon.h - h) / 2;
 
-    margin_window = win;
+        if (first) {
+            first = false;
 
-    while (margin_overlay_visible) {
-        pthread_mutex_lock(&margin_mutex);
-        double now = get_time();
-        if (now - last_margin_adjust > MARGIN_OVERLAY_TIMEOUT) {
-            margin_overlay_visible = false;
-            pthread_mutex_unlock(&margin_mutex);
-            break;
-        }
+            XSetWindowAttributes attrs = {0};
+            attrs.override_redirect = True;
+            attrs.background_pixel = 0xFFFFFF;
+            attrs.border_pixel = 0;
 
-        if (margin_need_redraw) {
-            margin_need_redraw = false;
+            win = XCreateWindow(dpy, root, x, y, w, h, 0,
+                                CopyFromParent, InputOutput, CopyFromParent,
+                                CWOverrideRedirect | CWBackPixel | CWBorderPixel,
+                                &attrs);
 
-            XLockDisplay(dpy);
-            XClearWindow(dpy, win);
+            Atom opacity_atom = XInternAtom(dpy, "_NET_WM_WINDOW_OPACITY", False);
+            unsigned long opacity = 0xFFFFFFFF;
+            XChangeProperty(dpy, win, opacity_atom, XA_CARDINAL, 32,
+                            PropModeReplace, (unsigned char*)&opacity, 1);
 
-            int margin = app_state->cfg.jump_margin;
-            if (margin < 0) margin = 0;
-            int x = margin;
-            int y = margin;
-            int w = scr_w - 2 * margin;
-            int h = scr_h - 2 * margin;
-            if (w > 0 && h > 0) {
-                XDrawRectangle(dpy, win, gc, x, y, w, h);
-            }
+            XMapWindow(dpy, win);
 
-            XFlush(dpy);
-            XUnlockDisplay(dpy);
+            gc = XCreateGC(dpy, win, 0, NULL);
+            XSetForeground(dpy, gc, BlackPixel(dpy, scr));
+            if (font) XSetFont(dpy, gc, font->fid);
+        } else {
+            XMoveResizeWindow(dpy, win, x, y, w, h);
         }
-        pthread_mutex_unlock(&margin_mutex);
+        overlay_track(win, x, y, w, h);
 
-        usleep(20000);
+        XClearWindow(dpy, win);
+        if (font) {
+            int tx = (w - text_w) / 2;
+            int ty = (h + asc - desc) / 2;
+            XDrawString(dpy, win, gc, tx, ty, msg, strlen(msg));
+        }
+        XFlush(dpy);
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        double now = ts.tv_sec + ts.tv_nsec * 1e-9;
+        double wait = end_time - now;
+        if (wait <= 0) {
+            pthread_mutex_lock(&feedback_mutex);
+            feedback_popup_active = false;
+            pthread_mutex_unlock(&feedback_mutex);
+            continue;
+        }
+
+        long sec = (long)wait;
+        long nsec = (wait - sec) * 1000000000L;
+        ts.tv_sec += sec;
+        ts.tv_nsec += nsec;
+        if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+
+        pthread_mutex_lock(&feedback_mutex);
+        int r = pthread_cond_timedwait(&feedback_cond, &feedback_mutex, &ts);
+        pthread_mutex_unlock(&feedback_mutex);
+
+        if (r == ETIMEDOUT) {
+            pthread_mutex_lock(&feedback_mutex);
+            feedback_popup_active = false;
+            pthread_mutex_unlock(&feedback_mutex);
+        }
     }
 
-    XLockDisplay(dpy);
-    XUnmapWindow(dpy, win);
-    XDestroyWindow(dpy, win);
-    XFreeGC(dpy, gc);
-    XUnlockDisplay(dpy);
+    if (font) XFreeFont(dpy, font);
+    if (gc) XFreeGC(dpy, gc);
+    if (win != None) {
+        overlay_untrack(win);
+        XDestroyWindow(dpy, win);
+    }
     XCloseDisplay(dpy);
-    margin_window = None;
     return NULL;
 }
 
-static int adjusting_jump_type = 0;
-static bool jump_overlay_visible = false;
-static Window jump_window = None;
-static pthread_t jump_thread = 0;
-static double last_jump_adjust = 0.0;
-static bool jump_need_redraw = false;
-static pthread_mutex_t jump_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void* drag_popup_thread(void *arg) {
+    (void)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) return NULL;
 
-static void show_jump_overlay(int type) {
-    pthread_mutex_lock(&jump_mutex);
-    if (jump_thread && !jump_overlay_visible) {
+    int scr = DefaultScreen(dpy);
+    Window root = DefaultRootWindow(dpy);
+
+    XFontStruct *font = XLoadQueryFont(dpy, "fixed");
+    if (!font) font = XLoadQueryFont(dpy, "9x15");
+
+    const char *msg = "Drag Mode";
+    Window win = None;
+    GC gc = None;
+
+    int w = 260, h = 60;
+    int text_w = 0, asc = 0, desc = 0;
+    if (font) {
+        int dir;
+        XCharStruct ov;
+        XTextExtents(font, msg, strlen(msg), &dir, &asc, &desc, &ov);
+        w = ov.width + 40;
+        h = asc + desc + 24;
+        text_w = ov.width;
+    }
+
+    Rect mon = monitor_under_pointer(dpy).r;
+    int x = mon.x + (mon.w - w) / 2;
+    int y = mon.y + (mon.h - h) / 2;
+
+    XSetWindowAttributes attrs = {0};
+    attrs.override_redirect = True;
+    attrs.background_pixel = 0xFFFFFF;
+    attrs.border_pixel = 0;
+
+    win = XCreateWindow(dpy, root, x, y, w, h, 0,
+                        CopyFromParent, InputOutput, CopyFromParent,
+                        CWOverrideRedirect | CWBackPixel | CWBorderPixel,
+                        &attrs);
+
+    Atom opacity_atom = XInternAtom(dpy, "_NET_WM_WINDOW_OPACITY", False);
+    unsigned long opacity = 0xFFFFFFFF;
+    XChangeProperty(dpy, win, opacity_atom, XA_CARDINAL, 32,
+                    PropModeReplace, (unsigned char*)&opacity, 1);
+
+    XMapWindow(dpy, win);
+    overlay_track(win, x, y, w, h);
+
+    gc = XCreateGC(dpy, win, 0, NULL);
+    XSetForeground(dpy, gc, BlackPixel(dpy, scr));
+    if (font) XSetFont(dpy, gc, font->fid);
+
+    XClearWindow(dpy, win);
+    if (font) {
+        int tx = (w - text_w) / 2;
+        int ty = (h + asc - desc) / 2;
+        XDrawString(dpy, win, gc, tx, ty, msg, strlen(msg));
+    }
+    XFlush(dpy);
+
+    pthread_mutex_lock(&drag_mutex);
+    while (drag_popup_visible) {
+        pthread_cond_wait(&drag_cond, &drag_mutex);
+    }
+    pthread_mutex_unlock(&drag_mutex);
+
+    if (font) XFreeFont(dpy, font);
+    if (gc) XFreeGC(dpy, gc);
+    if (win != None) {
+        overlay_untrack(win);
+        XDestroyWindow(dpy, win);
+    }
+    XCloseDisplay(dpy);
+    return NULL;
+}
+
+static void show_feedback(const char *text) {
+    if (headless) return;
+
+    pthread_mutex_lock(&feedback_mutex);
+    strncpy(feedback_message, text, sizeof(feedback_message)-1);
+    feedback_message[sizeof(feedback_message)-1] = '\0';
+    feedback_end_time = get_time() + (MODE_POPUP_DURATION_MS / 1000.0);
+    bool was_active = feedback_popup_active;
+    feedback_popup_active = true;
+    pthread_cond_signal(&feedback_cond);
+    pthread_mutex_unlock(&feedback_mutex);
+
+    if (!was_active) {
+        pthread_t th;
+        helper_thread_create(&th, true, feedback_popup_thread, NULL);
+    }
+}
+
+static void show_drag_popup(void) {
+    if (headless) return;
+
+    pthread_mutex_lock(&drag_mutex);
+    if (drag_popup_visible) {
+        pthread_mutex_unlock(&drag_mutex);
+        return;
+    }
+    drag_popup_visible = true;
+    pthread_mutex_unlock(&drag_mutex);
+
+    pthread_t th;
+    helper_thread_create(&th, true, drag_popup_thread, NULL);
+}
+
+static void hide_drag_popup(void) {
+    pthread_mutex_lock(&drag_mutex);
+    if (!drag_popup_visible) {
+        pthread_mutex_unlock(&drag_mutex);
+        return;
+    }
+    drag_popup_visible = false;
+    pthread_cond_signal(&drag_cond);
+    pthread_mutex_unlock(&drag_mutex);
+}
+
+/* ------------------------------------------------------------------ */
+/* Config Panel Functions                                             */
+/* ------------------------------------------------------------------ */
+static void init_config_panel(ConfigPanel *panel) {
+    panel->active = false;
+    panel->last_activity_time = 0.0;
+    panel->selected_row = 0;
+    panel->shortcut_col_x = 0;
+    panel->max_shortcut_w = 0;
+    panel->col1_w = 0;
+    panel->initial_mouse_x = 0;
+    panel->initial_mouse_y = 0;
+    panel->win = None;
+    panel->dpy = NULL;
+    panel->gc = None;
+    panel->font = NULL;
+    pthread_mutex_init(&panel->mutex, NULL);
+}
+
+static void* panel_timer_func(void *arg) {
+    ConfigPanel *panel = (ConfigPanel *)arg;
+    while (panel->active) {
+        double now = get_time();
+        if (now - panel->last_activity_time > 5.0) {
+            panel->active = false;
+            break;
+        }
+        usleep(100000);
+    }
+    return NULL;
+}
+
+static void* mouse_monitor_func(void *arg) {
+    ConfigPanel *panel = (ConfigPanel *)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) return NULL;
+    while (panel->active) {
+        Window root, child;
+        int root_x, root_y, win_x, win_y;
+        unsigned int mask;
+        if (XQueryPointer(dpy, DefaultRootWindow(dpy), &root, &child, &root_x, &root_y, &win_x, &win_y, &mask)) {
+            if (root_x != panel->initial_mouse_x || root_y != panel->initial_mouse_y) {
+                panel->active = false;
+                break;
+            }
+        }
+        usleep(50000);
+    }
+    XCloseDisplay(dpy);
+    return NULL;
+}
+
+static void draw_config_panel(ConfigPanel *panel) {
+    if (!panel->dpy || panel->win == None) return;
+
+    XClearWindow(panel->dpy, panel->win);
+
+    int ascent = panel->font->ascent;
+    int descent = panel->font->descent;
+    int line_h = ascent + descent + 8;
+    int left_margin = 10;
+    int top_margin = 10;
+    int col1_w = panel->col1_w;
+    int value_col_x = left_margin + col1_w;
+    int shortcut_col_x = panel->shortcut_col_x;
+
+    int win_w;
+    XWindowAttributes attrs;
+    XGetWindowAttributes(panel->dpy, panel->win, &attrs);
+    win_w = attrs.width;
+
+    // Title with arrow characters
+    int current_x = left_margin;
+    int y = top_margin + ascent;
+
+    XChar2b up_arrow = {0x21, 0x91};
+    XChar2b down_arrow = {0x21, 0x93};
+    XChar2b left_arrow = {0x21, 0x90};
+    XChar2b right_arrow = {0x21, 0x92};
+
+    char *part1 = "Esc = Exit | (8";
+    XDrawString(panel->dpy, panel->win, panel->gc, current_x, y, part1, strlen(part1));
+    current_x += XTextWidth(panel->font, part1, strlen(part1));
+
+    XDrawString16(panel->dpy, panel->win, panel->gc, current_x, y, &up_arrow, 1);
+    current_x += XTextWidth16(panel->font, &up_arrow, 1);
+
+    char *part2 = " 2";
+    XDrawString(panel->dpy, panel->win, panel->gc, current_x, y, part2, strlen(part2));
+    current_x += XTextWidth(panel->font, part2, strlen(part2));
+
+    XDrawString16(panel->dpy, panel->win, panel->gc, current_x, y, &down_arrow, 1);
+    current_x += XTextWidth16(panel->font, &down_arrow, 1);
+
+    char *part3 = ") Select | (";
+    XDrawString(panel->dpy, panel->win, panel->gc, current_x, y, part3, strlen(part3));
+    current_x += XTextWidth(panel->font, part3, strlen(part3));
+
+    XDrawString16(panel->dpy, panel->win, panel->gc, current_x, y, &left_arrow, 1);
+    current_x += XTextWidth16(panel->font, &left_arrow, 1);
+
+    char *part4 = "4 6";
+    XDrawString(panel->dpy, panel->win, panel->gc, current_x, y, part4, strlen(part4));
+    current_x += XTextWidth(panel->font, part4, strlen(part4));
+
+    XDrawString16(panel->dpy, panel->win, panel->gc, current_x, y, &right_arrow, 1);
+    current_x += XTextWidth16(panel->font, &right_arrow, 1);
+
+    char *part5 = ") Adjust";
+    XDrawString(panel->dpy, panel->win, panel->gc, current_x, y, part5, strlen(part5));
+
+    int line_y = y + 10;
+    XSetForeground(panel->dpy, panel->gc, 0x000000);
+    XDrawLine(panel->dpy, panel->win, panel->gc, left_margin, line_y, win_w - left_margin, line_y);
+
+    y += line_h + 10;
+    XSetForeground(panel->dpy, panel->gc, 0x555555);
+    char *header = "Shortcut";
+    int header_x = shortcut_col_x + panel->max_shortcut_w - XTextWidth(panel->font, header, strlen(header));
+    XDrawString(panel->dpy, panel->win, panel->gc, header_x, y - ascent - 20, header, strlen(header));
+    XSetForeground(panel->dpy, panel->gc, 0x000000);
+
+    for (int i = 0; i < num_config_items; ++i) {
+        ConfigItem *item = &config_items[i];
+        char valbuf[32];
+        if (item->is_double) snprintf(valbuf, sizeof(valbuf), item->fmt, *(double*)item->value);
+        else snprintf(valbuf, sizeof(valbuf), item->fmt, *(int*)item->value);
+
+        int row_y = y - ascent;
+
+        if (i == panel->selected_row) {
+            XSetForeground(panel->dpy, panel->gc, 0xCCCCCC);
+            XFillRectangle(panel->dpy, panel->win, panel->gc, 0, row_y - 2, win_w, line_h + 4);
+            XSetForeground(panel->dpy, panel->gc, 0x000000);
+        }
+
+        XDrawString(panel->dpy, panel->win, panel->gc, left_margin, y, item->name, strlen(item->name));
+        XDrawString(panel->dpy, panel->win, panel->gc, value_col_x, y, valbuf, strlen(valbuf));
+
+        XSetForeground(panel->dpy, panel->gc, 0x555555);
+        int shortcut_w = XTextWidth(panel->font, item->shortcut, strlen(item->shortcut));
+        XDrawString(panel->dpy, panel->win, panel->gc,
+                    shortcut_col_x + panel->max_shortcut_w - shortcut_w, y, item->shortcut, strlen(item->shortcut));
+        XSetForeground(panel->dpy, panel->gc, 0x000000);
+        y += line_h;
+    }
+
+    XFlush(panel->dpy);
+
+    if (panel->selected_row == 7) {
+        show_margin_overlay();
+    } else {
+        hide_margin_overlay();
+    }
+
+    if (panel->selected_row == 4) {
+        show_jump_overlay(1);
+    } else if (panel->selected_row == 5) {
+        show_jump_overlay(2);
+    } else if (panel->selected_row == 6) {
+        show_jump_overlay(3);
+    } else {
+        show_jump_overlay(0);
+    }
+}
+
+static void* config_panel_thread(void *arg) {
+    ConfigPanel *panel = (ConfigPanel *)arg;
+    panel->dpy = XOpenDisplay(NULL);
+    if (!panel->dpy) return NULL;
+
+    Rect mon = monitor_under_pointer(panel->dpy).r;
+
+    panel->font = XLoadQueryFont(panel->dpy, "-misc-fixed-bold-r-normal--12-*-*-*-*-*-iso10646-1");
+    if (!panel->font) panel->font = XLoadQueryFont(panel->dpy, "-misc-fixed-medium-r-normal--13-*-*-*-*-*-iso10646-1");
+    if (!panel->font) panel->font = XLoadQueryFont(panel->dpy, "-misc-fixed-medium-r-*-*-18-*-*-*-*-*-iso10646-1");
+    if (!panel->font) panel->font = XLoadQueryFont(panel->dpy, "-misc-fixed-bold-r-normal--14-*-*-*-*-*-iso10646-1");
+    if (!panel->font) panel->font = XLoadQueryFont(panel->dpy, "9x15");
+    if (!panel->font) panel->font = XLoadQueryFont(panel->dpy, "fixed");
+
+    int ascent = panel->font ? panel->font->ascent : 12;
+    int descent = panel->font ? panel->font->descent : 4;
+    int line_h = ascent + descent + 8;
+
+    int left_margin = 10;
+    int top_margin = 10;
+    int padding = 10;
+    int shortcut_padding = 60;
+
+    int max_name_w = 0;
+    int max_value_w = 0;
+    int max_shortcut_w = 0;
+    for (int i = 0; i < num_config_items; i++) {
+        ConfigItem *item = &config_items[i];
+        int nw = XTextWidth(panel->font, item->name, strlen(item->name));
+        if (nw > max_name_w) max_name_w = nw;
+
+        char valbuf[32];
+        if (item->is_double) snprintf(valbuf, sizeof(valbuf), item->fmt, *(double*)item->value);
+        else snprintf(valbuf, sizeof(valbuf), item->fmt, *(int*)item->value);
+        int vw = XTextWidth(panel->font, valbuf, strlen(valbuf));
+        if (vw > max_value_w) max_value_w = vw;
+
+        int sw = XTextWidth(panel->font, item->shortcut, strlen(item->shortcut));
+        if (sw > max_shortcut_w) max_shortcut_w = sw;
+    }
+
+    int col1_w = max_name_w + padding;
+    panel->col1_w = col1_w;
+    int col2_x = left_margin + col1_w + max_value_w + shortcut_padding;
+    int total_content_w = col1_w + max_value_w + shortcut_padding + max_shortcut_w;
+    panel->shortcut_col_x = col2_x;
+    panel->max_shortcut_w = max_shortcut_w;
+
+    XChar2b up_arrow = {0x21, 0x91};
+    XChar2b down_arrow = {0x21, 0x93};
+    XChar2b left_arrow = {0x21, 0x90};
+    XChar2b right_arrow = {0x21, 0x92};
+
+    char *part1 = "Esc = Exit | (8";
+    char *part2 = " 2";
+    char *part3 = ") Select | (";
+    char *part4 = "4 6";
+    char *part5 = ") Adjust";
+
+    int title_w = 0;
+    title_w += XTextWidth(panel->font, part1, strlen(part1));
+    title_w += XTextWidth16(panel->font, &up_arrow, 1);
+    title_w += XTextWidth(panel->font, part2, strlen(part2));
+    title_w += XTextWidth16(panel->font, &down_arrow, 1);
+    title_w += XTextWidth(panel->font, part3, strlen(part3));
+    title_w += XTextWidth16(panel->font, &left_arrow, 1);
+    title_w += XTextWidth(panel->font, part4, strlen(part4));
+    title_w += XTextWidth16(panel->font, &right_arrow, 1);
+    title_w += XTextWidth(panel->font, part5, strlen(part5));
+
+    int inner_w = title_w > total_content_w ? title_w : total_content_w;
+    int win_w = left_margin * 2 + inner_w;
+    int win_h = top_margin * 2 + num_config_items * line_h + 20;
+    int win_x = mon.x + (mon.w - win_w) / 2;
+    int win_y = mon.y + (mon.h - win_h) / 2;
+
+    Window root = DefaultRootWindow(panel->dpy);
+
+    XSetWindowAttributes attrs = {0};
+    attrs.override_redirect = True;
+    attrs.background_pixel = 0xFFFFFF;
+    attrs.border_pixel = 0x000000;
+    attrs.event_mask = KeyPressMask;
+
+    panel->win = XCreateWindow(panel->dpy, root, win_x, win_y, win_w, win_h, 2,
+                               CopyFromParent, InputOutput, CopyFromParent,
+                               CWOverrideRedirect | CWBackPixel | CWBorderPixel | CWEventMask,
+                               &attrs);
+
+    panel->gc = XCreateGC(panel->dpy, panel->win, 0, NULL);
+    XSetForeground(panel->dpy, panel->gc, 0x000000);
+    if (panel->font) XSetFont(panel->dpy, panel->gc, panel->font->fid);
+
+    XMapWindow(panel->dpy, panel->win);
+    overlay_track(panel->win, win_x, win_y, win_w + 4, win_h + 4);
+    XStoreName(panel->dpy, panel->win, "Mouse Daemon Config");
+
+    draw_config_panel(panel);
+
+    while (panel->active) {
+        usleep(10000);
+    }
+
+    if (panel->win != None) {
+        overlay_untrack(panel->win);
+        XDestroyWindow(panel->dpy, panel->win);
+    }
+    if (panel->gc) XFreeGC(panel->dpy, panel->gc);
+    if (panel->font) XFreeFont(panel->dpy, panel->font);
+    if (panel->dpy) XCloseDisplay(panel->dpy);
+
+    panel->win = None;
+    panel->dpy = NULL;
+    panel->gc = None;
+    panel->font = NULL;
+
+    return NULL;
+}
+
+static void show_config_panel(ConfigPanel *panel) {
+    pthread_mutex_lock(&panel->mutex);
+    if (panel->active) {
+        pthread_mutex_unlock(&panel->mutex);
+        return;
+    }
+    panel->active = true;
+
+    pthread_mutex_lock(&state.state_mutex);
+    memset(state.numpad_keys_pressed, 0, sizeof(state.numpad_keys_pressed));
+    memset(state.scroll_keys_pressed, 0, sizeof(state.scroll_keys_pressed));
+    state.autoscroll_up_active = state.autoscroll_down_active = false;
+    pthread_mutex_unlock(&state.state_mutex);
+
+    if (state.left_button_held) {
+        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
+        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+        state.left_button_held = false;
+		state.drag_locked = false;
+		hide_drag_popup();
+    }
+
+    panel->last_activity_time = get_time();
+
+    /* Headless: the panel is pure state, closed only by Esc or another key */
+    if (headless) {
+        pthread_mutex_unlock(&panel->mutex);
+        return;
+    }
+
+    Display *temp_dpy = XOpenDisplay(NULL);
+    if (temp_dpy) {
+        Window root, child;
+        int win_x, win_y;
+        unsigned int mask;
+        XQueryPointer(temp_dpy, DefaultRootWindow(temp_dpy), &root, &child, &panel->initial_mouse_x, &panel->initial_mouse_y, &win_x, &win_y, &mask);
+        XCloseDisplay(temp_dpy);
+    }
+
+    helper_thread_create(&panel->timer_thread, true, panel_timer_func, panel);
+    helper_thread_create(&panel->mouse_monitor_thread, true, mouse_monitor_func, panel);
+
+    pthread_t th;
+    helper_thread_create(&th, true, config_panel_thread, panel);
+    pthread_mutex_unlock(&panel->mutex);
+}
+
+static void hide_config_panel(ConfigPanel *panel) {
+    pthread_mutex_lock(&panel->mutex);
+    panel->active = false;
+    state.autoscroll_up_active = state.autoscroll_down_active = false;
+
+    save_config();
+
+    if (state.left_button_held) {
+        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
+        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+        state.left_button_held = false;
+		state.drag_locked = false;
+		hide_drag_popup();
+    }
+
+    panel->selected_row = 0;
+
+    pthread_mutex_unlock(&panel->mutex);
+    hide_margin_overlay();
+    show_jump_overlay(0);
+}
+
+/* ------------------------------------------------------------------ */
+/* Overlay Functions (Margin and Jump)                                */
+/* ------------------------------------------------------------------ */
+static bool margin_overlay_visible = false;
+static Window margin_window = None;
+static pthread_t margin_thread = 0;
+static double last_margin_adjust = 0.0;
+static bool margin_need_redraw = false;
+static pthread_mutex_t margin_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void show_margin_overlay(void) {
+    if (headless) return;
+
+    pthread_mutex_lock(&margin_mutex);
+    if (margin_thread && !margin_overlay_visible) {
+        pthread_join(margin_thread, NULL);
+        margin_thread = 0;
+    }
+    if (margin_overlay_visible) {
+        last_margin_adjust = get_time();
+        margin_need_redraw = true;
+        pthread_mutex_unlock(&margin_mutex);
+        return;
+    }
+    margin_overlay_visible = true;
+    last_margin_adjust = get_time();
+    margin_need_redraw = true;
+    helper_thread_create(&margin_thread, false, margin_overlay_thread, (void*)&state);
+    pthread_mutex_unlock(&margin_mutex);
+}
+
+static void hide_margin_overlay(void) {
+    pthread_mutex_lock(&margin_mutex);
+    if (!margin_overlay_visible) {
+        pthread_mutex_unlock(&margin_mutex);
+        return;
+    }
+    margin_overlay_visible = false;
+    pthread_mutex_unlock(&margin_mutex);
+    if (margin_thread) {
+        pthread_join(margin_thread, NULL);
+        margin_thread = 0;
+    }
+}
+
+static void* margin_overlay_thread(void *arg) {
+    AppState *app_state = (AppState *)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) return NULL;
+
+    int scr = DefaultScreen(dpy);
+    Window root = DefaultRootWindow(dpy);
+    /* Margins and jump steps are shown on the monitor under the pointer */
+    Rect mon = monitor_under_pointer(dpy).r;
+    int scr_w = mon.w;
+    int scr_h = mon.h;
+
+    XVisualInfo vinfo;
+    if (!XMatchVisualInfo(dpy, scr, 32, TrueColor, &vinfo)) {
+        XCloseDisplay(dpy);
+        return NULL;
+    }
+
+    XSetWindowAttributes attrs = {0};
+    attrs.override_redirect = True;
+    attrs.background_pixel = 0x00000000;
+    attrs.border_pixel = 0;
+    attrs.colormap = XCreateColormap(dpy, root, vinfo.visual, AllocNone);
+
+    Window win = XCreateWindow(dpy, root, mon.x, mon.y, scr_w, scr_h, 0,
+                               32, InputOutput, vinfo.visual,
+                               CWOverrideRedirect | CWBackPixel | CWBorderPixel | CWColormap,
+                               &attrs);
+
+    Atom above = XInternAtom(dpy, "_NET_WM_STATE_ABOVE", False);
+    XChangeProperty(dpy, win, XInternAtom(dpy, "_NET_WM_STATE", False),
+                    XA_ATOM, 32, PropModeAppend, (unsigned char *)&above, 1);
+
+    XMapWindow(dpy, win);
+    overlay_track(win, mon.x, mon.y, scr_w, scr_h);
+
+    GC gc = XCreateGC(dpy, win, 0, NULL);
+    unsigned long pixel = 0x33000000UL;
+    XSetForeground(dpy, gc, pixel);
+    XSetLineAttributes(dpy, gc, 2, LineSolid, CapButt, JoinMiter);
+
+    margin_window = win;
+
+    while (margin_overlay_visible) {
+        pthread_mutex_lock(&margin_mutex);
+        double now = get_time();
+        if (now - last_margin_adjust > MARGIN_OVERLAY_TIMEOUT) {
+            margin_overlay_visible = false;
+            pthread_mutex_unlock(&margin_mutex);
+            break;
+        }
+
+        if (margin_need_redraw) {
+            margin_need_redraw = false;
+
+            XLockDisplay(dpy);
+            XClearWindow(dpy, win);
+
+            int margin = app_state->cfg.jump_margin;
+            if (margin < 0) margin = 0;
+            int x = margin;
+            int y = margin;
+            int w = scr_w - 2 * margin;
+            int h = scr_h - 2 * margin;
+            if (w > 0 && h > 0) {
+                XDrawRectangle(dpy, win, gc, x, y, w, h);
+            }
+
+            XFlush(dpy);
+            XUnlockDisplay(dpy);
+        }
+        pthread_mutex_unlock(&margin_mutex);
+
+        usleep(20000);
+    }
+
+    XLockDisplay(dpy);
+    overlay_untrack(win);
+    XUnmapWindow(dpy, win);
+    XDestroyWindow(dpy, win);
+    XFreeGC(dpy, gc);
+    XUnlockDisplay(dpy);
+    XCloseDisplay(dpy);
+    margin_window = None;
+    return NULL;
+}
+
+static int adjusting_jump_type = 0;
+static bool jump_overlay_visible = false;
+static Window jump_window = None;
+static pthread_t jump_thread = 0;
+static double last_jump_adjust = 0.0;
+static bool jump_need_redraw = false;
+static pthread_mutex_t jump_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void show_jump_overlay(int type) {
+    pthread_mutex_lock(&jump_mutex);
+    if (jump_thread && !jump_overlay_visible) {
         pthread_join(jump_thread, NULL);
         jump_thread = 0;
     }
-    if (jump_overlay_visible && adjusting_jump_type != type) {
-        jump_overlay_visible = false;
-        pthread_mutex_unlock(&jump_mutex);
-        if (jump_thread) {
-            pthread_join(jump_thread, NULL);
-            jump_thread = 0;
+    if (jump_overlay_visible && adjusting_jump_type != type) {
+        jump_overlay_visible = false;
+        pthread_mutex_unlock(&jump_mutex);
+        if (jump_thread) {
+            pthread_join(jump_thread, NULL);
+            jump_thread = 0;
+        }
+        pthread_mutex_lock(&jump_mutex);
+    }
+    adjusting_jump_type = type;
+    if (type == 0) {
+        jump_overlay_visible = false;
+        pthread_mutex_unlock(&jump_mutex);
+        if (jump_thread) {
+            pthread_join(jump_thread, NULL);
+            jump_thread = 0;
+        }
+        return;
+    }
+    if (headless) {
+        pthread_mutex_unlock(&jump_mutex);
+        return;
+    }
+    jump_overlay_visible = true;
+    last_jump_adjust = get_time();
+    jump_need_redraw = true;
+    pthread_mutex_unlock(&jump_mutex);
+    if (!jump_thread) {
+        helper_thread_create(&jump_thread, false, jump_overlay_thread, (void*)&state);
+    }
+}
+
+static void hide_jump_overlay(void) {
+    show_jump_overlay(0);
+}
+
+static void* jump_overlay_thread(void *arg) {
+    AppState *app_state = (AppState *)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) return NULL;
+
+    int scr = DefaultScreen(dpy);
+    Window root = DefaultRootWindow(dpy);
+    Rect mon = monitor_under_pointer(dpy).r;
+    int scr_w = mon.w;
+    int scr_h = mon.h;
+
+    XVisualInfo vinfo;
+    if (!XMatchVisualInfo(dpy, scr, 32, TrueColor, &vinfo)) {
+        XCloseDisplay(dpy);
+        return NULL;
+    }
+
+    XSetWindowAttributes attrs = {0};
+    attrs.override_redirect = True;
+    attrs.background_pixel = 0x00000000;
+    attrs.border_pixel = 0;
+    attrs.colormap = XCreateColormap(dpy, root, vinfo.visual, AllocNone);
+
+    Window win = XCreateWindow(dpy, root, mon.x, mon.y, scr_w, scr_h, 0,
+                               32, InputOutput, vinfo.visual,
+                               CWOverrideRedirect | CWBackPixel | CWBorderPixel | CWColormap,
+                               &attrs);
+
+    Atom above = XInternAtom(dpy, "_NET_WM_STATE_ABOVE", False);
+    XChangeProperty(dpy, win, XInternAtom(dpy, "_NET_WM_STATE", False),
+                    XA_ATOM, 32, PropModeAppend, (unsigned char *)&above, 1);
+
+    XMapWindow(dpy, win);
+    overlay_track(win, mon.x, mon.y, scr_w, scr_h);
+
+    GC gc = XCreateGC(dpy, win, 0, NULL);
+    unsigned long pixel = 0x33000000UL;
+    XSetForeground(dpy, gc, pixel);
+
+    jump_window = win;
+
+    while (jump_overlay_visible) {
+        pthread_mutex_lock(&jump_mutex);
+        double now = get_time();
+        if (now - last_jump_adjust > JUMP_OVERLAY_TIMEOUT) {
+            jump_overlay_visible = false;
+            pthread_mutex_unlock(&jump_mutex);
+            break;
+        }
+
+        int current_type = adjusting_jump_type;
+        if (jump_need_redraw && current_type > 0) {
+            jump_need_redraw = false;
+
+            XLockDisplay(dpy);
+            XClearWindow(dpy, win);
+            int r = 3;
+
+            if (current_type == 1) {
+                if (app_state->cfg.jump_horizontal > 0) {
+                    int y = scr_h / 2;
+                    for (int x = 0; x < scr_w; x += app_state->cfg.jump_horizontal) {
+                        XFillRectangle(dpy, win, gc, x - r, y - r, 2 * r + 1, 2 * r + 1);
+                    }
+                }
+            } else if (current_type == 2) {
+                if (app_state->cfg.jump_vertical > 0) {
+                    int x = scr_w / 2;
+                    for (int y = 0; y < scr_h; y += app_state->cfg.jump_vertical) {
+                        XFillRectangle(dpy, win, gc, x - r, y - r, 2 * r + 1, 2 * r + 1);
+                    }
+                }
+            } else if (current_type == 3) {
+                if (app_state->cfg.jump_diagonal > 0) {
+                    double len = hypot((double)scr_w, (double)scr_h);
+                    double t_step = (double)app_state->cfg.jump_diagonal / len;
+
+                    for (double t = 0; t < 1.0; t += t_step) {
+                        int px = (int)(t * scr_w);
+                        int py = (int)(t * scr_h);
+                        XFillRectangle(dpy, win, gc, px - r, py - r, 2 * r + 1, 2 * r + 1);
+                    }
+
+                    for (double t = 0; t < 1.0; t += t_step) {
+                        int px = (int)(scr_w * (1.0 - t));
+                        int py = (int)(t * scr_h);
+                        XFillRectangle(dpy, win, gc, px - r, py - r, 2 * r + 1, 2 * r + 1);
+                    }
+                }
+            }
+            XFlush(dpy);
+            XUnlockDisplay(dpy);
+        }
+        pthread_mutex_unlock(&jump_mutex);
+
+        usleep(20000);
+    }
+
+    XLockDisplay(dpy);
+    overlay_untrack(win);
+    XUnmapWindow(dpy, win);
+    XDestroyWindow(dpy, win);
+    XFreeGC(dpy, gc);
+    XUnlockDisplay(dpy);
+    XCloseDisplay(dpy);
+    jump_window = None;
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Grid Targeting Mode                                                */
+/* ------------------------------------------------------------------ */
+/*
+ * Ctrl+KP0 lays a 3x3 grid over the screen; each numpad digit narrows the
+ * region to that cell and centres the pointer in it, so any pixel is a
+ * handful of presses away. One overlay window lives for the whole session
+ * and is only redrawn per step.
+ */
+#define GRID_MAX_DEPTH 16
+#define GRID_MIN_CELL 3           /* stop once a cell is this small */
+
+static bool grid_active = false;
+static Rect grid_stack[GRID_MAX_DEPTH + 1];
+static int grid_depth = 0;
+static int grid_release_code = -1;   /* swallow the release of the key that ended the grid */
+static pthread_t grid_thread = 0;
+static bool grid_need_redraw = false;
+static pthread_mutex_t grid_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t grid_cond = PTHREAD_COND_INITIALIZER;
+
+static void* grid_overlay_thread(void *arg) {
+    (void)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) return NULL;
+
+    int scr = DefaultScreen(dpy);
+    Window root = DefaultRootWindow(dpy);
+    int scr_w = DisplayWidth(dpy, scr);
+    int scr_h = DisplayHeight(dpy, scr);
+
+    XVisualInfo vinfo;
+    if (!XMatchVisualInfo(dpy, scr, 32, TrueColor, &vinfo)) {
+        XCloseDisplay(dpy);
+        return NULL;
+    }
+
+    XSetWindowAttributes attrs = {0};
+    attrs.override_redirect = True;
+    attrs.background_pixel = 0x00000000;
+    attrs.border_pixel = 0;
+    attrs.colormap = XCreateColormap(dpy, root, vinfo.visual, AllocNone);
+
+    Window win = XCreateWindow(dpy, root, 0, 0, scr_w, scr_h, 0,
+                               32, InputOutput, vinfo.visual,
+                               CWOverrideRedirect | CWBackPixel | CWBorderPixel | CWColormap,
+                               &attrs);
+    /* Empty input region: the full-screen overlay must not eat clicks */
+    XShapeCombineRectangles(dpy, win, ShapeInput, 0, 0, NULL, 0, ShapeSet, Unsorted);
+    XMapWindow(dpy, win);
+    overlay_track(win, 0, 0, scr_w, scr_h);
+
+    /* Dark line with a light shadow so the grid reads on any background */
+    GC dark = XCreateGC(dpy, win, 0, NULL);
+    XSetForeground(dpy, dark, 0x99000000UL);
+    GC light = XCreateGC(dpy, win, 0, NULL);
+    XSetForeground(dpy, light, 0x80808080UL);
+
+    pthread_mutex_lock(&grid_mutex);
+    while (grid_active) {
+        if (!grid_need_redraw) {
+            pthread_cond_wait(&grid_cond, &grid_mutex);
+            continue;
+        }
+        grid_need_redraw = false;
+        Rect r = grid_stack[grid_depth];
+        pthread_mutex_unlock(&grid_mutex);
+
+        XSegment seg[8];
+        for (int i = 0; i < 4; i++) {
+            int x = r.x + r.w * i / 3;
+            int y = r.y + r.h * i / 3;
+            seg[i] = (XSegment){ x, r.y, x, r.y + r.h };
+            seg[4 + i] = (XSegment){ r.x, y, r.x + r.w, y };
+        }
+        XClearWindow(dpy, win);
+        XDrawSegments(dpy, win, dark, seg, 8);
+        for (int i = 0; i < 8; i++) {
+            seg[i].x1++; seg[i].x2++;
+            seg[i].y1++; seg[i].y2++;
+        }
+        XDrawSegments(dpy, win, light, seg, 8);
+        XFlush(dpy);
+
+        pthread_mutex_lock(&grid_mutex);
+    }
+    pthread_mutex_unlock(&grid_mutex);
+
+    overlay_untrack(win);
+    XUnmapWindow(dpy, win);
+    XDestroyWindow(dpy, win);
+    XFreeGC(dpy, dark);
+    XFreeGC(dpy, light);
+    XCloseDisplay(dpy);
+    return NULL;
+}
+
+static void grid_enter(void) {
+    Display *dpy = input_display();
+    if (!dpy && !headless) return;
+
+    Rect mon = monitor_under_pointer(dpy).r;
+
+    pthread_mutex_lock(&grid_mutex);
+    grid_active = true;
+    grid_depth = 0;
+    grid_stack[0] = mon;
+    grid_need_redraw = true;
+    pthread_mutex_unlock(&grid_mutex);
+    history_note_pointer();
+
+    if (!headless) helper_thread_create(&grid_thread, false, grid_overlay_thread, NULL);
+}
+
+static void grid_exit(void) {
+    pthread_mutex_lock(&grid_mutex);
+    if (!grid_active) {
+        pthread_mutex_unlock(&grid_mutex);
+        return;
+    }
+    grid_active = false;
+    pthread_cond_signal(&grid_cond);
+    pthread_mutex_unlock(&grid_mutex);
+
+    if (grid_thread) {
+        pthread_join(grid_thread, NULL);
+        grid_thread = 0;
+    }
+}
+
+/* Cell moves are jumps: they glide and land on the history ring */
+static void grid_show(void) {
+    Rect r = grid_stack[grid_depth];
+    jump_to(input_display(), r.x + r.w / 2, r.y + r.h / 2);
+
+    pthread_mutex_lock(&grid_mutex);
+    grid_need_redraw = true;
+    pthread_cond_signal(&grid_cond);
+    pthread_mutex_unlock(&grid_mutex);
+}
+
+static void grid_select_cell(int col, int row) {
+    Rect r = grid_stack[grid_depth];
+    int x0 = r.x + r.w * col / 3, x1 = r.x + r.w * (col + 1) / 3;
+    int y0 = r.y + r.h * row / 3, y1 = r.y + r.h * (row + 1) / 3;
+    Rect cell = { x0, y0, x1 - x0, y1 - y0 };
+
+    pthread_mutex_lock(&grid_mutex);
+    if (grid_depth < GRID_MAX_DEPTH) grid_depth++;
+    grid_stack[grid_depth] = cell;
+    pthread_mutex_unlock(&grid_mutex);
+    grid_show();
+
+    if (cell.w < GRID_MIN_CELL * 3 && cell.h < GRID_MIN_CELL * 3) grid_exit();
+}
+
+static void grid_undo(void) {
+    pthread_mutex_lock(&grid_mutex);
+    if (grid_depth > 0) grid_depth--;
+    pthread_mutex_unlock(&grid_mutex);
+    grid_show();
+}
+
+/* ------------------------------------------------------------------ */
+/* Labelled Hint Mode                                                 */
+/* ------------------------------------------------------------------ */
+/*
+ * Ctrl+KPDOT covers the screen with two-letter labels; typing a label warps
+ * the pointer to the centre of its cell, so every target costs three keys.
+ * The labels are rendered once per screen geometry into a pixmap that backs
+ * a single window shaped to the label boxes; typing the first letter only
+ * reshapes the window down to that letter's 26 boxes.
+ */
+#define HINT_KEYS 26
+#define HINT_MAX (HINT_KEYS * HINT_KEYS)
+
+static const char hint_alphabet[HINT_KEYS + 1] = "asdfghjklqwertyuiopzxcvbnm";
+static const uint16_t hint_keycodes[HINT_KEYS] = {
+    KEY_A, KEY_S, KEY_D, KEY_F, KEY_G, KEY_H, KEY_J, KEY_K, KEY_L,
+    KEY_Q, KEY_W, KEY_E, KEY_R, KEY_T, KEY_Y, KEY_U, KEY_I, KEY_O, KEY_P,
+    KEY_Z, KEY_X, KEY_C, KEY_V, KEY_B, KEY_N, KEY_M,
+};
+
+typedef struct {
+    int x, y;               /* origin of the monitor the labels cover */
+    int scr_w, scr_h;
+    int cols, rows;
+    int count;
+} HintLayout;
+
+static bool hint_active = false;
+static int hint_first = -1;          /* first typed letter, -1 = none yet */
+static int hint_release_code = -1;
+static HintLayout hint_layout;
+static pthread_t hint_thread = 0;
+static bool hint_need_update = false;
+static bool hint_quit = false;
+static pthread_mutex_t hint_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hint_cond = PTHREAD_COND_INITIALIZER;
+
+/* Near-square cells: as many columns as the aspect ratio allows */
+static void hint_compute_layout(HintLayout *lay, int scr_w, int scr_h) {
+    int cols = (int)lround(sqrt((double)HINT_MAX * scr_w / (scr_h > 0 ? scr_h : 1)));
+    if (cols < 1) cols = 1;
+    if (cols > HINT_MAX) cols = HINT_MAX;
+    lay->scr_w = scr_w;
+    lay->scr_h = scr_h;
+    lay->cols = cols;
+    lay->rows = HINT_MAX / cols;
+    lay->count = lay->cols * lay->rows;
+}
+
+static void hint_cell_center(const HintLayout *lay, int idx, int *x, int *y) {
+    int col = idx % lay->cols, row = idx / lay->cols;
+    int x0 = lay->scr_w * col / lay->cols, x1 = lay->scr_w * (col + 1) / lay->cols;
+    int y0 = lay->scr_h * row / lay->rows, y1 = lay->scr_h * (row + 1) / lay->rows;
+    *x = x0 + (x1 - x0) / 2;
+    *y = y0 + (y1 - y0) / 2;
+}
+
+static void hint_render(Display *dpy, Pixmap pix, GC gc, XFontStruct *font,
+                        const HintLayout *lay, XRectangle *boxes) {
+    int tw = XTextWidth(font, "mm", 2);
+    int bw = tw + 6;
+    int bh = font->ascent + font->descent + 4;
+
+    for (int i = 0; i < lay->count; i++) {
+        char label[2] = { hint_alphabet[i / HINT_KEYS], hint_alphabet[i % HINT_KEYS] };
+        int cx, cy;
+        hint_cell_center(lay, i, &cx, &cy);
+        XRectangle *b = &boxes[i];
+        b->x = cx - bw / 2;
+        b->y = cy - bh / 2;
+        b->width = bw;
+        b->height = bh;
+
+        XSetForeground(dpy, gc, 0xFFD700);
+        XFillRectangle(dpy, pix, gc, b->x, b->y, bw, bh);
+        XSetForeground(dpy, gc, 0x404040);
+        XDrawRectangle(dpy, pix, gc, b->x, b->y, bw - 1, bh - 1);
+        XSetForeground(dpy, gc, 0x000000);
+        int lw = XTextWidth(font, label, 2);
+        XDrawString(dpy, pix, gc, cx - lw / 2, b->y + 2 + font->ascent, label, 2);
+    }
+}
+
+static void* hint_overlay_thread(void *arg) {
+    (void)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) return NULL;
+
+    XFontStruct *font = XLoadQueryFont(dpy, "fixed");
+    if (!font) font = XLoadQueryFont(dpy, "9x15");
+    if (!font) {
+        XCloseDisplay(dpy);
+        return NULL;
+    }
+
+    int scr = DefaultScreen(dpy);
+    Window root = RootWindow(dpy, scr);
+    XSetWindowAttributes attrs = {0};
+    attrs.override_redirect = True;
+    Window win = XCreateWindow(dpy, root, 0, 0, 1, 1, 0,
+                               CopyFromParent, InputOutput, CopyFromParent,
+                               CWOverrideRedirect, &attrs);
+    /* Empty input region: clicks land on whatever is under a label */
+    XShapeCombineRectangles(dpy, win, ShapeInput, 0, 0, NULL, 0, ShapeSet, Unsorted);
+
+    GC gc = XCreateGC(dpy, win, 0, NULL);
+    XSetFont(dpy, gc, font->fid);
+
+    static XRectangle boxes[HINT_MAX];
+    HintLayout cached = {0};
+    Pixmap pix = None;
+    bool mapped = false;
+
+    pthread_mutex_lock(&hint_mutex);
+    while (!hint_quit) {
+        if (!hint_need_update) {
+            pthread_cond_wait(&hint_cond, &hint_mutex);
+            continue;
+        }
+        hint_need_update = false;
+        bool active = hint_active;
+        int first = hint_first;
+        HintLayout lay = hint_layout;
+        pthread_mutex_unlock(&hint_mutex);
+
+        if (!active) {
+            if (mapped) {
+                overlay_untrack(win);
+                XUnmapWindow(dpy, win);
+            }
+            mapped = false;
+        } else {
+            if (lay.scr_w != cached.scr_w || lay.scr_h != cached.scr_h) {
+                if (pix != None) XFreePixmap(dpy, pix);
+                pix = XCreatePixmap(dpy, win, lay.scr_w, lay.scr_h, DefaultDepth(dpy, scr));
+                hint_render(dpy, pix, gc, font, &lay, boxes);
+                XResizeWindow(dpy, win, lay.scr_w, lay.scr_h);
+                XSetWindowBackgroundPixmap(dpy, win, pix);
+            }
+            if (lay.x != cached.x || lay.y != cached.y) XMoveWindow(dpy, win, lay.x, lay.y);
+            cached = lay;
+
+            int start = 0, n = lay.count;
+            if (first >= 0) {
+                start = first * HINT_KEYS;
+                n = lay.count - start < HINT_KEYS ? lay.count - start : HINT_KEYS;
+            }
+            XShapeCombineRectangles(dpy, win, ShapeBounding, 0, 0, boxes + start, n, ShapeSet, Unsorted);
+            if (!mapped) {
+                XMapRaised(dpy, win);
+                overlay_track(win, lay.x, lay.y, lay.scr_w, lay.scr_h);
+            }
+            mapped = true;
+        }
+        XFlush(dpy);
+
+        pthread_mutex_lock(&hint_mutex);
+    }
+    pthread_mutex_unlock(&hint_mutex);
+
+    if (pix != None) XFreePixmap(dpy, pix);
+    XDestroyWindow(dpy, win);
+    XFreeGC(dpy, gc);
+    XFreeFont(dpy, font);
+    XCloseDisplay(dpy);
+    return NULL;
+}
+
+static int hint_letter(uint16_t code) {
+    for (int i = 0; i < HINT_KEYS; i++) {
+        if (hint_keycodes[i] == code) return i;
+    }
+    return -1;
+}
+
+static void hint_update(void) {
+    hint_need_update = true;
+    pthread_cond_signal(&hint_cond);
+}
+
+static void hint_enter(void) {
+    Display *dpy = input_display();
+    if (!dpy && !headless) return;
+
+    Rect mon = monitor_under_pointer(dpy).r;
+
+    pthread_mutex_lock(&hint_mutex);
+    if (mon.w != hint_layout.scr_w || mon.h != hint_layout.scr_h)
+        hint_compute_layout(&hint_layout, mon.w, mon.h);
+    hint_layout.x = mon.x;
+    hint_layout.y = mon.y;
+    hint_active = true;
+    hint_first = -1;
+    hint_update();
+    pthread_mutex_unlock(&hint_mutex);
+
+    /* The overlay thread outlives a session so its pixmap stays cached */
+    if (!headless && !hint_thread) helper_thread_create(&hint_thread, false, hint_overlay_thread, NULL);
+}
+
+static void hint_exit(void) {
+    pthread_mutex_lock(&hint_mutex);
+    if (hint_active) {
+        hint_active = false;
+        hint_update();
+    }
+    pthread_mutex_unlock(&hint_mutex);
+}
+
+static void hint_shutdown(void) {
+    hint_exit();
+    pthread_mutex_lock(&hint_mutex);
+    hint_quit = true;
+    pthread_cond_signal(&hint_cond);
+    pthread_mutex_unlock(&hint_mutex);
+
+    if (hint_thread) {
+        pthread_join(hint_thread, NULL);
+        hint_thread = 0;
+    }
+}
+
+static void hint_set_first(int letter) {
+    pthread_mutex_lock(&hint_mutex);
+    hint_first = letter;
+    hint_update();
+    pthread_mutex_unlock(&hint_mutex);
+}
+
+static void hint_select(int idx) {
+    int x, y;
+    hint_cell_center(&hint_layout, idx, &x, &y);
+    x += hint_layout.x;
+    y += hint_layout.y;
+    hint_exit();
+    jump_to(input_display(), x, y);
+
+    static const int buttons[] = { 0, BTN_LEFT, BTN_MIDDLE, BTN_RIGHT };
+    int click = state.cfg.hint_click;
+    if (click > 0 && click <= 3) mouse_click(buttons[click]);
+}
+
+/* ------------------------------------------------------------------ */
+/* Edge Snapping                                                      */
+/* ------------------------------------------------------------------ */
+/*
+ * Holding KPDOT turns the direction keys into snaps: a 512x512 block
+ * around the pointer is fetched in one XShm request, reduced to an edge
+ * map, and the pointer jumps along the pressed direction to the next
+ * line-like edge. When a second edge closes a box within SNAP_BOX_MAX
+ * (a button, a field) the pointer lands in its middle instead. The
+ * capture and scan run on a snap thread with its own connection, so a
+ * slow server never stalls typing; repeats that pile up behind a running
+ * snap collapse into one.
+ */
+#define SNAP_REGION 512
+#define SNAP_EDGE_THRESHOLD 20   /* luma step that counts as an edge */
+#define SNAP_BAND 8              /* half-width of the line test across the ray */
+#define SNAP_MIN_STEP 4          /* skip the edge the pointer is already on */
+#define SNAP_BOX_MAX 160         /* widest box whose middle we aim for */
+
+typedef struct {
+    const char *name;
+    void (*luma_row)(const uint32_t *src, uint8_t *dst, int n);
+    void (*edge_row)(const uint8_t *cur, const uint8_t *next, uint8_t *dst, int n);
+} SnapKernel;
+
+static bool snap_held = false;
+static bool snap_used = false;       /* a snap happened while KPDOT was held */
+static uint8_t snap_luma[SNAP_REGION * SNAP_REGION];
+static uint8_t snap_edges[SNAP_REGION * SNAP_REGION];
+static XImage *snap_image = NULL;    /* snap thread only, like the buffers above */
+static XShmSegmentInfo snap_shm;
+static bool snap_use_shm = false;
+
+/* Luma approximated as (R + 2G + B) / 4 from 32bpp xRGB */
+static void snap_luma_row_scalar(const uint32_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        uint32_t p = src[i];
+        dst[i] = (uint8_t)((((p >> 16) & 0xff) + 2 * ((p >> 8) & 0xff) + (p & 0xff)) >> 2);
+    }
+}
+
+/* Strongest of the right and down differences; the last column and row get 0 across */
+static void snap_edge_span(const uint8_t *cur, const uint8_t *next, uint8_t *dst, int x, int n) {
+    for (; x < n; x++) {
+        int r = x + 1 < n ? cur[x + 1] : cur[x];
+        int gx = abs(r - cur[x]);
+        int gy = abs(next[x] - cur[x]);
+        dst[x] = (uint8_t)(gx > gy ? gx : gy);
+    }
+}
+
+static void snap_edge_row_scalar(const uint8_t *cur, const uint8_t *next, uint8_t *dst, int n) {
+    snap_edge_span(cur, next, dst, 0, n);
+}
+
+#ifdef __SSE2__
+static void snap_luma_row_sse2(const uint32_t *src, uint8_t *dst, int n) {
+    const __m128i mask = _mm_set1_epi32(0xff);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i l[4];
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i + 4 * k));
+            __m128i b = _mm_and_si128(v, mask);
+            __m128i g = _mm_and_si128(_mm_srli_epi32(v, 8), mask);
+            __m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), mask);
+            l[k] = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(r, b), _mm_slli_epi32(g, 1)), 2);
+        }
+        __m128i lo = _mm_packs_epi32(l[0], l[1]);
+        __m128i hi = _mm_packs_epi32(l[2], l[3]);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    snap_luma_row_scalar(src + i, dst + i, n - i);
+}
+
+static void snap_edge_row_sse2(const uint8_t *cur, const uint8_t *next, uint8_t *dst, int n) {
+    int x = 0;
+    for (; x + 17 <= n; x += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(cur + x));
+        __m128i r = _mm_loadu_si128((const __m128i *)(cur + x + 1));
+        __m128i d = _mm_loadu_si128((const __m128i *)(next + x));
+        __m128i gx = _mm_or_si128(_mm_subs_epu8(c, r), _mm_subs_epu8(r, c));
+        __m128i gy = _mm_or_si128(_mm_subs_epu8(c, d), _mm_subs_epu8(d, c));
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_max_epu8(gx, gy));
+    }
+    snap_edge_span(cur, next, dst, x, n);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void snap_luma_row_avx2(const uint32_t *src, uint8_t *dst, int n) {
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    /* packs/packus work per 128-bit lane; this restores pixel order */
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i l[4];
+        for (int k = 0; k < 4; k++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(src + i + 8 * k));
+            __m256i b = _mm256_and_si256(v, mask);
+            __m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 8), mask);
+            __m256i r = _mm256_and_si256(_mm256_srli_epi32(v, 16), mask);
+            l[k] = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(r, b), _mm256_slli_epi32(g, 1)), 2);
+        }
+        __m256i lo = _mm256_packs_epi32(l[0], l[1]);
+        __m256i hi = _mm256_packs_epi32(l[2], l[3]);
+        __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lo, hi), order);
+        _mm256_storeu_si256((__m256i *)(dst + i), bytes);
+    }
+    snap_luma_row_scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void snap_edge_row_avx2(const uint8_t *cur, const uint8_t *next, uint8_t *dst, int n) {
+    int x = 0;
+    for (; x + 33 <= n; x += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(cur + x));
+        __m256i r = _mm256_loadu_si256((const __m256i *)(cur + x + 1));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(next + x));
+        __m256i gx = _mm256_or_si256(_mm256_subs_epu8(c, r), _mm256_subs_epu8(r, c));
+        __m256i gy = _mm256_or_si256(_mm256_subs_epu8(c, d), _mm256_subs_epu8(d, c));
+        _mm256_storeu_si256((__m256i *)(dst + x), _mm256_max_epu8(gx, gy));
+    }
+    snap_edge_span(cur, next, dst, x, n);
+}
+#endif
+
+static const SnapKernel snap_kernels[] = {
+    {"scalar", snap_luma_row_scalar, snap_edge_row_scalar},
+#ifdef __SSE2__
+    {"sse2", snap_luma_row_sse2, snap_edge_row_sse2},
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx2", snap_luma_row_avx2, snap_edge_row_avx2},
+#endif
+};
+static const int num_snap_kernels = sizeof(snap_kernels) / sizeof(snap_kernels[0]);
+static const SnapKernel *snap_kernel = NULL;
+
+/* Whether the CPU runs the kernel variant called name */
+static bool kernel_supported(const char *name) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (strcmp(name, "avx2") == 0) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    (void)name;
+    return true;
+}
+
+/* Best kernel the CPU runs, picked once */
+static const SnapKernel* snap_best_kernel(void) {
+    if (!snap_kernel) {
+        for (int i = num_snap_kernels - 1; i >= 0 && !snap_kernel; i--) {
+            if (kernel_supported(snap_kernels[i].name)) snap_kernel = &snap_kernels[i];
+        }
+    }
+    return snap_kernel;
+}
+
+static void snap_edge_map(const SnapKernel *k, const uint32_t *px, int stride, int w, int h,
+                          uint8_t *luma, uint8_t *edges) {
+    k->luma_row(px, luma, w);
+    for (int y = 0; y < h; y++) {
+        if (y + 1 < h) k->luma_row(px + (y + 1) * stride, luma + (y + 1) * w, w);
+        const uint8_t *cur = luma + y * w;
+        k->edge_row(cur, y + 1 < h ? cur + w : cur, edges + y * w, w);
+    }
+}
+
+/* A majority of the band across the ray is edge: a line crosses it at step s */
+static bool snap_line_at(const uint8_t *edges, int w, int h, int ox, int oy, int dx, int dy, int s) {
+    int x = ox + dx * s, y = oy + dy * s;
+    int hits = 0;
+    for (int t = -SNAP_BAND; t <= SNAP_BAND; t++) {
+        int px = x - dy * t, py = y + dx * t;
+        if (px < 0 || py < 0 || px >= w || py >= h) continue;
+        if (edges[py * w + px] >= SNAP_EDGE_THRESHOLD) hits++;
+    }
+    return hits > SNAP_BAND;
+}
+
+static bool snap_in_bounds(int w, int h, int ox, int oy, int dx, int dy, int s) {
+    int x = ox + dx * s, y = oy + dy * s;
+    return x >= 0 && y >= 0 && x < w && y < h;
+}
+
+/* First step >= from where a line crosses the ray, or -1 */
+static int snap_find_edge(const uint8_t *edges, int w, int h, int ox, int oy, int dx, int dy, int from) {
+    for (int s = from; snap_in_bounds(w, h, ox, oy, dx, dy, s); s++) {
+        if (snap_line_at(edges, w, h, ox, oy, dx, dy, s)) return s;
+    }
+    return -1;
+}
+
+/*
+ * Distance along (dx, dy) from (ox, oy) to snap to: the middle of a box
+ * when one closes within SNAP_BOX_MAX, otherwise just past the first edge.
+ * Returns -1 when no edge lies in that direction.
+ */
+static int snap_target(const uint8_t *edges, int w, int h, int ox, int oy, int dx, int dy) {
+    int near = snap_find_edge(edges, w, h, ox, oy, dx, dy, SNAP_MIN_STEP);
+    if (near < 0) return -1;
+
+    int past = near;
+    while (snap_in_bounds(w, h, ox, oy, dx, dy, past + 1) &&
+           snap_line_at(edges, w, h, ox, oy, dx, dy, past + 1)) past++;
+
+    int far = snap_find_edge(edges, w, h, ox, oy, dx, dy, past + 1);
+    if (far > 0 && far - near <= SNAP_BOX_MAX) return (past + far) / 2;
+    if (snap_in_bounds(w, h, ox, oy, dx, dy, past + SNAP_MIN_STEP)) return past + SNAP_MIN_STEP;
+    return past;
+}
+
+/*
+ * XShmAttach always succeeds on the client side; the server's verdict is
+ * an error at the next XSync, which Xlib's default handler turns into an
+ * exit. The trap catches errors for one display on the calling thread
+ * and passes everything else on to whatever handler was there before.
+ */
+static pthread_once_t x_trap_once = PTHREAD_ONCE_INIT;
+static XErrorHandler x_trap_previous = NULL;
+static _Thread_local Display *x_trap_dpy = NULL;
+static _Thread_local int x_trap_code;
+
+static int x_error_trap(Display *dpy, XErrorEvent *err) {
+    if (dpy == x_trap_dpy) {
+        x_trap_code = err->error_code;
+        return 0;
+    }
+    return x_trap_previous ? x_trap_previous(dpy, err) : 0;
+}
+
+static void x_trap_install(void) {
+    x_trap_previous = XSetErrorHandler(x_error_trap);
+}
+
+/* Attach shm->shmid to the server; false if the server refused it */
+static bool x_shm_attach(Display *dpy, XShmSegmentInfo *shm) {
+    pthread_once(&x_trap_once, x_trap_install);
+
+    /* A rootless X server cannot attach a 0600 segment that belongs to root */
+    uid_t uid;
+    gid_t gid;
+    struct shmid_ds ds;
+    if (sudo_ids(&uid, &gid) && shmctl(shm->shmid, IPC_STAT, &ds) == 0) {
+        ds.shm_perm.uid = uid;
+        ds.shm_perm.gid = gid;
+        if (shmctl(shm->shmid, IPC_SET, &ds) < 0) perror("shmctl IPC_SET");
+    }
+
+    XSync(dpy, False);      /* earlier errors are not ours to swallow */
+    x_trap_dpy = dpy;
+    x_trap_code = Success;
+    bool ok = XShmAttach(dpy, shm);
+    XSync(dpy, False);
+    x_trap_dpy = NULL;
+    return ok && x_trap_code == Success;
+}
+
+/* One request for the whole block; shared memory when the server accepts it */
+static XImage* snap_capture(Display *dpy, int x, int y) {
+    static bool refused = false;    /* the server would not attach: XGetImage from now on */
+    int scr = DefaultScreen(dpy);
+    if (!snap_image && !refused && XShmQueryExtension(dpy)) {
+        snap_image = XShmCreateImage(dpy, DefaultVisual(dpy, scr), DefaultDepth(dpy, scr), ZPixmap,
+                                     NULL, &snap_shm, SNAP_REGION, SNAP_REGION);
+        if (snap_image) {
+            snap_shm.shmid = shmget(IPC_PRIVATE, snap_image->bytes_per_line * snap_image->height,
+                                    IPC_CREAT | 0600);
+            snap_shm.shmaddr = snap_image->data = snap_shm.shmid >= 0 ? shmat(snap_shm.shmid, NULL, 0) : (void *)-1;
+            snap_shm.readOnly = False;
+            if (snap_shm.shmaddr != (void *)-1 && x_shm_attach(dpy, &snap_shm)) {
+                shmctl(snap_shm.shmid, IPC_RMID, NULL);   /* freed once both sides detach */
+                snap_use_shm = true;
+            } else {
+                if (snap_shm.shmid >= 0) shmctl(snap_shm.shmid, IPC_RMID, NULL);
+                if (snap_shm.shmaddr != (void *)-1) shmdt(snap_shm.shmaddr);
+                snap_image->data = NULL;
+                XDestroyImage(snap_image);
+                snap_image = NULL;
+                refused = true;
+            }
+        }
+    }
+
+    Window root = RootWindow(dpy, scr);
+    if (snap_use_shm) {
+        return XShmGetImage(dpy, root, snap_image, x, y, AllPlanes) ? snap_image : NULL;
+    }
+    return XGetImage(dpy, root, x, y, SNAP_REGION, SNAP_REGION, AllPlanes, ZPixmap);
+}
+
+static pthread_t snap_thread = 0;
+static pthread_mutex_t snap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snap_cond = PTHREAD_COND_INITIALIZER;
+static bool snap_requested = false;
+static int snap_req_dx, snap_req_dy;
+
+static void snap_direction(Display *dpy, int dx, int dy) {
+    int scr_w, scr_h, px, py;
+    screen_size(dpy, &scr_w, &scr_h);
+    if (scr_w < SNAP_REGION || scr_h < SNAP_REGION || !query_pointer(dpy, &px, &py)) return;
+
+    int rx = px - SNAP_REGION / 2, ry = py - SNAP_REGION / 2;
+    if (rx < 0) rx = 0;
+    if (ry < 0) ry = 0;
+    if (rx > scr_w - SNAP_REGION) rx = scr_w - SNAP_REGION;
+    if (ry > scr_h - SNAP_REGION) ry = scr_h - SNAP_REGION;
+
+    XImage *img = snap_capture(dpy, rx, ry);
+    if (!img) return;
+    if (img->bits_per_pixel != 32) {
+        if (img != snap_image) XDestroyImage(img);
+        show_feedback("Snap needs a 24-bit display");
+        return;
+    }
+
+    snap_edge_map(snap_best_kernel(), (const uint32_t *)img->data, img->bytes_per_line / 4,
+                  SNAP_REGION, SNAP_REGION, snap_luma, snap_edges);
+    if (img != snap_image) XDestroyImage(img);
+
+    int s = snap_target(snap_edges, SNAP_REGION, SNAP_REGION, px - rx, py - ry, dx, dy);
+    if (s < 0) {
+        show_feedback("Snap: no edge");
+        return;
+    }
+    warp_mouse(dpy, px + dx * s, py + dy * s);
+}
+
+static void* snap_thread_func(void *arg) {
+    (void)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) return NULL;
+
+    pthread_mutex_lock(&snap_mutex);
+    while (state.running) {
+        if (!snap_requested) {
+            pthread_cond_wait(&snap_cond, &snap_mutex);
+            continue;
+        }
+        int dx = snap_req_dx, dy = snap_req_dy;
+        snap_requested = false;
+        pthread_mutex_unlock(&snap_mutex);
+        snap_direction(dpy, dx, dy);
+        pthread_mutex_lock(&snap_mutex);
+    }
+    pthread_mutex_unlock(&snap_mutex);
+    XCloseDisplay(dpy);
+    return NULL;
+}
+
+/* Hand a snap to the snap thread, started on first use */
+static void snap_request(int dx, int dy) {
+    if (headless) return;
+    pthread_mutex_lock(&snap_mutex);
+    snap_req_dx = dx;
+    snap_req_dy = dy;
+    snap_requested = true;
+    pthread_cond_signal(&snap_cond);
+    pthread_mutex_unlock(&snap_mutex);
+    if (!snap_thread && helper_thread_create(&snap_thread, false, snap_thread_func, NULL) != 0) snap_thread = 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Magnifier Lens                                                     */
+/* ------------------------------------------------------------------ */
+/*
+ * Holding KPDOT past LENS_HOLD_DELAY shows a lens beside the pointer: the
+ * LENS_SRC square under it blown up LENS_ZOOM times (nearest neighbour, so
+ * real pixels stay sharp) with a crosshair on the pointer's pixel. While it
+ * is up the direction keys nudge the pointer by one pixel instead of
+ * snapping. The movement thread drives it, and both shared-memory images
+ * are created on first use and reused for every frame.
+ */
+#define LENS_SRC 32
+#define LENS_ZOOM 8
+#define LENS_SIZE (LENS_SRC * LENS_ZOOM)
+#define LENS_OFFSET 32            /* gap between pointer and lens, clear of the captured square */
+#define LENS_HOLD_DELAY 0.3       /* seconds KPDOT must be held */
+#define LENS_FRAME_INTERVAL 0.008 /* at most one frame per 8 ms */
+#define LENS_CROSSHAIR 0xFF3030
+
+typedef struct {
+    const char *name;
+    void (*scale_row)(const uint32_t *src, uint32_t *dst, int n);
+} LensKernel;
+
+static _Atomic double lens_hold_since = 0.0;   /* KPDOT press time, 0 = released */
+static atomic_bool lens_shown = false;
+
+static void lens_scale_row_scalar(const uint32_t *src, uint32_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < LENS_ZOOM; k++) *dst++ = src[i];
+    }
+}
+
+#ifdef __SSE2__
+static void lens_scale_row_sse2(const uint32_t *src, uint32_t *dst, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i p[4] = {
+            _mm_shuffle_epi32(v, 0x00), _mm_shuffle_epi32(v, 0x55),
+            _mm_shuffle_epi32(v, 0xAA), _mm_shuffle_epi32(v, 0xFF),
+        };
+        for (int k = 0; k < 4; k++) {
+            for (int j = 0; j < LENS_ZOOM; j += 4) _mm_storeu_si128((__m128i *)(dst + j), p[k]);
+            dst += LENS_ZOOM;
+        }
+    }
+    lens_scale_row_scalar(src + i, dst, n - i);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void lens_scale_row_avx2(const uint32_t *src, uint32_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        __m256i p = _mm256_set1_epi32((int)src[i]);
+        for (int j = 0; j < LENS_ZOOM; j += 8) _mm256_storeu_si256((__m256i *)(dst + j), p);
+        dst += LENS_ZOOM;
+    }
+}
+#endif
+
+static const LensKernel lens_kernels[] = {
+    {"scalar", lens_scale_row_scalar},
+#ifdef __SSE2__
+    {"sse2", lens_scale_row_sse2},
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx2", lens_scale_row_avx2},
+#endif
+};
+static const int num_lens_kernels = sizeof(lens_kernels) / sizeof(lens_kernels[0]);
+
+/* Scale src (stride in pixels) into dst and mark pixel (cx, cy) */
+static void lens_render(const LensKernel *k, const uint32_t *src, int stride, uint32_t *dst, int dst_stride,
+                        int cx, int cy) {
+    for (int y = 0; y < LENS_SRC; y++) {
+        uint32_t *row = dst + y * LENS_ZOOM * dst_stride;
+        k->scale_row(src + y * stride, row, LENS_SRC);
+        for (int r = 1; r < LENS_ZOOM; r++) memcpy(row + r * dst_stride, row, LENS_SIZE * sizeof(uint32_t));
+    }
+
+    /* Crosshair lines stop short of the target pixel, which gets a box */
+    int x0 = cx * LENS_ZOOM - 1, x1 = (cx + 1) * LENS_ZOOM;
+    int y0 = cy * LENS_ZOOM - 1, y1 = (cy + 1) * LENS_ZOOM;
+    int mx = cx * LENS_ZOOM + LENS_ZOOM / 2, my = cy * LENS_ZOOM + LENS_ZOOM / 2;
+    for (int i = 0; i < LENS_SIZE; i++) {
+        if (i < x0 || i > x1) dst[my * dst_stride + i] = LENS_CROSSHAIR;
+        if (i < y0 || i > y1) dst[i * dst_stride + mx] = LENS_CROSSHAIR;
+    }
+    for (int i = x0; i <= x1; i++) {
+        if (i < 0 || i >= LENS_SIZE) continue;
+        if (y0 >= 0) dst[y0 * dst_stride + i] = LENS_CROSSHAIR;
+        if (y1 < LENS_SIZE) dst[y1 * dst_stride + i] = LENS_CROSSHAIR;
+    }
+    for (int i = y0; i <= y1; i++) {
+        if (i < 0 || i >= LENS_SIZE) continue;
+        if (x0 >= 0) dst[i * dst_stride + x0] = LENS_CROSSHAIR;
+        if (x1 < LENS_SIZE) dst[i * dst_stride + x1] = LENS_CROSSHAIR;
+    }
+}
+
+/* Shared-memory image on dpy, or NULL when there is none the server accepts */
+static XImage* lens_shm_image(Display *dpy, XShmSegmentInfo *shm, int w, int h) {
+    int scr = DefaultScreen(dpy);
+    XImage *img = XShmCreateImage(dpy, DefaultVisual(dpy, scr), DefaultDepth(dpy, scr), ZPixmap,
+                                  NULL, shm, w, h);
+    if (!img) return NULL;
+    if (img->bits_per_pixel != 32) {
+        XDestroyImage(img);
+        return NULL;
+    }
+    shm->shmid = shmget(IPC_PRIVATE, img->bytes_per_line * img->height, IPC_CREAT | 0600);
+    shm->shmaddr = img->data = shm->shmid >= 0 ? shmat(shm->shmid, NULL, 0) : (void *)-1;
+    shm->readOnly = False;
+    bool ok = shm->shmaddr != (void *)-1 && x_shm_attach(dpy, shm);
+    if (shm->shmid >= 0) shmctl(shm->shmid, IPC_RMID, NULL);
+    if (!ok) {
+        if (shm->shmaddr != (void *)-1) shmdt(shm->shmaddr);
+        img->data = NULL;
+        XDestroyImage(img);
+        return NULL;
+    }
+    return img;
+}
+
+/*
+ * Called from movement_tick() with the movement thread's display: shows,
+ * refreshes and hides the lens. Everything here lives on that thread.
+ */
+static void lens_tick(Display *dpy) {
+    static bool unavailable = false;
+    static Window win = None;
+    static GC gc;
+    static XImage *src_img = NULL, *dst_img = NULL;
+    static XShmSegmentInfo src_shm, dst_shm;
+    static const LensKernel *kernel = NULL;
+    static bool mapped = false;
+    static double last_frame = 0.0;
+
+    if (!dpy || unavailable) return;
+
+    /* Runs on every movement tick, so a released KPDOT must not read the clock */
+    double since = lens_hold_since;
+    if (since == 0.0 && !mapped) return;
+    double now = since > 0.0 ? get_time() : 0.0;
+    bool want = state.mouse_mode && since > 0.0 && now - since >= LENS_HOLD_DELAY;
+    if (!want) {
+        if (mapped) {
+            overlay_untrack(win);
+            XUnmapWindow(dpy, win);
+            XFlush(dpy);
+            mapped = false;
+            lens_shown = false;
+        }
+        return;
+    }
+    if (mapped && now - last_frame < LENS_FRAME_INTERVAL) return;
+
+    if (win == None) {
+        if (!XShmQueryExtension(dpy) ||
+            !(src_img = lens_shm_image(dpy, &src_shm, LENS_SRC, LENS_SRC)) ||
+            !(dst_img = lens_shm_image(dpy, &dst_shm, LENS_SIZE, LENS_SIZE))) {
+            if (src_img) {
+                XShmDetach(dpy, &src_shm);
+                shmdt(src_shm.shmaddr);
+                src_img->data = NULL;
+                XDestroyImage(src_img);
+                src_img = NULL;
+            }
+            fprintf(stderr, "Magnifier needs MIT-SHM the X server accepts and a 24-bit display\n");
+            unavailable = true;
+            return;
+        }
+        for (int i = num_lens_kernels - 1; i >= 0 && !kernel; i--) {
+            if (kernel_supported(lens_kernels[i].name)) kernel = &lens_kernels[i];
+        }
+
+        XSetWindowAttributes attrs = {0};
+        attrs.override_redirect = True;
+        attrs.border_pixel = LENS_CROSSHAIR;
+        win = XCreateWindow(dpy, DefaultRootWindow(dpy), 0, 0, LENS_SIZE, LENS_SIZE, 1,
+                            CopyFromParent, InputOutput, CopyFromParent,
+                            CWOverrideRedirect | CWBorderPixel, &attrs);
+        XShapeCombineRectangles(dpy, win, ShapeInput, 0, 0, NULL, 0, ShapeSet, Unsorted);
+        gc = XCreateGC(dpy, win, 0, NULL);
+    }
+
+    int px, py, scr_w, scr_h;
+    if (!query_pointer(dpy, &px, &py)) return;
+    screen_size(dpy, &scr_w, &scr_h);
+
+    int rx = px - LENS_SRC / 2, ry = py - LENS_SRC / 2;
+    if (rx < 0) rx = 0;
+    if (ry < 0) ry = 0;
+    if (rx > scr_w - LENS_SRC) rx = scr_w - LENS_SRC;
+    if (ry > scr_h - LENS_SRC) ry = scr_h - LENS_SRC;
+
+    /* Below-right of the pointer, flipped near the screen edges */
+    int wx = px + LENS_OFFSET, wy = py + LENS_OFFSET;
+    if (wx + LENS_SIZE + 2 > scr_w) wx = px - LENS_OFFSET - LENS_SIZE - 2;
+    if (wy + LENS_SIZE + 2 > scr_h) wy = py - LENS_OFFSET - LENS_SIZE - 2;
+
+    if (mapped) XMoveWindow(dpy, win, wx, wy);
+    overlay_track(win, wx, wy, LENS_SIZE + 2, LENS_SIZE + 2);
+    if (!XShmGetImage(dpy, DefaultRootWindow(dpy), src_img, rx, ry, AllPlanes)) return;
+
+    lens_render(kernel, (const uint32_t *)src_img->data, src_img->bytes_per_line / 4,
+                (uint32_t *)dst_img->data, dst_img->bytes_per_line / 4, px - rx, py - ry);
+    if (!mapped) {
+        XMoveWindow(dpy, win, wx, wy);
+        XMapRaised(dpy, win);
+        mapped = true;
+        lens_shown = true;
+    }
+    XShmPutImage(dpy, win, gc, dst_img, 0, 0, 0, 0, LENS_SIZE, LENS_SIZE, False);
+    XFlush(dpy);
+    last_frame = now;
+}
+
+static void lens_nudge(int dx, int dy) {
+    Display *dpy = input_display();
+    int x, y;
+    if (!query_pointer(dpy, &x, &y)) return;
+    warp_mouse(dpy, x + dx, y + dy);
+}
+
+/* ------------------------------------------------------------------ */
+/* Visual Anchors                                                     */
+/* ------------------------------------------------------------------ */
+/*
+ * KPDOT+KPMINUS then a letter saves the 32x32 patch under the pointer as
+ * anchor <letter> (a PGM in ~/.config/kat/anchors); KPDOT+KPASTERISK then
+ * a letter finds the patch on screen and warps to it. The search is
+ * normalised cross-correlation over a three-level pyramid: an exhaustive
+ * pass at 1/4 scale, split across cores, then the best candidates are
+ * refined at 1/2 and full scale. The capture and search run on their own
+ * thread, one at a time, so keys keep flowing while it works.
+ */
+#define ANCHOR_SIZE 32
+#define ANCHOR_LEVELS 3
+#define ANCHOR_CANDIDATES 8
+#define ANCHOR_REFINE 2           /* +/- pixels searched around a candidate per level */
+#define ANCHOR_MIN_SCORE 0.8
+#define ANCHOR_MAX_THREADS 8
+
+typedef struct {
+    const char *name;
+    /* Adds sum(img*tpl), sum(img) and sum(img^2) over n pixels, n a multiple of 8 */
+    void (*row)(const uint8_t *img, const int16_t *tpl, int n, int32_t *dot, int32_t *sum, int32_t *sq);
+} NccKernel;
+
+typedef struct {
+    uint8_t *px[ANCHOR_LEVELS];
+    int w[ANCHOR_LEVELS], h[ANCHOR_LEVELS];
+} Pyramid;
+
+typedef struct {
+    bool loaded;
+    int hot_x, hot_y;                                  /* pointer position inside the patch */
+    int16_t zm[ANCHOR_LEVELS][ANCHOR_SIZE * ANCHOR_SIZE]; /* patch minus its rounded mean */
+    int size[ANCHOR_LEVELS];
+    int32_t zm_sum[ANCHOR_LEVELS];
+    double zm_var[ANCHOR_LEVELS];
+} AnchorTemplate;
+
+typedef struct {
+    int x, y;
+    double score;
+} AnchorMatch;
+
+typedef struct {
+    const NccKernel *k;
+    const Pyramid *pyr;
+    const AnchorTemplate *t;
+    int y0, y1;
+    AnchorMatch best[ANCHOR_CANDIDATES];
+} AnchorJob;
+
+static const char *anchor_dir = NULL;
+static AnchorTemplate anchors[HINT_KEYS];
+static int anchor_pending = 0;        /* 1 = save, 2 = find: waiting for the letter */
+static int anchor_release_code = -1;
+/* Owned by whichever search thread holds anchor_searching; kept between searches */
+static Display *anchor_dpy = NULL;
+static Pyramid anchor_pyr;
+static XImage *anchor_image = NULL;
+static atomic_bool anchor_searching = false;
+static XShmSegmentInfo anchor_shm;
+
+static void ncc_row_scalar(const uint8_t *img, const int16_t *tpl, int n, int32_t *dot, int32_t *sum, int32_t *sq) {
+    int32_t d = 0, s = 0, q = 0;
+    for (int i = 0; i < n; i++) {
+        d += img[i] * tpl[i];
+        s += img[i];
+        q += img[i] * img[i];
+    }
+    *dot += d;
+    *sum += s;
+    *sq += q;
+}
+
+#ifdef __SSE2__
+static int32_t hsum_epi32(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4E));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xB1));
+    return _mm_cvtsi128_si32(v);
+}
+
+static void ncc_row_sse2(const uint8_t *img, const int16_t *tpl, int n, int32_t *dot, int32_t *sum, int32_t *sq) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i d = zero, q = zero, s = zero;
+    for (int i = 0; i < n; i += 8) {
+        __m128i b = _mm_loadl_epi64((const __m128i *)(img + i));
+        __m128i v = _mm_unpacklo_epi8(b, zero);
+        d = _mm_add_epi32(d, _mm_madd_epi16(v, _mm_loadu_si128((const __m128i *)(tpl + i))));
+        q = _mm_add_epi32(q, _mm_madd_epi16(v, v));
+        s = _mm_add_epi64(s, _mm_sad_epu8(b, zero));
+    }
+    *dot += hsum_epi32(d);
+    *sq += hsum_epi32(q);
+    *sum += _mm_cvtsi128_si32(s);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void ncc_row_avx2(const uint8_t *img, const int16_t *tpl, int n, int32_t *dot, int32_t *sum, int32_t *sq) {
+    __m256i d = _mm256_setzero_si256(), q = _mm256_setzero_si256();
+    __m128i s = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(img + i));
+        __m256i v = _mm256_cvtepu8_epi16(b);
+        d = _mm256_add_epi32(d, _mm256_madd_epi16(v, _mm256_loadu_si256((const __m256i *)(tpl + i))));
+        q = _mm256_add_epi32(q, _mm256_madd_epi16(v, v));
+        s = _mm_add_epi64(s, _mm_sad_epu8(b, _mm_setzero_si128()));
+    }
+    __m128i d4 = _mm_add_epi32(_mm256_castsi256_si128(d), _mm256_extracti128_si256(d, 1));
+    __m128i q4 = _mm_add_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+    if (i < n) {
+        __m128i b = _mm_loadl_epi64((const __m128i *)(img + i));
+        __m128i v = _mm_unpacklo_epi8(b, _mm_setzero_si128());
+        d4 = _mm_add_epi32(d4, _mm_madd_epi16(v, _mm_loadu_si128((const __m128i *)(tpl + i))));
+        q4 = _mm_add_epi32(q4, _mm_madd_epi16(v, v));
+        s = _mm_add_epi64(s, _mm_sad_epu8(b, _mm_setzero_si128()));
+    }
+    d4 = _mm_add_epi32(d4, _mm_shuffle_epi32(d4, 0x4E));
+    d4 = _mm_add_epi32(d4, _mm_shuffle_epi32(d4, 0xB1));
+    q4 = _mm_add_epi32(q4, _mm_shuffle_epi32(q4, 0x4E));
+    q4 = _mm_add_epi32(q4, _mm_shuffle_epi32(q4, 0xB1));
+    s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+    *dot += _mm_cvtsi128_si32(d4);
+    *sq += _mm_cvtsi128_si32(q4);
+    *sum += _mm_cvtsi128_si32(s);
+}
+#endif
+
+static const NccKernel ncc_kernels[] = {
+    {"scalar", ncc_row_scalar},
+#ifdef __SSE2__
+    {"sse2", ncc_row_sse2},
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx2", ncc_row_avx2},
+#endif
+};
+static const int num_ncc_kernels = sizeof(ncc_kernels) / sizeof(ncc_kernels[0]);
+
+static const NccKernel* ncc_best_kernel(void) {
+    static const NccKernel *best = NULL;
+    for (int i = num_ncc_kernels - 1; i >= 0 && !best; i--) {
+        if (kernel_supported(ncc_kernels[i].name)) best = &ncc_kernels[i];
+    }
+    return best;
+}
+
+/* 2x2 box downsample */
+static void pyr_down(const uint8_t *src, int w, int h, uint8_t *dst) {
+    int dw = w / 2, dh = h / 2;
+    for (int y = 0; y < dh; y++) {
+        const uint8_t *a = src + 2 * y * w, *b = a + w;
+        uint8_t *o = dst + y * dw;
+        for (int x = 0; x < dw; x++) {
+            o[x] = (uint8_t)((a[2 * x] + a[2 * x + 1] + b[2 * x] + b[2 * x + 1] + 2) >> 2);
+        }
+    }
+}
+
+/* Size the pyramid for a w x h base; buffers are kept while the size holds */
+static bool pyr_reserve(Pyramid *p, int w, int h) {
+    if (p->px[0] && p->w[0] == w && p->h[0] == h) return true;
+    for (int l = 0; l < ANCHOR_LEVELS; l++) {
+        free(p->px[l]);
+        p->w[l] = w >> l;
+        p->h[l] = h >> l;
+        p->px[l] = malloc((size_t)p->w[l] * p->h[l]);
+    }
+    for (int l = 0; l < ANCHOR_LEVELS; l++) {
+        if (p->px[l]) continue;
+        for (int i = 0; i < ANCHOR_LEVELS; i++) {
+            free(p->px[i]);
+            p->px[i] = NULL;
+        }
+        return false;
+    }
+    return true;
+}
+
+static void pyr_build(Pyramid *p) {
+    for (int l = 1; l < ANCHOR_LEVELS; l++) pyr_down(p->px[l - 1], p->w[l - 1], p->h[l - 1], p->px[l]);
+}
+
+/* Fills *out only when every level has contrast; a failure leaves it as it was */
+static bool anchor_template_from(AnchorTemplate *out, const uint8_t *patch, int hot_x, int hot_y) {
+    AnchorTemplate tmp, *t = &tmp;
+    uint8_t level[ANCHOR_LEVELS][ANCHOR_SIZE * ANCHOR_SIZE];
+    memcpy(level[0], patch, ANCHOR_SIZE * ANCHOR_SIZE);
+    for (int l = 1; l < ANCHOR_LEVELS; l++) {
+        pyr_down(level[l - 1], ANCHOR_SIZE >> (l - 1), ANCHOR_SIZE >> (l - 1), level[l]);
+    }
+
+    for (int l = 0; l < ANCHOR_LEVELS; l++) {
+        int size = ANCHOR_SIZE >> l, n = size * size;
+        int32_t total = 0;
+        for (int i = 0; i < n; i++) total += level[l][i];
+        int mean = (total + n / 2) / n;
+
+        int32_t zs = 0;
+        int64_t zq = 0;
+        for (int i = 0; i < n; i++) {
+            t->zm[l][i] = (int16_t)(level[l][i] - mean);
+            zs += t->zm[l][i];
+            zq += t->zm[l][i] * t->zm[l][i];
+        }
+        t->size[l] = size;
+        t->zm_sum[l] = zs;
+        t->zm_var[l] = (double)zq - (double)zs * zs / n;
+        if (t->zm_var[l] < 1.0) return false;   /* flat patch: nothing to match */
+    }
+    t->hot_x = hot_x;
+    t->hot_y = hot_y;
+    t->loaded = true;
+    *out = tmp;
+    return true;
+}
+
+static double anchor_score(const NccKernel *k, const Pyramid *p, const AnchorTemplate *t, int l, int x, int y) {
+    int size = t->size[l], n = size * size;
+    int32_t dot = 0, sum = 0, sq = 0;
+    const uint8_t *img = p->px[l] + y * p->w[l] + x;
+    for (int r = 0; r < size; r++) k->row(img + r * p->w[l], t->zm[l] + r * size, size, &dot, &sum, &sq);
+
+    double var = (double)sq - (double)sum * sum / n;
+    if (var < 1.0) return 0.0;
+    double cov = (double)dot - (double)sum * t->zm_sum[l] / n;
+    return cov / sqrt(var * t->zm_var[l]);
+}
+
+/* Keep the best few, one per neighbourhood */
+static void anchor_offer(AnchorMatch *best, int x, int y, double score) {
+    if (score <= best[ANCHOR_CANDIDATES - 1].score) return;
+    int at = ANCHOR_CANDIDATES - 1;
+    for (int i = 0; i < ANCHOR_CANDIDATES; i++) {
+        if (abs(best[i].x - x) <= ANCHOR_REFINE && abs(best[i].y - y) <= ANCHOR_REFINE) {
+            if (score <= best[i].score) return;
+            at = i;
+            break;
+        }
+    }
+    while (at > 0 && best[at - 1].score < score) {
+        best[at] = best[at - 1];
+        at--;
+    }
+    best[at] = (AnchorMatch){ x, y, score };
+}
+
+static void* anchor_coarse_thread(void *arg) {
+    AnchorJob *job = arg;
+    int l = ANCHOR_LEVELS - 1;
+    int max_x = job->pyr->w[l] - job->t->size[l];
+    for (int i = 0; i < ANCHOR_CANDIDATES; i++) job->best[i] = (AnchorMatch){ -100, -100, -1.0 };
+    for (int y = job->y0; y < job->y1; y++) {
+        for (int x = 0; x <= max_x; x++) {
+            anchor_offer(job->best, x, y, anchor_score(job->k, job->pyr, job->t, l, x, y));
+        }
+    }
+    return NULL;
+}
+
+/* Best match of t in p (top-left corner at full scale) using up to threads workers */
+static AnchorMatch anchor_search(const NccKernel *k, const Pyramid *p, const AnchorTemplate *t, int threads) {
+    int l = ANCHOR_LEVELS - 1;
+    int rows = p->h[l] - t->size[l] + 1;
+    AnchorMatch result = { 0, 0, -1.0 };
+    if (rows <= 0 || p->w[l] < t->size[l]) return result;
+
+    if (threads < 1) threads = 1;
+    if (threads > ANCHOR_MAX_THREADS) threads = ANCHOR_MAX_THREADS;
+    if (threads > rows) threads = rows;
+
+    AnchorJob jobs[ANCHOR_MAX_THREADS];
+    pthread_t tids[ANCHOR_MAX_THREADS];
+    for (int i = 0; i < threads; i++) {
+        jobs[i] = (AnchorJob){ .k = k, .pyr = p, .t = t, .y0 = rows * i / threads, .y1 = rows * (i + 1) / threads };
+        if (i == 0 || helper_thread_create(&tids[i], false, anchor_coarse_thread, &jobs[i]) != 0) tids[i] = 0;
+    }
+    for (int i = 0; i < threads; i++) {
+        if (!tids[i]) anchor_coarse_thread(&jobs[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        if (tids[i]) pthread_join(tids[i], NULL);
+    }
+
+    AnchorMatch cand[ANCHOR_CANDIDATES];
+    for (int i = 0; i < ANCHOR_CANDIDATES; i++) cand[i] = (AnchorMatch){ -100, -100, -1.0 };
+    for (int i = 0; i < threads; i++) {
+        for (int c = 0; c < ANCHOR_CANDIDATES; c++) {
+            if (jobs[i].best[c].score > -1.0) anchor_offer(cand, jobs[i].best[c].x, jobs[i].best[c].y, jobs[i].best[c].score);
+        }
+    }
+
+    /* Walk each candidate down the pyramid */
+    for (int c = 0; c < ANCHOR_CANDIDATES && cand[c].score > -1.0; c++) {
+        AnchorMatch m = cand[c];
+        for (int lv = l - 1; lv >= 0; lv--) {
+            int cx = m.x * 2, cy = m.y * 2;
+            m.score = -1.0;
+            for (int y = cy - ANCHOR_REFINE; y <= cy + ANCHOR_REFINE; y++) {
+                for (int x = cx - ANCHOR_REFINE; x <= cx + ANCHOR_REFINE; x++) {
+                    if (x < 0 || y < 0 || x > p->w[lv] - t->size[lv] || y > p->h[lv] - t->size[lv]) continue;
+                    double s = anchor_score(k, p, t, lv, x, y);
+                    if (s > m.score) m = (AnchorMatch){ x, y, s };
+                }
+            }
+        }
+        if (m.score > result.score) result = m;
+    }
+    return result;
+}
+
+static int anchor_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n > ANCHOR_MAX_THREADS ? ANCHOR_MAX_THREADS : (int)n;
+}
+
+static void anchor_path(int letter, char *buf, size_t sz) {
+    snprintf(buf, sz, "%s/%c.pgm", anchor_dir, hint_alphabet[letter]);
+}
+
+static bool anchor_load(int letter) {
+    if (anchors[letter].loaded) return true;
+    if (!anchor_dir) return false;
+
+    char path[600];
+    anchor_path(letter, path, sizeof(path));
+    FILE *f = user_file_fopen(path, "rb");
+    if (!f) return false;
+
+    uint8_t patch[ANCHOR_SIZE * ANCHOR_SIZE];
+    int hx, hy, w, h, maxval;
+    bool ok = fscanf(f, "P5 # kat anchor hotspot %d %d %d %d %d", &hx, &hy, &w, &h, &maxval) == 5 &&
+              w == ANCHOR_SIZE && h == ANCHOR_SIZE && maxval == 255 && fgetc(f) != EOF &&
+              fread(patch, 1, sizeof(patch), f) == sizeof(patch);
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "%s: not a %dx%d kat anchor\n", path, ANCHOR_SIZE, ANCHOR_SIZE);
+        return false;
+    }
+    return anchor_template_from(&anchors[letter], patch, hx, hy);
+}
+
+static void anchor_save(int letter) {
+    Display *dpy = input_display();
+    int px, py, scr_w, scr_h;
+    if (!dpy || !query_pointer(dpy, &px, &py)) return;
+    screen_size(dpy, &scr_w, &scr_h);
+
+    int rx = px - ANCHOR_SIZE / 2, ry = py - ANCHOR_SIZE / 2;
+    if (rx < 0) rx = 0;
+    if (ry < 0) ry = 0;
+    if (rx > scr_w - ANCHOR_SIZE) rx = scr_w - ANCHOR_SIZE;
+    if (ry > scr_h - ANCHOR_SIZE) ry = scr_h - ANCHOR_SIZE;
+
+    XImage *img = XGetImage(dpy, DefaultRootWindow(dpy), rx, ry, ANCHOR_SIZE, ANCHOR_SIZE, AllPlanes, ZPixmap);
+    if (!img) return;
+    uint8_t patch[ANCHOR_SIZE * ANCHOR_SIZE];
+    bool ok = img->bits_per_pixel == 32;
+    for (int y = 0; ok && y < ANCHOR_SIZE; y++) {
+        snap_best_kernel()->luma_row((const uint32_t *)(img->data + y * img->bytes_per_line),
+                                     patch + y * ANCHOR_SIZE, ANCHOR_SIZE);
+    }
+    XDestroyImage(img);
+
+    char msg[64];
+    if (!ok || !anchor_template_from(&anchors[letter], patch, px - rx, py - ry)) {
+        snprintf(msg, sizeof(msg), "Anchor %c: nothing to match here", hint_alphabet[letter]);
+        show_feedback(msg);
+        return;
+    }
+
+    char path[600];
+    anchor_path(letter, path, sizeof(path));
+    FILE *f = anchor_dir ? user_file_fopen(path, "wb") : NULL;
+    if (f) {
+        fprintf(f, "P5\n# kat anchor hotspot %d %d\n%d %d\n255\n", px - rx, py - ry, ANCHOR_SIZE, ANCHOR_SIZE);
+        fwrite(patch, 1, sizeof(patch), f);
+        fclose(f);
+    } else if (anchor_dir) {
+        perror("fopen anchor");
+    }
+    snprintf(msg, sizeof(msg), "Anchor %c saved", hint_alphabet[letter]);
+    show_feedback(msg);
+}
+
+/* Whole screen into the pyramid base; the XShm image is kept per geometry */
+static bool anchor_capture(Display *dpy) {
+    int scr = DefaultScreen(dpy);
+    int w = DisplayWidth(dpy, scr), h = DisplayHeight(dpy, scr);
+
+    if (anchor_image && (anchor_image->width != w || anchor_image->height != h)) {
+        XShmDetach(dpy, &anchor_shm);
+        shmdt(anchor_shm.shmaddr);
+        anchor_image->data = NULL;
+        XDestroyImage(anchor_image);
+        anchor_image = NULL;
+    }
+    static bool refused = false;    /* the server would not attach: XGetImage from now on */
+    if (!anchor_image && !refused && XShmQueryExtension(dpy)) {
+        anchor_image = lens_shm_image(dpy, &anchor_shm, w, h);
+        refused = !anchor_image;
+    }
+
+    XImage *img = anchor_image;
+    if (img && !XShmGetImage(dpy, DefaultRootWindow(dpy), img, 0, 0, AllPlanes)) return false;
+    if (!img) img = XGetImage(dpy, DefaultRootWindow(dpy), 0, 0, w, h, AllPlanes, ZPixmap);
+    if (!img) return false;
+
+    bool ok = img->bits_per_pixel == 32 && pyr_reserve(&anchor_pyr, w, h);
+    for (int y = 0; ok && y < h; y++) {
+        snap_best_kernel()->luma_row((const uint32_t *)(img->data + y * img->bytes_per_line),
+                                     anchor_pyr.px[0] + y * w, w);
+    }
+    if (img != anchor_image) XDestroyImage(img);
+    return ok;
+}
+
+typedef struct {
+    int letter;
+    AnchorTemplate t;
+} AnchorFindJob;
+
+static void* anchor_find_thread(void *arg) {
+    AnchorFindJob *job = arg;
+    char msg[64];
+    if (!anchor_dpy) anchor_dpy = XOpenDisplay(NULL);
+    Display *dpy = anchor_dpy;
+    if (dpy && anchor_capture(dpy)) {
+        pyr_build(&anchor_pyr);
+        AnchorMatch m = anchor_search(ncc_best_kernel(), &anchor_pyr, &job->t, anchor_threads());
+        if (m.score < ANCHOR_MIN_SCORE) {
+            snprintf(msg, sizeof(msg), "Anchor %c: not on screen", hint_alphabet[job->letter]);
+            show_feedback(msg);
+        } else {
+            jump_to(dpy, m.x + job->t.hot_x, m.y + job->t.hot_y);
+            XFlush(dpy);
+        }
+    }
+    free(job);
+    atomic_store(&anchor_searching, false);
+    return NULL;
+}
+
+static void anchor_find(int letter) {
+    char msg[64];
+    if (headless) return;
+    if (!anchor_load(letter)) {
+        snprintf(msg, sizeof(msg), "Anchor %c: not saved", hint_alphabet[letter]);
+        show_feedback(msg);
+        return;
+    }
+    if (atomic_exchange(&anchor_searching, true)) {
+        show_feedback("Anchor search busy");
+        return;
+    }
+
+    /* The thread gets its own copy: a save may replace the slot meanwhile */
+    AnchorFindJob *job = malloc(sizeof(*job));
+    pthread_t th;
+    if (job) {
+        job->letter = letter;
+        job->t = anchors[letter];
+    }
+    if (!job || helper_thread_create(&th, true, anchor_find_thread, job) != 0) {
+        free(job);
+        atomic_store(&anchor_searching, false);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Screen Change Tracking                                             */
+/* ------------------------------------------------------------------ */
+/*
+ * A thread listens for XDamage raw rectangles on the root window; nothing
+ * is ever captured or polled. Rectangles that arrive close together in time
+ * and space are merged into one change. A coarse grid of decaying repaint
+ * heat marks areas that are always busy (video, spinners, a blinking
+ * caret), so a dialog that pops up elsewhere still counts as the latest
+ * change. KP0+KPSLASH warps to the centre of that change.
+ */
+#define DAMAGE_SLOTS 32
+#define DAMAGE_MERGE_WINDOW 0.3   /* seconds a change stays open for merging */
+#define DAMAGE_MERGE_GAP 32       /* px between rectangles of one change */
+#define DAMAGE_MIN_AREA 2500      /* px repainted before a change counts */
+#define DAMAGE_MAX_AGE 120.0      /* seconds before a change is forgotten */
+#define DAMAGE_GRID_COLS 16
+#define DAMAGE_GRID_ROWS 9
+#define DAMAGE_HALF_LIFE 3.0      /* seconds */
+#define DAMAGE_BUSY 1.0           /* cells repainted this often per half-life are busy */
+
+typedef struct {
+    Rect box;
+    double first, last;
+    long area;
+    bool busy;              /* started in an area that was already busy */
+} DamageChange;
+
+static DamageChange damage_changes[DAMAGE_SLOTS];
+static double damage_heat[DAMAGE_GRID_ROWS][DAMAGE_GRID_COLS];
+static double damage_heat_time[DAMAGE_GRID_ROWS][DAMAGE_GRID_COLS];
+static Rect damage_area;                 /* what the heat grid covers */
+static pthread_t damage_thread = 0;
+static pthread_mutex_t damage_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Adds r to the heat grid; returns the hottest covered cell's heat before that */
+static double damage_heat_add(const Rect *r, double now) {
+    double cell_w = (double)damage_area.w / DAMAGE_GRID_COLS;
+    double cell_h = (double)damage_area.h / DAMAGE_GRID_ROWS;
+    int x = r->x - damage_area.x, y = r->y - damage_area.y;
+    int c0 = (int)(x / cell_w), c1 = (int)((x + r->w - 1) / cell_w);
+    int r0 = (int)(y / cell_h), r1 = (int)((y + r->h - 1) / cell_h);
+    if (c0 < 0) c0 = 0;
+    if (r0 < 0) r0 = 0;
+    if (c1 >= DAMAGE_GRID_COLS) c1 = DAMAGE_GRID_COLS - 1;
+    if (r1 >= DAMAGE_GRID_ROWS) r1 = DAMAGE_GRID_ROWS - 1;
+
+    double hottest = 0.0;
+    for (int row = r0; row <= r1; row++) {
+        for (int col = c0; col <= c1; col++) {
+            double *h = &damage_heat[row][col];
+            *h *= exp2(-(now - damage_heat_time[row][col]) / DAMAGE_HALF_LIFE);
+            damage_heat_time[row][col] = now;
+            if (*h > hottest) hottest = *h;
+
+            double ox = fmin(x + r->w, (col + 1) * cell_w) - fmax(x, col * cell_w);
+            double oy = fmin(y + r->h, (row + 1) * cell_h) - fmax(y, row * cell_h);
+            if (ox > 0 && oy > 0) *h += ox * oy / (cell_w * cell_h);
+        }
+    }
+    return hottest;
+}
+
+/* Follows the monitor layout; heat from the old layout maps to nothing */
+static void damage_set_area(Rect area) {
+    pthread_mutex_lock(&damage_mutex);
+    if (memcmp(&area, &damage_area, sizeof(Rect)) != 0) {
+        damage_area = area;
+        memset(damage_heat, 0, sizeof(damage_heat));
+    }
+    pthread_mutex_unlock(&damage_mutex);
+}
+
+static bool rect_near(const Rect *a, const Rect *b, int gap) {
+    return a->x - gap < b->x + b->w && b->x - gap < a->x + a->w &&
+           a->y - gap < b->y + b->h && b->y - gap < a->y + a->h;
+}
+
+static void damage_note(int x, int y, int w, int h, double now) {
+    if (w <= 0 || h <= 0 || overlay_covers(x, y, w, h, now)) return;
+    Rect r = { x, y, w, h };
+
+    pthread_mutex_lock(&damage_mutex);
+    bool busy = damage_heat_add(&r, now) >= DAMAGE_BUSY;
+
+    int oldest = 0;
+    for (int i = 0; i < DAMAGE_SLOTS; i++) {
+        DamageChange *c = &damage_changes[i];
+        if (c->area > 0 && now - c->last <= DAMAGE_MERGE_WINDOW && rect_near(&c->box, &r, DAMAGE_MERGE_GAP)) {
+            int x1 = c->box.x + c->box.w > x + w ? c->box.x + c->box.w : x + w;
+            int y1 = c->box.y + c->box.h > y + h ? c->box.y + c->box.h : y + h;
+            if (x < c->box.x) c->box.x = x;
+            if (y < c->box.y) c->box.y = y;
+            c->box.w = x1 - c->box.x;
+            c->box.h = y1 - c->box.y;
+            c->area += (long)w * h;
+            c->last = now;
+            pthread_mutex_unlock(&damage_mutex);
+            return;
+        }
+        if (c->last < damage_changes[oldest].last) oldest = i;
+    }
+    damage_changes[oldest] = (DamageChange){ r, now, now, (long)w * h, busy };
+    pthread_mutex_unlock(&damage_mutex);
+}
+
+/* Most recent significant change, preferring ones outside busy areas */
+static bool damage_latest(Rect *out, double now) {
+    int best = -1;
+    pthread_mutex_lock(&damage_mutex);
+    for (int pass = 0; pass < 2 && best < 0; pass++) {
+        for (int i = 0; i < DAMAGE_SLOTS; i++) {
+            const DamageChange *c = &damage_changes[i];
+            if (c->area < DAMAGE_MIN_AREA || now - c->first > DAMAGE_MAX_AGE) continue;
+            if (pass == 0 && c->busy) continue;
+            if (best < 0 || c->first > damage_changes[best].first) best = i;
+        }
+    }
+    if (best >= 0) *out = damage_changes[best].box;
+    pthread_mutex_unlock(&damage_mutex);
+    return best >= 0;
+}
+
+static void* damage_thread_func(void *arg) {
+    (void)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) return NULL;
+
+    int event_base, error_base;
+    if (!XDamageQueryExtension(dpy, &event_base, &error_base)) {
+        fprintf(stderr, "XDamage not available; jump to latest change disabled\n");
+        XCloseDisplay(dpy);
+        return NULL;
+    }
+    Damage damage = XDamageCreate(dpy, DefaultRootWindow(dpy), XDamageReportRawRectangles);
+
+    struct pollfd pfd = { .fd = ConnectionNumber(dpy), .events = POLLIN };
+    while (state.running) {
+        if (!XPending(dpy) && poll(&pfd, 1, 250) <= 0) continue;
+        count_wakeup();
+        /* The monitor thread reloads the layout on RRScreenChangeNotify */
+        damage_set_area(monitor_bounds(dpy));
+        while (XPending(dpy)) {
+            XEvent ev;
+            XNextEvent(dpy, &ev);
+            if (ev.type != event_base + XDamageNotify) continue;
+            XDamageNotifyEvent *dev = (XDamageNotifyEvent *)&ev;
+            damage_note(dev->area.x, dev->area.y, dev->area.width, dev->area.height, get_time());
+            /* Keep the server-side region from growing without bound */
+            if (!dev->more) XDamageSubtract(dpy, damage, None, None);
+        }
+    }
+
+    XDamageDestroy(dpy, damage);
+    XCloseDisplay(dpy);
+    return NULL;
+}
+
+static void damage_start(void) {
+    if (helper_thread_create(&damage_thread, false, damage_thread_func, NULL) != 0) damage_thread = 0;
+}
+
+static void damage_jump(void) {
+    Rect r;
+    if (!damage_latest(&r, get_time())) {
+        show_feedback("No recent change");
+        return;
+    }
+    jump_to(input_display(), r.x + r.w / 2, r.y + r.h / 2);
+}
+
+/* ------------------------------------------------------------------ */
+/* Window Tracking                                                    */
+/* ------------------------------------------------------------------ */
+/*
+ * A thread keeps a cache of top-level windows: the client list from
+ * _NET_CLIENT_LIST and, for each client, its frame (the ancestor that is a
+ * child of the root), frame geometry, map state and _NET_FRAME_EXTENTS.
+ * Root SubstructureNotify events keep geometry and map state current, and
+ * _NET_CLIENT_LIST_STACKING gives each entry its place in the stack. The
+ * server is only queried when either list changes. Without an EWMH
+ * window manager, the mapped normal children of the root are used
+ * instead, newest on top. KP0 chords look up targets in this cache and
+ * then warp once.
+ */
+#define MAX_WINDOWS 128
+
+typedef struct {
+    Window client, frame;
+    Rect frame_r;           /* root coordinates, border included */
+    int ext[4];             /* frame extents: left, right, top, bottom */
+    int stack;              /* higher is nearer the top; 0 = unknown */
+    bool mapped;
+} TrackedWindow;
+
+static TrackedWindow windows[MAX_WINDOWS];
+static int num_windows = 0;
+static Window active_window = None;
+static int window_stack_top = 0;        /* without EWMH: rank of the newest window */
+static pthread_t window_thread = 0;
+static pthread_mutex_t window_mutex = PTHREAD_MUTEX_INITIALIZER;
+static XErrorHandler x_error_previous = NULL;
+
+/* Windows can vanish between an event and our query; that is not fatal */
+static int x_error_ignore_gone(Display *dpy, XErrorEvent *err) {
+    if (err->error_code == BadWindow || err->error_code == BadDrawable) return 0;
+    return x_error_previous ? x_error_previous(dpy, err) : 0;
+}
+
+static Window window_frame(Display *dpy, Window w) {
+    Window root, parent, *children;
+    unsigned int n;
+    while (XQueryTree(dpy, w, &root, &parent, &children, &n)) {
+        if (children) XFree(children);
+        if (parent == root || parent == None) return w;
+        w = parent;
+    }
+    return None;
+}
+
+static void window_read_extents(Display *dpy, TrackedWindow *tw, Atom extents_atom) {
+    Atom type;
+    int format;
+    unsigned long n, after;
+    unsigned char *data = NULL;
+    memset(tw->ext, 0, sizeof(tw->ext));
+    if (XGetWindowProperty(dpy, tw->client, extents_atom, 0, 4, False, XA_CARDINAL,
+                           &type, &format, &n, &after, &data) == Success && data) {
+        if (format == 32 && n == 4) {
+            for (int i = 0; i < 4; i++) tw->ext[i] = (int)((long *)data)[i];
+        }
+        XFree(data);
+    }
+}
+
+/* Fill in a new entry for client; false if it is gone or ours */
+static bool window_load(Display *dpy, TrackedWindow *tw, Window client, Atom extents_atom) {
+    tw->client = client;
+    tw->stack = 0;
+    tw->frame = window_frame(dpy, client);
+    XWindowAttributes wa;
+    if (tw->frame == None || !XGetWindowAttributes(dpy, tw->frame, &wa) || wa.override_redirect) return false;
+    tw->frame_r = (Rect){ wa.x, wa.y, wa.width + 2 * wa.border_width, wa.height + 2 * wa.border_width };
+    tw->mapped = wa.map_state == IsViewable;
+    window_read_extents(dpy, tw, extents_atom);
+    XSelectInput(dpy, client, PropertyChangeMask);
+    return true;
+}
+
+static Window window_read_active(Display *dpy, Atom active_atom) {
+    Atom type;
+    int format;
+    unsigned long n, after;
+    unsigned char *data = NULL;
+    Window w = None;
+    if (XGetWindowProperty(dpy, DefaultRootWindow(dpy), active_atom, 0, 1, False, XA_WINDOW,
+                           &type, &format, &n, &after, &data) == Success && data) {
+        if (format == 32 && n == 1) w = (Window)((long *)data)[0];
+        XFree(data);
+    }
+    return w;
+}
+
+/*
+ * Rebuild the cache from _NET_CLIENT_LIST, keeping entries that are
+ * already known. Returns false when the property is missing.
+ */
+static bool window_sync_list(Display *dpy, Atom list_atom, Atom extents_atom) {
+    Atom type;
+    int format;
+    unsigned long n, after;
+    unsigned char *data = NULL;
+    if (XGetWindowProperty(dpy, DefaultRootWindow(dpy), list_atom, 0, MAX_WINDOWS, False, XA_WINDOW,
+                           &type, &format, &n, &after, &data) != Success || !data) return false;
+    if (format != 32) {
+        XFree(data);
+        return false;
+    }
+
+    static TrackedWindow next[MAX_WINDOWS];
+    int count = 0;
+    for (unsigned long i = 0; i < n && count < MAX_WINDOWS; i++) {
+        Window client = (Window)((long *)data)[i];
+        bool known = false;
+        pthread_mutex_lock(&window_mutex);
+        for (int j = 0; j < num_windows && !known; j++) {
+            if (windows[j].client == client) {
+                next[count++] = windows[j];
+                known = true;
+            }
+        }
+        pthread_mutex_unlock(&window_mutex);
+        if (!known && window_load(dpy, &next[count], client, extents_atom)) count++;
+    }
+    XFree(data);
+
+    pthread_mutex_lock(&window_mutex);
+    memcpy(windows, next, count * sizeof(TrackedWindow));
+    num_windows = count;
+    pthread_mutex_unlock(&window_mutex);
+    return true;
+}
+
+/* Rank the cached windows by _NET_CLIENT_LIST_STACKING, bottom first */
+static void window_sync_stacking(Display *dpy, Atom stacking_atom) {
+    Atom type;
+    int format;
+    unsigned long n, after;
+    unsigned char *data = NULL;
+    if (XGetWindowProperty(dpy, DefaultRootWindow(dpy), stacking_atom, 0, MAX_WINDOWS, False, XA_WINDOW,
+                           &type, &format, &n, &after, &data) != Success || !data) return;
+    if (format == 32) {
+        pthread_mutex_lock(&window_mutex);
+        for (int i = 0; i < num_windows; i++) windows[i].stack = 0;
+        for (unsigned long k = 0; k < n; k++) {
+            Window client = (Window)((long *)data)[k];
+            for (int i = 0; i < num_windows; i++) {
+                if (windows[i].client == client) windows[i].stack = (int)k + 1;
+            }
+        }
+        pthread_mutex_unlock(&window_mutex);
+    }
+    XFree(data);
+}
+
+/* XQueryTree lists the root's children bottom first, and a newly mapped window goes on top */
+static void window_add_toplevel(Display *dpy, Window w, Atom extents_atom) {
+    TrackedWindow tw;
+    if (!window_load(dpy, &tw, w, extents_atom)) return;
+    pthread_mutex_lock(&window_mutex);
+    tw.stack = ++window_stack_top;
+    if (num_windows < MAX_WINDOWS) windows[num_windows++] = tw;
+    pthread_mutex_unlock(&window_mutex);
+}
+
+static void window_remove(Window w) {
+    pthread_mutex_lock(&window_mutex);
+    for (int i = 0; i < num_windows; i++) {
+        if (windows[i].client == w || windows[i].frame == w) {
+            windows[i] = windows[--num_windows];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&window_mutex);
+}
+
+static void* window_thread_func(void *arg) {
+    (void)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) return NULL;
+
+    Window root = DefaultRootWindow(dpy);
+    Atom list_atom = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
+    Atom stacking_atom = XInternAtom(dpy, "_NET_CLIENT_LIST_STACKING", False);
+    Atom active_atom = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
+    Atom extents_atom = XInternAtom(dpy, "_NET_FRAME_EXTENTS", False);
+
+    XSelectInput(dpy, root, SubstructureNotifyMask | PropertyChangeMask);
+    bool ewmh = window_sync_list(dpy, list_atom, extents_atom);
+    if (ewmh) window_sync_stacking(dpy, stacking_atom);
+    if (!ewmh) {
+        Window r, p, *children;
+        unsigned int n;
+        if (XQueryTree(dpy, root, &r, &p, &children, &n)) {
+            for (unsigned int i = 0; i < n; i++) window_add_toplevel(dpy, children[i], extents_atom);
+            if (children) XFree(children);
+        }
+    }
+    Window active = window_read_active(dpy, active_atom);
+    pthread_mutex_lock(&window_mutex);
+    active_window = active;
+    pthread_mutex_unlock(&window_mutex);
+
+    struct pollfd pfd = { .fd = ConnectionNumber(dpy), .events = POLLIN };
+    while (state.running) {
+        if (!XPending(dpy) && poll(&pfd, 1, 250) <= 0) continue;
+        count_wakeup();
+        while (XPending(dpy)) {
+            XEvent ev;
+            XNextEvent(dpy, &ev);
+            switch (ev.type) {
+                case PropertyNotify:
+                    if (ev.xproperty.window == root && ev.xproperty.atom == list_atom) {
+                        ewmh = window_sync_list(dpy, list_atom, extents_atom);
+                        if (ewmh) window_sync_stacking(dpy, stacking_atom);
+                    } else if (ev.xproperty.window == root && ev.xproperty.atom == stacking_atom) {
+                        window_sync_stacking(dpy, stacking_atom);
+                    } else if (ev.xproperty.window == root && ev.xproperty.atom == active_atom) {
+                        active = window_read_active(dpy, active_atom);
+                        pthread_mutex_lock(&window_mutex);
+                        active_window = active;
+                        pthread_mutex_unlock(&window_mutex);
+                    } else if (ev.xproperty.atom == extents_atom) {
+                        TrackedWindow tw = { .client = ev.xproperty.window };
+                        window_read_extents(dpy, &tw, extents_atom);
+                        pthread_mutex_lock(&window_mutex);
+                        for (int i = 0; i < num_windows; i++) {
+                            if (windows[i].client == tw.client) memcpy(windows[i].ext, tw.ext, sizeof(tw.ext));
+                        }
+                        pthread_mutex_unlock(&window_mutex);
+                    }
+                    break;
+                case ConfigureNotify:
+                    pthread_mutex_lock(&window_mutex);
+                    for (int i = 0; i < num_windows; i++) {
+                        if (windows[i].frame != ev.xconfigure.window) continue;
+                        int bw = ev.xconfigure.border_width;
+                        windows[i].frame_r = (Rect){ ev.xconfigure.x, ev.xconfigure.y,
+                                                     ev.xconfigure.width + 2 * bw, ev.xconfigure.height + 2 * bw };
+                    }
+                    pthread_mutex_unlock(&window_mutex);
+                    break;
+                case MapNotify:
+                case UnmapNotify:
+                    pthread_mutex_lock(&window_mutex);
+                    for (int i = 0; i < num_windows; i++) {
+                        if (windows[i].frame == ev.xany.window) windows[i].mapped = ev.type == MapNotify;
+                    }
+                    pthread_mutex_unlock(&window_mutex);
+                    if (!ewmh && ev.type == MapNotify) {
+                        window_remove(ev.xmap.window);
+                        window_add_toplevel(dpy, ev.xmap.window, extents_atom);
+                    }
+                    break;
+                case ReparentNotify: {
+                    /* The window manager framed a client we already know */
+                    Window frame = window_frame(dpy, ev.xreparent.window);
+                    XWindowAttributes wa;
+                    if (frame == None || !XGetWindowAttributes(dpy, frame, &wa)) break;
+                    pthread_mutex_lock(&window_mutex);
+                    for (int i = 0; i < num_windows; i++) {
+                        if (windows[i].client != ev.xreparent.window) continue;
+                        windows[i].frame = frame;
+                        windows[i].frame_r = (Rect){ wa.x, wa.y, wa.width + 2 * wa.border_width,
+                                                     wa.height + 2 * wa.border_width };
+                        windows[i].mapped = wa.map_state == IsViewable;
+                    }
+                    pthread_mutex_unlock(&window_mutex);
+                    break;
+                }
+                case DestroyNotify:
+                    window_remove(ev.xdestroywindow.window);
+                    break;
+            }
+        }
+    }
+
+    XCloseDisplay(dpy);
+    return NULL;
+}
+
+static void window_tracker_start(void) {
+    x_error_previous = XSetErrorHandler(x_error_ignore_gone);
+    if (helper_thread_create(&window_thread, false, window_thread_func, NULL) != 0) window_thread = 0;
+}
+
+/* Client area of a tracked window: the frame minus its decorations */
+static Rect window_client_rect(const TrackedWindow *tw) {
+    return (Rect){ tw->frame_r.x + tw->ext[0], tw->frame_r.y + tw->ext[2],
+                   tw->frame_r.w - tw->ext[0] - tw->ext[1], tw->frame_r.h - tw->ext[2] - tw->ext[3] };
+}
+
+static bool rect_contains(const Rect *r, int x, int y) {
+    return x >= r->x && y >= r->y && x < r->x + r->w && y < r->y + r->h;
+}
+
+/* The focused window, or else the topmost one under (px, py); -1 if none */
+static int window_current(int px, int py) {
+    for (int i = 0; i < num_windows; i++) {
+        if (windows[i].mapped && windows[i].client == active_window) return i;
+    }
+    int top = -1;
+    for (int i = 0; i < num_windows; i++) {
+        if (!windows[i].mapped || !rect_contains(&windows[i].frame_r, px, py)) continue;
+        if (top < 0 || windows[i].stack > windows[top].stack) top = i;
+    }
+    return top;
+}
+
+/*
+ * KP6/KP4 only warp and never change focus, so repeats step on from the
+ * window they last reached; a focus change starts over from the focused
+ * window. Called with window_mutex held.
+ */
+static Window window_cycle = None;
+static Window window_cycle_focus = None;
+
+static int window_cycle_from(int cur) {
+    if (window_cycle == None || window_cycle_focus != active_window) return cur;
+    for (int i = 0; i < num_windows; i++) {
+        if (windows[i].mapped && windows[i].client == window_cycle) return i;
+    }
+    return cur;
+}
+
+/* Reading order of window centres: top to bottom in bands, then left to right */
+static int window_order_cmp(const TrackedWindow *a, const TrackedWindow *b) {
+    int ay = (a->frame_r.y + a->frame_r.h / 2) / 64, by = (b->frame_r.y + b->frame_r.h / 2) / 64;
+    if (ay != by) return ay - by;
+    int ax = a->frame_r.x + a->frame_r.w / 2, bx = b->frame_r.x + b->frame_r.w / 2;
+    if (ax != bx) return ax - bx;
+    return a->client < b->client ? -1 : a->client > b->client;
+}
+
+/* Neighbour of window `from` in reading order among mapped windows */
+static int window_step(int from, int dir) {
+    int best = -1, wrap = -1;
+    for (int i = 0; i < num_windows; i++) {
+        if (i == from || !windows[i].mapped) continue;
+        int rel = from < 0 ? dir : window_order_cmp(&windows[i], &windows[from]) * dir;
+        if (rel > 0 && (best < 0 || window_order_cmp(&windows[i], &windows[best]) * dir < 0)) best = i;
+        if (wrap < 0 || window_order_cmp(&windows[i], &windows[wrap]) * dir < 0) wrap = i;
+    }
+    return best >= 0 ? best : wrap;
+}
+
+/*
+ * Warp to a target on the current window: KP7/9/1/3 corners and KP5 the
+ * centre of its client area (JUMP_MARGIN inside), KP8 its title bar. KP6
+ * and KP4 move to the centre of the next or previous window.
+ */
+static bool window_jump(uint16_t code) {
+    Display *dpy = input_display();
+    int px = 0, py = 0;
+    query_pointer(dpy, &px, &py);
+
+    pthread_mutex_lock(&window_mutex);
+    int cur = window_current(px, py);
+    if (code == KEY_KP6 || code == KEY_KP4) {
+        cur = window_step(window_cycle_from(cur), code == KEY_KP6 ? 1 : -1);
+        window_cycle = cur >= 0 ? windows[cur].client : None;
+        window_cycle_focus = active_window;
+    }
+    if (cur < 0) {
+        pthread_mutex_unlock(&window_mutex);
+        show_feedback("No window here");
+        return false;
+    }
+    TrackedWindow tw = windows[cur];
+    pthread_mutex_unlock(&window_mutex);
+
+    Rect r = window_client_rect(&tw);
+    int m = state.cfg.jump_margin;
+    if (2 * m >= r.w || 2 * m >= r.h) m = 0;
+    int left = r.x + m, right = r.x + r.w - 1 - m;
+    int top = r.y + m, bottom = r.y + r.h - 1 - m;
+    int x = r.x + r.w / 2, y = r.y + r.h / 2;
+
+    switch (code) {
+        case KEY_KP7: x = left; y = top; break;
+        case KEY_KP9: x = right; y = top; break;
+        case KEY_KP1: x = left; y = bottom; break;
+        case KEY_KP3: x = right; y = bottom; break;
+        case KEY_KP8:
+            /* Middle of the decoration if the WM draws one, else just inside the top */
+            y = tw.ext[2] > 0 ? tw.frame_r.y + tw.ext[2] / 2 : top;
+            break;
+        default:
+            break;
+    }
+    jump_to(dpy, x, y);
+    return true;
+}
+
+/* ------------------------------------------------------------------ */
+/* Pointer History and Marks                                          */
+/* ------------------------------------------------------------------ */
+/*
+ * Jumps push where the pointer was and where it landed, and clicks push
+ * where they happened, onto a fixed ring. Back and forward step a cursor
+ * through the ring and warp straight to the stored position. The newest
+ * entry is taken as the current place, so recalling never has to ask the
+ * server where the pointer is. Pushing after going back drops the
+ * forward entries, like a browser.
+ *
+ * Named marks live in a small file mapped MAP_SHARED, so setting one is
+ * a plain store and it survives restarts without explicit saving.
+ */
+#define HISTORY_SIZE 64
+#define HISTORY_MERGE 16            /* px; closer positions are the same place */
+#define MARKS_MAGIC 0x4b41544dU     /* "KATM" */
+
+typedef struct {
+    int x, y;
+} HistoryEntry;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t set;                   /* bit per letter of hint_alphabet */
+    int32_t pos[26][2];
+} MarkFile;
+
+static HistoryEntry history[HISTORY_SIZE];
+static unsigned history_head = 0;   /* entries ever pushed */
+static unsigned history_tail = 0;   /* oldest entry still in the ring */
+static unsigned history_cursor = 0; /* entry being visited, head - 1 when live */
+static pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER; /* the anchor search jumps too */
+static MarkFile marks_mem;          /* used when the file cannot be mapped */
+static MarkFile *marks = &marks_mem;
+static int mark_pending = 0;        /* 1 = set, 2 = jump: waiting for the letter */
+
+static void history_push(int x, int y) {
+    pthread_mutex_lock(&history_mutex);
+    if (history_head > history_tail) {
+        history_head = history_cursor + 1;
+        HistoryEntry *last = &history[(history_head - 1) % HISTORY_SIZE];
+        if (abs(last->x - x) <= HISTORY_MERGE && abs(last->y - y) <= HISTORY_MERGE) {
+            *last = (HistoryEntry){ x, y };
+            pthread_mutex_unlock(&history_mutex);
+            return;
+        }
+    }
+    history[history_head % HISTORY_SIZE] = (HistoryEntry){ x, y };
+    history_head++;
+    if (history_head - history_tail > HISTORY_SIZE) history_tail++;
+    history_cursor = history_head - 1;
+    pthread_mutex_unlock(&history_mutex);
+}
+
+static void history_note_pointer(void) {
+    int x, y;
+    if (query_pointer(input_display(), &x, &y)) history_push(x, y);
+}
+
+/* Warp that is remembered: both ends go onto the history ring */
+static void jump_to(Display *dpy, int x, int y) {
+    int px, py;
+    /* Mid-glide, the jump starts from where the previous one is headed */
+    if (anim_target(&px, &py) || query_pointer(dpy, &px, &py)) history_push(px, py);
+    anim_warp(dpy, x, y);
+    history_push(x, y);
+}
+
+static void history_step(int dir) {
+    const char *msg = NULL;
+    HistoryEntry e;
+    pthread_mutex_lock(&history_mutex);
+    if (history_head == history_tail) {
+        msg = "No pointer history";
+    } else if (dir < 0 ? history_cursor == history_tail : history_cursor + 1 == history_head) {
+        msg = dir < 0 ? "Oldest position" : "Newest position";
+    } else {
+        history_cursor += dir;
+        e = history[history_cursor % HISTORY_SIZE];
+    }
+    pthread_mutex_unlock(&history_mutex);
+    if (msg) show_feedback(msg);
+    else warp_mouse(input_display(), e.x, e.y);
+}
+
+static void marks_open(const char *path) {
+    int fd = user_file_open(path, O_RDWR | O_CREAT);
+    if (fd < 0) {
+        perror("Failed to open marks file");
+        return;
+    }
+    if (ftruncate(fd, sizeof(MarkFile)) < 0) {
+        perror("Failed to size marks file");
+        close(fd);
+        return;
+    }
+    void *p = mmap(NULL, sizeof(MarkFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("Failed to map marks file");
+        return;
+    }
+    marks = p;
+    if (marks->magic != MARKS_MAGIC) {
+        memset(marks, 0, sizeof(MarkFile));
+        marks->magic = MARKS_MAGIC;
+    }
+}
+
+static void mark_set(int letter) {
+    int x, y;
+    if (!query_pointer(input_display(), &x, &y)) return;
+    marks->pos[letter][0] = x;
+    marks->pos[letter][1] = y;
+    marks->set |= 1u << letter;
+
+    char msg[32];
+    snprintf(msg, sizeof(msg), "Mark %c set", hint_alphabet[letter]);
+    show_feedback(msg);
+}
+
+static void mark_jump(int letter) {
+    if (!(marks->set & (1u << letter))) {
+        char msg[32];
+        snprintf(msg, sizeof(msg), "Mark %c not set", hint_alphabet[letter]);
+        show_feedback(msg);
+        return;
+    }
+    jump_to(input_display(), marks->pos[letter][0], marks->pos[letter][1]);
+}
+
+/* ------------------------------------------------------------------ */
+/* Pointer Macros                                                     */
+/* ------------------------------------------------------------------ */
+/*
+ * KPDOT+KPSLASH starts and stops recording what the daemon does to the
+ * pointer: every warp (as a delta from the previous one), button and
+ * wheel event. KPDOT+NumLock replays it at the recorded timing,
+ * KPDOT+KPENTER as fast as the desktop takes it; either key stops a
+ * running replay. Replay runs on its own thread, one batch per monitor
+ * frame: the frame's moves collapse into a single warp, and its button and
+ * wheel events go out in one uinput report, so a click always acts where
+ * the moves before it led. Macros are relative to where the pointer is
+ * when replay starts, and the last one is kept in ~/.config/kat/macro.
+ */
+#define MACRO_MAX 4096
+#define MACRO_MAGIC 0x5041544bU     /* "KATP" */
+
+enum { MACRO_MOVE, MACRO_BUTTON, MACRO_REL };
+
+typedef struct {
+    uint32_t t_ms;          /* since recording started */
+    uint16_t kind;
+    uint16_t code;          /* button or REL_* code */
+    int32_t a, b;           /* move: dx, dy; button and rel: value in a */
+} MacroAction;
+
+static pthread_mutex_t macro_mutex = PTHREAD_MUTEX_INITIALIZER;
+static MacroAction macro[MACRO_MAX];
+static int macro_len = 0;
+static atomic_bool macro_recording = false;
+static atomic_bool macro_playing = false;
+static atomic_bool macro_cancel = false;
+static double macro_record_start;
+static int macro_last_x, macro_last_y;   /* last warp target while recording */
+static const char *macro_path = NULL;
+static int macro_release_code = -1;
+
+/* Called with macro_mutex held */
+static void macro_append(uint16_t kind, uint16_t code, int32_t a, int32_t b) {
+    if (macro_len == MACRO_MAX) return;
+    uint32_t t = (uint32_t)((get_time() - macro_record_start) * 1000.0);
+    /* Warps in the same millisecond fold into one move */
+    if (kind == MACRO_MOVE && macro_len > 0) {
+        MacroAction *last = &macro[macro_len - 1];
+        if (last->kind == MACRO_MOVE && last->t_ms == t) {
+            last->a += a;
+            last->b += b;
+            return;
+        }
+    }
+    macro[macro_len++] = (MacroAction){ t, kind, code, a, b };
+}
+
+static void macro_note_warp(int x, int y) {
+    if (!atomic_load_explicit(&macro_recording, memory_order_relaxed)) return;
+    pthread_mutex_lock(&macro_mutex);
+    if (macro_recording && (x != macro_last_x || y != macro_last_y)) {
+        macro_append(MACRO_MOVE, 0, x - macro_last_x, y - macro_last_y);
+        macro_last_x = x;
+        macro_last_y = y;
+    }
+    pthread_mutex_unlock(&macro_mutex);
+}
+
+static void macro_note_mouse(uint16_t type, uint16_t code, int32_t value) {
+    if (!atomic_load_explicit(&macro_recording, memory_order_relaxed)) return;
+    if (type != EV_KEY && type != EV_REL) return;
+    pthread_mutex_lock(&macro_mutex);
+    if (macro_recording) macro_append(type == EV_KEY ? MACRO_BUTTON : MACRO_REL, code, value, 0);
+    pthread_mutex_unlock(&macro_mutex);
+}
+
+static void macro_save(void) {
+    if (!macro_path) return;
+    FILE *f = user_file_fopen(macro_path, "wb");
+    if (!f) {
+        perror("Failed to save macro");
+        return;
+    }
+    uint32_t header[2] = { MACRO_MAGIC, (uint32_t)macro_len };
+    if (fwrite(header, sizeof(header), 1, f) != 1 ||
+        fwrite(macro, sizeof(MacroAction), macro_len, f) != (size_t)macro_len) perror("Failed to save macro");
+    fclose(f);
+}
+
+static void macro_open(const char *path) {
+    macro_path = path;
+    FILE *f = user_file_fopen(path, "rb");
+    if (!f) return;
+    uint32_t header[2];
+    if (fread(header, sizeof(header), 1, f) == 1 && header[0] == MACRO_MAGIC && header[1] <= MACRO_MAX &&
+        fread(macro, sizeof(MacroAction), header[1], f) == header[1]) {
+        macro_len = (int)header[1];
+    }
+    fclose(f);
+}
+
+static void macro_toggle_record(void) {
+    if (macro_playing) {
+        show_feedback("Macro is playing");
+        return;
+    }
+    pthread_mutex_lock(&macro_mutex);
+    bool was_recording = macro_recording;
+    if (!was_recording) {
+        macro_len = 0;
+        macro_record_start = get_time();
+        macro_last_x = macro_last_y = 0;
+        query_pointer(input_display(), &macro_last_x, &macro_last_y);
+    }
+    atomic_store(&macro_recording, !was_recording);
+    int len = macro_len;
+    pthread_mutex_unlock(&macro_mutex);
+
+    if (!was_recording) {
+        show_feedback("Recording macro");
+        return;
+    }
+    macro_save();
+    char msg[48];
+    snprintf(msg, sizeof(msg), "Macro recorded: %d actions", len);
+    show_feedback(msg);
+}
+
+static void macro_sleep_until(Display *dpy, double t) {
+    if (!dpy) return;   /* headless replay runs on the spot */
+    struct timespec ts = { (time_t)t, (long)((t - (time_t)t) * 1e9) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+    count_wakeup();
+}
+
+static void macro_run(Display *dpy, bool fast) {
+    int x, y;
+    if (!query_pointer(dpy, &x, &y)) return;
+    double period = 1.0 / monitor_at(dpy, x, y).hz;
+    double start = mono_ns() * 1e-9;
+    unsigned held = 0;      /* buttons the macro has down, bit per BTN_LEFT + n */
+    long frame = 0;
+    int i = 0;
+
+    while (i < macro_len && !macro_cancel && state.running && state.mouse_mode) {
+        if (!fast) {
+            /* Sleep through gaps instead of waking every frame */
+            long due = (long)(macro[i].t_ms / 1000.0 / period);
+            if (due > frame) frame = due;
+        }
+        macro_sleep_until(dpy, start + frame * period);
+        double now_ms = frame * period * 1000.0;
+        frame++;
+
+        /* Moves up to the next button or wheel event become one warp */
+        bool moved = false;
+        while (i < macro_len && macro[i].kind == MACRO_MOVE && (fast || macro[i].t_ms <= now_ms)) {
+            x += macro[i].a;
+            y += macro[i].b;
+            moved = true;
+            i++;
+        }
+        if (moved) warp_mouse(dpy, x, y);
+
+        /* Then at most one button change and the wheel motion, in one report */
+        bool button = false, sent = false;
+        int32_t rel[REL_CNT] = {0};
+        while (i < macro_len && macro[i].kind != MACRO_MOVE && (fast || macro[i].t_ms <= now_ms)) {
+            const MacroAction *a = &macro[i];
+            if (a->kind == MACRO_BUTTON) {
+                if (button) break;
+                button = true;
+                emit_event(state.mouse_fd, EV_KEY, a->code, a->a);
+                unsigned bit = 1u << ((a->code - BTN_LEFT) & 31);
+                held = a->a ? held | bit : held & ~bit;
+            } else if (a->code < REL_CNT) {
+                rel[a->code] += a->a;
+            }
+            sent = true;
+            i++;
+        }
+        for (int c = 0; c < REL_CNT; c++) {
+            if (rel[c]) emit_event(state.mouse_fd, EV_REL, c, rel[c]);
+        }
+        if (sent) emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+    }
+
+    /* Never leave a button down behind the daemon's back */
+    for (int b = 0; held; b++, held >>= 1) {
+        if (!(held & 1)) continue;
+        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT + b, 0);
+        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+    }
+}
+
+static void* macro_thread_func(void *arg) {
+    bool fast = arg != NULL;
+    Display *dpy = XOpenDisplay(NULL);
+    if (dpy) {
+        macro_run(dpy, fast);
+        XCloseDisplay(dpy);
+    }
+    atomic_store(&macro_playing, false);
+    return NULL;
+}
+
+static void macro_play(bool fast) {
+    if (macro_playing) {
+        atomic_store(&macro_cancel, true);
+        show_feedback("Macro stopped");
+        return;
+    }
+    if (macro_recording) {
+        show_feedback("Stop recording first");
+        return;
+    }
+    if (macro_len == 0) {
+        show_feedback("No macro recorded");
+        return;
+    }
+    atomic_store(&macro_cancel, false);
+    atomic_store(&macro_playing, true);
+    if (headless) {
+        macro_run(NULL, fast);
+        atomic_store(&macro_playing, false);
+        return;
+    }
+
+    pthread_t th;
+    if (helper_thread_create(&th, true, macro_thread_func, fast ? (void *)1 : NULL) != 0)
+        atomic_store(&macro_playing, false);
+}
+
+/* ------------------------------------------------------------------ */
+/* Dwell Click                                                        */
+/* ------------------------------------------------------------------ */
+/*
+ * With DWELL_MS set, a left click follows once the pointer has rested
+ * that long after the daemon last moved it. Rest is judged from the
+ * daemon's own warps: each one only restamps dwell_last_motion, and one
+ * thread sleeps until that stamp plus DWELL_MS, so nothing polls the
+ * pointer and an idle daemon never wakes for it. While a click is
+ * pending a small bar beside the pointer fills up; any key press
+ * cancels it, and Esc does nothing else then.
+ */
+#define DWELL_FRAME 0.05        /* seconds between progress bar updates */
+#define DWELL_SHOW_AFTER 0.15   /* rest before the bar appears */
+#define DWELL_SLOP 8            /* px the pointer may drift before the click is dropped */
+#define DWELL_BAR_W 40
+#define DWELL_BAR_H 6
+#define DWELL_OFFSET 16
+
+static pthread_mutex_t dwell_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dwell_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t dwell_thread = 0;
+static bool dwell_armed = false;
+static double dwell_last_motion;
+static int dwell_x, dwell_y;        /* where the last warp left the pointer */
+static int dwell_release_code = -1;
+
+static void dwell_note_motion(int x, int y) {
+    if (state.cfg.dwell_ms <= 0 || !state.mouse_mode) return;
+    if (atomic_load_explicit(&macro_playing, memory_order_relaxed)) return;
+    pthread_mutex_lock(&dwell_mutex);
+    dwell_last_motion = anim_clock();
+    dwell_x = x;
+    dwell_y = y;
+    /* The thread rereads the stamp when it wakes, so only arming needs a signal */
+    if (!dwell_armed) {
+        dwell_armed = true;
+        pthread_cond_signal(&dwell_cond);
+    }
+    pthread_mutex_unlock(&dwell_mutex);
+}
+
+/* Drop a pending dwell click; true if there was one */
+static bool dwell_cancel(void) {
+    pthread_mutex_lock(&dwell_mutex);
+    bool was_armed = dwell_armed;
+    if (was_armed) {
+        dwell_armed = false;
+        pthread_cond_signal(&dwell_cond);
+    }
+    pthread_mutex_unlock(&dwell_mutex);
+    return was_armed;
+}
+
+/* Click at rest, unless the pointer was moved away behind the daemon's back */
+static void dwell_click(Display *dpy, int x, int y) {
+    if (!state.mouse_mode || state.left_button_held) return;
+    int px = x, py = y;
+    if (query_pointer(dpy, &px, &py) && (abs(px - x) > DWELL_SLOP || abs(py - y) > DWELL_SLOP)) return;
+    emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 1);
+    emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+    clock_sleep_us(10000);
+    emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
+    emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+}
+
+static Window dwell_win = None;
+static GC dwell_gc = None;
+static bool dwell_mapped = false;
+
+static void dwell_bar_show(Display *dpy, int x, int y, double done) {
+    int scr_w, scr_h;
+    screen_size(dpy, &scr_w, &scr_h);
+    int wx = x + DWELL_OFFSET, wy = y + DWELL_OFFSET;
+    if (wx + DWELL_BAR_W + 2 > scr_w) wx = x - DWELL_OFFSET - DWELL_BAR_W - 2;
+    if (wy + DWELL_BAR_H + 2 > scr_h) wy = y - DWELL_OFFSET - DWELL_BAR_H - 2;
+
+    if (dwell_win == None) {
+        XSetWindowAttributes attrs = {0};
+        attrs.override_redirect = True;
+        attrs.background_pixel = 0xFFFFFF;
+        attrs.border_pixel = 0;
+        dwell_win = XCreateWindow(dpy, DefaultRootWindow(dpy), wx, wy, DWELL_BAR_W, DWELL_BAR_H, 1,
+                                  CopyFromParent, InputOutput, CopyFromParent,
+                                  CWOverrideRedirect | CWBackPixel | CWBorderPixel, &attrs);
+        XShapeCombineRectangles(dpy, dwell_win, ShapeInput, 0, 0, NULL, 0, ShapeSet, Unsorted);
+        dwell_gc = XCreateGC(dpy, dwell_win, 0, NULL);
+        XSetForeground(dpy, dwell_gc, BlackPixel(dpy, DefaultScreen(dpy)));
+    }
+    XMoveWindow(dpy, dwell_win, wx, wy);
+    if (!dwell_mapped) {
+        XMapRaised(dpy, dwell_win);
+        dwell_mapped = true;
+    }
+    overlay_track(dwell_win, wx, wy, DWELL_BAR_W + 2, DWELL_BAR_H + 2);
+
+    XClearWindow(dpy, dwell_win);
+    XFillRectangle(dpy, dwell_win, dwell_gc, 0, 0, (unsigned)(DWELL_BAR_W * done), DWELL_BAR_H);
+    XFlush(dpy);
+}
+
+static void dwell_bar_hide(Display *dpy) {
+    if (!dwell_mapped) return;
+    overlay_untrack(dwell_win);
+    XUnmapWindow(dpy, dwell_win);
+    XFlush(dpy);
+    dwell_mapped = false;
+}
+
+static void* dwell_thread_func(void *arg) {
+    (void)arg;
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) return NULL;
+
+    pthread_mutex_lock(&dwell_mutex);
+    while (state.running) {
+        double total = state.cfg.dwell_ms / 1000.0;
+        if (dwell_armed && (total <= 0.0 || !state.mouse_mode)) dwell_armed = false;
+        if (!dwell_armed) {
+            pthread_mutex_unlock(&dwell_mutex);
+            dwell_bar_hide(dpy);
+            pthread_mutex_lock(&dwell_mutex);
+            /* No timeout: nothing wakes this thread until the daemon moves the pointer */
+            if (!dwell_armed) pthread_cond_wait(&dwell_cond, &dwell_mutex);
+            continue;
+        }
+
+        double now = anim_clock();
+        double rest = now - dwell_last_motion;
+        int x = dwell_x, y = dwell_y;
+        if (rest >= total) dwell_armed = false;
+        pthread_mutex_unlock(&dwell_mutex);
+
+        if (rest >= total) {
+            dwell_bar_hide(dpy);
+            dwell_click(dpy, x, y);
+        } else if (rest >= DWELL_SHOW_AFTER) {
+            dwell_bar_show(dpy, x, y, rest / total);
+        }
+
+        pthread_mutex_lock(&dwell_mutex);
+        if (!dwell_armed) continue;
+        double wake = now + DWELL_FRAME;
+        double deadline = dwell_last_motion + total;
+        if (wake > deadline) wake = deadline;
+        double wait = wake - anim_clock();
+        if (wait <= 0.0) continue;
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        long sec = (long)wait;
+        ts.tv_sec += sec;
+        ts.tv_nsec += (long)((wait - sec) * 1e9);
+        if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+        pthread_cond_timedwait(&dwell_cond, &dwell_mutex, &ts);
+        count_wakeup();
+    }
+    pthread_mutex_unlock(&dwell_mutex);
+
+    if (dwell_gc) XFreeGC(dpy, dwell_gc);
+    if (dwell_win != None) {
+        overlay_untrack(dwell_win);
+        XDestroyWindow(dpy, dwell_win);
+    }
+    XCloseDisplay(dpy);
+    return NULL;
+}
+
+static void dwell_start_thread(void) {
+    if (helper_thread_create(&dwell_thread, false, dwell_thread_func, NULL) != 0) dwell_thread = 0;
+}
+
+/* Replay: click if the pointer has rested long enough by the virtual time `until` */
+static void dwell_catch_up(double until) {
+    if (!dwell_armed) return;
+    double deadline = dwell_last_motion + state.cfg.dwell_ms / 1000.0;
+    if (deadline > until) return;
+    if (clock_virtual_now < deadline) clock_virtual_now = deadline;
+    dwell_armed = false;
+    dwell_click(NULL, dwell_x, dwell_y);
+}
+
+/* ------------------------------------------------------------------ */
+/* Numpad 0 Layer                                                     */
+/* ------------------------------------------------------------------ */
+/*
+ * Holding KP0 turns other numpad keys into jump chords. Until a chord key
+ * arrives the press is undecided: a release makes it a tap, any other key
+ * sends the 0 ahead of itself, and holding it past KP0_HOLD_TIME sends
+ * the press so 0 repeats like any held key. The input loop wakes for that
+ * deadline; replay catches up to it on the virtual clock.
+ */
+#define KP0_HOLD_TIME 0.5         /* seconds before an unchorded 0 is typed */
+
+static bool kp0_held = false;
+static bool kp0_used = false;
+static double kp0_held_since = 0.0;
+static int kp0_chord_code = -1;    /* swallow the release of the chord key */
+
+static bool kp0_chord_key(int code) {
+    switch (code) {
+        case KEY_KPSLASH: case KEY_KPPLUS: case KEY_KPENTER:
+        case KEY_KPMINUS: case KEY_KPASTERISK:
+        case KEY_KP7: case KEY_KP8: case KEY_KP9:
+        case KEY_KP4: case KEY_KP5: case KEY_KP6:
+        case KEY_KP1: case KEY_KP3:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* The held KP0 turned out to be a plain key: end a drag and send its press */
+static void kp0_forward_press(void) {
+    kp0_held = false;
+    if (state.left_button_held) {
+        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
+        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+        state.left_button_held = false;
+        state.drag_locked = false;
+        hide_drag_popup();
+    }
+    emit_event(state.uinput_fd, EV_KEY, KEY_KP0, 1);
+    emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
+}
+
+static bool kp0_undecided(void) {
+    return kp0_held && !kp0_used && !mark_pending;
+}
+
+/* A non-chord press while KP0 is undecided types the 0 first, keeping the order */
+static void kp0_feed(const struct input_event *ev) {
+    if (!kp0_undecided() || ev->value != 1) return;
+    if (ev->code == KEY_KP0 || kp0_chord_key(ev->code)) return;
+    kp0_forward_press();
+}
+
+/* Milliseconds until an undecided KP0 is typed, or -1 when none is pending */
+static int kp0_timeout_ms(void) {
+    if (!kp0_undecided()) return -1;
+    double left = kp0_held_since + KP0_HOLD_TIME - get_time();
+    return left > 0.0 ? (int)(left * 1000.0) + 1 : 0;
+}
+
+/* Type an undecided KP0 once it has been held KP0_HOLD_TIME by `until` */
+static void kp0_catch_up(double until) {
+    if (!kp0_undecided()) return;
+    double deadline = kp0_held_since + KP0_HOLD_TIME;
+    if (deadline > until) return;
+    if (clock_virtual && clock_virtual_now < deadline) clock_virtual_now = deadline;
+    kp0_forward_press();
+}
+
+/* ------------------------------------------------------------------ */
+/* Device Handling Functions                                          */
+/* ------------------------------------------------------------------ */
+static bool is_keyboard(const char *device_path) {
+    int fd = open(device_path, O_RDONLY);
+    if (fd < 0) return false;
+
+    unsigned long key_bits[NBITS(KEY_MAX)];
+    memset(key_bits, 0, sizeof(key_bits));
+
+    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits) < 0) {
+        close(fd);
+        return false;
+    }
+
+    bool has_a = test_bit(KEY_A, key_bits);
+    bool has_space = test_bit(KEY_SPACE, key_bits);
+    bool has_ctrl = test_bit(KEY_LEFTCTRL, key_bits);
+
+    close(fd);
+    return has_a && has_space && has_ctrl;
+}
+
+static bool is_virtual_device(const char *device_path) {
+    int fd = open(device_path, O_RDONLY);
+    if (fd < 0) return false;
+
+    char name[256] = "";
+    ioctl(fd, EVIOCGNAME(sizeof(name)), name);
+    close(fd);
+
+    return strstr(name, "evdev") || strstr(name, "uinput") ||
+           strstr(name, "Virtual") || strstr(name, "py-");
+}
+
+/* Explicit --keyboard devices replace the /dev/input scan */
+static const char *keyboard_paths[MAX_KBDS];
+static int num_keyboard_paths = 0;
+
+static void grab_keyboard(const char *device_path) {
+    /* Writable for LED feedback; reading is all that is really needed */
+    int fd = open(device_path, O_RDWR);
+    if (fd < 0) fd = open(device_path, O_RDONLY);
+    if (fd < 0) return;
+
+    if (ioctl(fd, EVIOCGRAB, 1) < 0) {
+        perror("Cannot grab keyboard");
+        close(fd);
+        return;
+    }
+
+    /* Timestamps comparable with mono_ns() for the forward latency histogram */
+    int clk = CLOCK_MONOTONIC;
+    ioctl(fd, EVIOCSCLOCKID, &clk);
+
+    char name[256] = "Unknown";
+    ioctl(fd, EVIOCGNAME(sizeof(name)), name);
+    printf("Grabbed keyboard: %s (%s)\n", name, device_path);
+
+    state.kbd_fds[state.num_kbds++] = fd;
+}
+
+static int find_all_keyboards(void) {
+    state.num_kbds = 0;
+
+    if (num_keyboard_paths > 0) {
+        for (int i = 0; i < num_keyboard_paths; i++) {
+            if (is_keyboard(keyboard_paths[i])) grab_keyboard(keyboard_paths[i]);
+        }
+    } else {
+        DIR *dir = opendir(INPUT_DIR);
+        if (!dir) {
+            perror("Cannot open /dev/input");
+            return -1;
+        }
+
+        struct dirent *entry;
+        char device_path[PATH_MAX];
+
+        while ((entry = readdir(dir)) != NULL && state.num_kbds < MAX_KBDS) {
+            if (strncmp(entry->d_name, "event", 5) == 0) {
+                snprintf(device_path, sizeof(device_path), "%s/%s", INPUT_DIR, entry->d_name);
+
+                if (is_virtual_device(device_path)) continue;
+
+                if (is_keyboard(device_path)) grab_keyboard(device_path);
+            }
+        }
+
+        closedir(dir);
+    }
+
+    if (state.num_kbds == 0) {
+        fprintf(stderr, "Error: Could not find any keyboard devices\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int find_input_device(const char *wanted, char *path, size_t path_sz) {
+    DIR *dir = opendir(INPUT_DIR);
+    if (!dir) return -1;
+
+    struct dirent *entry;
+    int found = -1;
+    while (found < 0 && (entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "event", 5) != 0) continue;
+        snprintf(path, path_sz, "%s/%s", INPUT_DIR, entry->d_name);
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) continue;
+        char name[256] = "";
+        ioctl(fd, EVIOCGNAME(sizeof(name)), name);
+        close(fd);
+
+        if (strcmp(name, wanted) == 0) found = 0;
+    }
+    closedir(dir);
+    return found;
+}
+
+static int create_keyboard_device(const char *name, uint16_t product) {
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (fd < 0) {
+        perror("Cannot open /dev/uinput");
+        return -1;
+    }
+
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_EVBIT, EV_SYN);
+
+    for (int i = 0; i < KEY_MAX; i++) {
+        ioctl(fd, UI_SET_KEYBIT, i);
+    }
+
+    struct uinput_setup usetup;
+    memset(&usetup, 0, sizeof(usetup));
+    usetup.id.bustype = BUS_USB;
+    usetup.id.vendor = 0x1234;
+    usetup.id.product = product;
+    snprintf(usetup.name, sizeof(usetup.name), "%s", name);
+
+    ioctl(fd, UI_DEV_SETUP, &usetup);
+    ioctl(fd, UI_DEV_CREATE);
+    usleep(10000);
+    return fd;
+}
+
+#define DAEMON_KEYBOARD_NAME "Virtual Mouse Daemon Keyboard"
+#define DAEMON_MOUSE_NAME "Virtual Mouse Daemon Mouse"
+
+/* The name a daemon gives its virtual device; isolated ones append their tag */
+static void daemon_device_name(char *buf, size_t size, const char *base, const char *tag) {
+    if (tag) snprintf(buf, size, "%s %s", base, tag);
+    else snprintf(buf, size, "%s", base);
+}
+
+static int create_uinput(void) {
+    char name[UINPUT_MAX_NAME_SIZE];
+    daemon_device_name(name, sizeof(name), DAEMON_KEYBOARD_NAME, isolated_tag);
+    int fd = create_keyboard_device(name, 0x5678);
+    if (fd < 0) return -1;
+
+    printf("Virtual keyboard created\n");
+    return fd;
+}
+
+static int create_mouse(void) {
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (fd < 0) {
+        perror("Cannot open /dev/uinput for mouse");
+        return -1;
+    }
+
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_EVBIT, EV_REL);
+    ioctl(fd, UI_SET_EVBIT, EV_SYN);
+
+    ioctl(fd, UI_SET_RELBIT, REL_X);
+    ioctl(fd, UI_SET_RELBIT, REL_Y);
+    ioctl(fd, UI_SET_RELBIT, REL_WHEEL);
+    ioctl(fd, UI_SET_RELBIT, REL_WHEEL_HI_RES);
+    ioctl(fd, UI_SET_RELBIT, REL_HWHEEL);
+    ioctl(fd, UI_SET_RELBIT, REL_HWHEEL_HI_RES);
+
+    ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
+    ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT);
+    ioctl(fd, UI_SET_KEYBIT, BTN_MIDDLE);
+
+    struct uinput_setup usetup;
+    memset(&usetup, 0, sizeof(usetup));
+    usetup.id.bustype = BUS_USB;
+    usetup.id.vendor = 0x1234;
+    usetup.id.product = 0x5679;
+    daemon_device_name(usetup.name, sizeof(usetup.name), DAEMON_MOUSE_NAME, isolated_tag);
+
+    ioctl(fd, UI_DEV_SETUP, &usetup);
+    ioctl(fd, UI_DEV_CREATE);
+    usleep(10000);
+
+    printf("Virtual mouse created\n");
+    return fd;
+}
+
+/* ------------------------------------------------------------------ */
+/* Gesture Recognizer                                                 */
+/* ------------------------------------------------------------------ */
+/*
+ * Tap, double-tap, hold and two-key chords, timed from the evdev
+ * timestamps on the key events themselves, so a late wakeup of the input
+ * loop never stretches or shrinks an interval. gesture_feed() sees every
+ * key event first and notes what it completed; gesture_dispatch() then
+ * runs the matching rows of gesture_bindings[]. A new gesture action is a
+ * row there, not another timing check in a key handler. Left and right
+ * modifiers count as one key. Holds are noticed on the key's autorepeat
+ * or release, so no timer is needed.
+ */
+#define GESTURE_DEBOUNCE 0.01        /* presses closer than this are contact bounce */
+
+enum {
+    GESTURE_TAP = 1 << 0,            /* released before HOLD_MS, nothing pressed meanwhile */
+    GESTURE_DOUBLE_TAP = 1 << 1,     /* pressed again within DOUBLE_TAP_MS of the last press */
+    GESTURE_HOLD = 1 << 2,           /* held for HOLD_MS */
+    GESTURE_CHORD = 1 << 3,          /* pressed within CHORD_MS of another key still down */
+};
+
+typedef struct {
+    double down_at;                  /* press time, 0 while up */
+    double last_press;               /* for double-tap; 0 once one fired */
+    unsigned long seq;               /* gesture_seq at the press */
+    bool hold_fired;
+} GestureKey;
+
+typedef struct {
+    uint16_t key;
+    uint16_t partner;                /* other key of a chord, 0 = any */
+    unsigned gesture;
+    bool mouse_mode_only;
+    /* Returns true when the event is used up */
+    bool (*action)(const struct input_event *ev, ConfigPanel *panel);
+} GestureBinding;
+
+static GestureKey gesture_keys[KEY_MAX + 1];
+static unsigned long gesture_seq = 0;        /* counts presses, to spot interrupted taps */
+static int gesture_last_down = -1;
+static unsigned gesture_events = 0;          /* GESTURE_* completed by the current event */
+static int gesture_partner = -1;             /* other key of a chord completed by it */
+
+static bool gesture_toggle_mouse_mode(const struct input_event *ev, ConfigPanel *panel) {
+    (void)ev;
+    (void)panel;
+    set_mouse_mode(!state.mouse_mode);
+    return true;
+}
+
+static bool gesture_open_config_panel(const struct input_event *ev, ConfigPanel *panel) {
+    (void)ev;
+    show_config_panel(panel);
+    return true;
+}
+
+static const GestureBinding gesture_bindings[] = {
+    { KEY_LEFTCTRL, 0, GESTURE_DOUBLE_TAP, false, gesture_toggle_mouse_mode },
+    { KEY_LEFTALT, 0, GESTURE_DOUBLE_TAP, true, gesture_open_config_panel },
+};
+
+static double ev_seconds(const struct input_event *ev) {
+    return ev->time.tv_sec + ev->time.tv_usec * 1e-6;
+}
+
+static int gesture_key(int code) {
+    switch (code) {
+        case KEY_RIGHTCTRL: return KEY_LEFTCTRL;
+        case KEY_RIGHTALT: return KEY_LEFTALT;
+        case KEY_RIGHTSHIFT: return KEY_LEFTSHIFT;
+        default: return code;
+    }
+}
+
+static void gesture_reset(void) {
+    memset(gesture_keys, 0, sizeof(gesture_keys));
+    gesture_last_down = -1;
+    gesture_events = 0;
+}
+
+static void gesture_feed(const struct input_event *ev) {
+    gesture_events = 0;
+    gesture_partner = -1;
+    if (ev->type != EV_KEY || ev->code > KEY_MAX) return;
+
+    int code = gesture_key(ev->code);
+    GestureKey *k = &gesture_keys[code];
+    double t = ev_seconds(ev);
+
+    if (ev->value == 1) {
+        double gap = t - k->last_press;
+        if (k->last_press > 0.0 && gap > GESTURE_DEBOUNCE && gap < state.cfg.double_tap_ms / 1000.0) {
+            gesture_events |= GESTURE_DOUBLE_TAP;
+            k->last_press = 0.0;    /* a third press starts over */
+        } else {
+            k->last_press = t;
+        }
+        if (gesture_last_down >= 0 && gesture_last_down != code) {
+            GestureKey *other = &gesture_keys[gesture_last_down];
+            if (other->down_at > 0.0 && t - other->down_at < state.cfg.chord_ms / 1000.0) {
+                gesture_events |= GESTURE_CHORD;
+                gesture_partner = gesture_last_down;
+            }
+        }
+        k->down_at = t;
+        k->seq = ++gesture_seq;
+        k->hold_fired = false;
+        gesture_last_down = code;
+        return;
+    }
+
+    if (k->down_at == 0.0) return;
+    if (!k->hold_fired && t - k->down_at >= state.cfg.hold_ms / 1000.0) {
+        gesture_events |= GESTURE_HOLD;
+        k->hold_fired = true;
+    }
+    if (ev->value == 0) {
+        if (!k->hold_fired && k->seq == gesture_seq) gesture_events |= GESTURE_TAP;
+        k->down_at = 0.0;
+    }
+}
+
+/* Run the bindings for what the current event completed; each fires once */
+static bool gesture_dispatch(const struct input_event *ev, ConfigPanel *panel) {
+    if (!gesture_events) return false;
+    int code = gesture_key(ev->code);
+    for (size_t i = 0; i < sizeof(gesture_bindings) / sizeof(gesture_bindings[0]); i++) {
+        const GestureBinding *b = &gesture_bindings[i];
+        if (b->key != code || !(gesture_events & b->gesture)) continue;
+        if (b->mouse_mode_only && !state.mouse_mode) continue;
+        if (b->gesture == GESTURE_CHORD && b->partner && b->partner != gesture_partner) continue;
+        gesture_events = 0;
+        return b->action(ev, panel);
+    }
+    return false;
+}
+
+/* ------------------------------------------------------------------ */
+/* Auto-Tuning                                                        */
+/* ------------------------------------------------------------------ */
+/*
+ * Smooth-motion sessions, from the first numpad press to the click they
+ * lead to, timed from evdev timestamps. Each key hold is a segment with a
+ * direction. A session that reverses direction before the click overshot;
+ * one that needed several presses the same way undershot. Either way it
+ * matters whether the segment got up to full speed: overshooting at full
+ * speed means MOUSE_SPEED is too high, during the ramp that
+ * MOVEMENT_ACCELERATION_TIME is too short, and the reverse for creeping.
+ *
+ * With AUTO_TUNE on, every TUNE_BATCH sessions the most common complaint,
+ * if it has TUNE_MIN_VOTES, moves its parameter one step, never outside
+ * the TUNE_* bounds, and only a step that changed something is saved to
+ * the config. The running rates and time-to-target are learner state, not
+ * settings: they live in ~/.config/kat/tune and show up only in the stats.
+ * time_to_target is recorded either way.
+ */
+#define TUNE_MAX_SEGS 8
+#define TUNE_IDLE 1.5                /* s without motion that ends a session */
+#define TUNE_BATCH 8
+#define TUNE_MIN_VOTES 3
+#define TUNE_EMA 0.05
+#define TUNE_SPEED_MIN 2
+#define TUNE_SPEED_MAX 20
+#define TUNE_ACCEL_MIN 0.15
+#define TUNE_ACCEL_MAX 1.5
+#define TUNE_ACCEL_STEP 0.05
+#define TUNE_MAGIC 0x4e55544bU       /* "KTUN" */
+
+enum { TUNE_OVER_FAST, TUNE_OVER_RAMP, TUNE_UNDER_FAST, TUNE_UNDER_RAMP, NUM_TUNE_CLASSES, TUNE_CLEAN };
+
+typedef struct {
+    double start, end;
+    int dx, dy;
+} TuneSegment;
+
+static TuneSegment tune_segs[TUNE_MAX_SEGS];
+static int tune_nsegs = 0;               /* finished segments */
+static bool tune_moving = false;         /* tune_segs[tune_nsegs] is open */
+static double tune_session_start;
+static int tune_votes[NUM_TUNE_CLASSES];
+static int tune_batch = 0;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t pad;
+    uint64_t sessions;
+    double overshoot;                    /* % of sessions, running average */
+    double undershoot;
+    double time_to_target_ms;
+} TuneState;
+
+static TuneState tune = { .magic = TUNE_MAGIC };
+static const char *tune_path = NULL;     /* NULL: nothing is kept across runs */
+
+static bool tune_full_speed(const TuneSegment *g) {
+    return g->end - g->start >= state.cfg.movement_acceleration_time;
+}
+
+/* Called after every numpad direction key change */
+static void tune_motion(const struct input_event *ev) {
+    double t = ev_seconds(ev);
+    const bool *k = state.numpad_keys_pressed;   /* 8 2 4 6 7 9 1 3 */
+    int dx = k[3] - k[2] + k[5] - k[4] + k[7] - k[6];
+    int dy = k[1] - k[0] + k[6] - k[4] + k[7] - k[5];
+    bool any = false;
+    for (int i = 0; i < 8; i++) any |= k[i];
+
+    /* Jumps are not a smooth approach */
+    if (state.ctrl_pressed) {
+        tune_nsegs = 0;
+        tune_moving = false;
+        return;
+    }
+    if (any && !tune_moving) {
+        if (tune_nsegs > 0 && t - tune_segs[tune_nsegs - 1].end > TUNE_IDLE) tune_nsegs = 0;
+        if (tune_nsegs == TUNE_MAX_SEGS) {
+            memmove(tune_segs, tune_segs + 1, (TUNE_MAX_SEGS - 1) * sizeof(TuneSegment));
+            tune_nsegs--;
+        }
+        if (tune_nsegs == 0) tune_session_start = t;
+        tune_segs[tune_nsegs] = (TuneSegment){ t, t, dx, dy };
+        tune_moving = true;
+    } else if (any) {
+        if (dx || dy) {
+            tune_segs[tune_nsegs].dx = dx;
+            tune_segs[tune_nsegs].dy = dy;
+        }
+    } else if (tune_moving) {
+        tune_segs[tune_nsegs++].end = t;
+        tune_moving = false;
+    }
+}
+
+static int tune_classify(int n) {
+    for (int i = n - 1; i > 0; i--) {
+        const TuneSegment *a = &tune_segs[i - 1], *b = &tune_segs[i];
+        if (a->dx * b->dx + a->dy * b->dy < 0) return tune_full_speed(a) ? TUNE_OVER_FAST : TUNE_OVER_RAMP;
+    }
+    if (n < 2) return TUNE_CLEAN;
+    bool full = false;
+    for (int i = 0; i < n; i++) {
+        if (i > 0 && tune_segs[i - 1].dx * tune_segs[i].dx + tune_segs[i - 1].dy * tune_segs[i].dy <= 0)
+            return TUNE_CLEAN;
+        full |= tune_full_speed(&tune_segs[i]);
+    }
+    return full ? TUNE_UNDER_FAST : TUNE_UNDER_RAMP;
+}
+
+static void tune_open(const char *path) {
+    tune_path = path;
+    FILE *f = user_file_fopen(path, "rb");
+    if (!f) return;
+    TuneState t;
+    if (fread(&t, sizeof(t), 1, f) == 1 && t.magic == TUNE_MAGIC) tune = t;
+    fclose(f);
+}
+
+static void tune_save(void) {
+    if (!tune_path) return;
+    FILE *f = user_file_fopen(tune_path, "wb");
+    if (!f) {
+        perror("Failed to save tuner state");
+        return;
+    }
+    if (fwrite(&tune, sizeof(tune), 1, f) != 1) perror("Failed to save tuner state");
+    fclose(f);
+}
+
+/* Whether the step moved a setting */
+static bool tune_nudge(void) {
+    int best = 0;
+    for (int c = 1; c < NUM_TUNE_CLASSES; c++) {
+        if (tune_votes[c] > tune_votes[best]) best = c;
+    }
+    int votes = tune_votes[best];
+    memset(tune_votes, 0, sizeof(tune_votes));
+    if (votes < TUNE_MIN_VOTES) return false;
+
+    int speed = state.cfg.mouse_speed;
+    double accel = state.cfg.movement_acceleration_time;
+    switch (best) {
+        case TUNE_OVER_FAST: if (speed - 1 >= TUNE_SPEED_MIN) speed--; break;
+        case TUNE_UNDER_FAST: if (speed + 1 <= TUNE_SPEED_MAX) speed++; break;
+        case TUNE_OVER_RAMP: if (accel + TUNE_ACCEL_STEP <= TUNE_ACCEL_MAX) accel += TUNE_ACCEL_STEP; break;
+        case TUNE_UNDER_RAMP: if (accel - TUNE_ACCEL_STEP >= TUNE_ACCEL_MIN) accel -= TUNE_ACCEL_STEP; break;
+    }
+    if (speed == state.cfg.mouse_speed && accel == state.cfg.movement_acceleration_time) return false;
+    pthread_mutex_lock(&state.state_mutex);
+    state.cfg.mouse_speed = speed;
+    state.cfg.movement_acceleration_time = accel;
+    pthread_mutex_unlock(&state.state_mutex);
+    return true;
+}
+
+/* Called on every button press made from the numpad */
+static void tune_click(const struct input_event *ev) {
+    double t = ev_seconds(ev);
+    if (tune_moving) {
+        tune_segs[tune_nsegs++].end = t;
+        tune_moving = false;
+    }
+    int n = tune_nsegs;
+    tune_nsegs = 0;
+    if (n == 0 || t - tune_segs[n - 1].end > TUNE_IDLE) return;
+
+    double ttt = t - tune_session_start;
+    hist_record(HIST_TIME_TO_TARGET, (uint64_t)(ttt * 1e9));
+    if (!state.cfg.auto_tune) return;
+
+    int cls = tune_classify(n);
+    tune.sessions++;
+    tune.overshoot += TUNE_EMA * ((cls <= TUNE_OVER_RAMP ? 100.0 : 0.0) - tune.overshoot);
+    tune.undershoot += TUNE_EMA * ((cls == TUNE_UNDER_FAST || cls == TUNE_UNDER_RAMP ? 100.0 : 0.0) - tune.undershoot);
+    if (tune.time_to_target_ms == 0.0) tune.time_to_target_ms = ttt * 1000.0;
+    else tune.time_to_target_ms += TUNE_EMA * (ttt * 1000.0 - tune.time_to_target_ms);
+    if (cls != TUNE_CLEAN) tune_votes[cls]++;
+
+    if (++tune_batch < TUNE_BATCH) return;
+    tune_batch = 0;
+    if (tune_nudge()) save_config();
+    tune_save();
+}
+
+static void tune_stats_dump(FILE *f) {
+    fprintf(f, "auto_tune %s: %lu sessions, overshoot %.1f%%, undershoot %.1f%%, time_to_target %.0f ms, "
+               "MOUSE_SPEED %d, MOVEMENT_ACCELERATION_TIME %.2f s\n",
+            state.cfg.auto_tune ? "on" : "off", (unsigned long)tune.sessions, tune.overshoot, tune.undershoot,
+            tune.time_to_target_ms, state.cfg.mouse_speed, state.cfg.movement_acceleration_time);
+}
+
+/* ------------------------------------------------------------------ */
+/* Keyboard LED Feedback                                              */
+/* ------------------------------------------------------------------ */
+/*
+ * With FEEDBACK_LEDS on, mouse mode, drag lock and autoscroll are shown on
+ * the grabbed keyboards' ScrollLock, Compose and Kana LEDs: one EV_LED
+ * write per change, with no thread or X connection, so it keeps up when X
+ * is busy. led_sync() runs after every handled event and writes only what
+ * changed, or everything once X or libinput may have rewritten the LEDs
+ * (a lock key, or an EV_LED report that disagrees with what we set). A
+ * state whose LED no grabbed keyboard has still gets its popup; popups
+ * are otherwise left for value changes. Turning the option off, or
+ * exiting, puts the LEDs back the way they were found.
+ */
+static const uint16_t led_codes[] = { LED_SCROLLL, LED_COMPOSE, LED_KANA };
+#define NUM_FEEDBACK_LEDS (int)(sizeof(led_codes) / sizeof(led_codes[0]))
+
+static unsigned led_caps[MAX_KBDS];     /* bit i: keyboard has led_codes[i] */
+static unsigned led_found[MAX_KBDS];    /* bit i: led_codes[i] was lit at startup */
+static unsigned led_any = 0;            /* union of led_caps */
+static unsigned led_shown = 0;          /* bits last written */
+static bool led_owned = false;          /* we have written since the last restore */
+static bool led_stale = false;          /* someone else may have overwritten ours */
+
+static void led_open(void) {
+    for (int k = 0; k < state.num_kbds; k++) {
+        unsigned long bits[NBITS(LED_MAX)] = {0}, lit[NBITS(LED_MAX)] = {0};
+        ioctl(state.kbd_fds[k], EVIOCGBIT(EV_LED, sizeof(bits)), bits);
+        ioctl(state.kbd_fds[k], EVIOCGLED(sizeof(lit)), lit);
+        for (int i = 0; i < NUM_FEEDBACK_LEDS; i++) {
+            if (test_bit(led_codes[i], bits)) led_caps[k] |= 1u << i;
+            if (test_bit(led_codes[i], lit)) led_found[k] |= 1u << i;
+        }
+        led_any |= led_caps[k];
+    }
+}
+
+/* Whether the LEDs are showing the state behind led_codes[i] */
+static bool led_shows(int i) {
+    return state.cfg.feedback_leds && (led_any & (1u << i));
+}
+
+static void led_write(unsigned want, bool restore) {
+    for (int k = 0; k < state.num_kbds; k++) {
+        unsigned target = restore ? led_found[k] : want;
+        unsigned diff = led_caps[k] & (restore ? ~0u : want ^ led_shown);
+        if (!diff) continue;
+        for (int i = 0; i < NUM_FEEDBACK_LEDS; i++) {
+            if (!(diff & (1u << i))) continue;
+            struct input_event ev = { .type = EV_LED, .code = led_codes[i], .value = !!(target & (1u << i)) };
+            if (write(state.kbd_fds[k], &ev, sizeof(ev)) < 0) break;
+            count_syscall();
+        }
+        struct input_event syn = { .type = EV_SYN, .code = SYN_REPORT };
+        if (write(state.kbd_fds[k], &syn, sizeof(syn)) == sizeof(syn)) count_syscall();
+    }
+}
+
+/* Watch for lock keys and foreign LED writes, which reset what we showed */
+static void led_note(const struct input_event *ev) {
+    if (!led_owned) return;
+    if (ev->type == EV_KEY) {
+        if (ev->code == KEY_CAPSLOCK || ev->code == KEY_NUMLOCK || ev->code == KEY_SCROLLLOCK) led_stale = true;
+        return;
+    }
+    if (ev->type != EV_LED) return;
+    for (int i = 0; i < NUM_FEEDBACK_LEDS; i++) {
+        /* Our own writes come back as EV_LED too, but always agree with led_shown */
+        if (ev->code == led_codes[i] && !ev->value != !(led_shown & (1u << i))) led_stale = true;
+    }
+}
+
+static void led_sync(void) {
+    if (!led_any) return;
+    if (!state.cfg.feedback_leds) {
+        if (led_owned) led_write(0, true);
+        led_owned = false;
+        return;
+    }
+    unsigned want = (state.mouse_mode ? 1u << 0 : 0) |
+                    (state.drag_locked ? 1u << 1 : 0) |
+                    (state.autoscroll_up_active || state.autoscroll_down_active ? 1u << 2 : 0);
+    if (led_owned && want == led_shown && !led_stale) return;
+    if (!led_owned || led_stale) led_shown = ~want;   /* set every LED again */
+    led_write(want, false);
+    led_shown = want;
+    led_owned = true;
+    led_stale = false;
+}
+
+static void led_close(void) {
+    if (led_owned) led_write(0, true);
+    led_owned = false;
+}
+
+/* Popup for a state change, unless LED i already shows it */
+static void show_state_feedback(int i, const char *text) {
+    if (!led_shows(i)) show_feedback(text);
+}
+
+/* ------------------------------------------------------------------ */
+/* Key Handling Functions                                             */
+/* ------------------------------------------------------------------ */
+static void set_mouse_mode(bool on) {
+    pthread_mutex_lock(&state.state_mutex);
+    state.mouse_mode = on;
+    bool was_autoscroll = false;
+    if (!state.mouse_mode) {
+        was_autoscroll = state.autoscroll_up_active || state.autoscroll_down_active;
+        state.autoscroll_up_active = false;
+        state.autoscroll_down_active = false;
+    }
+    pthread_mutex_unlock(&state.state_mutex);
+
+    const char *msg;
+    if (state.mouse_mode) {
+        msg = "Mouse Mode ON";
+    } else if (was_autoscroll) {
+        msg = "Mouse Mode and Autoscroll OFF";
+    } else {
+        msg = "Mouse Mode OFF";
+    }
+    show_state_feedback(0, msg);
+}
+
+static bool handle_ctrl_key(const struct input_event *ev, ConfigPanel *panel) {
+    if (ev->code != KEY_LEFTCTRL && ev->code != KEY_RIGHTCTRL) return false;
+
+    bool *forwarded = (ev->code == KEY_LEFTCTRL) ? &state.left_ctrl_forwarded : &state.right_ctrl_forwarded;
+
+    pthread_mutex_lock(&state.state_mutex);
+    if (ev->value != 0) {
+        state.ctrl_pressed = true;
+    } else {
+        state.ctrl_pressed = false;
+    }
+    pthread_mutex_unlock(&state.state_mutex);
+
+    if (ev->value == 1) {
+        if (gesture_dispatch(ev, panel)) return true;
+        state.pending_ctrl = true;
+        state.pending_ctrl_code = ev->code;
+        return true;
+    } else if (ev->value == 0) {
+        if (*forwarded) {
+            emit_event(state.uinput_fd, EV_KEY, ev->code, 0);
+            emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
+            *forwarded = false;
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool handle_alt_key(const struct input_event *ev, ConfigPanel *panel) {
+    if (ev->code != KEY_LEFTALT && ev->code != KEY_RIGHTALT) return false;
+
+    pthread_mutex_lock(&state.state_mutex);
+    state.alt_pressed = (ev->value != 0);
+    pthread_mutex_unlock(&state.state_mutex);
+
+    /* Alt itself always goes through below, unless a gesture brought up the panel */
+    if (ev->value == 1) gesture_dispatch(ev, panel);
+
+    if (!panel->active) {
+        emit_event(state.uinput_fd, EV_KEY, ev->code, ev->value);
+        emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
+    }
+
+    return true;
+}
+
+static bool handle_shift_key(const struct input_event *ev) {
+    if (ev->code != KEY_LEFTSHIFT && ev->code != KEY_RIGHTSHIFT) return false;
+
+    pthread_mutex_lock(&state.state_mutex);
+    state.shift_pressed = (ev->value != 0);
+    pthread_mutex_unlock(&state.state_mutex);
+
+    if (!(state.autoscroll_up_active || state.autoscroll_down_active)) {
+        emit_event(state.uinput_fd, EV_KEY, ev->code, ev->value);
+        emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
+    }
+
+    return true;
+}
+
+static bool handle_esc_in_panel(const struct input_event *ev, ConfigPanel *panel) {
+    if (ev->code != KEY_ESC || ev->value != 1) return false;
+
+    hide_config_panel(panel);
+    return true;
+}
+
+static void disable_autoscroll_if_not_allowed(const struct input_event *ev) {
+    if (ev->value != 1) return;
+
+    bool is_allowed = (ev->code == KEY_LEFTCTRL || ev->code == KEY_RIGHTCTRL ||
+                       ev->code == KEY_LEFTALT || ev->code == KEY_RIGHTALT ||
+                       ev->code == KEY_LEFTSHIFT || ev->code == KEY_RIGHTSHIFT ||
+                       (state.ctrl_pressed && (ev->code == KEY_KPPLUS || ev->code == KEY_KPENTER || (state.shift_pressed && ev->code == KEY_EQUAL))) ||
+                       (state.alt_pressed && (ev->code == KEY_KPPLUS || ev->code == KEY_KPENTER || (state.shift_pressed && ev->code == KEY_EQUAL) || ev->code == KEY_KPDOT)) ||
+                       (state.alt_pressed && state.shift_pressed && ev->code == KEY_KPDOT));
+
+    if (!is_allowed && (state.autoscroll_up_active || state.autoscroll_down_active)) {
+        state.autoscroll_up_active = false;
+        state.autoscroll_down_active = false;
+        double now = get_time();
+        if (now - state.last_autoscroll_feedback > 0.8) {
+            state.last_autoscroll_feedback = now;
+            show_state_feedback(2, "Autoscroll OFF");
+        }
+    }
+}
+
+static bool handle_panel_nav_key(const struct input_event *ev, ConfigPanel *panel) {
+    bool is_nav = (ev->code == KEY_KP8 || ev->code == KEY_UP ||
+                   ev->code == KEY_KP2 || ev->code == KEY_DOWN ||
+                   ev->code == KEY_KP4 || ev->code == KEY_LEFT ||
+                   ev->code == KEY_KP6 || ev->code == KEY_RIGHT);
+
+    if (!is_nav) return false;
+
+    if (ev->value != 1 && ev->value != 2) return true;
+
+    double now = get_time();
+    int multi = 1;
+    if (ev->value == 1) {
+        state.adjust_start_times[ev->code] = now;
+    } else {
+        double elapsed = now - state.adjust_start_times[ev->code];
+        multi = get_step_multiplier(elapsed);
+    }
+
+    switch (ev->code) {
+        case KEY_KP8:
+        case KEY_UP:
+            panel->selected_row = (panel->selected_row - 1 + num_config_items) % num_config_items;
+            break;
+        case KEY_KP2:
+        case KEY_DOWN:
+            panel->selected_row = (panel->selected_row + 1) % num_config_items;
+            break;
+        case KEY_KP4:
+        case KEY_LEFT:
+            adjust_config_value(panel->selected_row, -multi, false);
+            break;
+        case KEY_KP6:
+        case KEY_RIGHT:
+            adjust_config_value(panel->selected_row, multi, false);
+            break;
+        default:
+            return false;
+    }
+
+    panel->last_activity_time = now;
+    draw_config_panel(panel);
+
+    return true;
+}
+
+static bool handle_non_nav_in_panel(const struct input_event *ev, ConfigPanel *panel) {
+    if (ev->value != 1) return false;
+
+    hide_config_panel(panel);
+    emit_event(state.uinput_fd, EV_KEY, ev->code, ev->value);
+    emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
+
+    return true;
+}
+
+static bool handle_alt_adjustment_key(const struct input_event *ev) {
+    if (!state.alt_pressed || (ev->value != 1 && ev->value != 2)) return false;
+
+    int index = -1;
+    bool increase = true;
+    double now = get_time();
+
+    switch (ev->code) {
+        case KEY_KPPLUS:
+        case KEY_KPENTER:
+            index = (state.autoscroll_up_active || state.autoscroll_down_active) ? 11 : 9;
+            increase = (ev->code == KEY_KPPLUS);
+            break;
+        case KEY_NUMLOCK:
+            index = 0;
+            increase = !state.shift_pressed;
+            break;
+        case KEY_KPSLASH:
+            index = 3;
+            increase = !state.shift_pressed;
+            break;
+        case KEY_KPASTERISK:
+            index = 1;
+            increase = !state.shift_pressed;
+            break;
+        case KEY_KPMINUS:
+            index = 2;
+            increase = !state.shift_pressed;
+            break;
+        case KEY_KP5:
+            index = 7;
+            increase = !state.shift_pressed;
+            show_margin_overlay();
+            last_margin_adjust = now;
+            margin_need_redraw = true;
+            break;
+        case KEY_KP6:
+        case KEY_KP4:
+            index = 4;
+            increase = (ev->code == KEY_KP6);
+            show_jump_overlay(1);
+            last_jump_adjust = now;
+            jump_need_redraw = true;
+            break;
+        case KEY_KP8:
+        case KEY_KP2:
+            index = 5;
+            increase = (ev->code == KEY_KP8);
+            show_jump_overlay(2);
+            last_jump_adjust = now;
+            jump_need_redraw = true;
+            break;
+        case KEY_KP7:
+        case KEY_KP9:
+        case KEY_KP1:
+        case KEY_KP3:
+            index = 6;
+            increase = (ev->code == KEY_KP7 || ev->code == KEY_KP9);
+            show_jump_overlay(3);
+            last_jump_adjust = now;
+            jump_need_redraw = true;
+            break;
+        case KEY_KP0:
+            index = 8;
+            increase = !state.shift_pressed;
+            break;
+        case KEY_KPDOT:
+            index = (state.autoscroll_up_active || state.autoscroll_down_active) ? 12 : 10;
+            increase = !state.shift_pressed;
+            break;
+        default:
+            return false;
+    }
+
+    int multi = 1;
+    if (ev->value == 1) {
+        state.adjust_start_times[ev->code] = now;
+    } else {
+        double elapsed = now - state.adjust_start_times[ev->code];
+        multi = get_step_multiplier(elapsed);
+    }
+    int step = multi * (increase ? 1 : -1);
+    adjust_config_value(index, step, true);
+
+    save_config();
+    return true;
+}
+
+static bool handle_scroll_and_autoscroll_key(const struct input_event *ev) {
+    if (ev->code != KEY_KPPLUS && ev->code != KEY_KPENTER) return false;
+
+    bool is_plus = (ev->code == KEY_KPPLUS);
+
+    if (!state.ctrl_pressed) {
+        pthread_mutex_lock(&state.state_mutex);
+        if (ev->value == 0) {
+            /* Shift may have changed since the press; release both axes */
+            state.scroll_keys_pressed[is_plus ? 0 : 1] = false;
+            state.scroll_keys_pressed[is_plus ? 2 : 3] = false;
+        } else {
+            int index = state.shift_pressed ? (is_plus ? 2 : 3) : (is_plus ? 0 : 1);
+            if (ev->value == 1 && !state.scroll_keys_pressed[index]) stop_scroll_momentum();
+            state.scroll_keys_pressed[index] = true;
+        }
+        pthread_mutex_unlock(&state.state_mutex);
+        return true;
+    }
+
+    if (ev->value != 1) return true;
+
+    if (is_plus) {
+        state.autoscroll_up_active = !state.autoscroll_up_active;
+        if (state.autoscroll_up_active) state.autoscroll_down_active = false;
+    } else {
+        state.autoscroll_down_active = !state.autoscroll_down_active;
+        if (state.autoscroll_down_active) state.autoscroll_up_active = false;
+    }
+
+    pthread_mutex_lock(&state.state_mutex);
+    memset(state.scroll_keys_pressed, 0, sizeof(state.scroll_keys_pressed));
+    stop_scroll_momentum();
+    pthread_mutex_unlock(&state.state_mutex);
+
+    double now = get_time();
+    if (now - state.last_autoscroll_feedback > 0.8) {
+        state.last_autoscroll_feedback = now;
+        if (state.autoscroll_up_active)
+            show_state_feedback(2, "Autoscroll UP ON");
+        else if (state.autoscroll_down_active)
+            show_state_feedback(2, "Autoscroll DOWN ON");
+        else
+            show_state_feedback(2, "Autoscroll OFF");
+    }
+
+    state.pending_ctrl = false;  // NEW LINE HERE
+
+    return true;
+}
+
+static bool handle_ctrl_minus_key(const struct input_event *ev) {
+    if (!state.ctrl_pressed || ev->code != KEY_KPMINUS || ev->value == 0) return false;
+    state.pending_ctrl = false;  // NEW LINE HERE
+    return true;
+}
+
+static bool handle_absolute_jump_key(const struct input_event *ev) {
+    if (!state.ctrl_pressed || !state.shift_pressed || ev->value != 1) return false;
+
+    bool is_jump_key = (ev->code == KEY_KP8 || ev->code == KEY_KP2 || ev->code == KEY_KP4 || ev->code == KEY_KP6 ||
+                        ev->code == KEY_KP9 || ev->code == KEY_KP7 || ev->code == KEY_KP3 || ev->code == KEY_KP1 || ev->code == KEY_KP5);
+
+    if (!is_jump_key) return false;
+
+    Display *dpy = input_display();
+    if (!dpy && !headless) return true;
+
+    int root_x = 0, root_y = 0;
+    query_pointer(dpy, &root_x, &root_y);
+
+    Rect r = monitor_at(dpy, root_x, root_y).r;
+    int margin = state.cfg.jump_margin;
+    int left = r.x + margin;
+    int right = r.x + r.w - 1 - margin;
+    int top = r.y + margin;
+    int bottom = r.y + r.h - 1 - margin;
+    int center_x = r.x + r.w / 2;
+    int center_y = r.y + r.h / 2;
+
+    int target_x = root_x;
+    int target_y = root_y;
+
+    switch (ev->code) {
+        case KEY_KP8:
+            target_y = top;
+            if (root_y == top) target_x = center_x;
+            break;
+        case KEY_KP2:
+            target_y = bottom;
+            if (root_y == bottom) target_x = center_x;
+            break;
+        case KEY_KP4:
+            target_x = left;
+            if (root_x == left) target_y = center_y;
+            break;
+        case KEY_KP6:
+            target_x = right;
+            if (root_x == right) target_y = center_y;
+            break;
+        case KEY_KP9:
+            target_x = right;
+            target_y = top;
+            break;
+        case KEY_KP7:
+            target_x = left;
+            target_y = top;
+            break;
+        case KEY_KP3:
+            target_x = right;
+            target_y = bottom;
+            break;
+        case KEY_KP1:
+            target_x = left;
+            target_y = bottom;
+            break;
+        case KEY_KP5:
+            target_x = center_x;
+            target_y = center_y;
+            break;
+        default:
+            return false;
+    }
+
+    jump_to(dpy, target_x, target_y);
+
+    state.pending_ctrl = false;  // NEW LINE HERE
+
+    return true;
+}
+
+static bool handle_grid_key(const struct input_event *ev) {
+    if (!grid_active) {
+        if (ev->code == grid_release_code && ev->value == 0) {
+            grid_release_code = -1;
+            return true;
+        }
+        if (!state.ctrl_pressed || state.shift_pressed || ev->code != KEY_KP0 || ev->value != 1) return false;
+        grid_enter();
+        state.pending_ctrl = false;
+        return true;
+    }
+
+    int col = -1, row = -1;
+    switch (ev->code) {
+        case KEY_KP7: col = 0; row = 0; break;
+        case KEY_KP8: col = 1; row = 0; break;
+        case KEY_KP9: col = 2; row = 0; break;
+        case KEY_KP4: col = 0; row = 1; break;
+        case KEY_KP5: col = 1; row = 1; break;
+        case KEY_KP6: col = 2; row = 1; break;
+        case KEY_KP1: col = 0; row = 2; break;
+        case KEY_KP2: col = 1; row = 2; break;
+        case KEY_KP3: col = 2; row = 2; break;
+        case KEY_KPDOT:
+        case KEY_KP0:
+        case KEY_ESC:
+        case KEY_KPENTER:
+            break;
+        default:
+            /* Modifiers pass through; anything else leaves the grid */
+            if (ev->code == KEY_LEFTCTRL || ev->code == KEY_RIGHTCTRL ||
+                ev->code == KEY_LEFTSHIFT || ev->code == KEY_RIGHTSHIFT) return false;
+            if (ev->value == 1) grid_exit();
+            return false;
+    }
+
+    if (ev->value != 1) return true;
+
+    if (col >= 0) {
+        grid_select_cell(col, row);
+        if (!grid_active) grid_release_code = ev->code;
+    } else if (ev->code == KEY_KPDOT) {
+        grid_undo();
+    } else {
+        grid_exit();
+        grid_release_code = ev->code;
+        if (ev->code == KEY_KPENTER) mouse_click(BTN_LEFT);
+        state.pending_ctrl = false;
+    }
+    return true;
+}
+
+static bool handle_hint_key(const struct input_event *ev) {
+    if (!hint_active) {
+        if (ev->code == hint_release_code && ev->value == 0) {
+            hint_release_code = -1;
+            return true;
+        }
+        if (!state.ctrl_pressed || state.shift_pressed || ev->code != KEY_KPDOT || ev->value != 1) return false;
+        hint_enter();
+        state.pending_ctrl = false;
+        return true;
+    }
+
+    if (ev->code == KEY_LEFTCTRL || ev->code == KEY_RIGHTCTRL ||
+        ev->code == KEY_LEFTSHIFT || ev->code == KEY_RIGHTSHIFT) return false;
+
+    int letter = hint_letter(ev->code);
+    if (letter < 0 && ev->code != KEY_BACKSPACE && ev->code != KEY_ESC && ev->code != KEY_KPDOT) {
+        /* Anything else leaves hint mode and goes through */
+        if (ev->value == 1) hint_exit();
+        return false;
+    }
+
+    if (ev->value != 1) return true;
+
+    if (ev->code == KEY_BACKSPACE) {
+        if (hint_first >= 0) hint_set_first(-1);
+        else {
+            hint_exit();
+            hint_release_code = ev->code;
+        }
+    } else if (letter < 0) {
+        hint_exit();
+        hint_release_code = ev->code;
+        state.pending_ctrl = false;
+    } else if (hint_first < 0) {
+        if (letter * HINT_KEYS < hint_layout.count) hint_set_first(letter);
+    } else {
+        int idx = hint_first * HINT_KEYS + letter;
+        if (idx < hint_layout.count) {
+            hint_select(idx);
+            hint_release_code = ev->code;
+        }
+    }
+    return true;
+}
+
+/* Keys that make a held KPDOT a chord rather than a '.' */
+static bool snap_chord_key(int code) {
+    switch (code) {
+        case KEY_KP1: case KEY_KP2: case KEY_KP3:
+        case KEY_KP4: case KEY_KP6:
+        case KEY_KP7: case KEY_KP8: case KEY_KP9:
+        case KEY_KPSLASH: case KEY_NUMLOCK: case KEY_KPENTER:
+        case KEY_KPMINUS: case KEY_KPASTERISK:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* The held KPDOT turned out to be a plain key: end a drag and send its press */
+static void snap_forward_press(void) {
+    snap_held = false;
+    lens_hold_since = 0.0;
+    if (state.left_button_held) {
+        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
+        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+        state.left_button_held = false;
+        state.drag_locked = false;
+        hide_drag_popup();
+    }
+    emit_event(state.uinput_fd, EV_KEY, KEY_KPDOT, 1);
+    emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
+}
+
+/*
+ * Called for every key before the handlers: a press that is not a chord
+ * while KPDOT is still undecided means KPDOT was typed, so its press goes
+ * out first and the two keep their order. Its release then passes through.
+ */
+static void snap_feed(const struct input_event *ev) {
+    if (!snap_held || snap_used || lens_shown || ev->value != 1) return;
+    if (ev->code == KEY_KPDOT || snap_chord_key(ev->code)) return;
+    snap_forward_press();
+}
+
+static bool handle_snap_key(const struct input_event *ev) {
+    if (ev->code == KEY_KPDOT) {
+        if (ev->value == 1) {
+            if (state.ctrl_pressed || state.alt_pressed) return false;
+            snap_held = true;
+            snap_used = false;
+            lens_hold_since = get_time();
+            return true;
+        }
+        if (!snap_held) return false;
+        if (ev->value == 0) {
+            /* A hold that brought up the lens is not a tap either */
+            bool tap = !snap_used && !atomic_exchange(&lens_shown, false);
+            snap_held = false;
+            lens_hold_since = 0.0;
+            if (tap) {
+                snap_forward_press();
+                emit_event(state.uinput_fd, EV_KEY, KEY_KPDOT, 0);
+                emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
+            }
+        }
+        return true;
+    }
+    if (!snap_held) return false;
+
+    int dx, dy;
+    switch (ev->code) {
+        case KEY_KP8: dx = 0; dy = -1; break;
+        case KEY_KP2: dx = 0; dy = 1; break;
+        case KEY_KP4: dx = -1; dy = 0; break;
+        case KEY_KP6: dx = 1; dy = 0; break;
+        case KEY_KP7: dx = -1; dy = -1; break;
+        case KEY_KP9: dx = 1; dy = -1; break;
+        case KEY_KP1: dx = -1; dy = 1; break;
+        case KEY_KP3: dx = 1; dy = 1; break;
+        default: return false;
+    }
+    /* Autorepeat keeps snapping to the next edge, or nudging under the lens */
+    if (ev->value != 0) {
+        if (lens_shown) lens_nudge(dx, dy);
+        else snap_request(dx, dy);
+        snap_used = true;
+    }
+    return true;
+}
+
+/* Any key press drops a pending dwell click; Esc is spent on just that */
+static bool handle_dwell_key(const struct input_event *ev) {
+    if (ev->code == dwell_release_code && ev->value == 0) {
+        dwell_release_code = -1;
+        return true;
+    }
+    if (ev->value != 1 || !dwell_cancel() || ev->code != KEY_ESC) return false;
+    dwell_release_code = ev->code;
+    return true;
+}
+
+static bool handle_macro_key(const struct input_event *ev) {
+    if (ev->code == macro_release_code && ev->value == 0) {
+        macro_release_code = -1;
+        return true;
+    }
+    if (!snap_held) return false;
+    if (ev->code != KEY_KPSLASH && ev->code != KEY_NUMLOCK && ev->code != KEY_KPENTER) return false;
+    if (ev->value == 1) {
+        if (ev->code == KEY_KPSLASH) macro_toggle_record();
+        else macro_play(ev->code == KEY_KPENTER);
+    }
+    snap_used = true;
+    macro_release_code = ev->code;
+    return true;
+}
+
+static bool handle_anchor_key(const struct input_event *ev) {
+    if (ev->code == anchor_release_code && ev->value == 0) {
+        anchor_release_code = -1;
+        return true;
+    }
+    if (snap_held && (ev->code == KEY_KPMINUS || ev->code == KEY_KPASTERISK)) {
+        if (ev->value == 1) {
+            anchor_pending = ev->code == KEY_KPMINUS ? 1 : 2;
+            snap_used = true;
         }
-        pthread_mutex_lock(&jump_mutex);
+        return true;
     }
-    adjusting_jump_type = type;
-    if (type == 0) {
-        jump_overlay_visible = false;
-        pthread_mutex_unlock(&jump_mutex);
-        if (jump_thread) {
-            pthread_join(jump_thread, NULL);
-            jump_thread = 0;
+    if (!anchor_pending || ev->value != 1) return false;
+    if (ev->code == KEY_LEFTCTRL || ev->code == KEY_RIGHTCTRL ||
+        ev->code == KEY_LEFTSHIFT || ev->code == KEY_RIGHTSHIFT ||
+        ev->code == KEY_LEFTALT || ev->code == KEY_RIGHTALT) return false;
+
+    /* Anything but a letter cancels and goes through */
+    int op = anchor_pending;
+    anchor_pending = 0;
+    int letter = hint_letter(ev->code);
+    if (letter < 0) return false;
+
+    anchor_release_code = ev->code;
+    if (op == 1) anchor_save(letter);
+    else anchor_find(letter);
+    return true;
+}
+
+static bool handle_kp0_layer_key(const struct input_event *ev) {
+    if (ev->code == kp0_chord_code && ev->value == 0) {
+        kp0_chord_code = -1;
+        return true;
+    }
+    if (ev->code == KEY_KP0) {
+        if (ev->value == 1) {
+            if (state.ctrl_pressed || state.alt_pressed) return false;
+            kp0_held = true;
+            kp0_used = false;
+            kp0_held_since = get_time();
+            return true;
         }
-        return;
+        if (!kp0_held) return false;
+        if (ev->value == 0) {
+            /* A plain tap keeps its old meaning: end a drag and type the key */
+            if (!kp0_used) {
+                kp0_forward_press();
+                emit_event(state.uinput_fd, EV_KEY, KEY_KP0, 0);
+                emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
+            }
+            kp0_held = false;
+        }
+        return true;
     }
-    jump_overlay_visible = true;
-    last_jump_adjust = get_time();
-    jump_need_redraw = true;
-    pthread_mutex_unlock(&jump_mutex);
-    if (!jump_thread) {
-        pthread_create(&jump_thread, NULL, jump_overlay_thread, (void*)&state);
+    if (mark_pending && ev->value == 1) {
+        if (ev->code == KEY_LEFTCTRL || ev->code == KEY_RIGHTCTRL ||
+            ev->code == KEY_LEFTSHIFT || ev->code == KEY_RIGHTSHIFT ||
+            ev->code == KEY_LEFTALT || ev->code == KEY_RIGHTALT) return false;
+        /* The letter counts with 0 still held or after it; anything else cancels and goes through */
+        int op = mark_pending;
+        mark_pending = 0;
+        int letter = hint_letter(ev->code);
+        if (letter >= 0) {
+            kp0_chord_code = ev->code;
+            if (op == 1) mark_set(letter);
+            else mark_jump(letter);
+            return true;
+        }
     }
-}
+    if (!kp0_held || ev->value == 0) return false;
 
-static void hide_jump_overlay(void) {
-    show_jump_overlay(0);
+    switch (ev->code) {
+        case KEY_KPSLASH:
+            if (ev->value == 1) damage_jump();
+            break;
+        case KEY_KPPLUS:
+        case KEY_KPENTER:
+            history_step(ev->code == KEY_KPPLUS ? -1 : 1);
+            break;
+        case KEY_KPMINUS:
+        case KEY_KPASTERISK:
+            if (ev->value == 1) mark_pending = ev->code == KEY_KPMINUS ? 1 : 2;
+            break;
+        case KEY_KP7: case KEY_KP8: case KEY_KP9:
+        case KEY_KP5:
+        case KEY_KP1: case KEY_KP3:
+        case KEY_KP4: case KEY_KP6:
+            /* Holding a cycle key keeps stepping through windows */
+            if (ev->value == 1 || ev->code == KEY_KP4 || ev->code == KEY_KP6) window_jump(ev->code);
+            break;
+        default:
+            return false;
+    }
+    kp0_used = true;
+    kp0_chord_code = ev->code;
+    return true;
 }
 
-static void* jump_overlay_thread(void *arg) {
-    AppState *app_state = (AppState *)arg;
-    Display *dpy = XOpenDisplay(NULL);
-    if (!dpy) return NULL;
+static bool handle_numpad_direction_key(const struct input_event *ev) {
+    bool is_dir = (ev->code == KEY_KP1 || ev->code == KEY_KP2 || ev->code == KEY_KP3 ||
+                   ev->code == KEY_KP4 || ev->code == KEY_KP6 ||
+                   ev->code == KEY_KP7 || ev->code == KEY_KP8 || ev->code == KEY_KP9);
+    if (!is_dir) return false;
 
-    int scr = DefaultScreen(dpy);
-    Window root = DefaultRootWindow(dpy);
-    int scr_w = DisplayWidth(dpy, scr);
-    int scr_h = DisplayHeight(dpy, scr);
+    if (state.ctrl_pressed) {
+        pthread_mutex_lock(&state.state_mutex);
+        memset(state.numpad_keys_pressed, 0, sizeof(state.numpad_keys_pressed));
+        pthread_mutex_unlock(&state.state_mutex);
+        state.pending_ctrl = false;  // NEW LINE HERE
+    }
 
-    XVisualInfo vinfo;
-    if (!XMatchVisualInfo(dpy, scr, 32, TrueColor, &vinfo)) {
-        XCloseDisplay(dpy);
-        return NULL;
+    if (ev->value == 1) {
+        bool any_held = false;
+        for (int i = 0; i < 8; ++i) any_held |= state.numpad_keys_pressed[i];
+        if (!any_held) atomic_store(&motion_press_ns, mono_ns());
     }
 
-    XSetWindowAttributes attrs = {0};
-    attrs.override_redirect = True;
-    attrs.background_pixel = 0x00000000;
-    attrs.border_pixel = 0;
-    attrs.colormap = XCreateColormap(dpy, root, vinfo.visual, AllocNone);
+    pthread_mutex_lock(&state.state_mutex);
+    switch (ev->code) {
+        case KEY_KP8: state.numpad_keys_pressed[0] = (ev->value != 0); break;
+        case KEY_KP2: state.numpad_keys_pressed[1] = (ev->value != 0); break;
+        case KEY_KP4: state.numpad_keys_pressed[2] = (ev->value != 0); break;
+        case KEY_KP6: state.numpad_keys_pressed[3] = (ev->value != 0); break;
+        case KEY_KP7: state.numpad_keys_pressed[4] = (ev->value != 0); break;
+        case KEY_KP9: state.numpad_keys_pressed[5] = (ev->value != 0); break;
+        case KEY_KP1: state.numpad_keys_pressed[6] = (ev->value != 0); break;
+        case KEY_KP3: state.numpad_keys_pressed[7] = (ev->value != 0); break;
+        default: 
+            pthread_mutex_unlock(&state.state_mutex);
+            return false;
+    }
+    pthread_mutex_unlock(&state.state_mutex);
 
-    Window win = XCreateWindow(dpy, root, 0, 0, scr_w, scr_h, 0,
-                               32, InputOutput, vinfo.visual,
-                               CWOverrideRedirect | CWBackPixel | CWBorderPixel | CWColormap,
-                               &attrs);
+    tune_motion(ev);
+    return true;
+}
 
-    Atom above = XInternAtom(dpy, "_NET_WM_STATE_ABOVE", False);
-    XChangeProperty(dpy, win, XInternAtom(dpy, "_NET_WM_STATE", False),
-                    XA_ATOM, 32, PropModeAppend, (unsigned char *)&above, 1);
+static bool handle_kp5_key(const struct input_event *ev) {
+    if (ev->code != KEY_KP5) return false;
 
-    XMapWindow(dpy, win);
+    if (ev->value == 1) {
+        if (!state.drag_locked) {
+            tune_click(ev);
+            history_note_pointer();
+            emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 1);
+            emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+            state.left_button_held = true;
+        }
+    } else if (ev->value == 0) {
+        if (state.left_button_held) {
+            if (!(state.ctrl_pressed && state.shift_pressed)) {
+                emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
+                emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+                state.left_button_held = false;
+            }
+            if (state.drag_locked && !(state.ctrl_pressed && state.shift_pressed)) {
+                state.drag_locked = false;
+                hide_drag_popup();
+            }
+        }
+    }
+    return true;
+}
 
-    GC gc = XCreateGC(dpy, win, 0, NULL);
-    unsigned long pixel = 0x33000000UL;
-    XSetForeground(dpy, gc, pixel);
+static bool handle_kpslash_key(const struct input_event *ev) {
+    if (ev->code != KEY_KPSLASH || ev->value != 1) return false;
 
-    jump_window = win;
+    if (state.left_button_held) {
+        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
+        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+        state.left_button_held = false;
+        state.drag_locked = false;
+        hide_drag_popup();
+    } else {
+        tune_click(ev);
+        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 1);
+        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+        state.left_button_held = true;
+        state.drag_locked = true;
+        if (!led_shows(1)) show_drag_popup();
+    }
+    return true;
+}
 
-    while (jump_overlay_visible) {
-        pthread_mutex_lock(&jump_mutex);
-        double now = get_time();
-        if (now - last_jump_adjust > JUMP_OVERLAY_TIMEOUT) {
-            jump_overlay_visible = false;
-            pthread_mutex_unlock(&jump_mutex);
-            break;
-        }
+static bool handle_kpasterisk_key(const struct input_event *ev) {
+    if (ev->code != KEY_KPASTERISK || ev->value != 1) return false;
 
-        int current_type = adjusting_jump_type;
-        if (jump_need_redraw && current_type > 0) {
-            jump_need_redraw = false;
+    if (state.left_button_held) {
+        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
+        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+        state.left_button_held = false;
+		state.drag_locked = false;
+		hide_drag_popup();
+    }
+    tune_click(ev);
+    mouse_click(BTN_MIDDLE);
+    return true;
+}
 
-            XLockDisplay(dpy);
-            XClearWindow(dpy, win);
-            int r = 3;
+static bool handle_kpminus_key(const struct input_event *ev) {
+    if (ev->code != KEY_KPMINUS || ev->value != 1) return false;
 
-            if (current_type == 1) {
-                if (app_state->cfg.jump_horizontal > 0) {
-                    int y = scr_h / 2;
-                    for (int x = 0; x < scr_w; x += app_state->cfg.jump_horizontal) {
-                        XFillRectangle(dpy, win, gc, x - r, y - r, 2 * r + 1, 2 * r + 1);
-                    }
-                }
-            } else if (current_type == 2) {
-                if (app_state->cfg.jump_vertical > 0) {
-                    int x = scr_w / 2;
-                    for (int y = 0; y < scr_h; y += app_state->cfg.jump_vertical) {
-                        XFillRectangle(dpy, win, gc, x - r, y - r, 2 * r + 1, 2 * r + 1);
-                    }
-                }
-            } else if (current_type == 3) {
-                if (app_state->cfg.jump_diagonal > 0) {
-                    double len = hypot((double)scr_w, (double)scr_h);
-                    double t_step = (double)app_state->cfg.jump_diagonal / len;
+    if (state.left_button_held) {
+        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
+        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+        state.left_button_held = false;
+		state.drag_locked = false;
+		hide_drag_popup();
+    }
+    tune_click(ev);
+    mouse_click(BTN_RIGHT);
+    return true;
+}
 
-                    for (double t = 0; t < 1.0; t += t_step) {
-                        int px = (int)(t * scr_w);
-                        int py = (int)(t * scr_h);
-                        XFillRectangle(dpy, win, gc, px - r, py - r, 2 * r + 1, 2 * r + 1);
-                    }
+static bool handle_numlock_key(const struct input_event *ev) {
+    if (ev->code != KEY_NUMLOCK) return false;
 
-                    for (double t = 0; t < 1.0; t += t_step) {
-                        int px = (int)(scr_w * (1.0 - t));
-                        int py = (int)(t * scr_h);
-                        XFillRectangle(dpy, win, gc, px - r, py - r, 2 * r + 1, 2 * r + 1);
-                    }
-                }
+    if (ev->value == 1) {
+        if (!state.drag_locked) {
+            tune_click(ev);
+            history_note_pointer();
+            emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 1);
+            emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+            state.left_button_held = true;
+        }
+    } else if (ev->value == 0) {
+        if (state.left_button_held) {
+            emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
+            emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+            state.left_button_held = false;
+            if (state.drag_locked) {
+                state.drag_locked = false;
+                hide_drag_popup();
+            }
+        }
+    }
+    return true;
+}
+
+/* ------------------------------------------------------------------ */
+/* Event Dispatch                                                     */
+/* ------------------------------------------------------------------ */
+/* Leaving mouse mode ends every modal layer and pending chord */
+static void drop_mouse_mode_layers(void) {
+    if (state.mouse_mode) return;
+    if (grid_active) grid_exit();
+    if (hint_active) hint_exit();
+    snap_held = false;
+    lens_hold_since = 0.0;
+    anchor_pending = 0;
+    kp0_held = false;
+    mark_pending = 0;
+}
+
+static void dispatch_event(const struct input_event *ev, ConfigPanel *panel) {
+    led_note(ev);
+    if (ev->type != EV_KEY) {
+        emit_event(state.uinput_fd, ev->type, ev->code, ev->value);
+        return;
+    }
+
+    /* A key press lands any running jump glide before it is handled */
+    if (ev->value == 1) anim_finish();
+    gesture_feed(ev);
+    if (state.mouse_mode) {
+        kp0_catch_up(get_time());
+        snap_feed(ev);
+        kp0_feed(ev);
+    }
+    if (handle_dwell_key(ev)) return;
+
+    bool consumed = false;
+    bool was_active = panel->active;
+    bool in_hint = hint_active;
+    if (handle_ctrl_key(ev, panel)) consumed = true;
+    else if (handle_alt_key(ev, panel)) consumed = true;
+    else if (handle_shift_key(ev)) consumed = true;
+    else if (panel->active && handle_esc_in_panel(ev, panel)) consumed = true;
+
+    if (state.mouse_mode) {
+        disable_autoscroll_if_not_allowed(ev);
+
+        if (panel->active) {
+            if (was_active) {
+                if (handle_panel_nav_key(ev, panel)) consumed = true;
+                else if (handle_non_nav_in_panel(ev, panel)) consumed = true;
+            }
+        } else {
+            if (gesture_dispatch(ev, panel)) consumed = true;
+            else if (handle_grid_key(ev)) consumed = true;
+            else if (handle_hint_key(ev)) consumed = true;
+            else if (handle_alt_adjustment_key(ev)) consumed = true;
+            else if (handle_snap_key(ev)) consumed = true;
+            else if (handle_macro_key(ev)) consumed = true;
+            else if (handle_anchor_key(ev)) consumed = true;
+            else if (handle_kp0_layer_key(ev)) consumed = true;
+            else if (handle_scroll_and_autoscroll_key(ev)) consumed = true;
+            else if (handle_ctrl_minus_key(ev)) consumed = true;
+            else if (handle_absolute_jump_key(ev)) consumed = true;
+            else if (handle_numpad_direction_key(ev)) consumed = true;
+            else if (handle_kp5_key(ev)) consumed = true;
+            else if (handle_kpslash_key(ev)) consumed = true;
+            else if (handle_kpasterisk_key(ev)) consumed = true;
+            else if (handle_kpminus_key(ev)) consumed = true;
+            else if (handle_numlock_key(ev)) consumed = true;
+        }
+    }
+
+    drop_mouse_mode_layers();
+
+    /* Hint labels are typed with letters, which must not end a drag */
+    if (state.left_button_held && ev->value == 1 && !in_hint && !hint_active) {
+        bool is_numpad = (ev->code >= KEY_KP7 && ev->code <= KEY_KPDOT) ||
+                         ev->code == KEY_KPSLASH ||
+                         ev->code == KEY_KPASTERISK ||
+                         ev->code == KEY_KPENTER ||
+                         ev->code == KEY_NUMLOCK;
+        bool is_ctrl_or_shift = (ev->code == KEY_LEFTCTRL || ev->code == KEY_RIGHTCTRL ||
+                                 ev->code == KEY_LEFTSHIFT || ev->code == KEY_RIGHTSHIFT);
+        bool should_release = false;
+
+        if (is_numpad) {
+            if ((ev->code == KEY_KP0 && !kp0_held) || (ev->code == KEY_KPDOT && !snap_held)) {
+                should_release = true;
+            }
+        } else {
+            if (!is_ctrl_or_shift) {
+                should_release = true;
             }
-            XFlush(dpy);
-            XUnlockDisplay(dpy);
         }
-        pthread_mutex_unlock(&jump_mutex);
 
-        usleep(20000);
+        if (should_release) {
+            emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
+            emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+            state.left_button_held = false;
+            state.drag_locked = false;
+            hide_drag_popup();
+        }
     }
 
-    XLockDisplay(dpy);
-    XUnmapWindow(dpy, win);
-    XDestroyWindow(dpy, win);
-    XFreeGC(dpy, gc);
-    XUnlockDisplay(dpy);
-    XCloseDisplay(dpy);
-    jump_window = None;
-    return NULL;
+    if (!consumed) {
+        if (state.ctrl_pressed && state.pending_ctrl) {
+            emit_event(state.uinput_fd, EV_KEY, state.pending_ctrl_code, 1);
+            emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
+            bool *forwarded = (state.pending_ctrl_code == KEY_LEFTCTRL) ? &state.left_ctrl_forwarded : &state.right_ctrl_forwarded;
+            *forwarded = true;
+            state.pending_ctrl = false;
+        }
+        emit_event(state.uinput_fd, EV_KEY, ev->code, ev->value);
+        emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
+
+        /* Grabbed keyboards report CLOCK_MONOTONIC; synthetic events don't */
+        if (!headless) {
+            uint64_t ev_ns = (uint64_t)ev->time.tv_sec * 1000000000ULL + ev->time.tv_usec * 1000ULL;
+            uint64_t now_ns = mono_ns();
+            hist_record(HIST_FORWARD, now_ns > ev_ns ? now_ns - ev_ns : 0);
+        }
+    }
+
+    if (ev->value == 0) {
+        state.adjust_start_times[ev->code] = 0.0;
+    }
 }
 
 /* ------------------------------------------------------------------ */
-/* Device Handling Functions                                          */
+/* Status Page                                                        */
 /* ------------------------------------------------------------------ */
-static bool is_keyboard(const char *device_path) {
-    int fd = open(device_path, O_RDONLY);
-    if (fd < 0) return false;
+/*
+ * Live state for status bars and monitoring agents, in a file under /run
+ * that readers mmap and poll without talking to the daemon. Names and
+ * the thread counters are written in place (the counters are the ones
+ * count_event() and friends bump); flags and config values sit behind a
+ * seqlock. Only the input thread writes, and only when something changed.
+ * The page is built in a temporary file and renamed into place, and its
+ * owner holds a flock on it, so a second daemon neither resizes a page
+ * that another one has mapped nor unlinks it on exit.
+ *
+ * Reader protocol: load seq (acquire); if odd, retry; copy flags and
+ * items; acquire fence; reload seq; retry if it differs.
+ */
+#define STATUS_PATH RUN_DIR "/status"
+#define STATUS_MAGIC 0x5354414bu   /* "KATS" little-endian */
+#define STATUS_VERSION 2
+#define STATUS_MAX_ITEMS 48
+#define STATUS_NAME_LEN 32
 
-    unsigned long key_bits[NBITS(KEY_MAX)];
-    memset(key_bits, 0, sizeof(key_bits));
+enum {
+    STATUS_MOUSE_MODE = 1 << 0,
+    STATUS_DRAG_LOCKED = 1 << 1,
+    STATUS_BUTTON_HELD = 1 << 2,
+    STATUS_AUTOSCROLL_UP = 1 << 3,
+    STATUS_AUTOSCROLL_DOWN = 1 << 4,
+};
 
-    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits) < 0) {
-        close(fd);
-        return false;
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pid;
+    uint32_t num_items;
+    char item_names[STATUS_MAX_ITEMS][STATUS_NAME_LEN];
+    ThreadCounters counters[NUM_STATS_THREADS];
+    atomic_uint seq;               /* odd while a write is in progress */
+    uint32_t flags;                /* STATUS_* */
+    double items[STATUS_MAX_ITEMS];
+} StatusPage;
+
+static StatusPage *status_page = NULL;
+static int status_fd = -1;         /* keeps our flock on the page */
+static uint32_t status_last_flags;
+static Config status_last_cfg;
+
+static uint32_t status_flags(void) {
+    return (state.mouse_mode ? STATUS_MOUSE_MODE : 0) |
+           (state.drag_locked ? STATUS_DRAG_LOCKED : 0) |
+           (state.left_button_held ? STATUS_BUTTON_HELD : 0) |
+           (state.autoscroll_up_active ? STATUS_AUTOSCROLL_UP : 0) |
+           (state.autoscroll_down_active ? STATUS_AUTOSCROLL_DOWN : 0);
+}
+
+static void status_write(uint32_t flags) {
+    StatusPage *p = status_page;
+    unsigned seq = atomic_load_explicit(&p->seq, memory_order_relaxed);
+    atomic_store_explicit(&p->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    p->flags = flags;
+    for (uint32_t i = 0; i < p->num_items; i++) {
+        ConfigItem *item = &config_items[i];
+        p->items[i] = item->is_double ? *(double *)item->value : *(int *)item->value;
     }
+    atomic_store_explicit(&p->seq, seq + 2, memory_order_release);
+    status_last_flags = flags;
+    status_last_cfg = state.cfg;
+}
 
-    bool has_a = test_bit(KEY_A, key_bits);
-    bool has_space = test_bit(KEY_SPACE, key_bits);
-    bool has_ctrl = test_bit(KEY_LEFTCTRL, key_bits);
+/* Called after anything that may have changed state; cheap when nothing did */
+static void status_publish(void) {
+    if (!status_page) return;
+    uint32_t flags = status_flags();
+    if (flags == status_last_flags && memcmp(&status_last_cfg, &state.cfg, sizeof(Config)) == 0) return;
+    status_write(flags);
+}
 
-    close(fd);
-    return has_a && has_space && has_ctrl;
+/* Must run before any thread other than the caller touches the counters */
+static void status_open(const char *path) {
+    if (!run_dir_ready()) return;
+
+    int old = open(path, O_RDONLY | O_CLOEXEC);
+    if (old >= 0) {
+        bool owned = flock(old, LOCK_EX | LOCK_NB) < 0 && errno == EWOULDBLOCK;
+        close(old);
+        if (owned) {
+            fprintf(stderr, "Status page %s belongs to another kat, not publishing\n", path);
+            return;
+        }
+    }
+
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        perror("Failed to create status page");
+        return;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    /* A fresh file, so nobody has it mapped while it grows */
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0 || ftruncate(fd, sizeof(StatusPage)) < 0) {
+        perror("Failed to size status page");
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    void *m = mmap(NULL, sizeof(StatusPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        perror("Failed to map status page");
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    fchmod(fd, 0644);   /* readable by the user's status bar despite umask */
+
+    StatusPage *p = m;
+    p->version = STATUS_VERSION;
+    p->pid = (uint32_t)getpid();
+    p->num_items = num_config_items < STATUS_MAX_ITEMS ? num_config_items : STATUS_MAX_ITEMS;
+    for (uint32_t i = 0; i < p->num_items; i++)
+        snprintf(p->item_names[i], STATUS_NAME_LEN, "%s", config_items[i].name);
+    for (int t = 0; t < NUM_STATS_THREADS; t++) {
+        atomic_store(&p->counters[t].events, atomic_load(&thread_counters[t].events));
+        atomic_store(&p->counters[t].syscalls, atomic_load(&thread_counters[t].syscalls));
+        atomic_store(&p->counters[t].wakeups, atomic_load(&thread_counters[t].wakeups));
+    }
+    status_page = p;
+    status_write(status_flags());
+    /* Magic last: a reader that sees it sees a complete page */
+    atomic_thread_fence(memory_order_release);
+    p->magic = STATUS_MAGIC;
+
+    if (rename(tmp, path) < 0) {
+        perror("Failed to publish status page");
+        status_page = NULL;
+        munmap(m, sizeof(StatusPage));
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    thread_counters = p->counters;
+    status_fd = fd;
 }
 
-static bool is_virtual_device(const char *device_path) {
-    int fd = open(device_path, O_RDONLY);
-    if (fd < 0) return false;
+static void status_close(const char *path) {
+    if (!status_page) return;
+    status_page->magic = 0;
+    /* Only remove the page if the path still names ours */
+    struct stat a, b;
+    if (stat(path, &a) == 0 && fstat(status_fd, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+        unlink(path);
+}
 
-    char name[256] = "";
-    ioctl(fd, EVIOCGNAME(sizeof(name)), name);
+/* --status: print a snapshot of a running daemon's page */
+static int status_show(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    void *m = mmap(NULL, sizeof(StatusPage), PROT_READ, MAP_SHARED, fd, 0);
     close(fd);
+    if (m == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    const StatusPage *p = m;
+    if (p->magic != STATUS_MAGIC || p->version != STATUS_VERSION) {
+        fprintf(stderr, "%s: not a kat status page (or daemon not running)\n", path);
+        return 1;
+    }
 
-    return strstr(name, "evdev") || strstr(name, "uinput") ||
-           strstr(name, "Virtual") || strstr(name, "py-");
+    uint32_t flags, n = p->num_items < STATUS_MAX_ITEMS ? p->num_items : STATUS_MAX_ITEMS;
+    double items[STATUS_MAX_ITEMS];
+    unsigned s1, s2;
+    do {
+        s1 = atomic_load_explicit((atomic_uint *)&p->seq, memory_order_acquire);
+        flags = p->flags;
+        memcpy(items, p->items, sizeof(items));
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit((atomic_uint *)&p->seq, memory_order_relaxed);
+    } while ((s1 & 1) || s1 != s2);
+
+    printf("pid %u%s\n", p->pid, kill((pid_t)p->pid, 0) < 0 && errno == ESRCH ? " (not running)" : "");
+    printf("mouse_mode %d\ndrag_locked %d\nbutton_held %d\nautoscroll_up %d\nautoscroll_down %d\n",
+           !!(flags & STATUS_MOUSE_MODE), !!(flags & STATUS_DRAG_LOCKED), !!(flags & STATUS_BUTTON_HELD),
+           !!(flags & STATUS_AUTOSCROLL_UP), !!(flags & STATUS_AUTOSCROLL_DOWN));
+    for (uint32_t i = 0; i < n; i++) printf("%.*s %g\n", STATUS_NAME_LEN, p->item_names[i], items[i]);
+    for (int t = 0; t < NUM_STATS_THREADS; t++) {
+        printf("%s events=%lu syscalls=%lu wakeups=%lu\n", stats_thread_names[t],
+               atomic_load((atomic_ulong *)&p->counters[t].events),
+               atomic_load((atomic_ulong *)&p->counters[t].syscalls),
+               atomic_load((atomic_ulong *)&p->counters[t].wakeups));
+    }
+    return 0;
 }
 
-static int find_all_keyboards(void) {
-    DIR *dir = opendir(INPUT_DIR);
-    if (!dir) {
-        perror("Cannot open /dev/input");
-        return -1;
-    }
+/* ------------------------------------------------------------------ */
+/* Control Socket                                                     */
+/* ------------------------------------------------------------------ */
+/*
+ * A Unix socket for scripts, served from the input loop's poll() after
+ * the keyboards, so a slow client never delays forwarding. Requests are
+ * single lines:
+ *
+ *   move DX DY            relative motion
+ *   warp X Y              absolute pointer position
+ *   pos                   -> ok X Y
+ *   click [left|middle|right] [down|up]
+ *   scroll DY [DX]        wheel notches, fractions allowed
+ *   mode [on|off|toggle]  -> ok on|off
+ *   get [NAME]            one config item, or all as "NAME = VALUE" lines
+ *   set NAME VALUE        clamped and saved like a panel edit
+ *   stats                 the SIGUSR1 dump
+ *   subscribe             then "event mode on|off" / "event config NAME VALUE"
+ *
+ * Each request ends with a line starting "ok" or "err". Replies are sent
+ * without blocking; a client that stops reading is dropped.
+ */
+#define MAX_CONTROL_CLIENTS 8
+#define CONTROL_LINE_MAX 256
 
-    struct dirent *entry;
-    char device_path[PATH_MAX];
-    state.num_kbds = 0;
+typedef struct {
+    int fd;                 /* -1 = free slot */
+    bool subscribed;
+    bool overlong;          /* skipping the rest of a line that did not fit */
+    size_t len;
+    char buf[CONTROL_LINE_MAX];
+} ControlClient;
+
+static int control_fd = -1;
+static const char *control_path = NULL;
+static ControlClient control_clients[MAX_CONTROL_CLIENTS];
+static Config control_last_cfg;
+static bool control_last_mode = false;
+
+static void control_drop(ControlClient *c) {
+    close(c->fd);
+    c->fd = -1;
+}
+
+static bool control_write(ControlClient *c, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(c->fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        count_syscall();
+        if (n <= 0) {
+            control_drop(c);
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
 
-    while ((entry = readdir(dir)) != NULL && state.num_kbds < MAX_KBDS) {
-        if (strncmp(entry->d_name, "event", 5) == 0) {
-            snprintf(device_path, sizeof(device_path), "%s/%s", INPUT_DIR, entry->d_name);
+static void control_send(ControlClient *c, const char *fmt, ...) {
+    if (c->fd < 0) return;     /* dropped earlier in a multi-line reply */
+    char line[CONTROL_LINE_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line) - 1, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if (n > (int)sizeof(line) - 2) n = sizeof(line) - 2;
+    line[n++] = '\n';
+    control_write(c, line, (size_t)n);
+}
 
-            if (is_virtual_device(device_path)) continue;
+static void format_config_value(const ConfigItem *item, char *buf, size_t size) {
+    if (item->is_double) snprintf(buf, size, item->fmt, *(double*)item->value);
+    else snprintf(buf, size, item->fmt, *(int*)item->value);
+}
 
-            if (is_keyboard(device_path)) {
-                int fd = open(device_path, O_RDONLY);
-                if (fd < 0) continue;
+static ConfigItem* find_config_item(const char *name) {
+    for (int i = 0; i < num_config_items; i++) {
+        if (strcasecmp(config_items[i].name, name) == 0) return &config_items[i];
+    }
+    return NULL;
+}
 
-                if (ioctl(fd, EVIOCGRAB, 1) < 0) {
-                    perror("Cannot grab keyboard");
-                    close(fd);
-                    continue;
-                }
+static void control_button(int button, int value) {
+    emit_event(state.mouse_fd, EV_KEY, button, value);
+    emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+}
 
-                char name[256] = "Unknown";
-                ioctl(fd, EVIOCGNAME(sizeof(name)), name);
-                printf("Grabbed keyboard: %s (%s)\n", name, device_path);
+static void control_request(ControlClient *c, char *line) {
+    char *save = NULL;
+    char *cmd = strtok_r(line, " \t\r", &save);
+    char *a = cmd ? strtok_r(NULL, " \t\r", &save) : NULL;
+    char *b = a ? strtok_r(NULL, " \t\r", &save) : NULL;
+    if (!cmd) return;
 
-                state.kbd_fds[state.num_kbds++] = fd;
+    if (strcmp(cmd, "move") == 0 && b) {
+        emit_event(state.mouse_fd, EV_REL, REL_X, atoi(a));
+        emit_event(state.mouse_fd, EV_REL, REL_Y, atoi(b));
+        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
+        control_send(c, "ok");
+    } else if (strcmp(cmd, "warp") == 0 && b) {
+        warp_mouse(input_display(), atoi(a), atoi(b));
+        /* Scripts click for themselves; a dwell would add a second click */
+        dwell_cancel();
+        control_send(c, "ok");
+    } else if (strcmp(cmd, "pos") == 0) {
+        int x = 0, y = 0;
+        if (query_pointer(input_display(), &x, &y)) control_send(c, "ok %d %d", x, y);
+        else control_send(c, "err no display");
+    } else if (strcmp(cmd, "click") == 0) {
+        int button = BTN_LEFT;
+        if (a && strcmp(a, "middle") == 0) button = BTN_MIDDLE;
+        else if (a && strcmp(a, "right") == 0) button = BTN_RIGHT;
+        else if (a && strcmp(a, "left") != 0) {
+            control_send(c, "err unknown button %s", a);
+            return;
+        }
+        if (!b || strcmp(b, "down") == 0) control_button(button, 1);
+        if (!b || strcmp(b, "up") == 0) control_button(button, 0);
+        control_send(c, "ok");
+    } else if (strcmp(cmd, "scroll") == 0 && a) {
+        mouse_wheel(SCROLL_VERTICAL, atof(a));
+        if (b) mouse_wheel(SCROLL_HORIZONTAL, atof(b));
+        control_send(c, "ok");
+    } else if (strcmp(cmd, "mode") == 0) {
+        bool on = state.mouse_mode;
+        if (!a || strcmp(a, "toggle") == 0) on = !on;
+        else if (strcmp(a, "on") == 0) on = true;
+        else if (strcmp(a, "off") == 0) on = false;
+        else {
+            control_send(c, "err usage: mode [on|off|toggle]");
+            return;
+        }
+        if (on != state.mouse_mode) {
+            set_mouse_mode(on);
+            drop_mouse_mode_layers();
+        }
+        control_send(c, "ok %s", state.mouse_mode ? "on" : "off");
+    } else if (strcmp(cmd, "get") == 0) {
+        char val[64];
+        if (!a) {
+            for (int i = 0; i < num_config_items && c->fd >= 0; i++) {
+                format_config_value(&config_items[i], val, sizeof(val));
+                control_send(c, "%s = %s", config_items[i].name, val);
             }
+            control_send(c, "ok");
+            return;
+        }
+        ConfigItem *item = find_config_item(a);
+        if (!item) {
+            control_send(c, "err unknown item %s", a);
+            return;
+        }
+        format_config_value(item, val, sizeof(val));
+        control_send(c, "ok %s", val);
+    } else if (strcmp(cmd, "set") == 0 && b) {
+        ConfigItem *item = find_config_item(a);
+        if (!item) {
+            control_send(c, "err unknown item %s", a);
+            return;
+        }
+        apply_config_value(item->name, b);
+        clamp_config_item(item);
+        save_config();
+        char val[64];
+        format_config_value(item, val, sizeof(val));
+        control_send(c, "ok %s", val);
+    } else if (strcmp(cmd, "stats") == 0) {
+        char *text = NULL;
+        size_t size = 0;
+        FILE *f = open_memstream(&text, &size);
+        if (!f) {
+            control_send(c, "err %s", strerror(errno));
+            return;
         }
+        stats_dump(f);
+        fclose(f);
+        if (control_write(c, text, size)) control_send(c, "ok");
+        free(text);
+    } else if (strcmp(cmd, "subscribe") == 0) {
+        c->subscribed = true;
+        control_send(c, "ok");
+    } else {
+        control_send(c, "err unknown request %s", cmd);
     }
+}
 
-    closedir(dir);
-    if (state.num_kbds == 0) {
-        fprintf(stderr, "Error: Could not find any keyboard devices\n");
-        return -1;
-    }
-    return 0;
+/* Whether a running daemon answers on path; a leftover socket file does not */
+static bool control_in_use(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) return false;
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    bool live = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    close(fd);
+    return live;
 }
 
-static int create_uinput(void) {
-    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
-    if (fd < 0) {
-        perror("Cannot open /dev/uinput");
-        return -1;
+static void control_open(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Control socket path too long: %s\n", path);
+        return;
     }
+    strcpy(addr.sun_path, path);
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; i++) control_clients[i].fd = -1;
 
-    ioctl(fd, UI_SET_EVBIT, EV_KEY);
-    ioctl(fd, UI_SET_EVBIT, EV_SYN);
-
-    for (int i = 0; i < KEY_MAX; i++) {
-        ioctl(fd, UI_SET_KEYBIT, i);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("control socket");
+        return;
     }
+    /* Only a stale socket may be replaced, never another daemon's */
+    if (control_in_use(path)) {
+        fprintf(stderr, "Control socket %s is in use\n", path);
+        close(fd);
+        return;
+    }
+    if (!run_dir_ready()) {
+        close(fd);
+        return;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        perror("control socket bind");
+        close(fd);
+        return;
+    }
+    /* Anyone may connect; control_handle() keeps only the user's own clients */
+    chmod(path, 0666);
 
-    struct uinput_setup usetup;
-    memset(&usetup, 0, sizeof(usetup));
-    usetup.id.bustype = BUS_USB;
-    usetup.id.vendor = 0x1234;
-    usetup.id.product = 0x5678;
-    strcpy(usetup.name, "Virtual Mouse Daemon Keyboard");
-
-    ioctl(fd, UI_DEV_SETUP, &usetup);
-    ioctl(fd, UI_DEV_CREATE);
-    usleep(10000);
-
-    printf("Virtual keyboard created\n");
-    return fd;
+    control_fd = fd;
+    control_path = path;
+    control_last_cfg = state.cfg;
+    control_last_mode = state.mouse_mode;
 }
 
-static int create_mouse(void) {
-    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
-    if (fd < 0) {
-        perror("Cannot open /dev/uinput for mouse");
-        return -1;
+static void control_close(void) {
+    if (control_fd < 0) return;
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+        if (control_clients[i].fd >= 0) control_drop(&control_clients[i]);
     }
+    close(control_fd);
+    control_fd = -1;
+    unlink(control_path);
+}
 
-    ioctl(fd, UI_SET_EVBIT, EV_KEY);
-    ioctl(fd, UI_SET_EVBIT, EV_REL);
-    ioctl(fd, UI_SET_EVBIT, EV_SYN);
-
-    ioctl(fd, UI_SET_RELBIT, REL_X);
-    ioctl(fd, UI_SET_RELBIT, REL_Y);
-    ioctl(fd, UI_SET_RELBIT, REL_WHEEL);
-    ioctl(fd, UI_SET_RELBIT, REL_WHEEL_HI_RES);
+static void control_broadcast(const char *line) {
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+        ControlClient *c = &control_clients[i];
+        if (c->fd >= 0 && c->subscribed) control_send(c, "%s", line);
+    }
+}
 
-    ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
-    ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT);
-    ioctl(fd, UI_SET_KEYBIT, BTN_MIDDLE);
+/* Tell subscribers about mode and config changes from any source */
+static void control_publish(void) {
+    if (control_fd < 0) return;
+    if (state.mouse_mode != control_last_mode) {
+        control_last_mode = state.mouse_mode;
+        control_broadcast(control_last_mode ? "event mode on" : "event mode off");
+    }
+    if (memcmp(&control_last_cfg, &state.cfg, sizeof(Config)) == 0) return;
+    for (int i = 0; i < num_config_items; i++) {
+        ConfigItem *item = &config_items[i];
+        size_t off = (size_t)((char *)item->value - (char *)&state.cfg);
+        size_t size = item->is_double ? sizeof(double) : sizeof(int);
+        if (memcmp((char *)&control_last_cfg + off, item->value, size) == 0) continue;
+        char val[64], line[CONTROL_LINE_MAX];
+        format_config_value(item, val, sizeof(val));
+        snprintf(line, sizeof(line), "event config %s %s", item->name, val);
+        control_broadcast(line);
+    }
+    control_last_cfg = state.cfg;
+}
 
-    struct uinput_setup usetup;
-    memset(&usetup, 0, sizeof(usetup));
-    usetup.id.bustype = BUS_USB;
-    usetup.id.vendor = 0x1234;
-    usetup.id.product = 0x5679;
-    strcpy(usetup.name, "Virtual Mouse Daemon Mouse");
+/* Fill pollfds for the listener and clients; returns how many were added */
+static int control_poll_fds(struct pollfd *p) {
+    if (control_fd < 0) return 0;
+    int n = 0;
+    p[n++] = (struct pollfd){ .fd = control_fd, .events = POLLIN };
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+        if (control_clients[i].fd >= 0) p[n++] = (struct pollfd){ .fd = control_clients[i].fd, .events = POLLIN };
+    }
+    return n;
+}
 
-    ioctl(fd, UI_DEV_SETUP, &usetup);
-    ioctl(fd, UI_DEV_CREATE);
-    usleep(10000);
+static void control_read(ControlClient *c) {
+    ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, MSG_DONTWAIT);
+    count_syscall();
+    if (n <= 0) {
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) control_drop(c);
+        return;
+    }
+    c->len += (size_t)n;
+
+    char *start = c->buf, *nl;
+    while (c->fd >= 0 && (nl = memchr(start, '\n', c->len - (size_t)(start - c->buf)))) {
+        *nl = '\0';
+        if (!c->overlong) control_request(c, start);
+        c->overlong = false;
+        control_publish();
+        status_publish();
+        led_sync();
+        start = nl + 1;
+    }
+    if (c->fd < 0) return;
+    c->len -= (size_t)(start - c->buf);
+    memmove(c->buf, start, c->len);
+    if (c->len == sizeof(c->buf)) {
+        c->len = 0;
+        if (!c->overlong) control_send(c, "err line too long");
+        c->overlong = true;
+    }
+}
 
-    printf("Virtual mouse created\n");
-    return fd;
+static void control_handle(const struct pollfd *p, int n) {
+    if (n == 0) return;
+    /* Clients first: the slots must still match the fds that were polled */
+    for (int i = 1; i < n; i++) {
+        if (!(p[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        for (int j = 0; j < MAX_CONTROL_CLIENTS; j++) {
+            if (control_clients[j].fd == p[i].fd) control_read(&control_clients[j]);
+        }
+    }
+    if (p[0].revents & POLLIN) {
+        int fd = accept(control_fd, NULL, NULL);
+        count_syscall();
+        if (fd < 0) return;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+            (cred.uid != 0 && cred.uid != user_uid())) {
+            close(fd);
+            return;
+        }
+        for (int j = 0; j < MAX_CONTROL_CLIENTS; j++) {
+            if (control_clients[j].fd < 0) {
+                control_clients[j] = (ControlClient){ .fd = fd };
+                return;
+            }
+        }
+        close(fd);
+    }
 }
 
 /* ------------------------------------------------------------------ */
-/* Key Handling Functions                                             */
+/* Trace Capture and Replay                                           */
 /* ------------------------------------------------------------------ */
-static bool handle_ctrl_key(const struct input_event *ev, double *last_ctrl_press) {
-    if (ev->code != KEY_LEFTCTRL && ev->code != KEY_RIGHTCTRL) return false;
+static int start_trace_record(const char *path) {
+    char meta[TRACE_META_MAX];
+    size_t len = 0;
 
-    bool *forwarded = (ev->code == KEY_LEFTCTRL) ? &state.left_ctrl_forwarded : &state.right_ctrl_forwarded;
+    for (int i = 0; i < num_config_items && len < sizeof(meta); i++) {
+        ConfigItem *item = &config_items[i];
+        if (item->is_double) {
+            len += snprintf(meta + len, sizeof(meta) - len, "%s = %.17g\n", item->name, *(double*)item->value);
+        } else {
+            len += snprintf(meta + len, sizeof(meta) - len, "%s = %d\n", item->name, *(int*)item->value);
+        }
+    }
 
-    pthread_mutex_lock(&state.state_mutex);
-    if (ev->value != 0) {
-        state.ctrl_pressed = true;
-    } else {
-        state.ctrl_pressed = false;
+    Display *dpy = XOpenDisplay(NULL);
+    if (dpy) {
+        int w, h, x = 0, y = 0, event_base;
+        screen_size(dpy, &w, &h);
+        query_pointer(dpy, &x, &y);
+        if (monitor_randr_ok(dpy, &event_base)) monitor_load(dpy);
+        XCloseDisplay(dpy);
+        char layout[160];
+        monitor_format_layout(layout, sizeof(layout));
+        if (len < sizeof(meta)) {
+            len += snprintf(meta + len, sizeof(meta) - len,
+                            "SCREEN_WIDTH = %d\nSCREEN_HEIGHT = %d\nPOINTER_X = %d\nPOINTER_Y = %d\n", w, h, x, y);
+        }
+        if (layout[0] && len < sizeof(meta)) {
+            len += snprintf(meta + len, sizeof(meta) - len, "MONITORS = %s\n", layout);
+        }
     }
-    pthread_mutex_unlock(&state.state_mutex);
+    if (len >= sizeof(meta)) len = sizeof(meta) - 1;
 
-    if (ev->value == 1) {
-        double current_time = get_time();
-        double time_since_last = current_time - *last_ctrl_press;
-        if (time_since_last < DOUBLE_PRESS_THRESHOLD) {
-            pthread_mutex_lock(&state.state_mutex);
-            state.mouse_mode = !state.mouse_mode;
-            bool was_autoscroll = false;
-            if (!state.mouse_mode) {
-                was_autoscroll = state.autoscroll_up_active || state.autoscroll_down_active;
-                state.autoscroll_up_active = false;
-                state.autoscroll_down_active = false;
-            }
-            pthread_mutex_unlock(&state.state_mutex);
+    trace_record_file = fopen_as_user(path, "wb");
+    if (!trace_record_file) {
+        perror("fopen trace");
+        return -1;
+    }
+    if (!trace_write_header(trace_record_file, meta, (uint32_t)len)) {
+        perror("write trace header");
+        fclose(trace_record_file);
+        trace_record_file = NULL;
+        return -1;
+    }
+    printf("Recording input trace to %s\n", path);
+    return 0;
+}
 
-            const char *msg;
-            if (state.mouse_mode) {
-                msg = "Mouse Mode ON";
-            } else if (was_autoscroll) {
-                msg = "Mouse Mode and Autoscroll OFF";
-            } else {
-                msg = "Mouse Mode OFF";
-            }
-            show_feedback(msg);
+static void apply_trace_meta(const char *meta) {
+    char line[256], name[64], value[192];
+    const char *p = meta;
+
+    while (*p) {
+        const char *eol = strchr(p, '\n');
+        size_t n = eol ? (size_t)(eol - p) : strlen(p);
+        if (n >= sizeof(line)) n = sizeof(line) - 1;
+        memcpy(line, p, n);
+        line[n] = '\0';
+        p = eol ? eol + 1 : p + strlen(p);
+
+        if (!cfg_parse_line(line, name, sizeof(name), value, sizeof(value))) continue;
+
+        if (strcmp(name, "SCREEN_WIDTH") == 0) virtual_screen_w = atoi(value);
+        else if (strcmp(name, "SCREEN_HEIGHT") == 0) virtual_screen_h = atoi(value);
+        else if (strcmp(name, "POINTER_X") == 0) virtual_pointer_x = atoi(value);
+        else if (strcmp(name, "POINTER_Y") == 0) virtual_pointer_y = atoi(value);
+        else if (strcmp(name, "MONITORS") == 0) monitor_parse_layout(value);
+        else apply_config_value(name, value);
+    }
+    if (virtual_screen_w <= 0) virtual_screen_w = 1920;
+    if (virtual_screen_h <= 0) virtual_screen_h = 1080;
+}
 
-            *last_ctrl_press = 0.0;  // reset to prevent triple press issues
-            return true;
-        }
-        *last_ctrl_press = current_time;
-        state.pending_ctrl = true;
-        state.pending_ctrl_code = ev->code;
-        return true;
-    } else if (ev->value == 0) {
-        if (*forwarded) {
-            emit_event(state.uinput_fd, EV_KEY, ev->code, 0);
-            emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
-            *forwarded = false;
-        }
-        return true;
+/*
+ * Feed a recorded trace through dispatch_event() and movement_tick() on a
+ * virtual clock. Everything the daemon would have written to uinput, plus
+ * pointer warps, goes to out_path as a trace, so two builds can be compared
+ * with cmp(1).
+ */
+static int replay_trace(const char *in_path, const char *out_path) {
+    FILE *in = fopen_as_user(in_path, "rb");
+    if (!in) {
+        perror("fopen replay trace");
+        return 1;
+    }
+
+    char magic[8];
+    uint32_t version = 0, meta_len = 0;
+    if (fread(magic, 1, 8, in) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0 ||
+        fread(&version, sizeof(version), 1, in) != 1 || version != TRACE_VERSION ||
+        fread(&meta_len, sizeof(meta_len), 1, in) != 1 || meta_len >= TRACE_META_MAX) {
+        fprintf(stderr, "%s: not a kat trace (version %d)\n", in_path, TRACE_VERSION);
+        fclose(in);
+        return 1;
     }
-    return false;
-}
 
-static bool handle_alt_key(const struct input_event *ev, ConfigPanel *panel) {
-    if (ev->code != KEY_LEFTALT && ev->code != KEY_RIGHTALT) return false;
+    char meta[TRACE_META_MAX];
+    if (fread(meta, 1, meta_len, in) != meta_len) {
+        fprintf(stderr, "%s: truncated trace header\n", in_path);
+        fclose(in);
+        return 1;
+    }
+    meta[meta_len] = '\0';
 
-    pthread_mutex_lock(&state.state_mutex);
-    state.alt_pressed = (ev->value != 0);
-    pthread_mutex_unlock(&state.state_mutex);
+    init_config_defaults();
+    apply_trace_meta(meta);
 
-    if (ev->value == 1) {
-        double now = get_time();
-        if (state.mouse_mode && (now - state.last_alt_press) < ALT_DOUBLE_THRESHOLD && (now - state.last_alt_press) > 0.01) {
-            show_config_panel(panel);
-        }
-        state.last_alt_press = now;
+    FILE *out = strcmp(out_path, "-") == 0 ? stdout : fopen_as_user(out_path, "wb");
+    if (!out) {
+        perror("fopen replay output");
+        fclose(in);
+        return 1;
     }
+    trace_write_header(out, NULL, 0);
 
-    if (!panel->active) {
-        emit_event(state.uinput_fd, EV_KEY, ev->code, ev->value);
-        emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
+    /* Far from zero so "last press at 0.0" never reads as a double press */
+    replay_epoch = 1000000.0;
+    clock_virtual = true;
+    clock_virtual_now = replay_epoch;
+    headless = true;
+    replay_out = out;
+
+    state.uinput_fd = -1;
+    state.mouse_fd = -2;
+    state.running = true;
+    pthread_mutex_init(&state.state_mutex, NULL);
+
+    ConfigPanel panel;
+    init_config_panel(&panel);
+    double next_tick = replay_epoch;
+    long events = 0;
+
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    TraceRecord rec;
+    while (fread(&rec, sizeof(rec), 1, in) == 1) {
+        double t = replay_epoch + rec.time_us * 1e-6;
+
+        while (next_tick <= t) {
+            anim_catch_up(next_tick);
+            dwell_catch_up(next_tick);
+            kp0_catch_up(next_tick);
+            if (clock_virtual_now < next_tick) clock_virtual_now = next_tick;
+            next_tick = clock_virtual_now + movement_tick(NULL) * 1e-6;
+        }
+        anim_catch_up(t);
+        dwell_catch_up(t);
+        kp0_catch_up(t);
+        if (clock_virtual_now < t) clock_virtual_now = t;
+
+        struct input_event ev = {
+            .type = rec.type,
+            .code = rec.code,
+            .value = rec.value,
+        };
+        get_timeval(&ev.time);
+        dispatch_event(&ev, &panel);
+        events++;
     }
 
-    return true;
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double wall_ns = (wall_end.tv_sec - wall_start.tv_sec) * 1e9 + (wall_end.tv_nsec - wall_start.tv_nsec);
+
+    fclose(in);
+    if (out != stdout) fclose(out);
+    else fflush(out);
+    replay_out = NULL;
+
+    fprintf(stderr, "Replayed %ld events (%.1f s virtual) -> %ld records in %.3f ms, %.0f ns/event\n",
+            events, clock_virtual_now - replay_epoch, replay_out_records,
+            wall_ns / 1e6, events ? wall_ns / events : 0.0);
+    return 0;
 }
 
-static bool handle_shift_key(const struct input_event *ev) {
-    if (ev->code != KEY_LEFTSHIFT && ev->code != KEY_RIGHTSHIFT) return false;
+/* ------------------------------------------------------------------ */
+/* Microbenchmarks                                                    */
+/* ------------------------------------------------------------------ */
+/*
+ * Handlers run on the virtual clock, and every press moves it on by
+ * BENCH_PRESS_GAP, so timing rules (the gesture debounce, the double-tap
+ * window) see a human pace instead of presses a microsecond apart. A case
+ * that checks its outcome clears bench_ok when the handlers did not do
+ * what the case claims to measure.
+ */
+#define BENCH_ITERATIONS 200000
+#define BENCH_WARMUP 2000
+#define BENCH_PRESS_GAP 0.05      /* seconds of virtual time per press */
 
-    pthread_mutex_lock(&state.state_mutex);
-    state.shift_pressed = (ev->value != 0);
-    pthread_mutex_unlock(&state.state_mutex);
+static bool bench_ok;
 
-    if (!(state.autoscroll_up_active || state.autoscroll_down_active)) {
-        emit_event(state.uinput_fd, EV_KEY, ev->code, ev->value);
-        emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
-    }
+typedef struct {
+    const char *name;
+    bool mouse_mode;
+    int events_per_iter;
+    void (*iter)(ConfigPanel *panel);
+} BenchCase;
+
+static void bench_key(ConfigPanel *panel, uint16_t code, int32_t value) {
+    struct input_event ev = { .type = EV_KEY, .code = code, .value = value };
+    if (value == 1) clock_virtual_now += BENCH_PRESS_GAP;
+    get_timeval(&ev.time);
+    dispatch_event(&ev, panel);
+    ev.type = EV_SYN;
+    ev.code = SYN_REPORT;
+    ev.value = 0;
+    dispatch_event(&ev, panel);
+}
 
-    return true;
+static void bench_emit_event(ConfigPanel *panel) {
+    (void)panel;
+    emit_event(state.uinput_fd, EV_KEY, KEY_A, 1);
 }
 
-static bool handle_esc_in_panel(const struct input_event *ev, ConfigPanel *panel) {
-    if (ev->code != KEY_ESC || ev->value != 1) return false;
+static void bench_passthrough(ConfigPanel *panel) {
+    bench_key(panel, KEY_A, 1);
+    bench_key(panel, KEY_A, 0);
+}
 
-    hide_config_panel(panel);
-    return true;
+static void bench_numpad_motion(ConfigPanel *panel) {
+    bench_key(panel, KEY_KP8, 1);
+    bench_key(panel, KEY_KP8, 0);
 }
 
-static void disable_autoscroll_if_not_allowed(const struct input_event *ev) {
-    if (ev->value != 1) return;
+static void bench_alt_autorepeat(ConfigPanel *panel) {
+    if (!state.alt_pressed) {
+        bench_key(panel, KEY_LEFTALT, 1);
+        bench_key(panel, KEY_KPASTERISK, 1);
+    }
+    bench_key(panel, KEY_KPASTERISK, 2);
+}
 
-    bool is_allowed = (ev->code == KEY_LEFTCTRL || ev->code == KEY_RIGHTCTRL ||
-                       ev->code == KEY_LEFTALT || ev->code == KEY_RIGHTALT ||
-                       ev->code == KEY_LEFTSHIFT || ev->code == KEY_RIGHTSHIFT ||
-                       (state.ctrl_pressed && (ev->code == KEY_KPPLUS || ev->code == KEY_KPENTER || (state.shift_pressed && ev->code == KEY_EQUAL))) ||
-                       (state.alt_pressed && (ev->code == KEY_KPPLUS || ev->code == KEY_KPENTER || (state.shift_pressed && ev->code == KEY_EQUAL) || ev->code == KEY_KPDOT)) ||
-                       (state.alt_pressed && state.shift_pressed && ev->code == KEY_KPDOT));
+static void bench_ctrl_double_press(ConfigPanel *panel) {
+    bool was = state.mouse_mode;
+    bench_key(panel, KEY_LEFTCTRL, 1);
+    bench_key(panel, KEY_LEFTCTRL, 0);
+    bench_key(panel, KEY_LEFTCTRL, 1);
+    bench_key(panel, KEY_LEFTCTRL, 0);
+    if (state.mouse_mode == was) bench_ok = false;
+}
 
-    if (!is_allowed && (state.autoscroll_up_active || state.autoscroll_down_active)) {
-        state.autoscroll_up_active = false;
-        state.autoscroll_down_active = false;
-        double now = get_time();
-        if (now - state.last_autoscroll_feedback > 0.8) {
-            state.last_autoscroll_feedback = now;
-            show_feedback("Autoscroll OFF");
-        }
-    }
+static const BenchCase bench_cases[] = {
+    {"emit_event", false, 1, bench_emit_event},
+    {"passthrough_typing", false, 4, bench_passthrough},
+    {"numpad_motion_press_release", true, 4, bench_numpad_motion},
+    {"alt_adjust_autorepeat", true, 2, bench_alt_autorepeat},
+    {"ctrl_double_press_toggle", true, 8, bench_ctrl_double_press},
+};
+
+static int bench_open_sink(const char *name) {
+    int fd = (int)syscall(SYS_memfd_create, name, 0);
+    if (fd < 0) fd = open("/dev/null", O_WRONLY);
+    return fd;
 }
 
-static bool handle_panel_nav_key(const struct input_event *ev, ConfigPanel *panel) {
-    bool is_nav = (ev->code == KEY_KP8 || ev->code == KEY_UP ||
-                   ev->code == KEY_KP2 || ev->code == KEY_DOWN ||
-                   ev->code == KEY_KP4 || ev->code == KEY_LEFT ||
-                   ev->code == KEY_KP6 || ev->code == KEY_RIGHT);
+static void bench_reset(const BenchCase *bc) {
+    init_config_defaults();
+    state.mouse_mode = bc->mouse_mode;
+    state.ctrl_pressed = state.alt_pressed = state.shift_pressed = false;
+    memset(state.numpad_keys_pressed, 0, sizeof(state.numpad_keys_pressed));
+    memset(state.scroll_keys_pressed, 0, sizeof(state.scroll_keys_pressed));
+    state.left_button_held = state.drag_locked = false;
+    state.autoscroll_up_active = state.autoscroll_down_active = false;
+    state.pending_ctrl = false;
+    state.left_ctrl_forwarded = state.right_ctrl_forwarded = false;
+    gesture_reset();
+    bench_ok = true;
+
+    int fds[2] = { state.uinput_fd, state.mouse_fd };
+    for (int i = 0; i < 2; i++) {
+        if (ftruncate(fds[i], 0) == 0) lseek(fds[i], 0, SEEK_SET);
+    }
+}
 
-    if (!is_nav) return false;
+/*
+ * Snap kernels on a synthetic 512x512 screen (panels, buttons and a soft
+ * gradient), each checked against the scalar edge map, plus the ray search
+ * and, when an X display is reachable, the capture itself.
+ */
+#define SNAP_BENCH_ITERATIONS 2000
+#define SNAP_BENCH_CAPTURES 200
+
+static void bench_snap_fill(uint32_t *px) {
+    for (int y = 0; y < SNAP_REGION; y++) {
+        for (int x = 0; x < SNAP_REGION; x++) {
+            uint32_t g = 0xd0 + (x + y) / 32;
+            uint32_t p = g << 16 | g << 8 | g;
+            if ((x % 128) >= 24 && (x % 128) < 104 && (y % 64) >= 20 && (y % 64) < 44) p = 0x3060a0;
+            if ((x % 128) == 24 || (y % 64) == 20) p = 0x202020;
+            px[y * SNAP_REGION + x] = p;
+        }
+    }
+}
 
-    if (ev->value != 1 && ev->value != 2) return true;
+static void bench_snap(FILE *out) {
+    static uint32_t px[SNAP_REGION * SNAP_REGION];
+    static uint8_t reference[SNAP_REGION * SNAP_REGION];
+    bench_snap_fill(px);
+    snap_edge_map(&snap_kernels[0], px, SNAP_REGION, SNAP_REGION, SNAP_REGION, snap_luma, reference);
 
-    double now = get_time();
-    int multi = 1;
-    if (ev->value == 1) {
-        state.adjust_start_times[ev->code] = now;
-    } else {
-        double elapsed = now - state.adjust_start_times[ev->code];
-        multi = get_step_multiplier(elapsed);
+    fprintf(out, "  \"snap\": {\n    \"region\": %d,\n    \"kernels\": [\n", SNAP_REGION);
+    bool first = true;
+    for (int k = 0; k < num_snap_kernels; k++) {
+        const SnapKernel *sk = &snap_kernels[k];
+        if (!kernel_supported(sk->name)) continue;
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i = 0; i < SNAP_BENCH_ITERATIONS; i++) {
+            snap_edge_map(sk, px, SNAP_REGION, SNAP_REGION, SNAP_REGION, snap_luma, snap_edges);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / SNAP_BENCH_ITERATIONS;
+        bool match = memcmp(snap_edges, reference, sizeof(reference)) == 0;
+
+        fprintf(out, "%s      {\"name\": \"%s\", \"us_per_region\": %.1f, \"mpixels_per_s\": %.0f, \"matches_scalar\": %s}",
+                first ? "" : ",\n", sk->name, ns / 1000.0,
+                (double)SNAP_REGION * SNAP_REGION / ns * 1000.0, match ? "true" : "false");
+        first = false;
     }
 
-    switch (ev->code) {
-        case KEY_KP8:
-        case KEY_UP:
-            panel->selected_row = (panel->selected_row - 1 + num_config_items) % num_config_items;
-            break;
-        case KEY_KP2:
-        case KEY_DOWN:
-            panel->selected_row = (panel->selected_row + 1) % num_config_items;
-            break;
-        case KEY_KP4:
-        case KEY_LEFT:
-            adjust_config_value(panel->selected_row, -multi, false);
-            break;
-        case KEY_KP6:
-        case KEY_RIGHT:
-            adjust_config_value(panel->selected_row, multi, false);
-            break;
-        default:
-            return false;
+    static const int dirs[8][2] = { {0,-1}, {0,1}, {-1,0}, {1,0}, {-1,-1}, {1,-1}, {-1,1}, {1,1} };
+    struct timespec t0, t1;
+    volatile int sink = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < SNAP_BENCH_ITERATIONS; i++) {
+        const int *d = dirs[i % 8];
+        sink += snap_target(reference, SNAP_REGION, SNAP_REGION, SNAP_REGION / 2, SNAP_REGION / 2, d[0], d[1]);
     }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double search_ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / SNAP_BENCH_ITERATIONS;
+    fprintf(out, "\n    ],\n    \"search_us\": %.1f,\n", search_ns / 1000.0);
 
-    panel->last_activity_time = now;
-    draw_config_panel(panel);
+    Display *dpy = XOpenDisplay(NULL);
+    int scr_w = dpy ? DisplayWidth(dpy, DefaultScreen(dpy)) : 0;
+    int scr_h = dpy ? DisplayHeight(dpy, DefaultScreen(dpy)) : 0;
+    if (!dpy || scr_w < SNAP_REGION || scr_h < SNAP_REGION) {
+        fprintf(out, "    \"capture\": null\n  },\n");
+        if (dpy) XCloseDisplay(dpy);
+        return;
+    }
 
-    return true;
+    double worst = 0.0;
+    int failed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < SNAP_BENCH_CAPTURES; i++) {
+        double c0 = mono_now();
+        XImage *img = snap_capture(dpy, (i * 37) % (scr_w - SNAP_REGION + 1), (i * 53) % (scr_h - SNAP_REGION + 1));
+        if (!img) failed++;
+        else if (img != snap_image) XDestroyImage(img);
+        double dt = mono_now() - c0;
+        if (dt > worst) worst = dt;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double capture_ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / SNAP_BENCH_CAPTURES;
+    fprintf(out, "    \"capture\": {\"xshm\": %s, \"us_mean\": %.1f, \"us_max\": %.1f, \"failed\": %d}\n  },\n",
+            snap_use_shm ? "true" : "false", capture_ns / 1000.0, worst * 1e6, failed);
+
+    if (snap_use_shm) {
+        XShmDetach(dpy, &snap_shm);
+        shmdt(snap_shm.shmaddr);
+        snap_image->data = NULL;
+        XDestroyImage(snap_image);
+        snap_image = NULL;
+        snap_use_shm = false;
+    }
+    XCloseDisplay(dpy);
+    (void)sink;
 }
 
-static bool handle_non_nav_in_panel(const struct input_event *ev, ConfigPanel *panel) {
-    if (ev->value != 1) return false;
-
-    hide_config_panel(panel);
-    emit_event(state.uinput_fd, EV_KEY, ev->code, ev->value);
-    emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
+/*
+ * Anchor search on a synthetic 1920x1080 screen with the patch planted at
+ * a known spot: pyramid build plus search, per kernel, single-threaded
+ * and across cores.
+ */
+#define ANCHOR_BENCH_ITERATIONS 10
+#define ANCHOR_BENCH_W 1920
+#define ANCHOR_BENCH_H 1080
+#define ANCHOR_BENCH_X 1234
+#define ANCHOR_BENCH_Y 567
+
+static void bench_anchor(FILE *out) {
+    Pyramid pyr = {0};
+    if (!pyr_reserve(&pyr, ANCHOR_BENCH_W, ANCHOR_BENCH_H)) return;
+
+    /* Blocky UI-like texture so most patches are distinct */
+    uint32_t seed = 12345;
+    for (int by = 0; by < ANCHOR_BENCH_H; by += 8) {
+        for (int bx = 0; bx < ANCHOR_BENCH_W; bx += 8) {
+            seed = seed * 1103515245u + 12345u;
+            uint8_t v = (uint8_t)(seed >> 16);
+            for (int y = by; y < by + 8 && y < ANCHOR_BENCH_H; y++) {
+                for (int x = bx; x < bx + 8; x++) pyr.px[0][y * ANCHOR_BENCH_W + x] = (uint8_t)(v + ((x ^ y) & 7));
+            }
+        }
+    }
+    uint8_t patch[ANCHOR_SIZE * ANCHOR_SIZE];
+    for (int y = 0; y < ANCHOR_SIZE; y++) {
+        memcpy(patch + y * ANCHOR_SIZE, pyr.px[0] + (ANCHOR_BENCH_Y + y) * ANCHOR_BENCH_W + ANCHOR_BENCH_X, ANCHOR_SIZE);
+    }
+    AnchorTemplate t;
+    anchor_template_from(&t, patch, ANCHOR_SIZE / 2, ANCHOR_SIZE / 2);
 
-    return true;
+    fprintf(out, "  \"anchor\": {\n    \"screen\": \"%dx%d\",\n    \"runs\": [\n", ANCHOR_BENCH_W, ANCHOR_BENCH_H);
+    bool first = true;
+    for (int k = 0; k < num_ncc_kernels; k++) {
+        if (!kernel_supported(ncc_kernels[k].name)) continue;
+        int thread_counts[2] = { 1, anchor_threads() };
+        for (int tc = 0; tc < 2; tc++) {
+            if (tc == 1 && thread_counts[1] == 1) break;
+            AnchorMatch m = {0};
+            struct timespec t0, t1;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            for (int i = 0; i < ANCHOR_BENCH_ITERATIONS; i++) {
+                pyr_build(&pyr);
+                m = anchor_search(&ncc_kernels[k], &pyr, &t, thread_counts[tc]);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            double ms = ((t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6) / ANCHOR_BENCH_ITERATIONS;
+            fprintf(out, "%s      {\"kernel\": \"%s\", \"threads\": %d, \"ms_per_search\": %.2f, "
+                    "\"found\": [%d, %d], \"score\": %.3f, \"correct\": %s}",
+                    first ? "" : ",\n", ncc_kernels[k].name, thread_counts[tc], ms, m.x, m.y, m.score,
+                    m.x == ANCHOR_BENCH_X && m.y == ANCHOR_BENCH_Y ? "true" : "false");
+            first = false;
+        }
+    }
+    fprintf(out, "\n    ]\n  },\n");
+    for (int l = 0; l < ANCHOR_LEVELS; l++) free(pyr.px[l]);
 }
 
-static bool handle_alt_adjustment_key(const struct input_event *ev) {
-    if (!state.alt_pressed || (ev->value != 1 && ev->value != 2)) return false;
+/* Lens frames (scale plus crosshair) per kernel, checked against scalar */
+static void bench_lens(FILE *out) {
+    static uint32_t src[LENS_SRC * LENS_SRC];
+    static uint32_t dst[LENS_SIZE * LENS_SIZE], reference[LENS_SIZE * LENS_SIZE];
+    for (int i = 0; i < LENS_SRC * LENS_SRC; i++) src[i] = (uint32_t)i * 2654435761u;
+    lens_render(&lens_kernels[0], src, LENS_SRC, reference, LENS_SIZE, LENS_SRC / 2, LENS_SRC / 2);
 
-    int index = -1;
-    bool increase = true;
-    double now = get_time();
+    fprintf(out, "  \"lens\": [\n");
+    bool first = true;
+    for (int k = 0; k < num_lens_kernels; k++) {
+        const LensKernel *lk = &lens_kernels[k];
+        if (!kernel_supported(lk->name)) continue;
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i = 0; i < SNAP_BENCH_ITERATIONS; i++) {
+            lens_render(lk, src, LENS_SRC, dst, LENS_SIZE, i % LENS_SRC, LENS_SRC / 2);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / SNAP_BENCH_ITERATIONS;
+        lens_render(lk, src, LENS_SRC, dst, LENS_SIZE, LENS_SRC / 2, LENS_SRC / 2);
+        bool match = memcmp(dst, reference, sizeof(reference)) == 0;
+
+        fprintf(out, "%s    {\"name\": \"%s\", \"us_per_frame\": %.1f, \"matches_scalar\": %s}",
+                first ? "" : ",\n", lk->name, ns / 1000.0, match ? "true" : "false");
+        first = false;
+    }
+    fprintf(out, "\n  ]\n");
+}
 
-    switch (ev->code) {
-        case KEY_KPPLUS:
-        case KEY_KPENTER:
-            index = (state.autoscroll_up_active || state.autoscroll_down_active) ? 11 : 9;
-            increase = (ev->code == KEY_KPPLUS);
-            break;
-        case KEY_NUMLOCK:
-            index = 0;
-            increase = !state.shift_pressed;
-            break;
-        case KEY_KPSLASH:
-            index = 3;
-            increase = !state.shift_pressed;
-            break;
-        case KEY_KPASTERISK:
-            index = 1;
-            increase = !state.shift_pressed;
-            break;
-        case KEY_KPMINUS:
-            index = 2;
-            increase = !state.shift_pressed;
-            break;
-        case KEY_KP5:
-            index = 7;
-            increase = !state.shift_pressed;
-            show_margin_overlay();
-            last_margin_adjust = now;
-            margin_need_redraw = true;
-            break;
-        case KEY_KP6:
-        case KEY_KP4:
-            index = 4;
-            increase = (ev->code == KEY_KP6);
-            show_jump_overlay(1);
-            last_jump_adjust = now;
-            jump_need_redraw = true;
-            break;
-        case KEY_KP8:
-        case KEY_KP2:
-            index = 5;
-            increase = (ev->code == KEY_KP8);
-            show_jump_overlay(2);
-            last_jump_adjust = now;
-            jump_need_redraw = true;
-            break;
-        case KEY_KP7:
-        case KEY_KP9:
-        case KEY_KP1:
-        case KEY_KP3:
-            index = 6;
-            increase = (ev->code == KEY_KP7 || ev->code == KEY_KP9);
-            show_jump_overlay(3);
-            last_jump_adjust = now;
-            jump_need_redraw = true;
-            break;
-        case KEY_KP0:
-            index = 8;
-            increase = !state.shift_pressed;
-            break;
-        case KEY_KPDOT:
-            index = (state.autoscroll_up_active || state.autoscroll_down_active) ? 12 : 10;
-            increase = !state.shift_pressed;
-            break;
-        default:
-            return false;
+/*
+ * Time dispatch_event() for the common paths with the uinput fds pointed
+ * at memfds, and print the results as JSON together with the snap, anchor
+ * and lens kernels. Runs without devices or X; the snap capture is only timed when
+ * X is up.
+ */
+static int run_benchmarks(const char *out_path) {
+    FILE *out = strcmp(out_path, "-") == 0 ? stdout : fopen_as_user(out_path, "w");
+    if (!out) {
+        perror("fopen bench output");
+        return 1;
     }
 
-    int multi = 1;
-    if (ev->value == 1) {
-        state.adjust_start_times[ev->code] = now;
-    } else {
-        double elapsed = now - state.adjust_start_times[ev->code];
-        multi = get_step_multiplier(elapsed);
+    headless = true;
+    clock_virtual = true;
+    clock_virtual_now = 1000000.0;
+    state.uinput_fd = bench_open_sink("kat-bench-keyboard");
+    state.mouse_fd = bench_open_sink("kat-bench-mouse");
+    if (state.uinput_fd < 0 || state.mouse_fd < 0) {
+        perror("open bench sink");
+        return 1;
     }
-    int step = multi * (increase ? 1 : -1);
-    adjust_config_value(index, step, true);
+    state.running = true;
+    pthread_mutex_init(&state.state_mutex, NULL);
 
-    save_config();
-    return true;
-}
+    ConfigPanel panel;
+    init_config_panel(&panel);
 
-static bool handle_scroll_and_autoscroll_key(const struct input_event *ev) {
-    if (ev->code != KEY_KPPLUS && ev->code != KEY_KPENTER) return false;
+    int num_cases = sizeof(bench_cases) / sizeof(bench_cases[0]);
+    fprintf(out, "{\n  \"benchmark\": \"kat-dispatch\",\n  \"iterations\": %d,\n  \"results\": [\n",
+            BENCH_ITERATIONS);
+
+    bool all_ok = true;
+    for (int c = 0; c < num_cases; c++) {
+        const BenchCase *bc = &bench_cases[c];
+        bench_reset(bc);
+        for (int i = 0; i < BENCH_WARMUP; i++) bc->iter(&panel);
+        bench_reset(bc);
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i = 0; i < BENCH_ITERATIONS; i++) bc->iter(&panel);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+        long events = (long)BENCH_ITERATIONS * bc->events_per_iter;
+        off_t kbd_bytes = lseek(state.uinput_fd, 0, SEEK_CUR);
+        off_t mouse_bytes = lseek(state.mouse_fd, 0, SEEK_CUR);
+
+        fprintf(out, "    {\"name\": \"%s\", \"events\": %ld, \"ns_per_event\": %.1f, "
+                "\"ns_per_iteration\": %.1f, \"keyboard_bytes\": %lld, \"mouse_bytes\": %lld, \"ok\": %s}%s\n",
+                bc->name, events, ns / events, ns / BENCH_ITERATIONS,
+                (long long)(kbd_bytes > 0 ? kbd_bytes : 0), (long long)(mouse_bytes > 0 ? mouse_bytes : 0),
+                bench_ok ? "true" : "false", c + 1 < num_cases ? "," : "");
+        if (!bench_ok) {
+            fprintf(stderr, "bench %s: the handlers did not do what the case measures\n", bc->name);
+            all_ok = false;
+        }
+    }
 
-    bool is_plus = (ev->code == KEY_KPPLUS);
+    fprintf(out, "  ],\n");
+    bench_snap(out);
+    bench_anchor(out);
+    bench_lens(out);
+    fprintf(out, "}\n");
+    if (out != stdout) fclose(out);
+    close(state.uinput_fd);
+    close(state.mouse_fd);
+    return all_ok ? 0 : 1;
+}
 
-    if (!state.ctrl_pressed) {
-        pthread_mutex_lock(&state.state_mutex);
-        state.scroll_keys_pressed[is_plus ? 0 : 1] = (ev->value != 0);
-        pthread_mutex_unlock(&state.state_mutex);
-        return true;
-    }
+/* ------------------------------------------------------------------ */
+/* End-to-End Latency Probe                                           */
+/* ------------------------------------------------------------------ */
+#define PROBE_KEYBOARD_NAME "Kat Latency Probe Keyboard"
+#define PROBE_TIMEOUT 1.0        /* seconds to wait for a response */
+#define PROBE_SETTLE_US 150000   /* idle time between samples */
+
+static void probe_key(int fd, uint16_t code, int32_t value) {
+    struct input_event ev[2] = {
+        { .type = EV_KEY, .code = code, .value = value },
+        { .type = EV_SYN, .code = SYN_REPORT, .value = 0 },
+    };
+    if (write(fd, ev, sizeof(ev)) < 0) perror("write probe keyboard");
+}
 
-    if (ev->value != 1) return true;
+static void probe_drain(int fd) {
+    struct input_event ev;
+    while (read(fd, &ev, sizeof(ev)) == sizeof(ev)) {}
+}
 
-    if (is_plus) {
-        state.autoscroll_up_active = !state.autoscroll_up_active;
-        if (state.autoscroll_up_active) state.autoscroll_down_active = false;
-    } else {
-        state.autoscroll_down_active = !state.autoscroll_down_active;
-        if (state.autoscroll_down_active) state.autoscroll_up_active = false;
+/* Wait for a matching event on the daemon's mouse; returns latency in s or -1 */
+static double probe_wait_mouse(int fd, double t0, uint16_t type, uint16_t code, bool any_value, int32_t value) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    while (mono_now() - t0 < PROBE_TIMEOUT) {
+        if (poll(&pfd, 1, 10) <= 0) continue;
+        struct input_event ev;
+        while (read(fd, &ev, sizeof(ev)) == sizeof(ev)) {
+            if (ev.type == type && ev.code == code && (any_value || ev.value == value)) {
+                double t = ev.time.tv_sec + ev.time.tv_usec * 1e-6;
+                probe_drain(fd);
+                return t - t0;
+            }
+        }
     }
+    return -1.0;
+}
 
-    pthread_mutex_lock(&state.state_mutex);
-    state.scroll_keys_pressed[0] = state.scroll_keys_pressed[1] = false;
-    pthread_mutex_unlock(&state.state_mutex);
+static double probe_wait_motion(Display *dpy, double t0, int x0, int y0) {
+    while (mono_now() - t0 < PROBE_TIMEOUT) {
+        int x, y;
+        if (query_pointer(dpy, &x, &y) && (x != x0 || y != y0)) return mono_now() - t0;
+        usleep(50);
+    }
+    return -1.0;
+}
 
-    double now = get_time();
-    if (now - state.last_autoscroll_feedback > 0.8) {
-        state.last_autoscroll_feedback = now;
-        if (state.autoscroll_up_active)
-            show_feedback("Autoscroll UP ON");
-        else if (state.autoscroll_down_active)
-            show_feedback("Autoscroll DOWN ON");
-        else
-            show_feedback("Autoscroll OFF");
+/*
+ * Run a daemon for --probe or --stress without touching the user's setup:
+ * --isolated keeps it off the config file, marks, macros, anchors, control
+ * socket, status page and keyboard LEDs, and tags its virtual devices so
+ * only this run's are found even with another kat running.
+ */
+static pid_t isolated_daemon_start(const char *const *argv) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv("/proc/self/exe", (char * const *)argv);
+        perror("exec daemon");
+        _exit(127);
     }
+    if (pid < 0) perror("fork");
+    return pid;
+}
 
-    state.pending_ctrl = false;  // NEW LINE HERE
+/* Wait up to 3 s for the isolated daemon's device; returns an fd or -1 */
+static int isolated_daemon_device(const char *base, const char *tag, int flags) {
+    char name[UINPUT_MAX_NAME_SIZE], path[PATH_MAX];
+    daemon_device_name(name, sizeof(name), base, tag);
+    for (double t0 = mono_now(); mono_now() - t0 < 3.0; usleep(20000)) {
+        if (find_input_device(name, path, sizeof(path)) == 0) return open(path, flags);
+    }
+    return -1;
+}
 
-    return true;
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
 }
 
-static bool handle_ctrl_minus_key(const struct input_event *ev) {
-    if (!state.ctrl_pressed || ev->code != KEY_KPMINUS || ev->value == 0) return false;
-    state.pending_ctrl = false;  // NEW LINE HERE
-    return true;
+static void probe_report(FILE *out, const char *name, double *lat, int n, int timeouts, bool last) {
+    fprintf(out, "    {\"name\": \"%s\", \"samples\": %d, \"timeouts\": %d", name, n, timeouts);
+    if (n > 0) {
+        qsort(lat, n, sizeof(double), cmp_double);
+        fprintf(out, ", \"p50_us\": %.0f, \"p99_us\": %.0f, \"max_us\": %.0f",
+                lat[n / 2] * 1e6, lat[(n * 99) / 100] * 1e6, lat[n - 1] * 1e6);
+    }
+    fprintf(out, "}%s\n", last ? "" : ",");
 }
 
-static bool handle_absolute_jump_key(const struct input_event *ev) {
-    if (!state.ctrl_pressed || !state.shift_pressed || ev->value != 1) return false;
+/*
+ * Start a daemon grabbing only a private uinput keyboard, inject numpad
+ * presses into it and time the response on the daemon's virtual mouse
+ * (clicks, wheel) and on the X pointer (motion). Meant for Xvfb or a
+ * dedicated session; needs root for uinput.
+ */
+static int run_latency_probe(const char *prog, const char *out_path, int samples) {
+    FILE *out = strcmp(out_path, "-") == 0 ? stdout : fopen_as_user(out_path, "w");
+    if (!out) {
+        perror("fopen probe output");
+        return 1;
+    }
 
-    bool is_jump_key = (ev->code == KEY_KP8 || ev->code == KEY_KP2 || ev->code == KEY_KP4 || ev->code == KEY_KP6 ||
-                        ev->code == KEY_KP9 || ev->code == KEY_KP7 || ev->code == KEY_KP3 || ev->code == KEY_KP1 || ev->code == KEY_KP5);
+    char tag[32], kbd_name[UINPUT_MAX_NAME_SIZE];
+    snprintf(tag, sizeof(tag), "probe-%d", (int)getpid());
+    daemon_device_name(kbd_name, sizeof(kbd_name), PROBE_KEYBOARD_NAME, tag);
+    int kbd = create_keyboard_device(kbd_name, 0x567a);
+    if (kbd < 0) return 1;
 
-    if (!is_jump_key) return false;
+    char kbd_path[PATH_MAX];
+    if (find_input_device(kbd_name, kbd_path, sizeof(kbd_path)) < 0) {
+        fprintf(stderr, "Probe keyboard did not appear in %s\n", INPUT_DIR);
+        close(kbd);
+        return 1;
+    }
 
-    Display *dpy = XOpenDisplay(NULL);
-    if (!dpy) return true;
+    const char *argv[] = { prog, "--isolated", tag, "--keyboard", kbd_path, NULL };
+    pid_t daemon_pid = isolated_daemon_start(argv);
+    if (daemon_pid < 0) {
+        close(kbd);
+        return 1;
+    }
 
-    int scr = DefaultScreen(dpy);
-    int scr_w = DisplayWidth(dpy, scr);
-    int scr_h = DisplayHeight(dpy, scr);
-    int margin = state.cfg.jump_margin;
-    int left = margin;
-    int right = scr_w - 1 - margin;
-    int top = margin;
-    int bottom = scr_h - 1 - margin;
-    int center_x = scr_w / 2;
-    int center_y = scr_h / 2;
+    int mouse = isolated_daemon_device(DAEMON_MOUSE_NAME, tag, O_RDONLY | O_NONBLOCK);
+    if (mouse < 0) {
+        fprintf(stderr, "Daemon mouse did not appear\n");
+        kill(daemon_pid, SIGTERM);
+        waitpid(daemon_pid, NULL, 0);
+        close(kbd);
+        return 1;
+    }
+    int clk = CLOCK_MONOTONIC;
+    ioctl(mouse, EVIOCSCLOCKID, &clk);
+    usleep(200000);
+
+    /* Double Ctrl into mouse mode */
+    probe_key(kbd, KEY_LEFTCTRL, 1);
+    probe_key(kbd, KEY_LEFTCTRL, 0);
+    usleep(50000);
+    probe_key(kbd, KEY_LEFTCTRL, 1);
+    probe_key(kbd, KEY_LEFTCTRL, 0);
+    usleep(PROBE_SETTLE_US);
 
-    Window root, child;
-    int root_x, root_y, win_x, win_y;
-    unsigned int mask;
-    XQueryPointer(dpy, DefaultRootWindow(dpy), &root, &child, &root_x, &root_y, &win_x, &win_y, &mask);
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) fprintf(stderr, "No X display, skipping key-to-motion\n");
+
+    double *motion = calloc(samples, sizeof(double));
+    double *click = calloc(samples, sizeof(double));
+    double *scroll = calloc(samples, sizeof(double));
+    int n_motion = 0, n_click = 0, n_scroll = 0;
+    int to_motion = 0, to_click = 0, to_scroll = 0;
+
+    for (int i = 0; i < samples && dpy; i++) {
+        int x0, y0;
+        query_pointer(dpy, &x0, &y0);
+        uint16_t key = (i & 1) ? KEY_KP4 : KEY_KP6;
+        double t0 = mono_now();
+        probe_key(kbd, key, 1);
+        double lat = probe_wait_motion(dpy, t0, x0, y0);
+        probe_key(kbd, key, 0);
+        if (lat >= 0) motion[n_motion++] = lat; else to_motion++;
+        usleep(PROBE_SETTLE_US);
+    }
 
-    int target_x = root_x;
-    int target_y = root_y;
+    for (int i = 0; i < samples; i++) {
+        probe_drain(mouse);
+        double t0 = mono_now();
+        probe_key(kbd, KEY_KP5, 1);
+        double lat = probe_wait_mouse(mouse, t0, EV_KEY, BTN_LEFT, false, 1);
+        probe_key(kbd, KEY_KP5, 0);
+        if (lat >= 0) click[n_click++] = lat; else to_click++;
+        usleep(PROBE_SETTLE_US);
+    }
 
-    switch (ev->code) {
-        case KEY_KP8:
-            target_y = top;
-            if (root_y == top) target_x = center_x;
-            break;
-        case KEY_KP2:
-            target_y = bottom;
-            if (root_y == bottom) target_x = center_x;
-            break;
-        case KEY_KP4:
-            target_x = left;
-            if (root_x == left) target_y = center_y;
-            break;
-        case KEY_KP6:
-            target_x = right;
-            if (root_x == right) target_y = center_y;
-            break;
-        case KEY_KP9:
-            target_x = right;
-            target_y = top;
-            break;
-        case KEY_KP7:
-            target_x = left;
-            target_y = top;
-            break;
-        case KEY_KP3:
-            target_x = right;
-            target_y = bottom;
-            break;
-        case KEY_KP1:
-            target_x = left;
-            target_y = bottom;
-            break;
-        case KEY_KP5:
-            target_x = center_x;
-            target_y = center_y;
-            break;
-        default:
-            XCloseDisplay(dpy);
-            return false;
+    for (int i = 0; i < samples; i++) {
+        probe_drain(mouse);
+        double t0 = mono_now();
+        probe_key(kbd, KEY_KPPLUS, 1);
+        double lat = probe_wait_mouse(mouse, t0, EV_REL, REL_WHEEL_HI_RES, true, 0);
+        probe_key(kbd, KEY_KPPLUS, 0);
+        if (lat >= 0) scroll[n_scroll++] = lat; else to_scroll++;
+        usleep(PROBE_SETTLE_US);
     }
 
-    warp_mouse(dpy, target_x, target_y);
-    XCloseDisplay(dpy);
+    kill(daemon_pid, SIGTERM);
+    waitpid(daemon_pid, NULL, 0);
+
+    fprintf(out, "{\n  \"probe\": \"kat-latency\",\n  \"results\": [\n");
+    probe_report(out, "key_to_first_motion", motion, n_motion, to_motion, false);
+    probe_report(out, "key_to_click", click, n_click, to_click, false);
+    probe_report(out, "key_to_scroll", scroll, n_scroll, to_scroll, true);
+    fprintf(out, "  ]\n}\n");
+    if (out != stdout) fclose(out);
+
+    free(motion);
+    free(click);
+    free(scroll);
+    if (dpy) XCloseDisplay(dpy);
+    close(mouse);
+    ioctl(kbd, UI_DEV_DESTROY);
+    close(kbd);
+    return 0;
+}
 
-    state.pending_ctrl = false;  // NEW LINE HERE
+/* ------------------------------------------------------------------ */
+/* Sustained-Load Stress Generator                                    */
+/* ------------------------------------------------------------------ */
+#define STRESS_MAX_KEYBOARDS 4
+#define STRESS_KEYS 6
+#define STRESS_BURST 20          /* key presses per typing burst */
+#define STRESS_BURST_PAUSE 0.25  /* seconds between bursts */
+#define STRESS_DRAIN_US 500000
+
+/* Disjoint letter sets so forwarded keys identify their source keyboard */
+static const uint16_t stress_keys[STRESS_MAX_KEYBOARDS][STRESS_KEYS] = {
+    {KEY_A, KEY_S, KEY_D, KEY_F, KEY_G, KEY_H},
+    {KEY_J, KEY_K, KEY_L, KEY_Q, KEY_W, KEY_E},
+    {KEY_R, KEY_T, KEY_Y, KEY_U, KEY_I, KEY_O},
+    {KEY_P, KEY_Z, KEY_X, KEY_C, KEY_V, KEY_B},
+};
 
-    return true;
-}
+typedef struct {
+    int fd;
+    int index;
+    int rate;                /* typing key presses per second */
+    double end_time;
+    double *sent_at;         /* send time of each press, by sequence */
+    long capacity;
+    atomic_long sent;
+    long releases_sent;
+    /* receiver side */
+    long next_seq;
+    long received;
+    long releases_received;
+    long lost;
+    long reordered;
+} StressKeyboard;
 
-static bool handle_numpad_direction_key(const struct input_event *ev) {
-    bool is_dir = (ev->code == KEY_KP1 || ev->code == KEY_KP2 || ev->code == KEY_KP3 ||
-                   ev->code == KEY_KP4 || ev->code == KEY_KP6 ||
-                   ev->code == KEY_KP7 || ev->code == KEY_KP8 || ev->code == KEY_KP9);
-    if (!is_dir) return false;
+typedef struct {
+    StressKeyboard kbds[STRESS_MAX_KEYBOARDS];
+    int num_kbds;
+    int control_fd;
+    int forward_fd;
+    double end_time;
+    double *delays;
+    long num_delays;
+    long delay_capacity;
+    double max_delay;
+} StressRun;
+
+static void sleep_until(double t) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)t;
+    ts.tv_nsec = (long)((t - ts.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
 
-    if (state.ctrl_pressed) {
-        pthread_mutex_lock(&state.state_mutex);
-        memset(state.numpad_keys_pressed, 0, sizeof(state.numpad_keys_pressed));
-        pthread_mutex_unlock(&state.state_mutex);
-        state.pending_ctrl = false;  // NEW LINE HERE
+static void* stress_typing_thread(void *arg) {
+    StressKeyboard *k = (StressKeyboard *)arg;
+    double interval = 1.0 / k->rate;
+    double next = mono_now();
+
+    for (long seq = 0; seq < k->capacity && mono_now() < k->end_time; seq++) {
+        uint16_t key = stress_keys[k->index][seq % STRESS_KEYS];
+        k->sent_at[seq] = mono_now();
+        atomic_store_explicit(&k->sent, seq + 1, memory_order_release);
+        probe_key(k->fd, key, 1);
+        sleep_until(next + interval / 2);
+        probe_key(k->fd, key, 0);
+        k->releases_sent++;
+
+        next += interval;
+        if ((seq + 1) % STRESS_BURST == 0) next += STRESS_BURST_PAUSE;
+        sleep_until(next);
     }
+    return NULL;
+}
 
-    pthread_mutex_lock(&state.state_mutex);
-    switch (ev->code) {
-        case KEY_KP8: state.numpad_keys_pressed[0] = (ev->value != 0); break;
-        case KEY_KP2: state.numpad_keys_pressed[1] = (ev->value != 0); break;
-        case KEY_KP4: state.numpad_keys_pressed[2] = (ev->value != 0); break;
-        case KEY_KP6: state.numpad_keys_pressed[3] = (ev->value != 0); break;
-        case KEY_KP7: state.numpad_keys_pressed[4] = (ev->value != 0); break;
-        case KEY_KP9: state.numpad_keys_pressed[5] = (ev->value != 0); break;
-        case KEY_KP1: state.numpad_keys_pressed[6] = (ev->value != 0); break;
-        case KEY_KP3: state.numpad_keys_pressed[7] = (ev->value != 0); break;
-        default: 
-            pthread_mutex_unlock(&state.state_mutex);
-            return false;
-    }
-    pthread_mutex_unlock(&state.state_mutex);
+/* Mode toggles, held numpad keys with autorepeat and rapid Alt adjustments */
+static void* stress_control_thread(void *arg) {
+    StressRun *run = (StressRun *)arg;
+    int fd = run->control_fd;
+
+    while (mono_now() < run->end_time) {
+        probe_key(fd, KEY_LEFTCTRL, 1);
+        probe_key(fd, KEY_LEFTCTRL, 0);
+        usleep(40000);
+        probe_key(fd, KEY_LEFTCTRL, 1);
+        probe_key(fd, KEY_LEFTCTRL, 0);
+        usleep(100000);
 
-    return true;
+        probe_key(fd, KEY_KP8, 1);
+        for (int i = 0; i < 10; i++) {
+            usleep(33000);
+            probe_key(fd, KEY_KP8, 2);
+        }
+        probe_key(fd, KEY_KP8, 0);
+        usleep(100000);
+
+        probe_key(fd, KEY_LEFTALT, 1);
+        for (int i = 0; i < 10; i++) {
+            uint16_t key = (i & 1) ? KEY_KP2 : KEY_KP8;
+            probe_key(fd, key, 1);
+            usleep(10000);
+            probe_key(fd, key, 0);
+            usleep(40000);
+        }
+        probe_key(fd, KEY_LEFTALT, 0);
+        usleep(400000);
+    }
+    return NULL;
 }
 
-static bool handle_kp5_key(const struct input_event *ev) {
-    if (ev->code != KEY_KP5) return false;
+static void stress_account(StressRun *run, const struct input_event *ev) {
+    for (int k = 0; k < run->num_kbds; k++) {
+        StressKeyboard *kb = &run->kbds[k];
+        for (int idx = 0; idx < STRESS_KEYS; idx++) {
+            if (stress_keys[k][idx] != ev->code) continue;
 
-    if (ev->value == 1) {
-        if (!state.drag_locked) {
-            emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 1);
-            emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
-            state.left_button_held = true;
-        }
-    } else if (ev->value == 0) {
-        if (state.left_button_held) {
-            if (!(state.ctrl_pressed && state.shift_pressed)) {
-                emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
-                emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
-                state.left_button_held = false;
+            if (ev->value == 0) {
+                kb->releases_received++;
+                return;
             }
-            if (state.drag_locked && !(state.ctrl_pressed && state.shift_pressed)) {
-                state.drag_locked = false;
-                hide_drag_popup();
+            if (ev->value != 1) return;
+
+            /* Nearby forward gaps count as loss, nearby backward ones as reordering */
+            int delta = (int)((idx - kb->next_seq % STRESS_KEYS + STRESS_KEYS) % STRESS_KEYS);
+            if (delta > STRESS_KEYS / 2) {
+                kb->reordered++;
+                return;
+            }
+            kb->lost += delta;
+            long seq = kb->next_seq + delta;
+            kb->next_seq = seq + 1;
+            kb->received++;
+
+            if (seq < atomic_load_explicit(&kb->sent, memory_order_acquire)) {
+                double t = ev->time.tv_sec + ev->time.tv_usec * 1e-6;
+                double delay = t - kb->sent_at[seq];
+                if (delay > run->max_delay) run->max_delay = delay;
+                if (run->num_delays < run->delay_capacity) run->delays[run->num_delays++] = delay;
             }
+            return;
         }
     }
-    return true;
 }
 
-static bool handle_kpslash_key(const struct input_event *ev) {
-    if (ev->code != KEY_KPSLASH || ev->value != 1) return false;
-
-    if (state.left_button_held) {
-        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
-        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
-        state.left_button_held = false;
-        state.drag_locked = false;
-        hide_drag_popup();
-    } else {
-        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 1);
-        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
-        state.left_button_held = true;
-        state.drag_locked = true;
-        show_drag_popup();
-    }
+static bool read_process_cpu(pid_t pid, double *cpu_s) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    /* utime and stime are fields 14 and 15; comm may contain spaces */
+    char *p = strrchr(buf, ')');
+    if (!p) return false;
+    unsigned long utime, stime;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return false;
+    *cpu_s = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
     return true;
 }
 
-static bool handle_kpasterisk_key(const struct input_event *ev) {
-    if (ev->code != KEY_KPASTERISK || ev->value != 1) return false;
-
-    if (state.left_button_held) {
-        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
-        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
-        state.left_button_held = false;
-		state.drag_locked = false;
-		hide_drag_popup();
+/*
+ * Start a daemon on several private uinput keyboards and drive them
+ * concurrently: typing bursts on each, plus a control keyboard doing mode
+ * toggles, autorepeating numpad holds and Alt adjustments. Forwarded
+ * letters are read back from the daemon's virtual keyboard to measure
+ * loss, reordering and forwarding delay. Run under Xvfb or on a spare VT.
+ */
+static int run_stress(const char *prog, const char *out_path, double duration, int num_kbds, int rate) {
+    FILE *out = strcmp(out_path, "-") == 0 ? stdout : fopen_as_user(out_path, "w");
+    if (!out) {
+        perror("fopen stress output");
+        return 1;
     }
-    mouse_click(BTN_MIDDLE);
-    return true;
-}
+    if (num_kbds < 1) num_kbds = 1;
+    if (num_kbds > STRESS_MAX_KEYBOARDS) num_kbds = STRESS_MAX_KEYBOARDS;
+    if (rate < 1) rate = 1;
+
+    static StressRun run;
+    memset(&run, 0, sizeof(run));
+    run.num_kbds = num_kbds;
+
+    char paths[STRESS_MAX_KEYBOARDS + 1][PATH_MAX];
+    char tag[32], base[32], name[UINPUT_MAX_NAME_SIZE];
+    snprintf(tag, sizeof(tag), "stress-%d", (int)getpid());
+    const char *child_argv[2 * (STRESS_MAX_KEYBOARDS + 1) + 4];
+    int child_argc = 0;
+    child_argv[child_argc++] = prog;
+    child_argv[child_argc++] = "--isolated";
+    child_argv[child_argc++] = tag;
+
+    for (int k = 0; k <= num_kbds; k++) {
+        bool control = (k == num_kbds);
+        snprintf(base, sizeof(base), control ? "Kat Stress Control Keyboard" : "Kat Stress Keyboard %d", k);
+        daemon_device_name(name, sizeof(name), base, tag);
+        int fd = create_keyboard_device(name, (uint16_t)(0x5680 + k));
+        if (fd < 0 || find_input_device(name, paths[k], sizeof(paths[k])) < 0) {
+            fprintf(stderr, "Cannot create stress keyboard %s\n", name);
+            return 1;
+        }
+        if (control) {
+            run.control_fd = fd;
+        } else {
+            StressKeyboard *kb = &run.kbds[k];
+            kb->fd = fd;
+            kb->index = k;
+            kb->rate = rate;
+            kb->capacity = (long)(duration * rate) + STRESS_BURST;
+            kb->sent_at = calloc(kb->capacity, sizeof(double));
+            atomic_init(&kb->sent, 0);
+        }
+        child_argv[child_argc++] = "--keyboard";
+        child_argv[child_argc++] = paths[k];
+    }
+    child_argv[child_argc] = NULL;
 
-static bool handle_kpminus_key(const struct input_event *ev) {
-    if (ev->code != KEY_KPMINUS || ev->value != 1) return false;
+    pid_t daemon_pid = isolated_daemon_start(child_argv);
+    if (daemon_pid < 0) return 1;
 
-    if (state.left_button_held) {
-        emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
-        emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
-        state.left_button_held = false;
-		state.drag_locked = false;
-		hide_drag_popup();
+    run.forward_fd = isolated_daemon_device(DAEMON_KEYBOARD_NAME, tag, O_RDONLY);
+    if (run.forward_fd < 0) {
+        fprintf(stderr, "Daemon keyboard did not appear\n");
+        kill(daemon_pid, SIGTERM);
+        waitpid(daemon_pid, NULL, 0);
+        return 1;
     }
-    mouse_click(BTN_RIGHT);
-    return true;
-}
+    int clk = CLOCK_MONOTONIC;
+    ioctl(run.forward_fd, EVIOCSCLOCKID, &clk);
+    usleep(200000);
 
-static bool handle_numlock_key(const struct input_event *ev) {
-    if (ev->code != KEY_NUMLOCK) return false;
+    double cpu_start = 0.0, cpu_end = 0.0;
+    read_process_cpu(daemon_pid, &cpu_start);
 
-    if (ev->value == 1) {
-        if (!state.drag_locked) {
-            emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 1);
-            emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
-            state.left_button_held = true;
-        }
-    } else if (ev->value == 0) {
-        if (state.left_button_held) {
-            emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
-            emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
-            state.left_button_held = false;
-            if (state.drag_locked) {
-                state.drag_locked = false;
-                hide_drag_popup();
-            }
+    run.end_time = mono_now() + duration;
+    run.delay_capacity = (long)(duration * rate * num_kbds) + STRESS_BURST * num_kbds;
+    run.delays = calloc(run.delay_capacity, sizeof(double));
+
+    pthread_t threads[STRESS_MAX_KEYBOARDS + 1];
+    for (int k = 0; k < num_kbds; k++) {
+        run.kbds[k].end_time = run.end_time;
+        pthread_create(&threads[k], NULL, stress_typing_thread, &run.kbds[k]);
+    }
+    pthread_create(&threads[num_kbds], NULL, stress_control_thread, &run);
+
+    double drain_end = run.end_time + STRESS_DRAIN_US * 1e-6;
+    struct pollfd pfd = { .fd = run.forward_fd, .events = POLLIN };
+    while (mono_now() < drain_end) {
+        if (poll(&pfd, 1, 50) <= 0) continue;
+        struct input_event evs[64];
+        ssize_t n = read(run.forward_fd, evs, sizeof(evs));
+        for (ssize_t i = 0; i < n / (ssize_t)sizeof(evs[0]); i++) {
+            if (evs[i].type == EV_KEY) stress_account(&run, &evs[i]);
         }
     }
-    return true;
+
+    for (int k = 0; k <= num_kbds; k++) pthread_join(threads[k], NULL);
+    read_process_cpu(daemon_pid, &cpu_end);
+    kill(daemon_pid, SIGTERM);
+    waitpid(daemon_pid, NULL, 0);
+
+    long sent = 0, received = 0, lost = 0, reordered = 0, rel_sent = 0, rel_recv = 0;
+    for (int k = 0; k < num_kbds; k++) {
+        StressKeyboard *kb = &run.kbds[k];
+        long kb_sent = atomic_load(&kb->sent);
+        sent += kb_sent;
+        received += kb->received;
+        /* Presses never seen at the tail are lost too */
+        lost += kb->lost + (kb_sent > kb->next_seq ? kb_sent - kb->next_seq : 0);
+        reordered += kb->reordered;
+        rel_sent += kb->releases_sent;
+        rel_recv += kb->releases_received;
+    }
+
+    qsort(run.delays, run.num_delays, sizeof(double), cmp_double);
+    double p50 = run.num_delays ? run.delays[run.num_delays / 2] : 0.0;
+    double p99 = run.num_delays ? run.delays[(run.num_delays * 99) / 100] : 0.0;
+
+    fprintf(out, "{\n  \"stress\": \"kat-input-loop\",\n");
+    fprintf(out, "  \"duration_s\": %.1f,\n  \"keyboards\": %d,\n  \"rate_per_keyboard\": %d,\n",
+            duration, num_kbds, rate);
+    fprintf(out, "  \"daemon_cpu_s\": %.2f,\n  \"daemon_cpu_pct\": %.1f,\n",
+            cpu_end - cpu_start, 100.0 * (cpu_end - cpu_start) / duration);
+    fprintf(out, "  \"presses_sent\": %ld,\n  \"presses_forwarded\": %ld,\n  \"presses_lost\": %ld,\n",
+            sent, received, lost);
+    fprintf(out, "  \"presses_reordered\": %ld,\n  \"releases_sent\": %ld,\n  \"releases_forwarded\": %ld,\n",
+            reordered, rel_sent, rel_recv);
+    fprintf(out, "  \"forward_delay_p50_us\": %.0f,\n  \"forward_delay_p99_us\": %.0f,\n  \"forward_delay_max_us\": %.0f\n}\n",
+            p50 * 1e6, p99 * 1e6, run.max_delay * 1e6);
+    if (out != stdout) fclose(out);
+
+    for (int k = 0; k < num_kbds; k++) {
+        ioctl(run.kbds[k].fd, UI_DEV_DESTROY);
+        close(run.kbds[k].fd);
+        free(run.kbds[k].sent_at);
+    }
+    ioctl(run.control_fd, UI_DEV_DESTROY);
+    close(run.control_fd);
+    close(run.forward_fd);
+    free(run.delays);
+    return (lost > 0 || rel_recv < rel_sent) ? 2 : 0;
 }
 
 /* ------------------------------------------------------------------ */
@@ -2129,6 +8697,7 @@ static void cleanup(int sig) {
     state.running = false;
     pthread_join(state.movement_thread, NULL);
 
+    led_close();
     for (int i = 0; i < state.num_kbds; i++) {
         if (state.kbd_fds[i] >= 0) {
             ioctl(state.kbd_fds[i], EVIOCGRAB, 0);
@@ -2143,25 +8712,139 @@ static void cleanup(int sig) {
         ioctl(state.mouse_fd, UI_DEV_DESTROY);
         close(state.mouse_fd);
     }
+    if (trace_record_file) {
+        fclose(trace_record_file);
+        trace_record_file = NULL;
+    }
 
     hide_margin_overlay();
     hide_jump_overlay();
+    grid_exit();
+    hint_shutdown();
+    control_close();
+    status_close(STATUS_PATH);
     exit(0);
 }
 
 /* ------------------------------------------------------------------ */
 /* Main                                                               */
 /* ------------------------------------------------------------------ */
-int main(int argc, char **argv) {
-    (void)argc;
-    (void)argv;
-    
+static void print_usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--record FILE] [--keyboard DEVICE]...\n"
+            "       %s --replay FILE [--output FILE]\n"
+            "       %s --bench [--output FILE]\n"
+            "       %s --probe [--samples N] [--output FILE]\n"
+            "       %s --stress SECONDS [--keyboards N] [--rate N] [--output FILE]\n"
+            "       %s --status\n"
+            "\n"
+            "  --record FILE   log every event from the grabbed keyboards to FILE\n"
+            "  --keyboard DEV  grab only DEV instead of scanning /dev/input\n"
+            "  --replay FILE   run a recorded trace through the handlers on a virtual\n"
+            "                  clock, without devices or X\n"
+            "  --bench         time the key handlers and print the results as JSON\n"
+            "  --probe         start a daemon on a private uinput keyboard and report\n"
+            "                  key-to-motion/click/scroll latency percentiles as JSON\n"
+            "  --samples N     samples per --probe measurement (default: 200)\n"
+            "  --stress SECS   start a daemon on several private uinput keyboards, drive\n"
+            "                  them concurrently and report CPU time, loss, reordering\n"
+            "                  and forwarding delay as JSON\n"
+            "  --keyboards N   typing keyboards for --stress, 1-4 (default: 3)\n"
+            "  --rate N        key presses per second per typing keyboard (default: 50)\n"
+            "  --status        print the live state a running daemon publishes in\n"
+            "                  " STATUS_PATH "\n"
+            "  --isolated TAG  run without the user's config, marks, macros, anchors,\n"
+            "                  control socket, status page or LEDs, with TAG appended\n"
+            "                  to the virtual device names (used by --probe and --stress)\n"
+            "  --output FILE   where --replay, --bench, --probe and --stress write\n"
+            "                  their output (default: stdout)\n",
+            prog, prog, prog, prog, prog, prog);
+}
+
+/* Config, anchors, marks and macro under ~/.config/kat; -1 if another kat already runs for the user */
+static int user_files_open(char *control_buf, size_t control_sz) {
     const char *home = getenv("HOME");
     if (!home) home = "/tmp";  // safety
     static char path_buf[512];
     snprintf(path_buf, sizeof(path_buf), "%s/.config/kat/config.ini", home);
     mkdir(dirname(strdup(path_buf)), 0755);  // ensure dir exists
     config_file = path_buf;
+    static char anchor_buf[512];
+    snprintf(anchor_buf, sizeof(anchor_buf), "%s/.config/kat/anchors", home);
+    mkdir(anchor_buf, 0755);
+    anchor_dir = anchor_buf;
+    static char marks_buf[512];
+    snprintf(marks_buf, sizeof(marks_buf), "%s/.config/kat/marks", home);
+    marks_open(marks_buf);
+    static char macro_buf[512];
+    snprintf(macro_buf, sizeof(macro_buf), "%s/.config/kat/macro", home);
+    macro_open(macro_buf);
+    static char tune_buf[512];
+    snprintf(tune_buf, sizeof(tune_buf), "%s/.config/kat/tune", home);
+    tune_open(tune_buf);
+    snprintf(control_buf, control_sz, RUN_DIR "/control-%u.sock", (unsigned)user_uid());
+    if (control_in_use(control_buf)) {
+        fprintf(stderr, "kat is already running (%s answers)\n", control_buf);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    const char *output_path = "-";
+    bool bench = false;
+    bool probe = false;
+    bool status = false;
+    int samples = 200;
+    double stress_seconds = 0.0;
+    int stress_keyboards = 3;
+    int stress_rate = 50;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = true;
+        } else if (strcmp(argv[i], "--probe") == 0) {
+            probe = true;
+        } else if (strcmp(argv[i], "--status") == 0) {
+            status = true;
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            samples = atoi(argv[++i]);
+            if (samples < 1) samples = 1;
+        } else if (strcmp(argv[i], "--stress") == 0 && i + 1 < argc) {
+            stress_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--keyboards") == 0 && i + 1 < argc) {
+            stress_keyboards = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            stress_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--isolated") == 0 && i + 1 < argc) {
+            isolated_tag = argv[++i];
+        } else if (strcmp(argv[i], "--keyboard") == 0 && i + 1 < argc) {
+            if (num_keyboard_paths < MAX_KBDS) keyboard_paths[num_keyboard_paths++] = argv[++i];
+            else i++;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    /* Neither needs root; a sudo run gives it up before touching any file */
+    if (replay_path || bench) drop_privileges();
+    if (replay_path) return replay_trace(replay_path, output_path);
+    if (bench) return run_benchmarks(output_path);
+    if (status) return status_show(STATUS_PATH);
+    if (probe) return run_latency_probe(argv[0], output_path, samples);
+    if (stress_seconds > 0) return run_stress(argv[0], output_path, stress_seconds, stress_keyboards, stress_rate);
+
+    static char control_buf[512];
+    if (!isolated_tag && user_files_open(control_buf, sizeof(control_buf)) < 0) return 1;
 
     ConfigPanel panel;
     init_config_panel(&panel);
@@ -2170,7 +8853,6 @@ int main(int argc, char **argv) {
     load_config();
 
     struct input_event ev;
-    double last_ctrl_press = 0.0;
 
     if (!XInitThreads()) {
         fprintf(stderr, "Warning: XInitThreads failed\n");
@@ -2178,10 +8860,19 @@ int main(int argc, char **argv) {
 
     signal(SIGINT, cleanup);
     signal(SIGTERM, cleanup);
+    signal(SIGUSR1, request_stats_dump);
+    stats_thread = STATS_THREAD_INPUT;
+    stats_start_time = get_time();
+
+    if (record_path && start_trace_record(record_path) < 0) {
+        return 1;
+    }
 
     if (find_all_keyboards() < 0) {
         return 1;
     }
+    if (!isolated_tag) led_open();
+    led_sync();
 
     state.uinput_fd = create_uinput();
     if (state.uinput_fd < 0) cleanup(0);
@@ -2193,107 +8884,61 @@ int main(int argc, char **argv) {
     pthread_mutex_init(&state.state_mutex, NULL);
     memset(state.adjust_start_times, 0, sizeof(state.adjust_start_times));
 
-    if (pthread_create(&state.movement_thread, NULL, movement_thread_func, NULL) != 0) {
+    if (!isolated_tag) status_open(STATUS_PATH);
+    rt_save_affinity();
+    rt_lock_memory();
+    pthread_attr_t movement_attr;
+    pthread_attr_t *attr = rt_thread_attr(&movement_attr);
+    if (pthread_create(&state.movement_thread, attr, movement_thread_func, NULL) != 0) {
         fprintf(stderr, "Failed to create movement thread\n");
         cleanup(0);
     }
+    if (attr) pthread_attr_destroy(attr);
+    rt_apply(STATS_THREAD_INPUT, state.cfg.input_cpu);
+    if (!isolated_tag) control_open(control_buf);
+    damage_start();
+    window_tracker_start();
+    cursor_tracker_start();
+    monitor_tracker_start();
+    anim_start_thread();
+    dwell_start_thread();
 
     printf("\n*** Daemon started ***\n");
     printf("Double-Ctrl → toggle mouse mode\n\n");
 
-    struct pollfd polls[MAX_KBDS];
+    struct pollfd polls[MAX_KBDS + 1 + MAX_CONTROL_CLIENTS];
     for (int i = 0; i < state.num_kbds; i++) {
         polls[i].fd = state.kbd_fds[i];
         polls[i].events = POLLIN;
     }
 
     while (state.running) {
-        int ret = poll(polls, state.num_kbds, 1000);
+        int num_control = control_poll_fds(polls + state.num_kbds);
+        int timeout = kp0_timeout_ms();
+        int ret = poll(polls, state.num_kbds + num_control, timeout >= 0 && timeout < 1000 ? timeout : 1000);
+        count_syscall();
+        count_wakeup();
+        if (state.mouse_mode) kp0_catch_up(get_time());
+        if (stats_dump_requested) {
+            stats_dump_requested = 0;
+            stats_dump(stdout);
+        }
         if (ret > 0) {
             for (int i = 0; i < state.num_kbds; i++) {
                 if (polls[i].revents & POLLIN) {
                     ssize_t n = read(polls[i].fd, &ev, sizeof(ev));
+                    count_syscall();
                     if (n == sizeof(ev)) {
-                        if (ev.type == EV_KEY) {
-                            bool consumed = false;
-                            bool was_active = panel.active;
-                            if (handle_ctrl_key(&ev, &last_ctrl_press)) consumed = true;
-                            else if (handle_alt_key(&ev, &panel)) consumed = true;
-                            else if (handle_shift_key(&ev)) consumed = true;
-                            else if (panel.active && handle_esc_in_panel(&ev, &panel)) consumed = true;
-
-                            if (state.mouse_mode) {
-                                disable_autoscroll_if_not_allowed(&ev);
-
-                                if (panel.active) {
-                                    if (was_active) {
-                                        if (handle_panel_nav_key(&ev, &panel)) consumed = true;
-                                        else if (handle_non_nav_in_panel(&ev, &panel)) consumed = true;
-                                    }
-                                } else {
-                                    if (handle_alt_adjustment_key(&ev)) consumed = true;
-                                    else if (handle_scroll_and_autoscroll_key(&ev)) consumed = true;
-                                    else if (handle_ctrl_minus_key(&ev)) consumed = true;
-                                    else if (handle_absolute_jump_key(&ev)) consumed = true;
-                                    else if (handle_numpad_direction_key(&ev)) consumed = true;
-                                    else if (handle_kp5_key(&ev)) consumed = true;
-                                    else if (handle_kpslash_key(&ev)) consumed = true;
-                                    else if (handle_kpasterisk_key(&ev)) consumed = true;
-                                    else if (handle_kpminus_key(&ev)) consumed = true;
-									else if (handle_numlock_key(&ev)) consumed = true;
-                                }
-                            }
-
-							if (state.left_button_held && ev.value == 1) {
-								bool is_numpad = (ev.code >= KEY_KP7 && ev.code <= KEY_KPDOT) ||
-												 ev.code == KEY_KPSLASH ||
-												 ev.code == KEY_KPASTERISK ||
-												 ev.code == KEY_KPENTER ||
-												 ev.code == KEY_NUMLOCK;
-								bool is_ctrl_or_shift = (ev.code == KEY_LEFTCTRL || ev.code == KEY_RIGHTCTRL ||
-														 ev.code == KEY_LEFTSHIFT || ev.code == KEY_RIGHTSHIFT);
-								bool should_release = false;
-
-								if (is_numpad) {
-									if (ev.code == KEY_KP0 || ev.code == KEY_KPDOT) {
-										should_release = true;
-									}
-								} else {
-									if (!is_ctrl_or_shift) {
-										should_release = true;
-									}
-								}
-
-								if (should_release) {
-									emit_event(state.mouse_fd, EV_KEY, BTN_LEFT, 0);
-									emit_event(state.mouse_fd, EV_SYN, SYN_REPORT, 0);
-									state.left_button_held = false;
-									state.drag_locked = false;
-									hide_drag_popup();
-								}
-							}
-
-                            if (!consumed) {
-                                if (state.ctrl_pressed && state.pending_ctrl) {
-                                    emit_event(state.uinput_fd, EV_KEY, state.pending_ctrl_code, 1);
-                                    emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
-                                    bool *forwarded = (state.pending_ctrl_code == KEY_LEFTCTRL) ? &state.left_ctrl_forwarded : &state.right_ctrl_forwarded;
-                                    *forwarded = true;
-                                    state.pending_ctrl = false;
-                                }
-                                emit_event(state.uinput_fd, EV_KEY, ev.code, ev.value);
-                                emit_event(state.uinput_fd, EV_SYN, SYN_REPORT, 0);
-                            }
-
-                            if (ev.value == 0) {
-                                state.adjust_start_times[ev.code] = 0.0;
-                            }
-                        } else {
-                            emit_event(state.uinput_fd, ev.type, ev.code, ev.value);
-                        }
+                        count_event();
+                        if (trace_record_file) trace_record_event(i, &ev);
+                        dispatch_event(&ev, &panel);
+                        control_publish();
+                        status_publish();
+                        led_sync();
                     }
                 }
             }
+            control_handle(polls + state.num_kbds, num_control);
         } else if (ret < 0 && errno != EINTR) {
             perror("poll");
             break;